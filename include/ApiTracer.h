@@ -0,0 +1,101 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Hook.h>
+#include <PE.h>
+#include <Types.h>
+
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+namespace gan
+{
+
+
+// ---------------------------------------------------------------------------
+// Class ApiTracer: Traces calls to all exported functions of modules with a
+//                  single callback. Each export gets a Probe at its entry,
+//                  so no hook function has to be written per export. The
+//                  callback is told which export was called and gets the
+//                  registers and the stack pointer at the entry, from
+//                  which the arguments can be read according to the
+//                  calling convention of the export.
+//
+// Exports which aren't code, forward to other modules or can't be probed
+// are left out. So are exports sharing an address with, or starting inside
+// the patched bytes of, another export. All probes are installed and
+// uninstalled in a single HookTransaction.
+//
+// The callback isn't called for exports called by the callback itself.
+// A tracer must be uninstalled before it's destroyed.
+// ---------------------------------------------------------------------------
+
+class ApiTracer
+{
+public:
+	// "exportId" is the position in GetExports().
+	using Callback = void (*)(uint32_t exportId, ProbeContext& context, void* userData);
+
+	struct Export
+	{
+		MemAddr addr;
+		Ordinal ordinal;
+		std::string name;  // Empty if exported by ordinal only
+	};
+
+	explicit ApiTracer(Callback callback, void* userData = nullptr) noexcept;
+	~ApiTracer();
+
+	ApiTracer(const ApiTracer&) = delete;
+	ApiTracer& operator=(const ApiTracer&) = delete;
+
+	// Adds the exports of the loaded module at "moduleBase" and returns how many were added. Modules can only be
+	// added before the first installation. std::nullopt if it's too late or the headers of the module can't be read.
+	std::optional<size_t> AddModule(ConstMemAddr moduleBase);
+
+	// All or nothing, like HookTransaction::Commit(). Failure::index is the export ID.
+	std::expected<void, HookTransaction::Failure> Install();
+	std::expected<void, HookTransaction::Failure> Uninstall();
+
+	const std::vector<Export>& GetExports() const noexcept	{ return m_exports; }
+
+private:
+	// User data of the probe on each export
+	struct Target
+	{
+		ApiTracer* owner;
+		uint32_t exportId;
+	};
+
+	static void OnEntry(ProbeContext& context, void* userData);
+
+	const Callback m_callback;
+	void* const m_userData;
+	std::vector<Export> m_exports;
+	std::vector<Target> m_targets;
+	std::vector<Probe> m_probes;  // Created on the first installation
+};
+
+
+}  // namespace gan
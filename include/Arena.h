@@ -0,0 +1,102 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+
+namespace gan
+{
+
+
+class Buffer;
+
+
+namespace internal
+{
+
+
+// Containers of enumeration and parse results are templated on an allocator, so that each of them
+// comes in a std::allocator flavor and a std::pmr flavor (see namespace gan::pmr).
+template <typename Alloc, typename T>
+using _RebindAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+template <typename T, typename Alloc>
+using _Vector = std::vector<T, _RebindAlloc<Alloc, T>>;
+
+template <typename CharT, typename Alloc>
+using _String = std::basic_string<CharT, std::char_traits<CharT>, _RebindAlloc<Alloc, CharT>>;
+
+
+}  // namespace internal
+
+
+// ---------------------------------------------------------------------------
+// Class MonotonicArena: Memory resource for results which are thrown away as
+//                       a whole, e.g. a snapshot of modules or parsed PE
+//                       headers. Allocation bumps a pointer in a Buffer and
+//                       deallocation is a no-op. Not thread-safe.
+// ---------------------------------------------------------------------------
+
+class MonotonicArena : public std::pmr::memory_resource
+{
+public:
+	constexpr static size_t k_defaultInitialSize = 1 << 16;  // 64 KB
+
+	explicit MonotonicArena(size_t initialSize = k_defaultInitialSize);
+	~MonotonicArena() override;
+
+	// Non-copyable & non-movable, as containers keep pointers to their memory resource
+	MonotonicArena(const MonotonicArena&) = delete;
+	MonotonicArena(MonotonicArena&&) = delete;
+	MonotonicArena& operator=(const MonotonicArena&) = delete;
+	MonotonicArena& operator=(MonotonicArena&&) = delete;
+
+	// Invalidates all memory handed out so far. Requests which didn't fit in the buffer since the
+	// last reset make the buffer grow here, so the next cycle of the same size fits in it entirely.
+	// Containers using the arena must have been destroyed before.
+	void Reset() noexcept;
+
+	size_t GetCapacity() const noexcept;  // Size of the buffer, not counting overflow
+	size_t GetUsedSize() const noexcept	{ return m_usedSize + m_overflowSize; }
+	size_t GetOverflowSize() const noexcept	{ return m_overflowSize; }  // Bytes taken from BufferPool since the last reset
+
+private:
+	struct OverflowChunk;
+
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void*, size_t, size_t) noexcept override	{ }
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override	{ return this == &other; }
+
+	void* AllocateOverflow(size_t bytes, size_t alignment) noexcept;
+	void FreeOverflow() noexcept;
+
+	std::unique_ptr<Buffer> m_buffer;
+	size_t m_usedSize;
+	OverflowChunk* m_overflow;  // Most recent chunk first
+	size_t m_overflowSize;
+};
+
+
+}  // namespace gan
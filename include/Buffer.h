@@ -18,13 +18,30 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <span>
+#include <vector>
+
+#include <Types.h>
 
 
 namespace gan
 {
 
 
+enum class BufferOption : uint8_t
+{
+	VirtualMemory,  // Pages directly from VirtualAlloc() instead of BufferPool; implied for sizes >= Buffer::k_virtualMemoryThreshold
+	LargePages,  // Implies VirtualMemory. Falls back to normal pages if SeLockMemoryPrivilege isn't held.
+	Prefault,  // Touches pages as soon as they are committed so that later accesses don't page-fault
+	_Count
+};
+using BufferOptions = Flags<BufferOption, uint32_t>;
+
+
 class Buffer
 {
 private:
@@ -38,9 +55,15 @@ private:
 
 public:
 	constexpr static size_t k_minSize = 128;  // 128 B
+	constexpr static size_t k_virtualMemoryThreshold = 1 << 26;  // 64 MB
 
-	// Factory function
-	static std::unique_ptr<Buffer> Allocate(size_t size);
+	// Factory function. Memory comes from BufferPool and goes back to it on destruction, unless
+	// it's backed by virtual memory (see BufferOption).
+	static std::unique_ptr<Buffer> Allocate(size_t size, BufferOptions options = BufferOptions{});
+
+	// Buffer objects themselves are recycled by BufferPool as well
+	static void* operator new(size_t size) noexcept;
+	static void operator delete(void* ptr) noexcept;
 
 	Buffer(size_t capacity, size_t size, uint8_t* addr, Private) noexcept;
 	~Buffer();
@@ -58,13 +81,210 @@ public:
 
 	size_t GetCapacity() const noexcept	{ return m_capacity; }
 	size_t GetSize() const noexcept		{ return m_size; }
+	bool IsVirtualMemory() const noexcept	{ return m_reservedSize > 0; }
+
+	// A buffer backed by virtual memory grows in place as long as its address space reservation
+	// allows, by committing more pages. Otherwise contents are copied to a new location.
 	bool Resize(size_t newSize) noexcept;
 
 
 private:
+	bool ResizeVirtualMemory(size_t newSize) noexcept;
+
 	size_t m_capacity;
 	size_t m_size;  // size in use
 	uint8_t* m_data;
+	size_t m_reservedSize;  // Non-zero only if backed by virtual memory
+	BufferOptions m_options;
+};
+
+
+namespace internal
+{
+
+
+class _InlineBufferBase
+{
+protected:
+	// Storage out of line comes from BufferPool. "capacity" receives the actual size allocated.
+	static uint8_t* AllocateStorage(size_t minSize, size_t& capacity) noexcept;
+	static void FreeStorage(uint8_t* addr, size_t capacity) noexcept;
+};
+
+
+}  // namespace internal
+
+
+// ---------------------------------------------------------------------------
+// Class InlineBuffer: Movable value-type buffer which keeps up to
+//                     InlineCapacity bytes within the object itself, so small
+//                     buffers need no heap at all. Larger contents move to
+//                     memory from BufferPool.
+// ---------------------------------------------------------------------------
+
+// Inline storage is aligned like memory from the pool, so the object is padded, which C4324 warns about.
+#pragma warning(push)
+#pragma warning(disable: 4324)
+template <size_t InlineCapacity = 64>
+class InlineBuffer : private internal::_InlineBufferBase
+{
+public:
+	constexpr static size_t k_inlineCapacity = InlineCapacity;
+
+	InlineBuffer() noexcept
+		: m_capacity(InlineCapacity)
+		, m_size(0)
+		, m_data(m_inline)
+	{ }
+
+	~InlineBuffer()
+	{
+		if (!IsInline())
+			FreeStorage(m_data, m_capacity);
+	}
+
+	// Non-copyable
+	InlineBuffer(const InlineBuffer&) = delete;
+	InlineBuffer& operator=(const InlineBuffer&) = delete;
+
+	// Movable. The moved-from buffer becomes empty.
+	InlineBuffer(InlineBuffer&& other) noexcept
+		: InlineBuffer()
+	{
+		TakeFrom(other);
+	}
+	InlineBuffer& operator=(InlineBuffer&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (!IsInline())
+				FreeStorage(m_data, m_capacity);
+			m_capacity = InlineCapacity;
+			m_data = m_inline;
+			TakeFrom(other);
+		}
+		return *this;
+	}
+
+	operator const uint8_t*() const noexcept { return m_data; }
+	operator uint8_t*() noexcept			 { return m_data; }
+	const uint8_t* GetData() const noexcept	 { return m_data; }
+	uint8_t* GetData() noexcept				 { return m_data; }
+
+	size_t GetCapacity() const noexcept	{ return m_capacity; }
+	size_t GetSize() const noexcept		{ return m_size; }
+	bool IsInline() const noexcept		{ return m_data == m_inline; }
+
+	// Growing beyond the capacity at least doubles it (or grows by half for very large buffers)
+	// to keep repeated growth amortized. Contents are preserved up to the smaller of both sizes.
+	bool Resize(size_t newSize) noexcept
+	{
+		if (newSize <= m_capacity)
+		{
+			m_size = newSize;
+			return true;
+		}
+
+		size_t newCapacity = 0;
+		auto* newData = AllocateStorage(std::max(newSize, m_capacity + m_capacity / 2), newCapacity);
+		if (!newData)
+			return false;
+
+		memcpy(newData, m_data, m_size);
+		if (!IsInline())
+			FreeStorage(m_data, m_capacity);
+		m_capacity = newCapacity;
+		m_size = newSize;
+		m_data = newData;
+		return true;
+	}
+
+private:
+	void TakeFrom(InlineBuffer& other) noexcept
+	{
+		if (other.IsInline())
+			memcpy(m_inline, other.m_inline, other.m_size);
+		else
+		{
+			m_capacity = other.m_capacity;
+			m_data = other.m_data;
+		}
+		m_size = other.m_size;
+
+		other.m_capacity = InlineCapacity;
+		other.m_size = 0;
+		other.m_data = other.m_inline;
+	}
+
+	size_t m_capacity;
+	size_t m_size;  // size in use
+	uint8_t* m_data;  // Either m_inline or memory from BufferPool
+	alignas(16) uint8_t m_inline[InlineCapacity];
+};
+#pragma warning(pop)
+
+
+// ---------------------------------------------------------------------------
+// Class BufferChain: Append-only sequence of Buffer chunks for streaming data
+//                    such as memory dumps and file reads. Growth adds another
+//                    chunk and never moves what's already stored. Contents
+//                    are exposed as a list of segments, one per chunk, which
+//                    maps directly onto scatter-gather I/O (e.g. WSABUF).
+// ---------------------------------------------------------------------------
+
+class BufferChain
+{
+public:
+	using Segment = std::span<const uint8_t>;
+
+	constexpr static size_t k_defaultChunkSize = 1 << 16;  // 64 KB
+
+	// Each chunk has a capacity of at least chunkSize
+	explicit BufferChain(size_t chunkSize = k_defaultChunkSize) noexcept;
+
+	// Non-copyable
+	BufferChain(const BufferChain&) = delete;
+	BufferChain& operator=(const BufferChain&) = delete;
+
+	// Movable. The moved-from chain becomes empty.
+	BufferChain(BufferChain&& other) noexcept;
+	BufferChain& operator=(BufferChain&& other) noexcept;
+
+	// Copies data to the end of the chain
+	bool Append(ConstMemAddr data, size_t size);
+
+	// Reads memory of another process straight into chunks, the counterpart of process_vm_readv().
+	// Whatever is read before a failure stays appended.
+	WinErrorCode AppendFromProcess(WinHandle process, ConstMemAddr addr, size_t size);
+
+	// Reads up to maxSize bytes from the current position of a file opened without FILE_FLAG_OVERLAPPED.
+	// Reaching the end of file isn't an error.
+	WinErrorCode AppendFromFile(WinHandle file, size_t maxSize);
+
+	// Writes all segments in order to the current position of a file opened without FILE_FLAG_OVERLAPPED,
+	// the counterpart of writev()
+	WinErrorCode WriteToFile(WinHandle file) const noexcept;
+
+	// Copies [offset, offset + size) of the chain to dest. Fails if the range is out of bounds.
+	bool CopyTo(MemAddr dest, size_t offset, size_t size) const noexcept;
+
+	// Releases all chunks
+	void Clear() noexcept;
+
+	std::span<const Segment> GetSegments() const noexcept	{ return m_segments; }
+	size_t GetSize() const noexcept		{ return m_size; }
+	size_t GetChunkSize() const noexcept	{ return m_chunkSize; }
+	bool IsEmpty() const noexcept		{ return m_size == 0; }
+
+private:
+	// Writable space at the end of the last chunk. A new chunk is added if the last one is full.
+	std::span<uint8_t> PrepareAppend();
+	void CommitAppend(size_t size) noexcept;
+
+	size_t m_chunkSize;
+	size_t m_size;
+	std::vector<std::unique_ptr<Buffer>> m_chunks;
+	std::vector<Segment> m_segments;  // Used part of each chunk
 };
 
 
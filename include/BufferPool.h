@@ -0,0 +1,87 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include <Mutex.h>
+#include <Types.h>
+
+
+namespace gan
+{
+
+
+namespace internal
+{
+	class BufferPoolThreadCache;
+}
+
+
+// ---------------------------------------------------------------------------
+// Class BufferPool: Recycles memory blocks of power-of-two sizes so that
+//                   short-lived buffers don't go to the process heap every
+//                   time. A released block goes to a small cache of the
+//                   releasing thread first, and then to a free list shared by
+//                   all threads.
+// ---------------------------------------------------------------------------
+
+class BufferPool : public Singleton<BufferPool>
+{
+public:
+	constexpr static size_t k_minBlockSize = 128;  // Same as Buffer::k_minSize
+	constexpr static size_t k_maxBlockSize = 1 << 26;  // 64 MB
+	constexpr static size_t k_numSizeClasses = 20;  // 128 B to 64 MB
+
+	struct Stats
+	{
+		size_t numHeapAllocs;
+		size_t numHeapFrees;
+	};
+
+	BufferPool();
+	~BufferPool();
+
+	// Sizes other than powers of 2 within [k_minBlockSize, k_maxBlockSize] aren't pooled and go
+	// directly to the process heap. The size passed to Release() must be the same as to Acquire().
+	void* Acquire(size_t size) noexcept;
+	void Release(void* block, size_t size) noexcept;
+
+	// Frees blocks in the global free lists and those cached by the calling thread
+	void Trim() noexcept;
+
+	Stats GetStats() const noexcept;
+
+	static bool IsPooledSize(size_t size) noexcept;
+
+private:
+	friend class internal::BufferPoolThreadCache;
+
+	void ReleaseToFreeList(void* block, size_t sizeClass) noexcept;
+	void* AllocFromHeap(size_t size) noexcept;
+	void FreeToHeap(void* block) noexcept;
+
+	ThreadSafeResource<std::vector<void*>> m_freeLists[k_numSizeClasses];
+	std::atomic<size_t> m_numHeapAllocs;
+	std::atomic<size_t> m_numHeapFrees;
+};
+
+
+}  // namespace gan
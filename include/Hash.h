@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <memory>
+#include <string_view>
+
 #include <Types.h>
 
 
@@ -32,16 +35,118 @@ struct Hash
 	constexpr static size_t k_numOfBytes = NumOfBits >> 3;
 
 	uint8_t data[k_numOfBytes];
+
+	constexpr bool operator==(const Hash&) const = default;
 };
 
 
+template <unsigned int NumOfBits>
+concept IsSHAWidth = (NumOfBits == 160 || NumOfBits == 256 || NumOfBits == 512);
+
+template <unsigned int NumOfBits>
+concept IsXXH3Width = (NumOfBits == 64 || NumOfBits == 128);
+
+
 class Hasher
 {
 public:
-	// generate the SHA256 hash for a given buffer.
+	// generate the SHA1, SHA256 or SHA512 hash for a given buffer, picked by the type of "out".
 	// returns a Windows error code indicating the result of the last internal system call.
+	static WinErrorCode GetSHA(ConstMemAddr dataAddr, size_t size, Hash<160>& out);
 	static WinErrorCode GetSHA(ConstMemAddr dataAddr, size_t size, Hash<256>& out);
+	static WinErrorCode GetSHA(ConstMemAddr dataAddr, size_t size, Hash<512>& out);
+
+	// generate the CRC-32C (Castagnoli) checksum for a given buffer. To checksum data in pieces,
+	// pass the result of the previous piece in "crc".
+	static uint32_t GetCRC32C(ConstMemAddr dataAddr, size_t size, uint32_t crc = 0) noexcept;
+
+	// generate the non-cryptographic XXH3 hash for a given buffer. Output bytes are in the
+	// canonical (big-endian) form, so they match what other XXH3 implementations print.
+	// Use it for deduplication and cache keys only, never for anything security-related.
+	template <unsigned int NumOfBits>
+		requires IsXXH3Width<NumOfBits>
+	static void GetXXH3(ConstMemAddr dataAddr, size_t size, Hash<NumOfBits>& out, uint64_t seed = 0) noexcept;
+
+	// generate the SHA or XXH3 hash (picked by the width of "out") of a file's content. Reading of
+	// the next chunk is overlapped with hashing of the current one.
+	// returns a Windows error code indicating the result of the last internal system call.
+	template <unsigned int NumOfBits>
+		requires IsSHAWidth<NumOfBits> || IsXXH3Width<NumOfBits>
+	static WinErrorCode HashFile(std::wstring_view path, Hash<NumOfBits>& out);
 };
 
 
+// ---------------------------------------------------------------------------
+// Class ShaHasher: Streaming version of Hasher::GetSHA(). Errors are sticky:
+//                  once a call fails, all following calls return the same
+//                  error code.
+// ---------------------------------------------------------------------------
+
+template <unsigned int NumOfBits>
+	requires IsSHAWidth<NumOfBits>
+class ShaHasher
+{
+public:
+	ShaHasher();
+	~ShaHasher();
+
+	// Non-copyable & non-movable
+	ShaHasher(const ShaHasher&) = delete;
+	ShaHasher(ShaHasher&&) = delete;
+	ShaHasher& operator=(const ShaHasher&) = delete;
+	ShaHasher& operator=(ShaHasher&&) = delete;
+
+	WinErrorCode Update(ConstMemAddr dataAddr, size_t size);
+	WinErrorCode Finish(Hash<NumOfBits>& out);  // Resets the state for hashing new data
+
+private:
+	void* m_hHash;  // BCRYPT_HASH_HANDLE
+	std::unique_ptr<uint8_t[]> m_hashObj;
+	WinErrorCode m_lastError;
+};
+
+extern template class ShaHasher<160>;
+extern template class ShaHasher<256>;
+extern template class ShaHasher<512>;
+
+
+// ---------------------------------------------------------------------------
+// Class XXH3Hasher: Streaming version of Hasher::GetXXH3(). Feeding the same
+//                   bytes in any number of Update() calls yields the same
+//                   hash as a single call to Hasher::GetXXH3().
+// ---------------------------------------------------------------------------
+
+// The state is aligned for SIMD loads and stores, and padded as a result, which is what C4324 warns about.
+#pragma warning(push)
+#pragma warning(disable: 4324)
+template <unsigned int NumOfBits>
+	requires IsXXH3Width<NumOfBits>
+class XXH3Hasher
+{
+public:
+	explicit XXH3Hasher(uint64_t seed = 0) noexcept;
+
+	void Reset(uint64_t seed = 0) noexcept;
+	void Update(ConstMemAddr dataAddr, size_t size) noexcept;
+	Hash<NumOfBits> Finish() const noexcept;  // Doesn't alter the state; more data can follow.
+
+private:
+	constexpr static size_t k_numOfAccs = 8;
+	constexpr static size_t k_secretSize = 192;
+	constexpr static size_t k_bufferSize = 256;
+
+	alignas(64) uint64_t m_acc[k_numOfAccs];
+	alignas(64) uint8_t m_secret[k_secretSize];
+	alignas(64) uint8_t m_buffer[k_bufferSize];
+	uint64_t m_totalSize;
+	uint64_t m_seed;
+	uint32_t m_bufferedSize;
+	uint32_t m_numStripesSoFar;  // Number of stripes consumed in the current block
+};
+#pragma warning(pop)
+
+extern template class XXH3Hasher<64>;
+extern template class XXH3Hasher<128>;
+
+
 }  // namespace gan
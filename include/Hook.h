@@ -20,6 +20,14 @@
 
 #include <Types.h>
 
+#include <atomic>
+#include <chrono>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
 
 namespace gan
 {
@@ -28,15 +36,33 @@ namespace gan
 // ---------------------------------------------------------------------------
 // Class Hook: Just a hook.
 //
-// The following Win32 API functions are used by Hook and shouldn't be hooked:
+// The following Win32 API functions are used by Hook and HookTransaction and
+// shouldn't be hooked:
+//   - AddVectoredExceptionHandler()
+//   - FlushInstructionCache()
+//   - FlushProcessWriteBuffers()
 //   - GetSystemInfo()
+//   - GetTickCount64()
 // 	 - VirtualAlloc()
+//   - VirtualFree()
 //   - VirtualProtect()
 //   - VirtualQuery()
 // ---------------------------------------------------------------------------
 
+template <auto Target>
+	requires IsAnyFuncPtr<decltype(Target)>
+class StaticHook;
+class Probe;
+
+
 class Hook
 {
+	friend class HookTransaction;
+	friend class Probe;
+	template <auto Target>
+		requires IsAnyFuncPtr<decltype(Target)>
+	friend class StaticHook;
+
 public:
 	enum class OpResult : uint8_t
 	{
@@ -54,19 +80,50 @@ public:
 		AccessDenied,			// Failed to write to memory.
 	};
 
+	// How the target function reaches the hook function
+	enum class Dispatch : uint8_t
+	{
+		Direct,			// Jumping straight to the hook function, or through a relay if it's too far away.
+		Toggleable,		// Jumping to a stub which goes either to the hook function or to the trampoline. See SetEnabled().
+
+		// Sharing the target with other layered hooks. The layer installed last is called first, and
+		// GetOriginal() of each layer leads to the one installed before it. Adding and removing layers
+		// doesn't touch the prolog again. Like any hook, a layer must not be removed while it's running.
+		Layered,
+
+		// Set by class Probe, where the hook function is a Probe::Callback. Not to be used with other hooks.
+		Probe,
+	};
+
 	template <class F>
 		requires IsAnyFuncPtr<F>
-	Hook(F origFunc, F hookFunc) noexcept
-		: m_funcOrig(FromAnyFn(origFunc))
-		, m_funcHook(FromAnyFn(hookFunc))
-		, m_hooked(false)
-	{
-		AssertCtorArgs(m_funcOrig, m_funcHook);
-	}
+	Hook(F origFunc, F hookFunc, Dispatch dispatch = Dispatch::Direct) noexcept
+		: Hook(origFunc, hookFunc, nullptr, dispatch)
+	{ }
 
 	OpResult Install();
 	OpResult Uninstall();
 
+	// Only has an effect with Dispatch::Toggleable. A disabled hook passes calls on to the original function.
+	// While the hook is installed, toggling is a single atomic store to its dispatch stub and may be done from
+	// any thread. Otherwise the state is kept for the next installation. Hooks are enabled by default.
+	void SetEnabled(bool enabled) noexcept
+	{
+		std::atomic_ref(m_enabled).store(enabled);
+		SyncDispatchFlag();
+	}
+
+	bool IsEnabled() const noexcept	{ return std::atomic_ref(m_enabled).load(std::memory_order_relaxed); }
+
+	// Where the hook function passes calls on to: the next layer with Dispatch::Layered, or the trampoline.
+	// nullptr if the hook isn't installed.
+	template <class F>
+		requires IsAnyFuncPtr<F>
+	F GetOriginal() const noexcept
+	{
+		return ToAnyFn<F>(m_original.Ptr<>());
+	}
+
 	template <class F>
 		requires IsAnyFuncPtr<F>
 	static auto GetTrampoline(F origFunc)
@@ -86,15 +143,318 @@ public:
 		return ToAnyFn<F>(GetTrampolineAddr(origFunc).ConstCast().Ptr<>());
 	}
 
+	// Code left behind by uninstallation, such as trampolines, relays and auxiliary prologs, is only reused or
+	// freed after a grace period, as other threads may still be running it. So are tables outgrown by
+	// GetTrampoline() lookups. 5 seconds by default. A shorter one is only safe if no thread can be suspended
+	// in such code, e.g. in tests. Takes effect on items already retired.
+	static void SetGracePeriod(std::chrono::milliseconds gracePeriod) noexcept;
+	static std::chrono::milliseconds GetGracePeriod() noexcept;
+
 private:
+	// "trampolineSlot" gets the same address as GetOriginal() before the hook becomes active
+	// and is reset to nullptr once the hook is removed.
+	template <class F>
+		requires IsAnyFuncPtr<F>
+	Hook(F origFunc, F hookFunc, void** trampolineSlot, Dispatch dispatch) noexcept
+		: m_funcOrig(FromAnyFn(origFunc))
+		, m_funcHook(FromAnyFn(hookFunc))
+		, m_trampolineSlot(trampolineSlot)
+		, m_original()
+		, m_dispatchFlag(nullptr)
+		, m_userData(nullptr)
+		, m_dispatch(dispatch)
+		, m_enabled(true)
+		, m_hooked(false)
+	{
+		AssertCtorArgs(m_funcOrig, m_funcHook);
+	}
+
+	// For probes, which can be at any instruction boundary rather than a function
+	Hook(MemAddr addr, MemAddr callback, void* userData) noexcept
+		: m_funcOrig(addr)
+		, m_funcHook(callback)
+		, m_trampolineSlot(nullptr)
+		, m_original()
+		, m_dispatchFlag(nullptr)
+		, m_userData(userData)
+		, m_dispatch(Dispatch::Probe)
+		, m_enabled(true)
+		, m_hooked(false)
+	{
+		AssertCtorArgs(m_funcOrig, m_funcHook);
+	}
+
+	// Brings the flag in the dispatch stub in line with "m_enabled". Each writer, be it SetEnabled() or the
+	// installation publishing the flag, checks "m_enabled" again after its store, so that the last one to
+	// change it also has the last word on the flag.
+	void SyncDispatchFlag() noexcept
+	{
+		auto* flag = std::atomic_ref(m_dispatchFlag).load();
+		if (!flag)
+			return;
+		for (bool enabled = std::atomic_ref(m_enabled).load(); ; )
+		{
+			std::atomic_ref(*flag).store(enabled ? 1 : 0);
+			const bool current = std::atomic_ref(m_enabled).load();
+			if (current == enabled)
+				break;
+			enabled = current;
+		}
+	}
+
 	// Helper functions as a layer of abstraction not to expose implementation in header.
 	static void AssertCtorArgs(MemAddr origFunc, MemAddr hookFunc) noexcept;
 	static ConstMemAddr GetTrampolineAddr(ConstMemAddr origFunc);  // Usage of this function is highly discouraged.
 
 	MemAddr m_funcOrig;  // address to where the inline hook is installed.
 	MemAddr m_funcHook;  // address to the user-defined hook function.
+	void** m_trampolineSlot;  // optional
+	MemAddr m_original;  // see GetOriginal()
+	uint8_t* m_dispatchFlag;  // in the dispatch stub while a toggleable hook is installed, accessed atomically
+	void* m_userData;  // passed to the callback of a probe
+	Dispatch m_dispatch;
+	mutable bool m_enabled;  // accessed atomically
 	bool m_hooked;
 };
 
 
+// ---------------------------------------------------------------------------
+// Class StaticHook: A hook on a function known at compile time. Each
+//                   instantiation has its own static slot holding the
+//                   trampoline, so calling the original function from the
+//                   hook function is an indirect call through that slot,
+//                   without going through the hook registry.
+//
+// Only one StaticHook per target can be installed at a time, even with
+// Hook::Dispatch::Layered, since all of them share the slot. Other layers
+// of the same target have to be Hooks.
+// ---------------------------------------------------------------------------
+
+template <auto Target>
+	requires IsAnyFuncPtr<decltype(Target)>
+class StaticHook
+{
+public:
+	using FuncType = decltype(Target);
+
+	explicit StaticHook(FuncType hookFunc, Hook::Dispatch dispatch = Hook::Dispatch::Direct) noexcept
+		: m_hook(Target, hookFunc, &s_trampoline.addr, dispatch)
+	{ }
+
+	Hook::OpResult Install()	{ return m_hook.Install(); }
+	Hook::OpResult Uninstall()	{ return m_hook.Uninstall(); }
+
+	void SetEnabled(bool enabled) noexcept	{ m_hook.SetEnabled(enabled); }
+	bool IsEnabled() const noexcept	{ return m_hook.IsEnabled(); }
+
+	// For adding to a HookTransaction
+	Hook& GetHook() noexcept	{ return m_hook; }
+
+	// nullptr if the hook isn't installed. For Hook::Dispatch::Layered, this is the next layer.
+	static FuncType GetTrampoline() noexcept	{ return s_trampoline.func; }
+
+private:
+	inline static internal::_MemFnAddr<FuncType> s_trampoline { .addr = nullptr };
+
+	Hook m_hook;
+};
+
+
+namespace internal
+{
+	// Implemented in Hook.cpp along with other code in trampoline pages
+	MemAddr _CreateClosureThunk(void* callable, MemAddr invoker);
+	void _DestroyClosureThunk(MemAddr thunk) noexcept;
+	void* _GetClosureCallable() noexcept;  // Of the thunk entered last by the calling thread
+
+	template <class F, class Callable>
+	struct _ClosureInvoker;
+
+	// The invoker has to share the calling convention of F.
+#define DEFINE_CLOSURE_INVOKER(callConv)	\
+	template <class R, class... Args, bool NoExcept, class Callable>	\
+	struct _ClosureInvoker<R (callConv*)(Args...) noexcept(NoExcept), Callable>	\
+	{	\
+		static R callConv Invoke(Args... args) noexcept(NoExcept)	\
+		{	\
+			return (*static_cast<Callable*>(_GetClosureCallable()))(std::forward<Args>(args)...);	\
+		}	\
+	}
+
+	DEFINE_CLOSURE_INVOKER(__cdecl);
+#if !defined(_WIN64)
+	DEFINE_CLOSURE_INVOKER(__stdcall);
+	DEFINE_CLOSURE_INVOKER(__fastcall);
+#endif
+#undef DEFINE_CLOSURE_INVOKER
+}  // namespace internal
+
+
+// ---------------------------------------------------------------------------
+// Class Closure: A function pointer of type F which calls a callable object,
+//                so that a hook function can carry state of its own rather
+//                than keeping it in globals. The pointer leads to a thunk in
+//                the trampoline pages, which stores the address of the
+//                object in a TLS slot of the calling thread and jumps to an
+//                invoker of type F. The invoker takes the object from the
+//                slot and calls it with the arguments.
+//
+// F must be a pointer to a non-member function, which isn't variadic.
+// The closure must outlive any hook using it, and Get() returns nullptr if
+// the thunk couldn't be allocated.
+// ---------------------------------------------------------------------------
+
+template <class F>
+	requires std::is_pointer_v<F> && std::is_function_v<std::remove_pointer_t<F>>
+class Closure
+{
+public:
+	template <class Callable>
+	explicit Closure(Callable callable)
+		: m_callable(new Callable(std::move(callable)), [](void* obj) noexcept { delete static_cast<Callable*>(obj); })
+		, m_thunk(internal::_CreateClosureThunk(
+			m_callable.get(),
+			MemAddr{ FromAnyFn(&internal::_ClosureInvoker<F, Callable>::Invoke) }
+		))
+	{ }
+
+	~Closure()
+	{
+		if (m_thunk)
+			internal::_DestroyClosureThunk(m_thunk);
+	}
+
+	Closure(const Closure&) = delete;
+	Closure& operator=(const Closure&) = delete;
+
+	F Get() const noexcept	{ return m_thunk ? ToAnyFn<F>(m_thunk.Ptr()) : nullptr; }
+
+private:
+	std::unique_ptr<void, void (*)(void*)> m_callable;
+	MemAddr m_thunk;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class Probe: Calls a callback whenever execution reaches an address, which
+//              can be any instruction boundary rather than a function entry.
+//              The instructions at the address are patched with a jump to a
+//              stub, which saves the registers into a ProbeContext, calls the
+//              callback, restores the registers and resumes with relocated
+//              copies of the patched instructions.
+//
+// Only registers which the callback may clobber under the calling convention
+// are saved, i.e. the volatile ones. Others keep their values across the
+// callback anyway. Changes made to the context by the callback are restored
+// into the registers, except for the stack pointer. The x87, SSE and AVX
+// state, which isn't in the context, is saved and restored as a whole.
+//
+// The patched instructions (5 bytes' worth) must not be jump targets, and
+// the callback must not throw or unwind through the stub. Probes can't share
+// addresses or patched bytes with each other or with hooks.
+// ---------------------------------------------------------------------------
+
+struct ProbeContext
+{
+#if defined(_WIN64)
+	uint64_t r11;
+	uint64_t r10;
+	uint64_t r9;
+	uint64_t r8;
+	uint64_t rdx;
+	uint64_t rcx;
+	uint64_t rax;
+	uint64_t rsp;  // At the probe. Read-only.
+	uint64_t rflags;
+#else
+	uint32_t edx;
+	uint32_t ecx;
+	uint32_t eax;
+	uint32_t esp;  // At the probe. Read-only.
+	uint32_t eflags;
+#endif
+};
+
+
+class Probe
+{
+public:
+	using Callback = void (*)(ProbeContext& context, void* userData);
+
+	Probe(MemAddr addr, Callback callback, void* userData = nullptr) noexcept
+		: m_hook(addr, MemAddr{ FromAnyFn(callback) }, userData)
+	{ }
+
+	Hook::OpResult Install()	{ return m_hook.Install(); }
+	Hook::OpResult Uninstall()	{ return m_hook.Uninstall(); }
+
+	// For adding to a HookTransaction
+	Hook& GetHook() noexcept	{ return m_hook; }
+
+	// Number of bytes which Install() would patch at "addr", or std::nullopt if the instructions there can't be
+	// relocated. Nothing but the code at "addr" is accessed, so it's safe to call from multiple threads at once.
+	static std::optional<uint8_t> GetPatchLength(ConstMemAddr addr);
+
+private:
+	Hook m_hook;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class HookTransaction: Installs and uninstalls a batch of hooks at once.
+//                        Everything is prepared before any code is touched:
+//                        prologs of large batches are decoded in parallel,
+//                        trampolines are allocated in bulk, and each page is
+//                        made writable only once for all prologs on it.
+//                        Either all operations take effect or none does.
+//
+// Hooks can be installed and uninstalled from multiple threads at once,
+// either directly or through transactions. Transactions sharing a target
+// function take turns, while others only wait for each other to write to
+// the same pages. A single Hook object must not be used by two threads at
+// the same time though.
+//
+// Other threads may keep calling the target functions meanwhile, with no
+// need to suspend them. A prolog is replaced with a single atomic store, or
+// is kept from being entered while it's rewritten. The trampolines, relays
+// and auxiliary prologs of uninstalled hooks are left intact for a grace
+// period of a few seconds before they're reused, so that threads which have
+// just entered them get through. A thread which was interrupted right
+// inside a prolog may still resume in the middle of the new instructions,
+// unless the first instruction covers the whole patch, as in functions
+// built to be hot-patched, and one which stays suspended inside the code
+// of an uninstalled hook for longer than the grace period may find it gone.
+// ---------------------------------------------------------------------------
+
+class HookTransaction
+{
+public:
+	struct Failure
+	{
+		size_t index;  // Operation that failed, in the order of Install() and Uninstall() calls
+		Hook::OpResult result;
+	};
+
+	// Hooks are referred to by address and must not be moved or destroyed until Commit() returns.
+	void Install(Hook& hook);
+	void Uninstall(Hook& hook);
+
+	// Operations on hooks which are already in the requested state are no-ops. Otherwise each
+	// target function may only appear once, or the later operation fails with AddressInUse.
+	// The transaction is empty afterwards regardless of the result.
+	std::expected<void, Failure> Commit();
+
+	size_t GetSize() const noexcept	{ return m_operations.size(); }
+
+private:
+	struct Operation
+	{
+		Hook* hook;
+		bool install;
+	};
+
+	std::vector<Operation> m_operations;
+};
+
+
 }  // namespace gan
@@ -18,11 +18,13 @@
 
 #pragma once
 
+#include <Arena.h>
 #include <Handle.h>
 #include <Types.h>
 
 #include <expected>
-#include <vector>
+#include <memory>
+#include <memory_resource>
 
 
 namespace gan
@@ -77,7 +79,13 @@ struct MemoryRegion
 
 	constexpr std::strong_ordering operator<=>(const MemoryRegion&) const = default;
 };
-using MemoryRegionList = std::vector<MemoryRegion>;
+using MemoryRegionList = internal::_Vector<MemoryRegion, std::allocator<void>>;
+
+// Variant whose memory comes from a std::pmr::memory_resource
+namespace pmr
+{
+using MemoryRegionList = internal::_Vector<MemoryRegion, std::pmr::polymorphic_allocator<>>;
+}  // namespace pmr
 
 
 class MemoryRegionEnumerator
@@ -95,6 +103,10 @@ public:
 	// All regions containing the range [start, end-1]
 	std::expected<MemoryRegionList, Error> operator()(uint32_t pid, ConstMemRange addrRange = k_maxRange);
 	std::expected<MemoryRegionList, Error> operator()(WinHandle process, ConstMemRange addrRange = k_maxRange);
+
+	// The list is allocated from "resource", e.g. a MonotonicArena
+	std::expected<pmr::MemoryRegionList, Error> operator()(uint32_t pid, std::pmr::memory_resource* resource, ConstMemRange addrRange = k_maxRange);
+	std::expected<pmr::MemoryRegionList, Error> operator()(WinHandle process, std::pmr::memory_resource* resource, ConstMemRange addrRange = k_maxRange);
 };
 
 
@@ -0,0 +1,76 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Hash.h>
+#include <Types.h>
+
+#include <span>
+#include <vector>
+
+
+namespace gan
+{
+
+
+// ---------------------------------------------------------------------------
+// Class MerkleTree: Chunked hashing of a large memory range. The range is split
+//                   into fixed-size leaves hashed in parallel, and only leaves
+//                   marked dirty are rehashed by subsequent Update() calls.
+//
+// Hashes are XXH3-128 and therefore only meant to detect changes, not tampering
+// by an adversary. The memory range must stay readable for the lifetime of the
+// tree. Instances aren't thread-safe.
+// ---------------------------------------------------------------------------
+
+class MerkleTree
+{
+public:
+	using Digest = Hash<128>;
+
+	constexpr static size_t k_defaultLeafSize = 0x1000;  // 4 KB, i.e., a page
+
+	explicit MerkleTree(ConstMemRange range, size_t leafSize = k_defaultLeafSize);
+
+	// Marks leaves for rehashing by the next Update().
+	void MarkDirty(size_t leafIndex) noexcept;
+	void MarkDirty(ConstMemRange range) noexcept;  // All leaves overlapping with "range"
+	void MarkAllDirty() noexcept;
+
+	// Rehashes dirty leaves and their ancestors. Returns the number of leaves rehashed.
+	// All leaves are dirty right after construction.
+	size_t Update();
+
+	const Digest& GetRoot() const noexcept				{ return m_levels.back().front(); }
+	std::span<const Digest> GetLeaves() const noexcept	{ return m_levels.front(); }
+	size_t GetLeafSize() const noexcept					{ return m_leafSize; }
+	ConstMemRange GetLeafRange(size_t leafIndex) const noexcept;
+
+private:
+	void HashLeaf(size_t leafIndex) noexcept;
+	void HashNode(size_t level, size_t nodeIndex) noexcept;
+
+	ConstMemRange m_range;
+	size_t m_leafSize;
+	std::vector<std::vector<Digest>> m_levels;  // Leaves first and root last
+	std::vector<uint8_t> m_dirtyFlags;  // Shared index with m_levels.front()
+};
+
+
+}  // namespace gan
@@ -18,28 +18,45 @@
 
 #pragma once
 
+#include <Arena.h>
 #include <Handle.h>
 #include <Types.h>
 
 #include <expected>
-#include <string>
-#include <vector>
+#include <memory>
+#include <memory_resource>
 
 
 namespace gan
 {
 
 
-struct ModuleInfo
+namespace internal
+{
+
+
+template <typename Alloc>
+struct _ModuleInfo
 {
 	ConstMemAddr base;
 	size_t size;
-	std::wstring imageName;  // incl. file extension
-	std::wstring imagePath;
-
-//	explicit ModuleInfo(const ::tagMODULEENTRY32W& moduleEntry);
+	_String<wchar_t, Alloc> imageName;  // incl. file extension
+	_String<wchar_t, Alloc> imagePath;
 };
-using ModuleList = std::vector<ModuleInfo>;
+
+
+}  // namespace internal
+
+
+using ModuleInfo = internal::_ModuleInfo<std::allocator<void>>;
+using ModuleList = internal::_Vector<ModuleInfo, std::allocator<void>>;
+
+// Variants whose memory comes from a std::pmr::memory_resource
+namespace pmr
+{
+using ModuleInfo = internal::_ModuleInfo<std::pmr::polymorphic_allocator<>>;
+using ModuleList = internal::_Vector<ModuleInfo, std::pmr::polymorphic_allocator<>>;
+}  // namespace pmr
 
 
 // ---------------------------------------------------------------------------
@@ -57,6 +74,10 @@ public:
 
 	std::expected<ModuleList, Error> operator()(uint32_t processId);
 	std::expected<ModuleList, Error> operator()(WinHandle process);
+
+	// The list and all strings in it are allocated from "resource", e.g. a MonotonicArena
+	std::expected<pmr::ModuleList, Error> operator()(uint32_t processId, std::pmr::memory_resource* resource);
+	std::expected<pmr::ModuleList, Error> operator()(WinHandle process, std::pmr::memory_resource* resource);
 };
 
 
@@ -18,14 +18,15 @@
 
 #pragma once
 
+#include <Arena.h>
 #include <Types.h>
 
 #include <windows.h>
 
+#include <memory>
+#include <memory_resource>
 #include <optional>
-#include <string>
 #include <string_view>
-#include <vector>
 
 
 namespace gan
@@ -59,49 +60,80 @@ struct ImageNtHeaders
 };
 
 
+// Aliases of Windows SDK types. Just to make PeHeaders easier to read.
+using ImageDosHeader = IMAGE_DOS_HEADER;
+
+
+namespace internal
+{
+
+
 // REF: https://learn.microsoft.com/en-us/windows/win32/debug/pe-format#the-edata-section-image-only
-struct ImageExportData
+template <typename Alloc>
+struct _ImageExportData
 {
 	struct ExportedFunction
 	{
+		using NameString = _String<char, Alloc>;
+
 		Rva rva;  // Relative virtual address
 		Ordinal ordinal;
 		bool forwarding : 1;
-		std::string name;
+		NameString name;
 	};
-	using ExportedFunctionList = std::vector<ExportedFunction>;
+	using ExportedFunctionList = _Vector<ExportedFunction, Alloc>;
 
 	IMAGE_EXPORT_DIRECTORY directory;
 	ExportedFunctionList functions;
 };
 
 
-// Aliases of Windows SDK types. Just to make PeHeaders easier to read.
-using ImageDosHeader = IMAGE_DOS_HEADER;
-using ImageSectionHeaderList = std::vector<IMAGE_SECTION_HEADER>;
-
-
-struct PeHeaders
+template <typename Alloc>
+struct _PeHeaders
 {
+	using SectionHeaderList = _Vector<IMAGE_SECTION_HEADER, Alloc>;
+
 	// Basic part
 	ImageDosHeader dosHeader;
 	ImageNtHeaders ntHeaders;
-	ImageSectionHeaderList sectionHeaderList;
+	SectionHeaderList sectionHeaderList;
 
 	// Directory data
-	std::optional<ImageExportData> exportData;
+	std::optional<_ImageExportData<Alloc>> exportData;
 	
 	// Helpers
 	// Note: behavior is undefined if the PEHeaders instance isn't loaded by Gandr API such as GetLoadedHeaders().
 	std::optional<uint32_t> FindSectionByName(uint32_t start, std::u8string_view name) const noexcept;
 };
 
+extern template struct _PeHeaders<std::allocator<void>>;
+extern template struct _PeHeaders<std::pmr::polymorphic_allocator<>>;
+
+
+}  // namespace internal
+
+
+using ImageExportData = internal::_ImageExportData<std::allocator<void>>;
+using PeHeaders = internal::_PeHeaders<std::allocator<void>>;
+using ImageSectionHeaderList = PeHeaders::SectionHeaderList;
+
+// Variants whose memory comes from a std::pmr::memory_resource
+namespace pmr
+{
+using ImageExportData = internal::_ImageExportData<std::pmr::polymorphic_allocator<>>;
+using PeHeaders = internal::_PeHeaders<std::pmr::polymorphic_allocator<>>;
+using ImageSectionHeaderList = PeHeaders::SectionHeaderList;
+}  // namespace pmr
+
 
 class PeImageHelper
 {
 public:
 	static std::optional<PeHeaders> GetLoadedHeaders(ConstMemAddr addr);
 
+	// Section headers and export data are allocated from "resource", e.g. a MonotonicArena
+	static std::optional<pmr::PeHeaders> GetLoadedHeaders(ConstMemAddr addr, std::pmr::memory_resource* resource);
+
 };
 
 
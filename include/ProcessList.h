@@ -18,25 +18,39 @@
 
 #pragma once
 
+#include <Arena.h>
+
+#include <cstdint>
 #include <expected>
+#include <memory>
+#include <memory_resource>
 #include <optional>
-#include <string>
-#include <vector>
 
 
 namespace gan
 {
 
 
-struct ProcessInfo
+namespace internal
+{
+
+
+template <typename Alloc>
+struct _ProcessInfo
 {
 	uint32_t pid;
 	uint32_t nThread;
 	uint32_t pidParent;
 	uint32_t basePriority;
-	std::wstring imageName;  // incl. file extension
+	_String<wchar_t, Alloc> imageName;  // incl. file extension
 };
-using ProcessList = std::vector<ProcessInfo>;
+
+
+}  // namespace internal
+
+
+using ProcessInfo = internal::_ProcessInfo<std::allocator<void>>;
+using ProcessList = internal::_Vector<ProcessInfo, std::allocator<void>>;
 
 
 struct ThreadInfo
@@ -45,7 +59,16 @@ struct ThreadInfo
 	uint32_t pidParent;
 	uint32_t basePriority;
 };
-using ThreadList = std::vector<ThreadInfo>;
+using ThreadList = internal::_Vector<ThreadInfo, std::allocator<void>>;
+
+
+// Variants whose memory comes from a std::pmr::memory_resource
+namespace pmr
+{
+using ProcessInfo = internal::_ProcessInfo<std::pmr::polymorphic_allocator<>>;
+using ProcessList = internal::_Vector<ProcessInfo, std::pmr::polymorphic_allocator<>>;
+using ThreadList = internal::_Vector<ThreadInfo, std::pmr::polymorphic_allocator<>>;
+}  // namespace pmr
 
 
 // ---------------------------------------------------------------------------
@@ -62,6 +85,9 @@ public:
 	};
 
 	std::expected<ProcessList, Error> operator()();
+
+	// The list and all strings in it are allocated from "resource", e.g. a MonotonicArena
+	std::expected<pmr::ProcessList, Error> operator()(std::pmr::memory_resource* resource);
 };
 
 
@@ -80,6 +106,9 @@ public:
 
 	std::expected<ThreadList, Error> operator()();
 	std::expected<ThreadList, Error> operator()(uint32_t pid);
+
+	// The list is allocated from "resource", e.g. a MonotonicArena. Threads of all processes are listed if pid is 0.
+	std::expected<pmr::ThreadList, Error> operator()(uint32_t pid, std::pmr::memory_resource* resource);
 };
 
 
@@ -0,0 +1,130 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Hook.h>
+#include <Types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace gan
+{
+
+
+namespace internal
+{
+	struct ProfilerCounter;
+}
+
+
+// ---------------------------------------------------------------------------
+// Class Profiler: Counts calls to a set of functions and measures inclusive
+//                 latency of the calls in TSC cycles. The entry of each
+//                 function gets a Probe, which redirects the return address
+//                 to a shared exit stub for the duration of the call. Each
+//                 thread has counters of its own, padded to cache lines, so
+//                 profiled calls don't contend with each other. Collect()
+//                 sums counters of all threads up into histograms.
+//
+// As return addresses are redirected, exceptions must not unwind through
+// profiled functions, and stack walks through them stop at the exit stub.
+// Calls nested deeper than k_maxDepth are counted but not timed, and calls
+// made by the profiler itself aren't counted at all. A thread has counters
+// of at most k_maxPerThread profilers at a time. Those of destroyed ones
+// make room for others, but calls to functions of any more live ones aren't
+// counted, which GetNumDropped() tells about.
+//
+// A profiler must be uninstalled before it's destroyed, and must not be
+// destroyed while any profiled call is in progress.
+// ---------------------------------------------------------------------------
+
+class Profiler
+{
+public:
+	constexpr static size_t k_numBuckets = 30;
+	constexpr static size_t k_maxDepth = 256;  // Of profiled calls per thread
+	constexpr static size_t k_maxPerThread = 8;  // Profilers with counters in each thread
+
+	struct Histogram
+	{
+		MemAddr func;
+		uint64_t calls;
+		uint64_t cycles;  // Sum over all timed calls
+
+		// Bucket i counts timed calls which took [2^(i-1), 2^i) cycles. The last bucket has no upper bound.
+		uint64_t buckets[k_numBuckets];
+	};
+
+	Profiler();
+	~Profiler();
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	// Functions can only be added before the first installation.
+	template <class F>
+		requires IsAnyFuncPtr<F>
+	bool Add(F func)
+	{
+		return Add(MemAddr{ FromAnyFn(func) });
+	}
+	bool Add(MemAddr func);
+
+	// All or nothing, like HookTransaction::Commit(). Failure::index is the position of the function
+	// in the order of Add() calls.
+	std::expected<void, HookTransaction::Failure> Install();
+	std::expected<void, HookTransaction::Failure> Uninstall();
+
+	// Can be called from any thread at any time. Counters keep accumulating across installations.
+	std::vector<Histogram> Collect() const;
+
+	// Calls not counted because the calling thread had counters of k_maxPerThread other profilers
+	uint64_t GetNumDropped() const noexcept	{ return m_numDropped.load(std::memory_order_relaxed); }
+
+private:
+	using Counter = internal::ProfilerCounter;
+
+	// User data of the probe on each function
+	struct Target
+	{
+		Profiler* owner;
+		size_t index;
+	};
+
+	static void OnEntry(ProbeContext& context, void* userData);
+	Counter* AddThread();
+
+	const uint64_t m_id;  // Unique in the process, unlike addresses of profilers
+	std::vector<MemAddr> m_funcs;
+	std::vector<Target> m_targets;
+	std::vector<Probe> m_probes;  // Created on the first installation
+
+	std::vector<std::unique_ptr<Counter[]>> m_threadCounters;  // Per thread, one for each function
+	mutable std::mutex m_mutex;  // For m_threadCounters
+	std::atomic<uint64_t> m_numDropped;
+};
+
+
+}  // namespace gan
@@ -0,0 +1,247 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Handle.h>
+#include <Types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace gan
+{
+
+
+// ---------------------------------------------------------------------------
+// Trace file format. All fields are little-endian. A file header is followed
+// by blocks, each of which holds records written by one thread, in order.
+// Every record starts at a multiple of k_traceAlignment from the start of
+// the file and is padded to it as well.
+// ---------------------------------------------------------------------------
+
+constexpr uint32_t k_traceMagic = 0x4352'5447;  // "GTRC"
+constexpr uint16_t k_traceVersion = 1;
+constexpr size_t k_traceAlignment = 16;
+
+struct TraceFileHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t headerSize;
+	uint64_t qpcFrequency;  // Of QueryPerformanceCounter(), for converting the samples in block headers
+};
+
+struct TraceBlockHeader
+{
+	uint32_t size;  // Of records following the header
+	uint32_t threadId;
+	uint64_t tsc;  // Sampled along with "qpc" when the block was written, for converting timestamps of records
+	uint64_t qpc;
+	uint64_t numDropped;  // Records dropped by the thread so far, because its ring was full
+};
+
+struct TraceRecordHeader
+{
+	uint64_t timestamp;  // From rdtsc
+	uint32_t type;
+	uint32_t size;  // Of the data following the header, excluding padding
+};
+
+static_assert(sizeof(TraceFileHeader) % k_traceAlignment == 0);
+static_assert(sizeof(TraceBlockHeader) % k_traceAlignment == 0);
+static_assert(sizeof(TraceRecordHeader) % k_traceAlignment == 0);
+
+
+namespace internal
+{
+	class TraceRing;
+}
+
+
+// ---------------------------------------------------------------------------
+// Class TraceWriter: Records events from any thread, such as hook functions,
+//                    into a trace file. Each thread writes to a ring buffer of
+//                    its own without locking or waiting, and a background
+//                    thread drains the rings into the file in batches.
+//
+// A record which doesn't fit in the ring of its thread is dropped and counted
+// rather than waiting for the drainer. Records written while Close() is in
+// progress may be lost. The writer must outlive all threads writing to it.
+//
+// A thread writes to at most k_maxPerThread writers at a time. Rings of
+// destroyed writers make room for others, but records written to any more
+// live ones are dropped and counted as well.
+// ---------------------------------------------------------------------------
+
+class TraceWriter
+{
+public:
+	struct Options
+	{
+		size_t ringSize = 1 << 16;  // Per thread; rounded up to a power of two
+		std::chrono::milliseconds drainInterval { 10 };
+	};
+
+	// Type reserved for padding in rings. It never appears in trace files.
+	constexpr static uint32_t k_paddingType = UINT32_MAX;
+
+	constexpr static size_t k_maxPerThread = 8;  // Writers with rings in each thread
+
+	TraceWriter();
+	~TraceWriter();
+
+	TraceWriter(const TraceWriter&) = delete;
+	TraceWriter& operator=(const TraceWriter&) = delete;
+
+	// Creates the file, overwriting any existing one, and starts the drainer.
+	WinErrorCode Open(std::wstring_view path, const Options& options);
+	WinErrorCode Open(std::wstring_view path)	{ return Open(path, Options{ }); }
+
+	// Drains all rings, stops the drainer and closes the file. Returns the first error of writing to the file.
+	WinErrorCode Close();
+
+	// Drains all rings into the file on the calling thread.
+	void Flush();
+
+	// Never blocks. Returns false if the writer isn't open, or the calling thread has no room in its ring
+	// or for one.
+	bool Write(uint32_t type, ConstMemAddr data, uint32_t size) noexcept;
+
+	template <class T>
+		requires std::is_trivially_copyable_v<T>
+	bool Write(uint32_t type, const T& data) noexcept
+	{
+		return Write(type, ConstMemAddr{ &data }, sizeof(T));
+	}
+
+	uint64_t GetNumDropped() const;
+
+private:
+	internal::TraceRing* AddThread() noexcept;
+	void DrainerMain();
+	void Drain();  // m_drainMutex must be held
+
+	const uint64_t m_id;  // Unique in the process, unlike addresses of writers
+	Options m_options;
+	std::atomic<bool> m_open;
+
+	std::vector<std::unique_ptr<internal::TraceRing>> m_rings;
+	mutable std::mutex m_ringsMutex;
+	std::atomic<uint64_t> m_numDropped;  // Records of threads which couldn't get a ring
+
+	// Drainer. Rings have a single consumer, so draining is serialized by m_drainMutex.
+	AutoWinHandle m_file;
+	std::vector<uint8_t> m_batch;
+	WinErrorCode m_writeError;
+	std::mutex m_drainMutex;
+	std::thread m_drainer;
+	bool m_stopping;
+	std::mutex m_stateMutex;  // For m_stopping
+	std::condition_variable m_wakeUp;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class TraceReader: Maps a trace file into memory and iterates its records
+//                    in place. A file truncated by a crash of the writer is
+//                    read up to its last complete block.
+// ---------------------------------------------------------------------------
+
+class TraceReader
+{
+public:
+	struct Record
+	{
+		uint32_t threadId;
+		uint32_t type;
+		uint64_t timestamp;
+		std::span<const uint8_t> data;  // Points into the mapped file
+	};
+
+	class Iterator
+	{
+		friend class TraceReader;
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = Record;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Record*;
+		using reference = const Record&;
+
+		Iterator() = default;
+
+		const Record& operator*() const noexcept	{ return m_record; }
+		const Record* operator->() const noexcept	{ return &m_record; }
+
+		Iterator& operator++() noexcept;
+		Iterator operator++(int) noexcept
+		{
+			auto copy = *this;
+			++*this;
+			return copy;
+		}
+
+		bool operator==(const Iterator& other) const noexcept	{ return m_records.data() == other.m_records.data(); }
+		bool operator==(std::default_sentinel_t) const noexcept	{ return m_records.data() == nullptr; }
+
+	private:
+		explicit Iterator(std::span<const uint8_t> blocks) noexcept;
+
+		std::span<const uint8_t> m_blocks;  // After the current block
+		std::span<const uint8_t> m_records;  // After the current record in the current block; nullptr at the end
+		Record m_record { };
+	};
+
+	TraceReader() noexcept;
+	~TraceReader();
+
+	TraceReader(const TraceReader&) = delete;
+	TraceReader& operator=(const TraceReader&) = delete;
+
+	// Fails with ERROR_BAD_FORMAT if the file isn't a trace file of a supported version.
+	WinErrorCode Open(std::wstring_view path);
+
+	uint64_t GetQpcFrequency() const noexcept	{ return m_header ? m_header->qpcFrequency : 0; }
+
+	Iterator begin() const noexcept;
+	std::default_sentinel_t end() const noexcept	{ return { }; }
+
+private:
+	void Close() noexcept;
+
+	AutoWinHandle m_file;
+	AutoWinHandle m_mapping;
+	std::span<const uint8_t> m_view;
+	const TraceFileHeader* m_header;  // In m_view
+};
+
+
+}  // namespace gan
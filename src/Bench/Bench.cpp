@@ -0,0 +1,112 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Bench.h"
+
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include <windows.h>
+
+
+namespace
+{
+
+
+constexpr double k_minRunSeconds = 0.2;
+
+
+class Stopwatch
+{
+public:
+	Stopwatch() noexcept
+	{
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+		m_freq = static_cast<double>(freq.QuadPart);
+		QueryPerformanceCounter(&m_start);
+	}
+
+	double GetElapsedSeconds() const noexcept
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return static_cast<double>(now.QuadPart - m_start.QuadPart) / m_freq;
+	}
+
+private:
+	LARGE_INTEGER m_start;
+	double m_freq;
+};
+
+
+// Returns the average time in seconds per run
+double Measure(const BenchmarkRegistry& benchmark)
+{
+	benchmark.funcRunOnce();  // Warm-up
+
+	// Double the number of runs until it takes long enough
+	for (size_t numRuns = 1; ; numRuns *= 2)
+	{
+		Stopwatch stopwatch;
+		for (size_t i = 0; i < numRuns; ++i)
+			benchmark.funcRunOnce();
+
+		const double elapsed = stopwatch.GetElapsedSeconds();
+		if (elapsed >= k_minRunSeconds)
+			return elapsed / static_cast<double>(numRuns);
+	}
+}
+
+
+}  // unnamed namespace
+
+
+
+BenchmarkRegistry::BenchmarkRegistry(const char* name, size_t bytesPerOp, std::function<void ()> funcRunOnce)
+	: name(name)
+	, bytesPerOp(bytesPerOp)
+	, funcRunOnce(std::move(funcRunOnce))
+{
+	BenchmarkManager::Add(this);
+}
+
+
+void BenchmarkManager::Add(const BenchmarkRegistry* benchmark)
+{
+	GetInstance().m_benchmarks.emplace_back(benchmark);
+}
+
+
+void BenchmarkManager::RunAll(const char* filter)
+{
+	printf("%-32s %14s %12s\n", "Benchmark", "Time/op (ns)", "MB/s");
+	for (const auto* benchmark : GetInstance().m_benchmarks)
+	{
+		if (filter && !strstr(benchmark->name, filter))
+			continue;
+
+		const double secondsPerOp = Measure(*benchmark);
+		printf("%-32s %14.1f ", benchmark->name, secondsPerOp * 1e9);
+		if (benchmark->bytesPerOp)
+			printf("%12.1f\n", static_cast<double>(benchmark->bytesPerOp) / secondsPerOp / (1024 * 1024));
+		else
+			printf("%12s\n", "-");
+	}
+}
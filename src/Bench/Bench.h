@@ -0,0 +1,72 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include <Types.h>
+
+
+
+struct BenchmarkRegistry
+{
+	const char* name;
+	size_t bytesPerOp;  // 0 if throughput isn't meaningful for the benchmark
+	std::function<void ()> funcRunOnce;
+
+	BenchmarkRegistry(const char* name, size_t bytesPerOp, std::function<void ()> funcRunOnce);
+};
+
+
+// Each benchmark body is a single operation. It's called repeatedly until the total run time is
+// long enough for a stable measurement. Expensive setup should go into function-local statics,
+// which get initialized by the warm-up run and thus stay out of the measurement.
+#define DEFINE_BENCHMARK(name, bytesPerOp)	\
+	static void Benchmark_##name();			\
+	static const BenchmarkRegistry __s_benchmarkReg_##name { #name, bytesPerOp, Benchmark_##name };	\
+	static void Benchmark_##name()
+
+
+// Prevents the compiler from optimizing away a computation whose result is otherwise unused
+template <typename T>
+	requires std::is_trivially_copyable_v<T>
+void KeepResult(const T& value) noexcept
+{
+	volatile uint8_t sink = 0;
+	const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+	for (size_t i = 0; i < sizeof(T); ++i)
+		sink = sink ^ bytes[i];
+}
+
+
+
+class BenchmarkManager : public gan::Singleton<BenchmarkManager>
+{
+public:
+	static void Add(const BenchmarkRegistry* benchmark);
+
+	// Runs benchmarks whose name contains "filter", or all of them if it's null.
+	static void RunAll(const char* filter);
+
+private:
+	std::vector<const BenchmarkRegistry*> m_benchmarks;
+};
@@ -0,0 +1,146 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Bench.h"
+
+#include <Hash.h>
+
+#include <string>
+#include <vector>
+
+#include <windows.h>
+
+
+namespace
+{
+
+
+constexpr size_t k_pageSize = 0x1000;
+constexpr size_t k_largeSize = 0x10'0000;
+constexpr size_t k_fileSize = 0x400'0000;
+
+
+const uint8_t* GetInput() noexcept
+{
+	const static std::vector<uint8_t> s_input = [] {
+		std::vector<uint8_t> data(k_largeSize);
+		uint32_t state = 0x9E37'79B9;
+		for (auto& byte : data)
+		{
+			state = state * 1'664'525 + 1'013'904'223;  // LCG
+			byte = static_cast<uint8_t>(state >> 24);
+		}
+		return data;
+	}();
+	return s_input.data();
+}
+
+
+void RunCRC32C(size_t size) noexcept
+{
+	KeepResult(gan::Hasher::GetCRC32C(gan::ConstMemAddr{ GetInput() }, size));
+}
+
+
+template <unsigned int NumOfBits>
+void RunXXH3(size_t size) noexcept
+{
+	gan::Hash<NumOfBits> hash;
+	gan::Hasher::GetXXH3(gan::ConstMemAddr{ GetInput() }, size, hash);
+	KeepResult(hash);
+}
+
+
+template <unsigned int NumOfBits>
+void RunSHA(size_t size)
+{
+	gan::Hash<NumOfBits> hash;
+	gan::Hasher::GetSHA(gan::ConstMemAddr{ GetInput() }, size, hash);
+	KeepResult(hash);
+}
+
+
+// A temporary file filled with 64 MB of the input pattern, deleted on exit
+class TempFile
+{
+public:
+	TempFile()
+	{
+		wchar_t dir[MAX_PATH];
+		wchar_t path[MAX_PATH];
+		if (!GetTempPathW(MAX_PATH, dir) || !GetTempFileNameW(dir, L"gan", 0, path))
+			return;
+		m_path = path;
+
+		HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (hFile == INVALID_HANDLE_VALUE)
+			return;
+		for (size_t offset = 0; offset < k_fileSize; offset += k_largeSize)
+		{
+			DWORD numWritten = 0;
+			WriteFile(hFile, GetInput(), static_cast<DWORD>(k_largeSize), &numWritten, nullptr);
+		}
+		CloseHandle(hFile);
+	}
+
+	~TempFile()
+	{
+		if (!m_path.empty())
+			DeleteFileW(m_path.c_str());
+	}
+
+	const std::wstring& GetPath() const noexcept	{ return m_path; }
+
+private:
+	std::wstring m_path;
+};
+
+
+// Reads from the file cache after the warm-up run, so this measures the
+// overlap of reading and hashing rather than the disk.
+template <unsigned int NumOfBits>
+void RunHashFile()
+{
+	const static TempFile s_file;
+	gan::Hash<NumOfBits> hash;
+	gan::Hasher::HashFile(s_file.GetPath(), hash);
+	KeepResult(hash);
+}
+
+
+}  // unnamed namespace
+
+
+
+DEFINE_BENCHMARK(Hash_CRC32C_4K, k_pageSize)	{ RunCRC32C(k_pageSize); }
+DEFINE_BENCHMARK(Hash_CRC32C_1M, k_largeSize)	{ RunCRC32C(k_largeSize); }
+
+DEFINE_BENCHMARK(Hash_XXH3_64_4K, k_pageSize)	{ RunXXH3<64>(k_pageSize); }
+DEFINE_BENCHMARK(Hash_XXH3_64_1M, k_largeSize)	{ RunXXH3<64>(k_largeSize); }
+DEFINE_BENCHMARK(Hash_XXH3_128_4K, k_pageSize)	{ RunXXH3<128>(k_pageSize); }
+DEFINE_BENCHMARK(Hash_XXH3_128_1M, k_largeSize)	{ RunXXH3<128>(k_largeSize); }
+
+DEFINE_BENCHMARK(Hash_SHA1_4K, k_pageSize)		{ RunSHA<160>(k_pageSize); }
+DEFINE_BENCHMARK(Hash_SHA1_1M, k_largeSize)		{ RunSHA<160>(k_largeSize); }
+DEFINE_BENCHMARK(Hash_SHA256_4K, k_pageSize)	{ RunSHA<256>(k_pageSize); }
+DEFINE_BENCHMARK(Hash_SHA256_1M, k_largeSize)	{ RunSHA<256>(k_largeSize); }
+DEFINE_BENCHMARK(Hash_SHA512_4K, k_pageSize)	{ RunSHA<512>(k_pageSize); }
+DEFINE_BENCHMARK(Hash_SHA512_1M, k_largeSize)	{ RunSHA<512>(k_largeSize); }
+
+DEFINE_BENCHMARK(Hash_File_XXH3_64_64M, k_fileSize)	{ RunHashFile<64>(); }
+DEFINE_BENCHMARK(Hash_File_SHA256_64M, k_fileSize)	{ RunHashFile<256>(); }
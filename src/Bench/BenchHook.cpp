@@ -0,0 +1,118 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Bench.h"
+
+#include <Hook.h>
+
+#include <barrier>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+
+
+constexpr size_t k_numThreads = 32;
+constexpr size_t k_callsPerThread = 0x1000;
+
+
+volatile size_t g_zero = 0;  // Keeps the compiler from evaluating Add() at compile time
+
+
+__declspec(noinline) size_t Add(size_t n1, size_t n2)
+{
+	return g_zero ? 0 : n1 + n2;
+}
+
+
+// Every call looks up the trampoline, which is the cost being measured.
+__declspec(noinline) size_t AddThroughTrampoline(size_t n1, size_t n2)
+{
+	return gan::Hook::GetTrampoline(Add)(n1, n2);
+}
+
+
+void CallHookedFunction() noexcept
+{
+	const static bool s_hooked = [] {
+		static gan::Hook s_hook{ Add, AddThroughTrampoline };
+		return s_hook.Install() == gan::Hook::OpResult::Hooked;
+	}();
+
+	size_t sum = 0;
+	for (size_t i = 0; i < k_callsPerThread; ++i)
+		sum += Add(i, s_hooked);
+	KeepResult(sum);
+}
+
+
+// Threads which call the hooked function all at once every time Run() is called
+class CallerThreads
+{
+public:
+	CallerThreads()
+		: m_start(k_numThreads + 1)
+		, m_done(k_numThreads + 1)
+		, m_stopping(false)
+	{
+		m_threads.reserve(k_numThreads);
+		for (size_t i = 0; i < k_numThreads; ++i)
+		{
+			m_threads.emplace_back([this] {
+				for (m_start.arrive_and_wait(); !m_stopping; m_start.arrive_and_wait())
+				{
+					CallHookedFunction();
+					m_done.arrive_and_wait();
+				}
+			});
+		}
+	}
+
+	~CallerThreads()
+	{
+		m_stopping = true;
+		m_start.arrive_and_wait();
+	}
+
+	void Run()
+	{
+		m_start.arrive_and_wait();
+		m_done.arrive_and_wait();
+	}
+
+private:
+	std::barrier<> m_start;
+	std::barrier<> m_done;
+	bool m_stopping;  // Only changed before arriving at m_start, which orders it for the threads
+	std::vector<std::jthread> m_threads;  // Last member, so the threads are joined before the barriers are gone
+};
+
+
+}  // unnamed namespace
+
+
+
+// Each op is k_callsPerThread calls on every thread.
+DEFINE_BENCHMARK(Hook_Trampoline_1Thread, 0)	{ CallHookedFunction(); }
+DEFINE_BENCHMARK(Hook_Trampoline_32Threads, 0)
+{
+	static CallerThreads s_threads;
+	s_threads.Run();
+}
@@ -0,0 +1,176 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ApiTracer.h>
+
+#include <Hook.h>
+#include <PE.h>
+#include <Types.h>
+
+#include <algorithm>
+#include <execution>
+#include <optional>
+#include <ranges>
+
+#include <windows.h>
+
+
+namespace
+{
+
+
+constinit thread_local bool t_busy = false;  // In the callback of any tracer
+
+
+bool IsCode(const gan::PeHeaders& headers, gan::Rva rva) noexcept
+{
+	return std::ranges::any_of(
+		headers.sectionHeaderList,
+		[rva](const IMAGE_SECTION_HEADER& section) noexcept {
+			const gan::Range<gan::Rva> sectionRange{
+				.min = section.VirtualAddress,
+				.max = section.VirtualAddress + section.Misc.VirtualSize
+			};
+			return (section.Characteristics & IMAGE_SCN_MEM_EXECUTE) != 0 && sectionRange.InRange(rva);
+		}
+	);
+}
+
+
+}  // unnamed namespace
+
+
+
+namespace gan
+{
+
+
+// ---------------------------------------------------------------------------
+// Class ApiTracer
+// ---------------------------------------------------------------------------
+
+ApiTracer::ApiTracer(Callback callback, void* userData) noexcept
+	: m_callback(callback)
+	, m_userData(userData)
+{ }
+
+
+ApiTracer::~ApiTracer() = default;
+
+
+std::optional<size_t> ApiTracer::AddModule(ConstMemAddr moduleBase)
+{
+	if (!m_probes.empty())
+		return std::nullopt;
+
+	const auto headers = PeImageHelper::GetLoadedHeaders(moduleBase);
+	if (!headers)
+		return std::nullopt;
+	if (!headers->exportData)
+		return 0;
+
+	// One candidate per address, which is code in the module itself
+	struct Candidate
+	{
+		Rva rva;
+		const ImageExportData::ExportedFunction* func;
+		std::optional<uint8_t> patchLength;
+	};
+	std::vector<Candidate> candidates;
+	for (const auto& func : headers->exportData->functions)
+	{
+		if (!func.forwarding && IsCode(*headers, func.rva))
+			candidates.emplace_back(func.rva, &func, std::nullopt);
+	}
+	std::ranges::stable_sort(candidates, { }, &Candidate::rva);  // Aliases are named after the lowest ordinal.
+	const auto aliases = std::ranges::unique(candidates, { }, &Candidate::rva);
+	candidates.erase(aliases.begin(), aliases.end());
+
+	// Decoding prologs is the bulk of the work. Spread it over the thread pool.
+	std::for_each(
+		std::execution::par,
+		candidates.begin(),
+		candidates.end(),
+		[moduleBase](Candidate& candidate) noexcept {
+			candidate.patchLength = Probe::GetPatchLength(moduleBase.Offset(candidate.rva));
+		}
+	);
+
+	// Another export starting within the patched bytes would jump into the middle of the patch.
+	const size_t numExports = m_exports.size();
+	for (auto i : std::views::iota(0uz, candidates.size()))
+	{
+		const Candidate& candidate = candidates[i];
+		if (!candidate.patchLength)
+			continue;
+		if (i + 1 < candidates.size() && candidates[i + 1].rva < candidate.rva + *candidate.patchLength)
+			continue;
+
+		m_exports.emplace_back(
+			moduleBase.Offset(candidate.rva).ConstCast(),
+			candidate.func->ordinal,
+			std::string{ candidate.func->name }
+		);
+	}
+	return m_exports.size() - numExports;
+}
+
+
+std::expected<void, HookTransaction::Failure> ApiTracer::Install()
+{
+	if (m_probes.empty())
+	{
+		m_targets.reserve(m_exports.size());
+		m_probes.reserve(m_exports.size());
+		for (auto i : std::views::iota(0uz, m_exports.size()))
+		{
+			m_targets.emplace_back(this, static_cast<uint32_t>(i));
+			m_probes.emplace_back(m_exports[i].addr, OnEntry, &m_targets[i]);
+		}
+	}
+
+	HookTransaction transaction;
+	for (auto& probe : m_probes)
+		transaction.Install(probe.GetHook());
+	return transaction.Commit();
+}
+
+
+std::expected<void, HookTransaction::Failure> ApiTracer::Uninstall()
+{
+	HookTransaction transaction;
+	for (auto& probe : m_probes)
+		transaction.Uninstall(probe.GetHook());
+	return transaction.Commit();
+}
+
+
+void ApiTracer::OnEntry(ProbeContext& context, void* userData)
+{
+	bool& busy = t_busy;
+	if (busy)
+		return;
+
+	const Target& target = *static_cast<const Target*>(userData);
+	busy = true;
+	target.owner->m_callback(target.exportId, context, target.owner->m_userData);
+	busy = false;
+}
+
+
+}  // namespace gan
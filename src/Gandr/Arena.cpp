@@ -0,0 +1,172 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Arena.h>
+
+#include <Buffer.h>
+#include <BufferPool.h>
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+
+namespace
+{
+
+
+// Offset of the first address at or after base + offset which is a multiple of alignment
+constexpr size_t AlignedOffset(uintptr_t base, size_t offset, size_t alignment) noexcept
+{
+	assert((alignment & (alignment - 1)) == 0);
+	return ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+}
+
+
+// Bump-allocates from [base, base + capacity) starting at "used". Returns nullptr if it doesn't fit.
+void* BumpAllocate(uint8_t* base, size_t capacity, size_t& used, size_t bytes, size_t alignment) noexcept
+{
+	const size_t start = AlignedOffset(reinterpret_cast<uintptr_t>(base), used, alignment);
+	if (start > capacity || bytes > capacity - start)
+		return nullptr;
+
+	used = start + bytes;
+	return base + start;
+}
+
+
+}  // unnamed namespace
+
+
+namespace gan
+{
+
+
+// Header of a chunk which MonotonicArena gets from BufferPool once its buffer is full
+struct MonotonicArena::OverflowChunk
+{
+	constexpr static size_t k_minSize = 4096;
+
+	OverflowChunk* next;
+	size_t size;  // incl. this header
+	size_t used;  // incl. this header
+
+	uint8_t* GetBase() noexcept	{ return reinterpret_cast<uint8_t*>(this); }
+};
+
+
+MonotonicArena::MonotonicArena(size_t initialSize)
+	: m_buffer(Buffer::Allocate(initialSize))
+	, m_usedSize(0)
+	, m_overflow(nullptr)
+	, m_overflowSize(0)
+{ }
+
+
+MonotonicArena::~MonotonicArena()
+{
+	FreeOverflow();
+}
+
+
+void MonotonicArena::Reset() noexcept
+{
+	const size_t cycleSize = GetUsedSize();
+	const bool hasOverflowed = m_overflow != nullptr;
+	FreeOverflow();
+	m_usedSize = 0;
+	m_overflowSize = 0;
+
+	if (hasOverflowed)
+	{
+		// Alignment padding may differ once everything is in one buffer, which Buffer's rounding
+		// up of the capacity more than covers.
+		m_buffer.reset();
+		m_buffer = Buffer::Allocate(cycleSize);
+	}
+}
+
+
+size_t MonotonicArena::GetCapacity() const noexcept
+{
+	return m_buffer ? m_buffer->GetCapacity() : 0;
+}
+
+
+void* MonotonicArena::do_allocate(size_t bytes, size_t alignment)
+{
+	if (m_buffer)
+	{
+		if (auto* addr = BumpAllocate(m_buffer->GetData(), m_buffer->GetCapacity(), m_usedSize, bytes, alignment))
+			return addr;
+	}
+
+	if (auto* addr = AllocateOverflow(bytes, alignment))
+		return addr;
+
+	throw std::bad_alloc{ };  // Required by std::pmr::memory_resource, as containers don't expect nullptr
+}
+
+
+void* MonotonicArena::AllocateOverflow(size_t bytes, size_t alignment) noexcept
+{
+	if (m_overflow)
+	{
+		const size_t usedBefore = m_overflow->used;
+		if (auto* addr = BumpAllocate(m_overflow->GetBase(), m_overflow->size, m_overflow->used, bytes, alignment))
+		{
+			m_overflowSize += m_overflow->used - usedBefore;
+			return addr;
+		}
+	}
+
+	// Chunks at least double in size so that a long cycle needs only a few of them
+	const size_t minChunkSize = sizeof(OverflowChunk) + alignment + bytes;
+	if (minChunkSize < bytes)
+		return nullptr;  // Overflowed
+	const size_t chunkSize = std::max({ minChunkSize, OverflowChunk::k_minSize, m_overflow ? m_overflow->size * 2 : 0 });
+
+	auto* chunkAddr = BufferPool::GetInstance().Acquire(chunkSize);
+	if (!chunkAddr)
+		return nullptr;
+	m_overflow = new(chunkAddr) OverflowChunk{
+		.next = m_overflow,
+		.size = chunkSize,
+		.used = sizeof(OverflowChunk)
+	};
+
+	auto* addr = BumpAllocate(m_overflow->GetBase(), m_overflow->size, m_overflow->used, bytes, alignment);
+	assert(addr);
+	m_overflowSize += m_overflow->used - sizeof(OverflowChunk);
+	return addr;
+}
+
+
+void MonotonicArena::FreeOverflow() noexcept
+{
+	auto& pool = BufferPool::GetInstance();
+	while (m_overflow)
+	{
+		auto* next = m_overflow->next;
+		pool.Release(m_overflow, m_overflow->size);
+		m_overflow = next;
+	}
+}
+
+
+}  // namespace gan
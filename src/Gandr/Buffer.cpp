@@ -18,12 +18,18 @@
 
 #include <Buffer.h>
 
+#include <BufferPool.h>
 #include <Types.h>
 
 #include <intrin.h>
 #include <windows.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <utility>
 
 
 namespace
@@ -48,6 +54,126 @@ size_t DetermineCapacity(size_t requestedSize) noexcept
 }
 
 
+// ---------------------------------------------------------------------------
+// Buffers backed by virtual memory. Address space is reserved beyond what's
+// committed on AMD64, so that growth mostly commits more pages in place
+// rather than copying (the Windows counterpart of mremap).
+// ---------------------------------------------------------------------------
+
+namespace vm
+{
+
+
+struct Allocation
+{
+	uint8_t* addr;
+	size_t committedSize;
+	size_t reservedSize;
+};
+
+
+// Address space is scarce on IA32, so we only reserve generously on AMD64
+constexpr size_t k_reservationFactor = gan::Is64() ? 4 : 1;
+
+
+const SYSTEM_INFO& GetSystemInfo() noexcept
+{
+	const static SYSTEM_INFO s_sysInfo = [] {
+		SYSTEM_INFO sysInfo;
+		::GetSystemInfo(&sysInfo);
+		return sysInfo;
+	}();
+	return s_sysInfo;
+}
+
+
+// Returns 0 on overflow
+constexpr size_t RoundUp(size_t size, size_t alignment) noexcept
+{
+	return size > std::numeric_limits<size_t>::max() - (alignment - 1) ?
+		0 :
+		(size + alignment - 1) & ~(alignment - 1);
+}
+
+
+void Prefault(uint8_t* addr, size_t size) noexcept
+{
+	// Freshly committed pages are zero-filled so writing a zero changes nothing but the fault is taken now
+	const size_t pageSize = GetSystemInfo().dwPageSize;
+	for (size_t offset = 0; offset < size; offset += pageSize)
+		reinterpret_cast<volatile uint8_t*>(addr)[offset] = 0;
+}
+
+
+// Large pages can only be reserved and committed at once, so they aren't over-reserved
+std::optional<Allocation> AllocateLargePages(size_t size) noexcept
+{
+	const size_t largePageSize = ::GetLargePageMinimum();
+	if (largePageSize == 0)
+		return std::nullopt;
+
+	const auto allocSize = RoundUp(size, largePageSize);
+	if (allocSize == 0)
+		return std::nullopt;
+
+	// Fails without SeLockMemoryPrivilege
+	auto* addr = ::VirtualAlloc(nullptr, allocSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (!addr)
+		return std::nullopt;
+	return Allocation{ static_cast<uint8_t*>(addr), allocSize, allocSize };  // Large pages are never paged out; no need to prefault
+}
+
+
+std::optional<Allocation> Allocate(size_t size, gan::BufferOptions options) noexcept
+{
+	if (options.Has(gan::BufferOption::LargePages))
+	{
+		if (auto allocation = AllocateLargePages(size))
+			return allocation;
+	}
+
+	const auto& sysInfo = GetSystemInfo();
+	const auto commitSize = RoundUp(std::max<size_t>(size, 1), sysInfo.dwPageSize);
+	if (commitSize == 0)
+		return std::nullopt;
+
+	// Try a generous reservation first, and then a minimal one
+	const size_t reserveSizes[] {
+		commitSize <= std::numeric_limits<size_t>::max() / k_reservationFactor ?
+			RoundUp(commitSize * k_reservationFactor, sysInfo.dwAllocationGranularity) :
+			0,
+		RoundUp(commitSize, sysInfo.dwAllocationGranularity)
+	};
+	for (const auto reserveSize : reserveSizes)
+	{
+		if (reserveSize == 0)
+			continue;
+		auto* addr = static_cast<uint8_t*>(::VirtualAlloc(nullptr, reserveSize, MEM_RESERVE, PAGE_NOACCESS));
+		if (!addr)
+			continue;
+
+		if (!::VirtualAlloc(addr, commitSize, MEM_COMMIT, PAGE_READWRITE))
+		{
+			::VirtualFree(addr, 0, MEM_RELEASE);
+			return std::nullopt;
+		}
+		if (options.Has(gan::BufferOption::Prefault))
+			Prefault(addr, commitSize);
+		return Allocation{ addr, commitSize, reserveSize };
+	}
+	return std::nullopt;
+}
+
+
+void Free(uint8_t* addr) noexcept
+{
+	::VirtualFree(addr, 0, MEM_RELEASE);
+}
+
+
+}  // namespace vm
+
+
 }  // unnamed namespace
 
 
@@ -55,23 +181,71 @@ namespace gan
 {
 
 
-std::unique_ptr<Buffer> Buffer::Allocate(size_t size)
+static_assert(Buffer::k_minSize == BufferPool::k_minBlockSize);
+
+
+std::unique_ptr<Buffer> Buffer::Allocate(size_t size, BufferOptions options)
 {
+	const bool useVirtualMemory =
+		options.Has(BufferOption::VirtualMemory)
+		|| options.Has(BufferOption::LargePages)
+		|| size >= k_virtualMemoryThreshold;
+	if (useVirtualMemory)
+	{
+		const auto allocation = vm::Allocate(size, options);
+		if (!allocation)
+			return nullptr;
+
+		auto buffer = std::make_unique<Buffer>(allocation->committedSize, size, allocation->addr, Private{});
+		if (!buffer)
+		{
+			vm::Free(allocation->addr);
+			return nullptr;
+		}
+		buffer->m_reservedSize = allocation->reservedSize;
+		buffer->m_options = options;
+		return buffer;
+	}
+
 	const auto capacity = DetermineCapacity(size);
 	assert(capacity >= size);
 	if (capacity >= size)
 	{
-		if (const MemAddr dataPtr{ ::HeapAlloc(::GetProcessHeap(), 0, capacity) })
-			return std::make_unique<Buffer>(capacity, size, dataPtr.Ptr<uint8_t>(), Private{});
+		auto& pool = BufferPool::GetInstance();
+		if (const MemAddr dataPtr{ pool.Acquire(capacity) })
+		{
+			// operator new is noexcept so a failure results in nullptr rather than an exception
+			if (auto buffer = std::make_unique<Buffer>(capacity, size, dataPtr.Ptr<uint8_t>(), Private{}))
+				return buffer;
+			pool.Release(dataPtr.Ptr(), capacity);
+		}
 	}
 	return nullptr;
 }
 
 
+void* Buffer::operator new(size_t size) noexcept
+{
+	static_assert(sizeof(Buffer) <= BufferPool::k_minBlockSize);
+	assert(size <= BufferPool::k_minBlockSize);
+	return size <= BufferPool::k_minBlockSize ?
+		BufferPool::GetInstance().Acquire(BufferPool::k_minBlockSize) :
+		nullptr;
+}
+
+
+void Buffer::operator delete(void* ptr) noexcept
+{
+	BufferPool::GetInstance().Release(ptr, BufferPool::k_minBlockSize);
+}
+
+
 Buffer::Buffer(size_t capacity, size_t size, uint8_t* addr, Private) noexcept
 	: m_capacity(capacity)
 	, m_size(size)
 	, m_data(addr)
+	, m_reservedSize(0)
+	, m_options()
 {
 	assert(capacity >= size);
 	assert(capacity > 0);
@@ -81,7 +255,10 @@ Buffer::Buffer(size_t capacity, size_t size, uint8_t* addr, Private) noexcept
 
 Buffer::~Buffer()
 {
-	::HeapFree(::GetProcessHeap(), 0, m_data);
+	if (IsVirtualMemory())
+		vm::Free(m_data);
+	else
+		BufferPool::GetInstance().Release(m_data, m_capacity);
 }
 
 
@@ -93,13 +270,20 @@ bool Buffer::Resize(size_t newSize) noexcept
 		return true;
 	}
 
+	if (IsVirtualMemory() || newSize >= k_virtualMemoryThreshold)
+		return ResizeVirtualMemory(newSize);
+
 	const auto newCapacity = DetermineCapacity(newSize);
 	assert(newCapacity >= newSize);
 	if (newCapacity < newSize)
 		return false;
 
-	if (const MemAddr newAddr{ ::HeapReAlloc(::GetProcessHeap(), 0, m_data, newCapacity) })
+	auto& pool = BufferPool::GetInstance();
+	if (const MemAddr newAddr{ pool.Acquire(newCapacity) })
 	{
+		memcpy(newAddr.Ptr(), m_data, m_size);
+		pool.Release(m_data, m_capacity);
+
 		m_capacity = newCapacity;
 		m_size = newSize;
 		m_data = newAddr.Ptr<uint8_t>();
@@ -109,4 +293,240 @@ bool Buffer::Resize(size_t newSize) noexcept
 }
 
 
+bool Buffer::ResizeVirtualMemory(size_t newSize) noexcept
+{
+	// Grow in place within the reservation
+	const auto& sysInfo = vm::GetSystemInfo();
+	const auto newCommitSize = vm::RoundUp(newSize, sysInfo.dwPageSize);
+	if (IsVirtualMemory() && newCommitSize != 0 && newCommitSize <= m_reservedSize)
+	{
+		if (newCommitSize > m_capacity)
+		{
+			auto* extraPages = m_data + m_capacity;
+			const auto extraSize = newCommitSize - m_capacity;
+			if (!::VirtualAlloc(extraPages, extraSize, MEM_COMMIT, PAGE_READWRITE))
+				return false;
+			if (m_options.Has(BufferOption::Prefault))
+				vm::Prefault(extraPages, extraSize);
+			m_capacity = newCommitSize;
+		}
+		m_size = newSize;
+		return true;
+	}
+
+	// Move to a new and larger reservation
+	const auto allocation = vm::Allocate(newSize, m_options);
+	if (!allocation)
+		return false;
+
+	memcpy(allocation->addr, m_data, m_size);
+	if (IsVirtualMemory())
+		vm::Free(m_data);
+	else
+		BufferPool::GetInstance().Release(m_data, m_capacity);
+
+	m_capacity = allocation->committedSize;
+	m_size = newSize;
+	m_data = allocation->addr;
+	m_reservedSize = allocation->reservedSize;
+	return true;
+}
+
+
+// ---------------------------------------------------------------------------
+// class InlineBuffer
+// ---------------------------------------------------------------------------
+
+uint8_t* internal::_InlineBufferBase::AllocateStorage(size_t minSize, size_t& capacity) noexcept
+{
+	const auto newCapacity = DetermineCapacity(minSize);
+	if (newCapacity < minSize)
+		return nullptr;
+
+	auto* addr = static_cast<uint8_t*>(BufferPool::GetInstance().Acquire(newCapacity));
+	if (addr)
+		capacity = newCapacity;
+	return addr;
+}
+
+
+void internal::_InlineBufferBase::FreeStorage(uint8_t* addr, size_t capacity) noexcept
+{
+	BufferPool::GetInstance().Release(addr, capacity);
+}
+
+
+BufferChain::BufferChain(size_t chunkSize) noexcept
+	: m_chunkSize(std::clamp<size_t>(chunkSize, Buffer::k_minSize, std::numeric_limits<DWORD>::max() / 2))  // A segment fits in a single ReadFile()/WriteFile()
+	, m_size(0)
+	, m_chunks()
+	, m_segments()
+{ }
+
+
+BufferChain::BufferChain(BufferChain&& other) noexcept
+	: m_chunkSize(other.m_chunkSize)
+	, m_size(std::exchange(other.m_size, 0))
+	, m_chunks(std::move(other.m_chunks))
+	, m_segments(std::move(other.m_segments))
+{
+	other.m_chunks.clear();
+	other.m_segments.clear();
+}
+
+
+BufferChain& BufferChain::operator=(BufferChain&& other) noexcept
+{
+	if (this != &other)
+	{
+		m_chunkSize = other.m_chunkSize;
+		m_size = std::exchange(other.m_size, 0);
+		m_chunks = std::move(other.m_chunks);
+		m_segments = std::move(other.m_segments);
+		other.m_chunks.clear();
+		other.m_segments.clear();
+	}
+	return *this;
+}
+
+
+bool BufferChain::Append(ConstMemAddr data, size_t size)
+{
+	const auto* src = data.ConstPtr<uint8_t>();
+	while (size > 0)
+	{
+		const auto space = PrepareAppend();
+		if (space.empty())
+			return false;
+
+		const auto sizeToCopy = std::min(space.size(), size);
+		memcpy(space.data(), src, sizeToCopy);
+		CommitAppend(sizeToCopy);
+		src += sizeToCopy;
+		size -= sizeToCopy;
+	}
+	return true;
+}
+
+
+WinErrorCode BufferChain::AppendFromProcess(WinHandle process, ConstMemAddr addr, size_t size)
+{
+	while (size > 0)
+	{
+		const auto space = PrepareAppend();
+		if (space.empty())
+			return ERROR_NOT_ENOUGH_MEMORY;
+
+		const auto sizeToRead = std::min(space.size(), size);
+		SIZE_T sizeRead = 0;
+		const bool succeeded = ::ReadProcessMemory(process, addr.ConstPtr(), space.data(), sizeToRead, &sizeRead);
+		CommitAppend(sizeRead);
+		if (!succeeded)
+			return ::GetLastError();
+
+		addr = addr.Offset(sizeToRead);
+		size -= sizeToRead;
+	}
+	return NO_ERROR;
+}
+
+
+WinErrorCode BufferChain::AppendFromFile(WinHandle file, size_t maxSize)
+{
+	while (maxSize > 0)
+	{
+		const auto space = PrepareAppend();
+		if (space.empty())
+			return ERROR_NOT_ENOUGH_MEMORY;
+
+		const auto sizeToRead = static_cast<DWORD>(std::min(space.size(), maxSize));
+		DWORD sizeRead = 0;
+		const bool succeeded = ::ReadFile(file, space.data(), sizeToRead, &sizeRead, nullptr);
+		CommitAppend(sizeRead);
+		if (!succeeded)
+			return ::GetLastError();
+		if (sizeRead == 0)
+			break;  // End of file
+
+		maxSize -= sizeRead;
+	}
+	return NO_ERROR;
+}
+
+
+WinErrorCode BufferChain::WriteToFile(WinHandle file) const noexcept
+{
+	for (const auto& segment : m_segments)
+	{
+		DWORD sizeWritten = 0;
+		if (!::WriteFile(file, segment.data(), static_cast<DWORD>(segment.size()), &sizeWritten, nullptr))
+			return ::GetLastError();
+		if (sizeWritten != segment.size())
+			return ERROR_WRITE_FAULT;
+	}
+	return NO_ERROR;
+}
+
+
+bool BufferChain::CopyTo(MemAddr dest, size_t offset, size_t size) const noexcept
+{
+	if (offset > m_size || size > m_size - offset)
+		return false;
+
+	auto* dst = dest.Ptr<uint8_t>();
+	for (const auto& segment : m_segments)
+	{
+		if (size == 0)
+			break;
+		if (offset >= segment.size())
+		{
+			offset -= segment.size();
+			continue;
+		}
+
+		const auto sizeToCopy = std::min(segment.size() - offset, size);
+		memcpy(dst, segment.data() + offset, sizeToCopy);
+		dst += sizeToCopy;
+		size -= sizeToCopy;
+		offset = 0;
+	}
+	return true;
+}
+
+
+void BufferChain::Clear() noexcept
+{
+	m_segments.clear();
+	m_chunks.clear();
+	m_size = 0;
+}
+
+
+std::span<uint8_t> BufferChain::PrepareAppend()
+{
+	if (m_chunks.empty() || m_segments.back().size() == m_chunks.back()->GetCapacity())
+	{
+		auto chunk = Buffer::Allocate(m_chunkSize);
+		if (!chunk)
+			return { };
+
+		m_segments.emplace_back(chunk->GetData(), 0);
+		m_chunks.emplace_back(std::move(chunk));
+	}
+
+	auto& lastChunk = *m_chunks.back();
+	const auto usedSize = m_segments.back().size();
+	return { lastChunk.GetData() + usedSize, lastChunk.GetCapacity() - usedSize };
+}
+
+
+void BufferChain::CommitAppend(size_t size) noexcept
+{
+	auto& lastSegment = m_segments.back();
+	assert(lastSegment.size() + size <= m_chunks.back()->GetCapacity());
+	lastSegment = Segment{ lastSegment.data(), lastSegment.size() + size };
+	m_size += size;
+}
+
+
 }  // namespace gan
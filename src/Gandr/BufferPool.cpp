@@ -0,0 +1,286 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <BufferPool.h>
+
+#include <windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+
+
+namespace
+{
+
+
+constexpr size_t k_log2MinBlockSize = std::countr_zero(gan::BufferPool::k_minBlockSize);
+static_assert(gan::BufferPool::k_minBlockSize << (gan::BufferPool::k_numSizeClasses - 1) == gan::BufferPool::k_maxBlockSize);
+
+// Bytes worth of blocks to keep per size class. Large blocks are kept in small numbers or not at
+// all, to bound the memory sitting idle in the pool.
+constexpr size_t k_threadCacheBytesPerClass = 1 << 18;  // 256 KB
+constexpr size_t k_freeListBytesPerClass = 1 << 24;  // 16 MB
+constexpr size_t k_maxThreadCachedBlocks = 8;
+constexpr size_t k_maxFreeListBlocks = 256;
+
+
+size_t GetSizeClass(size_t size) noexcept
+{
+	return static_cast<size_t>(std::countr_zero(size)) - k_log2MinBlockSize;
+}
+
+
+constexpr size_t GetThreadCacheLimit(size_t sizeClass) noexcept
+{
+	return std::min(k_maxThreadCachedBlocks, k_threadCacheBytesPerClass >> (sizeClass + k_log2MinBlockSize));
+}
+
+
+constexpr size_t GetFreeListLimit(size_t sizeClass) noexcept
+{
+	return std::min(k_maxFreeListBlocks, k_freeListBytesPerClass >> (sizeClass + k_log2MinBlockSize));
+}
+
+
+// Set once the calling thread's cache is destroyed, so that buffers freed later on during thread
+// or process shutdown bypass it. Being trivially destructible, it's valid throughout the thread's lifetime.
+thread_local bool t_isThreadCacheDestroyed = false;
+
+// Set once the pool is destroyed on process exit, after which buffers may still be freed, e.g., by
+// global objects destroyed later or by thread caches of exiting threads. They then go straight to
+// the heap. Likewise trivially destructible, so it outlives the pool.
+std::atomic<bool> s_isPoolDestroyed { false };
+
+
+}  // unnamed namespace
+
+
+namespace gan
+{
+
+
+namespace internal
+{
+
+
+class BufferPoolThreadCache
+{
+public:
+	BufferPoolThreadCache() noexcept
+		: m_blocks()
+		, m_numBlocks()
+	{ }
+
+	~BufferPoolThreadCache()
+	{
+		Flush();
+		t_isThreadCacheDestroyed = true;
+	}
+
+	void* Pop(size_t sizeClass) noexcept
+	{
+		auto& numBlocks = m_numBlocks[sizeClass];
+		return numBlocks > 0 ? m_blocks[sizeClass][--numBlocks] : nullptr;
+	}
+
+	bool Push(void* block, size_t sizeClass) noexcept
+	{
+		auto& numBlocks = m_numBlocks[sizeClass];
+		if (numBlocks >= GetThreadCacheLimit(sizeClass))
+			return false;
+		m_blocks[sizeClass][numBlocks++] = block;
+		return true;
+	}
+
+	void Flush() noexcept
+	{
+		const bool isPoolDestroyed = s_isPoolDestroyed.load(std::memory_order_relaxed);
+		for (size_t sizeClass = 0; sizeClass < BufferPool::k_numSizeClasses; ++sizeClass)
+		{
+			for (; m_numBlocks[sizeClass] > 0; --m_numBlocks[sizeClass])
+			{
+				auto* block = m_blocks[sizeClass][m_numBlocks[sizeClass] - 1];
+				if (isPoolDestroyed)
+					::HeapFree(::GetProcessHeap(), 0, block);
+				else
+					BufferPool::GetInstance().ReleaseToFreeList(block, sizeClass);
+			}
+		}
+	}
+
+private:
+	void* m_blocks[BufferPool::k_numSizeClasses][k_maxThreadCachedBlocks];
+	uint8_t m_numBlocks[BufferPool::k_numSizeClasses];
+};
+
+
+}  // namespace internal
+
+
+namespace
+{
+
+
+thread_local internal::BufferPoolThreadCache t_threadCache;
+
+
+}  // unnamed namespace
+
+
+
+// ---------------------------------------------------------------------------
+// Class BufferPool
+// ---------------------------------------------------------------------------
+
+BufferPool::BufferPool()
+	: m_freeLists()
+	, m_numHeapAllocs(0)
+	, m_numHeapFrees(0)
+{
+	// So that pushing to a free list never goes to the heap
+	for (size_t sizeClass = 0; sizeClass < k_numSizeClasses; ++sizeClass)
+	{
+		const auto limit = GetFreeListLimit(sizeClass);
+		m_freeLists[sizeClass].ApplyOperation([limit](std::vector<void*>& list) {
+			list.reserve(limit);
+		});
+	}
+}
+
+
+BufferPool::~BufferPool()
+{
+	// Blocks released from now on, including those flushed by Trim(), bypass the free lists.
+	s_isPoolDestroyed.store(true, std::memory_order_relaxed);
+	Trim();
+}
+
+
+void* BufferPool::Acquire(size_t size) noexcept
+{
+	if (s_isPoolDestroyed.load(std::memory_order_relaxed))
+		return ::HeapAlloc(::GetProcessHeap(), 0, size);
+	if (!IsPooledSize(size))
+		return AllocFromHeap(size);
+
+	const auto sizeClass = GetSizeClass(size);
+	if (!t_isThreadCacheDestroyed)
+	{
+		if (auto* block = t_threadCache.Pop(sizeClass))
+			return block;
+	}
+
+	auto* block = m_freeLists[sizeClass].ApplyOperation([](std::vector<void*>& list) noexcept -> void* {
+		if (list.empty())
+			return nullptr;
+		auto* lastBlock = list.back();
+		list.pop_back();
+		return lastBlock;
+	});
+	return block ? block : AllocFromHeap(size);
+}
+
+
+void BufferPool::Release(void* block, size_t size) noexcept
+{
+	if (!block)
+		return;
+	if (s_isPoolDestroyed.load(std::memory_order_relaxed))
+	{
+		::HeapFree(::GetProcessHeap(), 0, block);
+		return;
+	}
+	if (!IsPooledSize(size))
+	{
+		FreeToHeap(block);
+		return;
+	}
+
+	const auto sizeClass = GetSizeClass(size);
+	if (!t_isThreadCacheDestroyed && t_threadCache.Push(block, sizeClass))
+		return;
+	ReleaseToFreeList(block, sizeClass);
+}
+
+
+void BufferPool::Trim() noexcept
+{
+	if (!t_isThreadCacheDestroyed)
+		t_threadCache.Flush();
+
+	for (auto& freeList : m_freeLists)
+	{
+		freeList.ApplyOperation([this](std::vector<void*>& list) noexcept {
+			for (auto* block : list)
+				FreeToHeap(block);
+			list.clear();
+		});
+	}
+}
+
+
+BufferPool::Stats BufferPool::GetStats() const noexcept
+{
+	return {
+		.numHeapAllocs = m_numHeapAllocs.load(std::memory_order_relaxed),
+		.numHeapFrees = m_numHeapFrees.load(std::memory_order_relaxed)
+	};
+}
+
+
+bool BufferPool::IsPooledSize(size_t size) noexcept
+{
+	return size >= k_minBlockSize && size <= k_maxBlockSize && std::has_single_bit(size);
+}
+
+
+void BufferPool::ReleaseToFreeList(void* block, size_t sizeClass) noexcept
+{
+	assert(sizeClass < k_numSizeClasses);
+
+	const auto limit = GetFreeListLimit(sizeClass);
+	const bool isPooled = m_freeLists[sizeClass].ApplyOperation([block, limit](std::vector<void*>& list) noexcept {
+		if (list.size() >= limit)
+			return false;
+		list.emplace_back(block);  // Never reallocates as capacity has been reserved
+		return true;
+	});
+	if (!isPooled)
+		FreeToHeap(block);
+}
+
+
+void* BufferPool::AllocFromHeap(size_t size) noexcept
+{
+	auto* block = ::HeapAlloc(::GetProcessHeap(), 0, size);
+	if (block)
+		m_numHeapAllocs.fetch_add(1, std::memory_order_relaxed);
+	return block;
+}
+
+
+void BufferPool::FreeToHeap(void* block) noexcept
+{
+	::HeapFree(::GetProcessHeap(), 0, block);
+	m_numHeapFrees.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+}  // namespace gan
@@ -43,12 +43,15 @@ namespace
 class InjectionHelper
 {
 public:
+	// Stack frames are only a few pointers in size and thus always fit in the inline storage
+	using StackFrameBuffer = gan::InlineBuffer<32>;
+
 	template <gan::Arch arch>
-	static std::unique_ptr<gan::Buffer> GenerateStackFrameAndUpdateContext(CONTEXT&, const wchar_t*);
+	static StackFrameBuffer GenerateStackFrameAndUpdateContext(CONTEXT&, const wchar_t*);
 
 
 	template <>
-	std::unique_ptr<gan::Buffer> GenerateStackFrameAndUpdateContext<gan::Arch::IA32>(CONTEXT& context, const wchar_t* remoteDllPath)
+	StackFrameBuffer GenerateStackFrameAndUpdateContext<gan::Arch::IA32>(CONTEXT& context, const wchar_t* remoteDllPath)
 	{
 		// write faked stack frame
 		struct StackFrameForLoadLibraryW32
@@ -67,14 +70,13 @@ public:
 		auto funcVirtualFree = gan::DllLookup::Get<decltype(&::VirtualFree)>(L"kernel32"sv, "VirtualFree"sv);
 		assert(funcVirtualFree);
 
-		auto output = gan::Buffer::Allocate(sizeof(StackFrameForLoadLibraryW32));
-		assert(output);
-		if (!output)
-			return nullptr;
+		static_assert(sizeof(StackFrameForLoadLibraryW32) <= StackFrameBuffer::k_inlineCapacity);
+		StackFrameBuffer output;
+		output.Resize(sizeof(StackFrameForLoadLibraryW32));
 
-		GET_CONTEXT_REG(context, sp) -= output->GetSize();
+		GET_CONTEXT_REG(context, sp) -= output.GetSize();
 
-		const gan::MemAddr bufferData{ output->GetData() };
+		const gan::MemAddr bufferData{ output.GetData() };
 		bufferData.Ref<StackFrameForLoadLibraryW32>() = {
 			// for LoadLibraryW()
 			funcVirtualFree,
@@ -89,11 +91,11 @@ public:
 
 		SetIPToLoadLibraryW(context);
 
-		return std::move(output);
+		return output;
 	}
 
 	template <>
-	std::unique_ptr<gan::Buffer> GenerateStackFrameAndUpdateContext<gan::Arch::Amd64>(CONTEXT& context, const wchar_t* remoteDllPath)
+	StackFrameBuffer GenerateStackFrameAndUpdateContext<gan::Arch::Amd64>(CONTEXT& context, const wchar_t* remoteDllPath)
 	{
 		struct StackFrameForLoadLibraryW64
 		{
@@ -101,22 +103,21 @@ public:
 			LPVOID pRetAddrOrigin;
 		};
 
-		auto output = gan::Buffer::Allocate(sizeof(StackFrameForLoadLibraryW64));
-		assert(output);
-		if (!output)
-			return nullptr;
+		static_assert(sizeof(StackFrameForLoadLibraryW64) <= StackFrameBuffer::k_inlineCapacity);
+		StackFrameBuffer output;
+		output.Resize(sizeof(StackFrameForLoadLibraryW64));
 
-		GET_CONTEXT_REG(context, sp) -= output->GetSize();
+		GET_CONTEXT_REG(context, sp) -= output.GetSize();
 		GET_CONTEXT_REG(context, cx) = reinterpret_cast<size_t>(remoteDllPath);  // Arg to LoadLibraryW
 
-		const gan::MemAddr bufferData{ output->GetData() };
+		const gan::MemAddr bufferData{ output.GetData() };
 		bufferData.Ref<StackFrameForLoadLibraryW64>() = {
 			reinterpret_cast<LPVOID>(GET_CONTEXT_REG(context, ip))
 		};
 
 		SetIPToLoadLibraryW(context);
 
-		return std::move(output);
+		return output;
 	}
 
 
@@ -171,17 +172,15 @@ DllInjectorByContext::Result DllInjectorByContext::Inject(std::wstring_view dllP
 		return Result::DLLPathNotWritten;
 
 	// Generate a "synthesized" stack frame and modify registers accordingly
-	auto bufferStackFrame = InjectionHelper::GenerateStackFrameAndUpdateContext<BuildArch()>(context, remoteBuffer);
-	assert(bufferStackFrame);
-	if (!bufferStackFrame)
-		return Result::StackFrameNotWritten;
+	const auto bufferStackFrame = InjectionHelper::GenerateStackFrameAndUpdateContext<BuildArch()>(context, remoteBuffer);
+	assert(bufferStackFrame.GetSize() > 0);
 
 	// Write the stack frame target process memory
 	const auto stackFrameWritten = ::WriteProcessMemory(
 		*m_hProcess,
 		reinterpret_cast<LPVOID>(GET_CONTEXT_REG(context, sp)),
-		bufferStackFrame->GetData(),
-		bufferStackFrame->GetSize(),
+		bufferStackFrame.GetData(),
+		bufferStackFrame.GetSize(),
 		nullptr
 	);
 	if (stackFrameWritten == FALSE)
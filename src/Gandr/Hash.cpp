@@ -20,10 +20,18 @@
 
 #include <Handle.h>
 
+#include <intrin.h>
 #include <windows.h>
 #include <bcrypt.h>  // Win32 API bug: must be included after windows.h
 
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <expected>
 #include <memory>
+#include <span>
+#include <string>
 
 #pragma comment(lib, "bcrypt.lib")
 
@@ -40,12 +48,1029 @@ struct AutoBcryptAlgHandleImpl
 using AutoBcryptAlgHandle = gan::AutoHandle<AutoBcryptAlgHandleImpl>;
 
 
-struct AutoBcryptHashHandleImpl
+// ---------------------------------------------------------------------------
+// XXH3 implementation
+// REF: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+// ---------------------------------------------------------------------------
+
+namespace xxh3
+{
+
+
+constexpr uint32_t k_prime32_1 = 0x9E3779B1u;
+constexpr uint32_t k_prime32_2 = 0x85EBCA77u;
+constexpr uint32_t k_prime32_3 = 0xC2B2AE3Du;
+constexpr uint64_t k_prime64_1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t k_prime64_2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t k_prime64_3 = 0x165667B19E3779F9ull;
+constexpr uint64_t k_prime64_4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t k_prime64_5 = 0x27D4EB2F165667C5ull;
+constexpr uint64_t k_primeMx1 = 0x165667919E3779F9ull;
+constexpr uint64_t k_primeMx2 = 0x9FB21C651E98DF25ull;
+
+constexpr size_t k_stripeSize = 64;
+constexpr size_t k_numOfAccs = 8;
+constexpr size_t k_secretSize = 192;
+constexpr size_t k_secretSizeMin = 136;
+constexpr size_t k_secretConsumeRate = 8;
+constexpr size_t k_secretLastAccStart = 7;
+constexpr size_t k_secretMergeAccsStart = 11;
+constexpr size_t k_midSizeMax = 240;
+constexpr size_t k_midSizeStartOffset = 3;
+constexpr size_t k_midSizeLastOffset = 17;
+constexpr size_t k_numStripesPerBlock = (k_secretSize - k_stripeSize) / k_secretConsumeRate;
+constexpr size_t k_blockSize = k_stripeSize * k_numStripesPerBlock;
+
+alignas(64) constexpr uint8_t k_defaultSecret[k_secretSize] {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+constexpr uint64_t k_initAcc[k_numOfAccs] {
+	k_prime32_3, k_prime64_1, k_prime64_2, k_prime64_3,
+	k_prime64_4, k_prime32_2, k_prime64_5, k_prime32_1
+};
+
+
+struct Uint128
+{
+	uint64_t low;
+	uint64_t high;
+};
+
+
+// x86 and amd64 are both little-endian, so plain unaligned loads are fine.
+inline uint32_t Read32(const uint8_t* ptr) noexcept
+{
+	uint32_t result;
+	memcpy(&result, ptr, sizeof(result));
+	return result;
+}
+
+inline uint64_t Read64(const uint8_t* ptr) noexcept
+{
+	uint64_t result;
+	memcpy(&result, ptr, sizeof(result));
+	return result;
+}
+
+inline void Write64(uint8_t* ptr, uint64_t value) noexcept
+{
+	memcpy(ptr, &value, sizeof(value));
+}
+
+inline Uint128 Mul64To128(uint64_t lhs, uint64_t rhs) noexcept
+{
+#if defined _WIN64
+	Uint128 result;
+	result.low = _umul128(lhs, rhs, &result.high);
+	return result;
+#else
+	const uint64_t loLo = (lhs & 0xFFFF'FFFF) * (rhs & 0xFFFF'FFFF);
+	const uint64_t hiLo = (lhs >> 32) * (rhs & 0xFFFF'FFFF);
+	const uint64_t loHi = (lhs & 0xFFFF'FFFF) * (rhs >> 32);
+	const uint64_t hiHi = (lhs >> 32) * (rhs >> 32);
+	const uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFF'FFFF) + loHi;
+	return {
+		.low = (cross << 32) | (loLo & 0xFFFF'FFFF),
+		.high = (hiLo >> 32) + (cross >> 32) + hiHi
+	};
+#endif  // _WIN64
+}
+
+inline uint64_t Mul128Fold64(uint64_t lhs, uint64_t rhs) noexcept
+{
+	const auto product = Mul64To128(lhs, rhs);
+	return product.low ^ product.high;
+}
+
+inline uint64_t XXH64Avalanche(uint64_t hash) noexcept
+{
+	hash ^= hash >> 33;
+	hash *= k_prime64_2;
+	hash ^= hash >> 29;
+	hash *= k_prime64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+inline uint64_t Avalanche(uint64_t hash) noexcept
+{
+	hash ^= hash >> 37;
+	hash *= k_primeMx1;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+inline uint64_t RrmxmxAvalanche(uint64_t hash, uint64_t size) noexcept
+{
+	hash ^= std::rotl(hash, 49) ^ std::rotl(hash, 24);
+	hash *= k_primeMx2;
+	hash ^= (hash >> 35) + size;
+	hash *= k_primeMx2;
+	hash ^= hash >> 28;
+	return hash;
+}
+
+inline uint64_t Mix16B(const uint8_t* input, const uint8_t* secret, uint64_t seed) noexcept
+{
+	return Mul128Fold64(
+		Read64(input) ^ (Read64(secret) + seed),
+		Read64(input + 8) ^ (Read64(secret + 8) - seed)
+	);
+}
+
+inline Uint128 Mix32B(Uint128 acc, const uint8_t* input1, const uint8_t* input2, const uint8_t* secret, uint64_t seed) noexcept
+{
+	acc.low += Mix16B(input1, secret, seed);
+	acc.low ^= Read64(input2) + Read64(input2 + 8);
+	acc.high += Mix16B(input2, secret + 16, seed);
+	acc.high ^= Read64(input1) + Read64(input1 + 8);
+	return acc;
+}
+
+void InitCustomSecret(uint64_t seed, uint8_t (&out)[k_secretSize]) noexcept
+{
+	for (size_t i = 0; i < k_secretSize; i += 16)
+	{
+		Write64(out + i, Read64(k_defaultSecret + i) + seed);
+		Write64(out + i + 8, Read64(k_defaultSecret + i + 8) - seed);
+	}
+}
+
+
+// ---------------------------------------------------------------------------
+// Long input: the stripe accumulation loop is where all the time is spent on
+// large regions, so it comes in SSE2 and AVX2 flavors. SSE2 is the baseline
+// for both x86 and amd64 builds; AVX2 is picked at runtime when available.
+// ---------------------------------------------------------------------------
+
+struct LongKernel
+{
+	using AccumulateFunc = void (*)(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t numStripes) noexcept;
+	using ScrambleFunc = void (*)(uint64_t* acc, const uint8_t* secret) noexcept;
+
+	AccumulateFunc accumulate;
+	ScrambleFunc scramble;
+};
+
+
+void AccumulateSse2(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t numStripes) noexcept
+{
+	auto* accVec = reinterpret_cast<__m128i*>(acc);
+	__m128i xacc[4] {
+		_mm_load_si128(accVec + 0), _mm_load_si128(accVec + 1),
+		_mm_load_si128(accVec + 2), _mm_load_si128(accVec + 3)
+	};
+
+	for (size_t n = 0; n < numStripes; ++n)
+	{
+		const auto* inputVec = reinterpret_cast<const __m128i*>(input + n * k_stripeSize);
+		const auto* secretVec = reinterpret_cast<const __m128i*>(secret + n * k_secretConsumeRate);
+		for (size_t i = 0; i < 4; ++i)
+		{
+			const __m128i data = _mm_loadu_si128(inputVec + i);
+			const __m128i dataKey = _mm_xor_si128(data, _mm_loadu_si128(secretVec + i));
+			const __m128i dataKeyHigh = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+			const __m128i product = _mm_mul_epu32(dataKey, dataKeyHigh);
+			const __m128i dataSwapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+			xacc[i] = _mm_add_epi64(xacc[i], _mm_add_epi64(product, dataSwapped));
+		}
+	}
+
+	for (size_t i = 0; i < 4; ++i)
+		_mm_store_si128(accVec + i, xacc[i]);
+}
+
+void ScrambleSse2(uint64_t* acc, const uint8_t* secret) noexcept
+{
+	auto* accVec = reinterpret_cast<__m128i*>(acc);
+	const auto* secretVec = reinterpret_cast<const __m128i*>(secret);
+	const __m128i prime = _mm_set1_epi32(static_cast<int>(k_prime32_1));
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		const __m128i accValue = _mm_load_si128(accVec + i);
+		const __m128i data = _mm_xor_si128(accValue, _mm_srli_epi64(accValue, 47));
+		const __m128i dataKey = _mm_xor_si128(data, _mm_loadu_si128(secretVec + i));
+		const __m128i dataKeyHigh = _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+		const __m128i productLow = _mm_mul_epu32(dataKey, prime);
+		const __m128i productHigh = _mm_mul_epu32(dataKeyHigh, prime);
+		_mm_store_si128(accVec + i, _mm_add_epi64(productLow, _mm_slli_epi64(productHigh, 32)));
+	}
+}
+
+void AccumulateAvx2(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t numStripes) noexcept
+{
+	auto* accVec = reinterpret_cast<__m256i*>(acc);
+	__m256i xacc[2] { _mm256_load_si256(accVec + 0), _mm256_load_si256(accVec + 1) };
+
+	for (size_t n = 0; n < numStripes; ++n)
+	{
+		const auto* inputVec = reinterpret_cast<const __m256i*>(input + n * k_stripeSize);
+		const auto* secretVec = reinterpret_cast<const __m256i*>(secret + n * k_secretConsumeRate);
+		for (size_t i = 0; i < 2; ++i)
+		{
+			const __m256i data = _mm256_loadu_si256(inputVec + i);
+			const __m256i dataKey = _mm256_xor_si256(data, _mm256_loadu_si256(secretVec + i));
+			const __m256i dataKeyHigh = _mm256_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+			const __m256i product = _mm256_mul_epu32(dataKey, dataKeyHigh);
+			const __m256i dataSwapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+			xacc[i] = _mm256_add_epi64(xacc[i], _mm256_add_epi64(product, dataSwapped));
+		}
+	}
+
+	_mm256_store_si256(accVec + 0, xacc[0]);
+	_mm256_store_si256(accVec + 1, xacc[1]);
+}
+
+void ScrambleAvx2(uint64_t* acc, const uint8_t* secret) noexcept
+{
+	auto* accVec = reinterpret_cast<__m256i*>(acc);
+	const auto* secretVec = reinterpret_cast<const __m256i*>(secret);
+	const __m256i prime = _mm256_set1_epi32(static_cast<int>(k_prime32_1));
+
+	for (size_t i = 0; i < 2; ++i)
+	{
+		const __m256i accValue = _mm256_load_si256(accVec + i);
+		const __m256i data = _mm256_xor_si256(accValue, _mm256_srli_epi64(accValue, 47));
+		const __m256i dataKey = _mm256_xor_si256(data, _mm256_loadu_si256(secretVec + i));
+		const __m256i dataKeyHigh = _mm256_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1));
+		const __m256i productLow = _mm256_mul_epu32(dataKey, prime);
+		const __m256i productHigh = _mm256_mul_epu32(dataKeyHigh, prime);
+		_mm256_store_si256(accVec + i, _mm256_add_epi64(productLow, _mm256_slli_epi64(productHigh, 32)));
+	}
+}
+
+bool IsAvx2Supported() noexcept
+{
+	int cpuInfo[4] { };
+	__cpuid(cpuInfo, 0);
+	if (cpuInfo[0] < 7)
+		return false;
+
+	// The OS must also save YMM registers on context switches (OSXSAVE + XCR0 bits 1 and 2).
+	__cpuid(cpuInfo, 1);
+	constexpr int k_osxsave = 1 << 27;
+	constexpr int k_avx = 1 << 28;
+	if ((cpuInfo[2] & (k_osxsave | k_avx)) != (k_osxsave | k_avx)
+		|| (_xgetbv(0) & 0b110) != 0b110)
+	{
+		return false;
+	}
+
+	__cpuidex(cpuInfo, 7, 0);
+	constexpr int k_avx2 = 1 << 5;
+	return cpuInfo[1] & k_avx2;
+}
+
+const LongKernel& GetLongKernel() noexcept
+{
+	const static LongKernel s_kernel = IsAvx2Supported() ?
+		LongKernel{ AccumulateAvx2, ScrambleAvx2 } :
+		LongKernel{ AccumulateSse2, ScrambleSse2 };
+	return s_kernel;
+}
+
+// Processes "numStripes" stripes starting at the "numStripesSoFar"-th one of the current block,
+// scrambling the accumulators whenever a block is completed.
+void ConsumeStripes(
+	const LongKernel& kernel,
+	uint64_t* acc,
+	uint32_t& numStripesSoFar,
+	const uint8_t* input,
+	size_t numStripes,
+	const uint8_t* secret) noexcept
+{
+	while (numStripesSoFar + numStripes >= k_numStripesPerBlock)
+	{
+		const size_t numStripesToEnd = k_numStripesPerBlock - numStripesSoFar;
+		kernel.accumulate(acc, input, secret + numStripesSoFar * k_secretConsumeRate, numStripesToEnd);
+		kernel.scramble(acc, secret + k_secretSize - k_stripeSize);
+		input += numStripesToEnd * k_stripeSize;
+		numStripes -= numStripesToEnd;
+		numStripesSoFar = 0;
+	}
+	kernel.accumulate(acc, input, secret + numStripesSoFar * k_secretConsumeRate, numStripes);
+	numStripesSoFar += static_cast<uint32_t>(numStripes);
+}
+
+uint64_t MergeAccs(const uint64_t* acc, const uint8_t* secret, uint64_t start) noexcept
+{
+	uint64_t result = start;
+	for (size_t i = 0; i < 4; ++i)
+		result += Mul128Fold64(acc[2 * i] ^ Read64(secret + 16 * i), acc[2 * i + 1] ^ Read64(secret + 16 * i + 8));
+	return Avalanche(result);
+}
+
+// "acc" must be 64-byte aligned
+void HashLongInternal(uint64_t* acc, const uint8_t* input, size_t size, const uint8_t* secret) noexcept
+{
+	const LongKernel& kernel = GetLongKernel();
+	std::copy_n(k_initAcc, k_numOfAccs, acc);
+
+	// Full blocks, then whatever full stripes remain. The last byte always ends up in the last stripe.
+	uint32_t numStripesSoFar = 0;
+	ConsumeStripes(kernel, acc, numStripesSoFar, input, (size - 1) / k_stripeSize, secret);
+	kernel.accumulate(acc, input + size - k_stripeSize, secret + k_secretSize - k_stripeSize - k_secretLastAccStart, 1);
+}
+
+
+// ---------------------------------------------------------------------------
+// 64-bit variant
+// ---------------------------------------------------------------------------
+
+uint64_t Hash64Len1To3(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	const uint32_t combined =
+		(static_cast<uint32_t>(input[0]) << 16)
+		| (static_cast<uint32_t>(input[size >> 1]) << 24)
+		| static_cast<uint32_t>(input[size - 1])
+		| static_cast<uint32_t>(size << 8);
+	const uint64_t bitflip = (Read32(secret) ^ Read32(secret + 4)) + seed;
+	return XXH64Avalanche(combined ^ bitflip);
+}
+
+uint64_t Hash64Len4To8(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	seed ^= static_cast<uint64_t>(std::byteswap(static_cast<uint32_t>(seed))) << 32;
+	const uint64_t bitflip = (Read64(secret + 8) ^ Read64(secret + 16)) - seed;
+	const uint64_t input64 = Read32(input + size - 4) + (static_cast<uint64_t>(Read32(input)) << 32);
+	return RrmxmxAvalanche(input64 ^ bitflip, size);
+}
+
+uint64_t Hash64Len9To16(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	const uint64_t bitflip1 = (Read64(secret + 24) ^ Read64(secret + 32)) + seed;
+	const uint64_t bitflip2 = (Read64(secret + 40) ^ Read64(secret + 48)) - seed;
+	const uint64_t inputLow = Read64(input) ^ bitflip1;
+	const uint64_t inputHigh = Read64(input + size - 8) ^ bitflip2;
+	const uint64_t acc = size + std::byteswap(inputLow) + inputHigh + Mul128Fold64(inputLow, inputHigh);
+	return Avalanche(acc);
+}
+
+uint64_t Hash64Len0To16(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	if (size > 8)
+		return Hash64Len9To16(input, size, secret, seed);
+	else if (size >= 4)
+		return Hash64Len4To8(input, size, secret, seed);
+	else if (size > 0)
+		return Hash64Len1To3(input, size, secret, seed);
+	return XXH64Avalanche(seed ^ Read64(secret + 56) ^ Read64(secret + 64));
+}
+
+uint64_t Hash64Len17To128(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	uint64_t acc = size * k_prime64_1;
+	if (size > 32)
+	{
+		if (size > 64)
+		{
+			if (size > 96)
+			{
+				acc += Mix16B(input + 48, secret + 96, seed);
+				acc += Mix16B(input + size - 64, secret + 112, seed);
+			}
+			acc += Mix16B(input + 32, secret + 64, seed);
+			acc += Mix16B(input + size - 48, secret + 80, seed);
+		}
+		acc += Mix16B(input + 16, secret + 32, seed);
+		acc += Mix16B(input + size - 32, secret + 48, seed);
+	}
+	acc += Mix16B(input, secret, seed);
+	acc += Mix16B(input + size - 16, secret + 16, seed);
+	return Avalanche(acc);
+}
+
+uint64_t Hash64Len129To240(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	const size_t numRounds = size / 16;
+
+	uint64_t acc = size * k_prime64_1;
+	for (size_t i = 0; i < 8; ++i)
+		acc += Mix16B(input + 16 * i, secret + 16 * i, seed);
+	acc = Avalanche(acc);
+
+	for (size_t i = 8; i < numRounds; ++i)
+		acc += Mix16B(input + 16 * i, secret + 16 * (i - 8) + k_midSizeStartOffset, seed);
+	acc += Mix16B(input + size - 16, secret + k_secretSizeMin - k_midSizeLastOffset, seed);
+	return Avalanche(acc);
+}
+
+uint64_t Hash64Long(const uint8_t* input, size_t size, const uint8_t* secret) noexcept
+{
+	alignas(64) uint64_t acc[k_numOfAccs];
+	HashLongInternal(acc, input, size, secret);
+	return MergeAccs(acc, secret + k_secretMergeAccsStart, size * k_prime64_1);
+}
+
+uint64_t Hash64(const uint8_t* input, size_t size, uint64_t seed) noexcept
+{
+	if (size <= 16)
+		return Hash64Len0To16(input, size, k_defaultSecret, seed);
+	else if (size <= 128)
+		return Hash64Len17To128(input, size, k_defaultSecret, seed);
+	else if (size <= k_midSizeMax)
+		return Hash64Len129To240(input, size, k_defaultSecret, seed);
+	else if (seed == 0)
+		return Hash64Long(input, size, k_defaultSecret);
+
+	alignas(64) uint8_t customSecret[k_secretSize];
+	InitCustomSecret(seed, customSecret);
+	return Hash64Long(input, size, customSecret);
+}
+
+
+// ---------------------------------------------------------------------------
+// 128-bit variant
+// ---------------------------------------------------------------------------
+
+Uint128 Hash128Len1To3(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	const uint32_t combinedLow =
+		(static_cast<uint32_t>(input[0]) << 16)
+		| (static_cast<uint32_t>(input[size >> 1]) << 24)
+		| static_cast<uint32_t>(input[size - 1])
+		| static_cast<uint32_t>(size << 8);
+	const uint32_t combinedHigh = std::rotl(std::byteswap(combinedLow), 13);
+	const uint64_t bitflipLow = (Read32(secret) ^ Read32(secret + 4)) + seed;
+	const uint64_t bitflipHigh = (Read32(secret + 8) ^ Read32(secret + 12)) - seed;
+	return {
+		.low = XXH64Avalanche(combinedLow ^ bitflipLow),
+		.high = XXH64Avalanche(combinedHigh ^ bitflipHigh)
+	};
+}
+
+Uint128 Hash128Len4To8(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	seed ^= static_cast<uint64_t>(std::byteswap(static_cast<uint32_t>(seed))) << 32;
+	const uint64_t input64 = Read32(input) + (static_cast<uint64_t>(Read32(input + size - 4)) << 32);
+	const uint64_t bitflip = (Read64(secret + 16) ^ Read64(secret + 24)) + seed;
+
+	Uint128 product = Mul64To128(input64 ^ bitflip, k_prime64_1 + (size << 2));
+	product.high += product.low << 1;
+	product.low ^= product.high >> 3;
+	product.low ^= product.low >> 35;
+	product.low *= k_primeMx2;
+	product.low ^= product.low >> 28;
+	product.high = Avalanche(product.high);
+	return product;
+}
+
+Uint128 Hash128Len9To16(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	const uint64_t bitflipLow = (Read64(secret + 32) ^ Read64(secret + 40)) - seed;
+	const uint64_t bitflipHigh = (Read64(secret + 48) ^ Read64(secret + 56)) + seed;
+	const uint64_t inputLow = Read64(input);
+	uint64_t inputHigh = Read64(input + size - 8);
+
+	Uint128 product = Mul64To128(inputLow ^ inputHigh ^ bitflipLow, k_prime64_1);
+	product.low += static_cast<uint64_t>(size - 1) << 54;
+	inputHigh ^= bitflipHigh;
+	product.high += inputHigh + static_cast<uint64_t>(static_cast<uint32_t>(inputHigh)) * (k_prime32_2 - 1);
+	product.low ^= std::byteswap(product.high);
+
+	Uint128 result = Mul64To128(product.low, k_prime64_2);
+	result.high += product.high * k_prime64_2;
+	result.low = Avalanche(result.low);
+	result.high = Avalanche(result.high);
+	return result;
+}
+
+Uint128 Hash128Len0To16(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	if (size > 8)
+		return Hash128Len9To16(input, size, secret, seed);
+	else if (size >= 4)
+		return Hash128Len4To8(input, size, secret, seed);
+	else if (size > 0)
+		return Hash128Len1To3(input, size, secret, seed);
+	return {
+		.low = XXH64Avalanche(seed ^ Read64(secret + 64) ^ Read64(secret + 72)),
+		.high = XXH64Avalanche(seed ^ Read64(secret + 80) ^ Read64(secret + 88))
+	};
+}
+
+Uint128 FinalizeMidSize128(Uint128 acc, size_t size, uint64_t seed) noexcept
+{
+	return {
+		.low = Avalanche(acc.low + acc.high),
+		.high = 0 - Avalanche(acc.low * k_prime64_1 + acc.high * k_prime64_4 + (size - seed) * k_prime64_2)
+	};
+}
+
+Uint128 Hash128Len17To128(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	Uint128 acc{ .low = size * k_prime64_1, .high = 0 };
+	if (size > 32)
+	{
+		if (size > 64)
+		{
+			if (size > 96)
+				acc = Mix32B(acc, input + 48, input + size - 64, secret + 96, seed);
+			acc = Mix32B(acc, input + 32, input + size - 48, secret + 64, seed);
+		}
+		acc = Mix32B(acc, input + 16, input + size - 32, secret + 32, seed);
+	}
+	acc = Mix32B(acc, input, input + size - 16, secret, seed);
+	return FinalizeMidSize128(acc, size, seed);
+}
+
+Uint128 Hash128Len129To240(const uint8_t* input, size_t size, const uint8_t* secret, uint64_t seed) noexcept
+{
+	const size_t numRounds = size / 32;
+
+	Uint128 acc{ .low = size * k_prime64_1, .high = 0 };
+	for (size_t i = 0; i < 4; ++i)
+		acc = Mix32B(acc, input + 32 * i, input + 32 * i + 16, secret + 32 * i, seed);
+	acc.low = Avalanche(acc.low);
+	acc.high = Avalanche(acc.high);
+
+	for (size_t i = 4; i < numRounds; ++i)
+		acc = Mix32B(acc, input + 32 * i, input + 32 * i + 16, secret + k_midSizeStartOffset + 32 * (i - 4), seed);
+	acc = Mix32B(acc, input + size - 16, input + size - 32, secret + k_secretSizeMin - k_midSizeLastOffset - 16, 0 - seed);
+	return FinalizeMidSize128(acc, size, seed);
+}
+
+Uint128 Hash128Long(const uint8_t* input, size_t size, const uint8_t* secret) noexcept
+{
+	alignas(64) uint64_t acc[k_numOfAccs];
+	HashLongInternal(acc, input, size, secret);
+	return {
+		.low = MergeAccs(acc, secret + k_secretMergeAccsStart, size * k_prime64_1),
+		.high = MergeAccs(acc, secret + k_secretSize - k_stripeSize - k_secretMergeAccsStart, ~(size * k_prime64_2))
+	};
+}
+
+Uint128 Hash128(const uint8_t* input, size_t size, uint64_t seed) noexcept
+{
+	if (size <= 16)
+		return Hash128Len0To16(input, size, k_defaultSecret, seed);
+	else if (size <= 128)
+		return Hash128Len17To128(input, size, k_defaultSecret, seed);
+	else if (size <= k_midSizeMax)
+		return Hash128Len129To240(input, size, k_defaultSecret, seed);
+	else if (seed == 0)
+		return Hash128Long(input, size, k_defaultSecret);
+
+	alignas(64) uint8_t customSecret[k_secretSize];
+	InitCustomSecret(seed, customSecret);
+	return Hash128Long(input, size, customSecret);
+}
+
+
+// Canonical representation: big-endian, high half first.
+void ToCanonical(uint64_t value, gan::Hash<64>& out) noexcept
+{
+	Write64(out.data, std::byteswap(value));
+}
+
+void ToCanonical(Uint128 value, gan::Hash<128>& out) noexcept
+{
+	Write64(out.data, std::byteswap(value.high));
+	Write64(out.data + 8, std::byteswap(value.low));
+}
+
+
+}  // namespace xxh3
+
+
+// ---------------------------------------------------------------------------
+// SHA family through CNG. CNG dispatches to SHA-NI and AVX2 code paths on its
+// own when the CPU supports them, so there's no point in rolling our own.
+// ---------------------------------------------------------------------------
+
+namespace sha
+{
+
+
+template <unsigned int NumOfBits>
+consteval const wchar_t* GetAlgorithmName() noexcept
+{
+	if constexpr (NumOfBits == 160)
+		return BCRYPT_SHA1_ALGORITHM;
+	else if constexpr (NumOfBits == 256)
+		return BCRYPT_SHA256_ALGORITHM;
+	else
+	{
+		static_assert(NumOfBits == 512);
+		return BCRYPT_SHA512_ALGORITHM;
+	}
+}
+
+
+struct AlgorithmProvider
 {
-	using RawHandle = BCRYPT_HASH_HANDLE;
-	static void Close(RawHandle handle) noexcept { ::BCryptDestroyHash(handle); }
+	AutoBcryptAlgHandle handle;
+	uint32_t hashObjSize;
 };
-using AutoBcryptHashHandle = gan::AutoHandle<AutoBcryptHashHandleImpl>;
+
+
+// Opening an algorithm provider is much more expensive than hashing a page of data, so each
+// algorithm is opened once and shared. An algorithm handle is safe to be used by multiple threads.
+// A null handle means initialization failed.
+template <unsigned int NumOfBits>
+const AlgorithmProvider& GetProvider() noexcept
+{
+	const static AlgorithmProvider s_provider = [] {
+		AlgorithmProvider provider { };
+		ULONG numByteRead = 0;
+		const bool succeeded =
+			BCRYPT_SUCCESS(::BCryptOpenAlgorithmProvider(
+				&provider.handle.GetRef(),
+				GetAlgorithmName<NumOfBits>(),
+				nullptr,
+				0
+			))
+			&& BCRYPT_SUCCESS(::BCryptGetProperty(
+				*provider.handle,
+				BCRYPT_OBJECT_LENGTH,
+				reinterpret_cast<uint8_t*>(&provider.hashObjSize),
+				sizeof(provider.hashObjSize),
+				&numByteRead,
+				0
+			));
+		if (!succeeded)
+			provider.handle.Invalidate();
+		return provider;
+	}();
+	return s_provider;
+}
+
+
+// CNG functions report errors as NTSTATUS and don't necessarily set the last error code
+gan::WinErrorCode GetLastErrorOrFailure() noexcept
+{
+	const auto error = GetLastError();
+	return error != NO_ERROR ? error : ERROR_INTERNAL_ERROR;
+}
+
+
+}  // namespace sha
+
+
+// ---------------------------------------------------------------------------
+// CRC-32C (Castagnoli)
+// The SSE4.2 path is based on Mark Adler's crc32c.c which runs three
+// independent crc32 instruction streams to hide the instruction's 3-cycle
+// latency, then merges them with precomputed "append zeros" operators.
+// REF: https://stackoverflow.com/a/17646775
+// ---------------------------------------------------------------------------
+
+namespace crc32c
+{
+
+
+constexpr uint32_t k_polynomial = 0x82F6'3B78u;  // Reflected
+constexpr size_t k_longStreamSize = 8192;
+constexpr size_t k_shortStreamSize = 256;
+
+
+using ByteTable = uint32_t[256];
+
+
+struct SoftwareTables
+{
+	ByteTable slices[8];  // Slicing-by-8
+
+	SoftwareTables() noexcept
+	{
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t crc = n;
+			for (int k = 0; k < 8; ++k)
+				crc = crc & 1 ? (crc >> 1) ^ k_polynomial : crc >> 1;
+			slices[0][n] = crc;
+		}
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			uint32_t crc = slices[0][n];
+			for (size_t k = 1; k < 8; ++k)
+			{
+				crc = slices[0][crc & 0xFF] ^ (crc >> 8);
+				slices[k][n] = crc;
+			}
+		}
+	}
+};
+
+
+// Operator of appending a given number of zero bytes to a CRC, in the form of
+// four byte-indexed lookup tables.
+struct ShiftTable
+{
+	ByteTable bytes[4];
+
+	explicit ShiftTable(size_t numZeroBytes) noexcept
+	{
+		uint32_t op[32];
+		MakeZerosOperator(numZeroBytes, op);
+		for (uint32_t n = 0; n < 256; ++n)
+		{
+			bytes[0][n] = MultiplyMatrix(op, n);
+			bytes[1][n] = MultiplyMatrix(op, n << 8);
+			bytes[2][n] = MultiplyMatrix(op, n << 16);
+			bytes[3][n] = MultiplyMatrix(op, n << 24);
+		}
+	}
+
+	uint32_t Shift(uint32_t crc) const noexcept
+	{
+		return bytes[0][crc & 0xFF] ^ bytes[1][(crc >> 8) & 0xFF] ^ bytes[2][(crc >> 16) & 0xFF] ^ bytes[3][crc >> 24];
+	}
+
+private:
+	// Multiplication of a 32x32 matrix over GF(2) by a vector
+	static uint32_t MultiplyMatrix(const uint32_t* mat, uint32_t vec) noexcept
+	{
+		uint32_t sum = 0;
+		for (; vec; vec >>= 1, ++mat)
+		{
+			if (vec & 1)
+				sum ^= *mat;
+		}
+		return sum;
+	}
+
+	static void SquareMatrix(uint32_t* out, const uint32_t* mat) noexcept
+	{
+		for (size_t n = 0; n < 32; ++n)
+			out[n] = MultiplyMatrix(mat, mat[n]);
+	}
+
+	static void MakeZerosOperator(size_t numZeroBytes, uint32_t (&out)[32]) noexcept
+	{
+		// Operator for a single zero bit
+		uint32_t odd[32];
+		odd[0] = k_polynomial;
+		for (uint32_t n = 1, row = 1; n < 32; ++n, row <<= 1)
+			odd[n] = row;
+
+		SquareMatrix(out, odd);  // 2 zero bits
+		SquareMatrix(odd, out);  // 4 zero bits
+
+		// Keep squaring to 8, 16, 32... zero bits, while applying the ones needed by "numZeroBytes".
+		// Both stream sizes we use are powers of 2, so that's just squaring until reaching the count.
+		assert(std::has_single_bit(numZeroBytes));
+		while (true)
+		{
+			SquareMatrix(out, odd);
+			numZeroBytes >>= 1;
+			if (numZeroBytes == 0)
+				return;
+			SquareMatrix(odd, out);
+			numZeroBytes >>= 1;
+			if (numZeroBytes == 0)
+			{
+				std::copy_n(odd, 32, out);
+				return;
+			}
+		}
+	}
+};
+
+
+bool IsSse42Supported() noexcept
+{
+	const static bool s_supported = [] {
+		int cpuInfo[4] { };
+		__cpuid(cpuInfo, 1);
+		constexpr int k_sse42 = 1 << 20;
+		return (cpuInfo[2] & k_sse42) != 0;
+	}();
+	return s_supported;
+}
+
+
+uint32_t UpdateSoftware(uint32_t crc, const uint8_t* input, size_t size) noexcept
+{
+	const static SoftwareTables s_tables;
+	const auto& t = s_tables.slices;
+
+	crc = ~crc;
+	for (; size >= 8; size -= 8, input += 8)
+	{
+		const uint64_t word = xxh3::Read64(input) ^ crc;
+		crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+			^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+	}
+	for (; size > 0; --size, ++input)
+		crc = t[0][(crc ^ *input) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+
+// Native word for the crc32 instruction: 64-bit operand is amd64-only.
+#if defined _WIN64
+using CrcWord = uint64_t;
+inline uint32_t CrcStep(uint32_t crc, const uint8_t* input) noexcept
+{
+	return static_cast<uint32_t>(_mm_crc32_u64(crc, xxh3::Read64(input)));
+}
+#else
+using CrcWord = uint32_t;
+inline uint32_t CrcStep(uint32_t crc, const uint8_t* input) noexcept
+{
+	return _mm_crc32_u32(crc, xxh3::Read32(input));
+}
+#endif  // _WIN64
+
+
+// Runs three interleaved streams of "StreamSize" bytes each as long as the input is long enough.
+template <size_t StreamSize>
+uint32_t UpdateInterleaved(uint32_t crc, const uint8_t*& input, size_t& size) noexcept
+{
+	const static ShiftTable s_shift{ StreamSize };
+
+	for (; size >= StreamSize * 3; size -= StreamSize * 3, input += StreamSize * 3)
+	{
+		uint32_t crc1 = 0;
+		uint32_t crc2 = 0;
+		for (size_t offset = 0; offset < StreamSize; offset += sizeof(CrcWord))
+		{
+			crc = CrcStep(crc, input + offset);
+			crc1 = CrcStep(crc1, input + offset + StreamSize);
+			crc2 = CrcStep(crc2, input + offset + StreamSize * 2);
+		}
+		crc = s_shift.Shift(crc) ^ crc1;
+		crc = s_shift.Shift(crc) ^ crc2;
+	}
+	return crc;
+}
+
+
+uint32_t UpdateSse42(uint32_t crc, const uint8_t* input, size_t size) noexcept
+{
+	crc = ~crc;
+
+	// Align input so that all word-sized loads below are aligned
+	for (; size > 0 && (reinterpret_cast<uintptr_t>(input) & (sizeof(CrcWord) - 1)); --size, ++input)
+		crc = _mm_crc32_u8(crc, *input);
+
+	crc = UpdateInterleaved<k_longStreamSize>(crc, input, size);
+	crc = UpdateInterleaved<k_shortStreamSize>(crc, input, size);
+
+	for (; size >= sizeof(CrcWord); size -= sizeof(CrcWord), input += sizeof(CrcWord))
+		crc = CrcStep(crc, input);
+	for (; size > 0; --size, ++input)
+		crc = _mm_crc32_u8(crc, *input);
+
+	return ~crc;
+}
+
+
+}  // namespace crc32c
+
+
+// ---------------------------------------------------------------------------
+// Sequential file reading with two overlapped requests in flight: while the
+// caller consumes one chunk, the read of the next one is already going on.
+// ---------------------------------------------------------------------------
+
+namespace file
+{
+
+
+class ReadRequest
+{
+public:
+	ReadRequest(HANDLE hFile, uint8_t* buffer) noexcept
+		: m_hFile(hFile)
+		, m_overlapped()
+		, m_event(::CreateEventW(nullptr, TRUE, FALSE, nullptr))
+		, m_buffer(buffer)
+		, m_requestedSize(0)
+		, m_pending(false)
+	{ }
+
+	// The buffer must not be freed while the system may still write to it
+	~ReadRequest()
+	{
+		if (m_pending)
+		{
+			::CancelIoEx(m_hFile, &m_overlapped);
+			DWORD numRead = 0;
+			::GetOverlappedResult(m_hFile, &m_overlapped, &numRead, TRUE);
+		}
+	}
+
+	ReadRequest(const ReadRequest&) = delete;
+	ReadRequest& operator=(const ReadRequest&) = delete;
+
+	bool IsValid() const noexcept	{ return static_cast<bool>(m_event); }
+	bool IsPending() const noexcept	{ return m_pending; }
+	const uint8_t* GetBuffer() const noexcept	{ return m_buffer; }
+	DWORD GetRequestedSize() const noexcept		{ return m_requestedSize; }
+
+	gan::WinErrorCode Issue(uint64_t offset, DWORD size) noexcept
+	{
+		m_overlapped = { };
+		m_overlapped.Offset = static_cast<DWORD>(offset);
+		m_overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		m_overlapped.hEvent = *m_event;
+		m_requestedSize = size;
+
+		if (!::ReadFile(m_hFile, m_buffer, size, nullptr, &m_overlapped) && GetLastError() != ERROR_IO_PENDING)
+			return GetLastError();
+		m_pending = true;
+		return NO_ERROR;
+	}
+
+	// Returns the number of bytes read
+	std::expected<DWORD, gan::WinErrorCode> Wait() noexcept
+	{
+		m_pending = false;
+
+		DWORD numRead = 0;
+		if (!::GetOverlappedResult(m_hFile, &m_overlapped, &numRead, TRUE))
+		{
+			const auto error = GetLastError();
+			if (error != ERROR_HANDLE_EOF)
+				return std::unexpected(error);
+		}
+		return numRead;
+	}
+
+private:
+	HANDLE m_hFile;
+	OVERLAPPED m_overlapped;
+	gan::AutoWinHandle m_event;
+	uint8_t* m_buffer;
+	DWORD m_requestedSize;
+	bool m_pending;
+};
+
+
+// Calls "func" with each chunk of the file in order. "func" returns a Windows error code, and
+// anything other than NO_ERROR stops the reading.
+template <typename Func>
+gan::WinErrorCode ForEachChunk(HANDLE hFile, Func&& func)
+{
+	constexpr static DWORD k_chunkSize = 0x10'0000;
+
+	LARGE_INTEGER fileSize;
+	if (!::GetFileSizeEx(hFile, &fileSize))
+		return GetLastError();
+	const auto size = static_cast<uint64_t>(fileSize.QuadPart);
+
+	// Declared before the requests so that it outlives any read in flight
+	auto buffer = std::make_unique_for_overwrite<uint8_t[]>(k_chunkSize * 2);
+	ReadRequest requests[2] {
+		{ hFile, buffer.get() },
+		{ hFile, buffer.get() + k_chunkSize }
+	};
+	if (!requests[0].IsValid() || !requests[1].IsValid())
+		return GetLastError();
+
+	uint64_t nextOffset = 0;
+	auto issueNext = [&nextOffset, size](ReadRequest& request) -> gan::WinErrorCode {
+		if (nextOffset >= size)
+			return NO_ERROR;
+		const auto chunkSize = static_cast<DWORD>(std::min<uint64_t>(size - nextOffset, k_chunkSize));
+		const auto result = request.Issue(nextOffset, chunkSize);
+		nextOffset += chunkSize;
+		return result;
+	};
+
+	if (const auto result = issueNext(requests[0]); result != NO_ERROR)
+		return result;
+	for (size_t current = 0; requests[current].IsPending(); current ^= 1)
+	{
+		auto& request = requests[current];
+		const auto numRead = request.Wait();
+		if (!numRead)
+			return numRead.error();
+
+		// A short read means the file got truncated in the meantime. Stop after this chunk since
+		// any data further on doesn't follow it anymore.
+		const bool isTruncated = *numRead < request.GetRequestedSize();
+		if (!isTruncated)
+		{
+			if (const auto result = issueNext(requests[current ^ 1]); result != NO_ERROR)
+				return result;
+		}
+
+		if (const auto result = func(std::span{ request.GetBuffer(), *numRead }); result != NO_ERROR)
+			return result;
+		if (isTruncated)
+			break;
+	}
+	return NO_ERROR;
+}
+
+
+}  // namespace file
 
 
 }  // unnamed namespace
@@ -55,65 +1080,331 @@ namespace gan
 {
 
 
+WinErrorCode Hasher::GetSHA(ConstMemAddr dataAddr, size_t size, Hash<160>& out)
+{
+	ShaHasher<160> hasher;
+	hasher.Update(dataAddr, size);
+	return hasher.Finish(out);
+}
+
+
 WinErrorCode Hasher::GetSHA(ConstMemAddr dataAddr, size_t size, Hash<256>& out)
 {
-	AutoBcryptAlgHandle hProv{ };
-	AutoBcryptHashHandle hHash{ };
-
-	// Initialization of service provider
-	ULONG numByteRead = 0;
-	uint32_t hashObjSize = 1;
-	const bool initSucceeded =
-		BCRYPT_SUCCESS(::BCryptOpenAlgorithmProvider(
-			&hProv.GetRef(),
-			BCRYPT_SHA256_ALGORITHM,
-			nullptr,
-			0
-		))
-		&& BCRYPT_SUCCESS(::BCryptGetProperty(
-			*hProv,
-			BCRYPT_OBJECT_LENGTH,
-			reinterpret_cast<uint8_t*>(&hashObjSize),
-			sizeof(hashObjSize),
-			&numByteRead,
-			0
-		));
-
-	// Hash calculation
-	auto hashObj = std::make_unique<uint8_t[]>(hashObjSize);
-	Hash<256> hash { { 0 } };
-	const bool hashSucceeded =
-		initSucceeded
-		&& BCRYPT_SUCCESS(::BCryptCreateHash(
-			*hProv,
-			&hHash.GetRef(),
-			hashObj.get(),
-			hashObjSize,
-			nullptr,
-			0,
-			0
-		))
+	ShaHasher<256> hasher;
+	hasher.Update(dataAddr, size);
+	return hasher.Finish(out);
+}
+
+
+WinErrorCode Hasher::GetSHA(ConstMemAddr dataAddr, size_t size, Hash<512>& out)
+{
+	ShaHasher<512> hasher;
+	hasher.Update(dataAddr, size);
+	return hasher.Finish(out);
+}
+
+
+uint32_t Hasher::GetCRC32C(ConstMemAddr dataAddr, size_t size, uint32_t crc) noexcept
+{
+	const auto* input = dataAddr.ConstPtr<uint8_t>();
+	return crc32c::IsSse42Supported() ?
+		crc32c::UpdateSse42(crc, input, size) :
+		crc32c::UpdateSoftware(crc, input, size);
+}
+
+
+template <unsigned int NumOfBits>
+	requires IsXXH3Width<NumOfBits>
+void Hasher::GetXXH3(ConstMemAddr dataAddr, size_t size, Hash<NumOfBits>& out, uint64_t seed) noexcept
+{
+	const auto* input = dataAddr.ConstPtr<uint8_t>();
+	if constexpr (NumOfBits == 64)
+		xxh3::ToCanonical(xxh3::Hash64(input, size, seed), out);
+	else
+		xxh3::ToCanonical(xxh3::Hash128(input, size, seed), out);
+}
+
+template void Hasher::GetXXH3<64>(ConstMemAddr, size_t, Hash<64>&, uint64_t) noexcept;
+template void Hasher::GetXXH3<128>(ConstMemAddr, size_t, Hash<128>&, uint64_t) noexcept;
+
+
+template <unsigned int NumOfBits>
+	requires IsSHAWidth<NumOfBits> || IsXXH3Width<NumOfBits>
+WinErrorCode Hasher::HashFile(std::wstring_view path, Hash<NumOfBits>& out)
+{
+	AutoWinHandle hFile{ ::CreateFileW(
+		std::wstring{ path }.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,  // Sequential scan doubles the cache manager's read-ahead
+		nullptr
+	) };
+	if (!hFile)
+		return GetLastError();
+
+	if constexpr (IsXXH3Width<NumOfBits>)
+	{
+		XXH3Hasher<NumOfBits> hasher;
+		const auto result = file::ForEachChunk(*hFile, [&hasher](std::span<const uint8_t> chunk) -> WinErrorCode {
+			hasher.Update(ConstMemAddr{ chunk.data() }, chunk.size());
+			return NO_ERROR;
+		});
+		if (result != NO_ERROR)
+			return result;
+
+		out = hasher.Finish();
+		return NO_ERROR;
+	}
+	else
+	{
+		ShaHasher<NumOfBits> hasher;
+		const auto result = file::ForEachChunk(*hFile, [&hasher](std::span<const uint8_t> chunk) {
+			return hasher.Update(ConstMemAddr{ chunk.data() }, chunk.size());
+		});
+		if (result != NO_ERROR)
+			return result;
+
+		return hasher.Finish(out);
+	}
+}
+
+template WinErrorCode Hasher::HashFile<64>(std::wstring_view, Hash<64>&);
+template WinErrorCode Hasher::HashFile<128>(std::wstring_view, Hash<128>&);
+template WinErrorCode Hasher::HashFile<160>(std::wstring_view, Hash<160>&);
+template WinErrorCode Hasher::HashFile<256>(std::wstring_view, Hash<256>&);
+template WinErrorCode Hasher::HashFile<512>(std::wstring_view, Hash<512>&);
+
+
+// ---------------------------------------------------------------------------
+// Class ShaHasher
+// ---------------------------------------------------------------------------
+
+template <unsigned int NumOfBits>
+	requires IsSHAWidth<NumOfBits>
+ShaHasher<NumOfBits>::ShaHasher()
+	: m_hHash(nullptr)
+	, m_hashObj()
+	, m_lastError(NO_ERROR)
+{
+	const auto& provider = sha::GetProvider<NumOfBits>();
+	if (!provider.handle)
+	{
+		m_lastError = sha::GetLastErrorOrFailure();
+		return;
+	}
+
+	m_hashObj = std::make_unique_for_overwrite<uint8_t[]>(provider.hashObjSize);
+	BCRYPT_HASH_HANDLE hHash = nullptr;
+	if (!BCRYPT_SUCCESS(::BCryptCreateHash(
+		*provider.handle,
+		&hHash,
+		m_hashObj.get(),
+		provider.hashObjSize,
+		nullptr,
+		0,
+		BCRYPT_HASH_REUSABLE_FLAG  // BCryptFinishHash() resets the object rather than making it unusable
+	)))
+	{
+		m_lastError = sha::GetLastErrorOrFailure();
+		return;
+	}
+	m_hHash = hHash;
+}
+
+
+template <unsigned int NumOfBits>
+	requires IsSHAWidth<NumOfBits>
+ShaHasher<NumOfBits>::~ShaHasher()
+{
+	if (m_hHash)
+		::BCryptDestroyHash(m_hHash);
+}
+
+
+template <unsigned int NumOfBits>
+	requires IsSHAWidth<NumOfBits>
+WinErrorCode ShaHasher<NumOfBits>::Update(ConstMemAddr dataAddr, size_t size)
+{
+	// BCryptHashData() takes a 32-bit size. Feed larger buffers in pieces.
+	constexpr size_t k_maxChunkSize = 0x8000'0000;
+	for (size_t offset = 0; m_lastError == NO_ERROR && offset < size; offset += k_maxChunkSize)
+	{
 		// Win32 API bug: the 2nd param of BCryptHashData should be const as it's pure input
 		// REF: https://learn.microsoft.com/en-us/windows/win32/api/bcrypt/nf-bcrypt-bcrypthashdata
-		&& BCRYPT_SUCCESS(::BCryptHashData(
-			*hHash,
-			dataAddr.ConstCast().Ptr<uint8_t>(),
-			static_cast<ULONG>(size),
+		if (!BCRYPT_SUCCESS(::BCryptHashData(
+			m_hHash,
+			dataAddr.Offset(offset).ConstCast().Ptr<uint8_t>(),
+			static_cast<ULONG>(std::min(size - offset, k_maxChunkSize)),
 			0
-		))
-		&& BCRYPT_SUCCESS(::BCryptFinishHash(
-			*hHash,
-			reinterpret_cast<uint8_t*>(&hash.data),
-			sizeof(hash),
-			0
-		));
-	if (!hashSucceeded)
-		return GetLastError();
+		)))
+			m_lastError = sha::GetLastErrorOrFailure();
+	}
+	return m_lastError;
+}
+
+
+template <unsigned int NumOfBits>
+	requires IsSHAWidth<NumOfBits>
+WinErrorCode ShaHasher<NumOfBits>::Finish(Hash<NumOfBits>& out)
+{
+	if (m_lastError != NO_ERROR)
+		return m_lastError;
+
+	Hash<NumOfBits> hash;
+	if (!BCRYPT_SUCCESS(::BCryptFinishHash(
+		m_hHash,
+		hash.data,
+		sizeof(hash.data),
+		0
+	)))
+	{
+		m_lastError = sha::GetLastErrorOrFailure();
+		return m_lastError;
+	}
 
 	out = hash;
 	return NO_ERROR;
 }
 
+template class ShaHasher<160>;
+template class ShaHasher<256>;
+template class ShaHasher<512>;
+
+
+// ---------------------------------------------------------------------------
+// Class XXH3Hasher
+// ---------------------------------------------------------------------------
+
+template <unsigned int NumOfBits>
+	requires IsXXH3Width<NumOfBits>
+XXH3Hasher<NumOfBits>::XXH3Hasher(uint64_t seed) noexcept
+{
+	Reset(seed);
+}
+
+template <unsigned int NumOfBits>
+	requires IsXXH3Width<NumOfBits>
+void XXH3Hasher<NumOfBits>::Reset(uint64_t seed) noexcept
+{
+	static_assert(k_numOfAccs == xxh3::k_numOfAccs);
+	static_assert(k_secretSize == xxh3::k_secretSize);
+	static_assert(k_bufferSize % xxh3::k_stripeSize == 0);
+
+	std::copy_n(xxh3::k_initAcc, k_numOfAccs, m_acc);
+	if (seed == 0)
+		memcpy(m_secret, xxh3::k_defaultSecret, k_secretSize);
+	else
+		xxh3::InitCustomSecret(seed, m_secret);
+	m_totalSize = 0;
+	m_seed = seed;
+	m_bufferedSize = 0;
+	m_numStripesSoFar = 0;
+}
+
+template <unsigned int NumOfBits>
+	requires IsXXH3Width<NumOfBits>
+void XXH3Hasher<NumOfBits>::Update(ConstMemAddr dataAddr, size_t size) noexcept
+{
+	constexpr size_t k_numStripesPerBuffer = k_bufferSize / xxh3::k_stripeSize;
+
+	const auto* input = dataAddr.ConstPtr<uint8_t>();
+	m_totalSize += size;
+
+	// Keep buffering until there's more than a full buffer, so that Finish() always has
+	// at least one byte left to put in the last stripe.
+	if (m_bufferedSize + size <= k_bufferSize)
+	{
+		memcpy(m_buffer + m_bufferedSize, input, size);
+		m_bufferedSize += static_cast<uint32_t>(size);
+		return;
+	}
+
+	const auto& kernel = xxh3::GetLongKernel();
+	if (m_bufferedSize > 0)
+	{
+		const size_t sizeToFill = k_bufferSize - m_bufferedSize;
+		memcpy(m_buffer + m_bufferedSize, input, sizeToFill);
+		input += sizeToFill;
+		size -= sizeToFill;
+		xxh3::ConsumeStripes(kernel, m_acc, m_numStripesSoFar, m_buffer, k_numStripesPerBuffer, m_secret);
+		m_bufferedSize = 0;
+	}
+
+	// Consume directly from input without copying, as long as something remains afterwards.
+	if (size > k_bufferSize)
+	{
+		const size_t numStripes = (size - 1) / xxh3::k_stripeSize;
+		xxh3::ConsumeStripes(kernel, m_acc, m_numStripesSoFar, input, numStripes, m_secret);
+		input += numStripes * xxh3::k_stripeSize;
+		size -= numStripes * xxh3::k_stripeSize;
+
+		// Finish() may need the bytes right before the remaining ones to build the last stripe.
+		memcpy(m_buffer + k_bufferSize - xxh3::k_stripeSize, input - xxh3::k_stripeSize, xxh3::k_stripeSize);
+	}
+
+	memcpy(m_buffer, input, size);
+	m_bufferedSize = static_cast<uint32_t>(size);
+}
+
+template <unsigned int NumOfBits>
+	requires IsXXH3Width<NumOfBits>
+Hash<NumOfBits> XXH3Hasher<NumOfBits>::Finish() const noexcept
+{
+	Hash<NumOfBits> result;
+
+	if (m_totalSize <= xxh3::k_midSizeMax)
+	{
+		Hasher::GetXXH3(ConstMemAddr{ m_buffer }, static_cast<size_t>(m_totalSize), result, m_seed);
+		return result;
+	}
+
+	alignas(64) uint64_t acc[k_numOfAccs];
+	std::copy_n(m_acc, k_numOfAccs, acc);
+
+	const auto& kernel = xxh3::GetLongKernel();
+	const uint8_t* lastStripe;
+	alignas(64) uint8_t lastStripeBuffer[xxh3::k_stripeSize];
+	if (m_bufferedSize >= xxh3::k_stripeSize)
+	{
+		uint32_t numStripesSoFar = m_numStripesSoFar;
+		xxh3::ConsumeStripes(kernel, acc, numStripesSoFar, m_buffer, (m_bufferedSize - 1) / xxh3::k_stripeSize, m_secret);
+		lastStripe = m_buffer + m_bufferedSize - xxh3::k_stripeSize;
+	}
+	else
+	{
+		// The last stripe straddles the tail of the previously consumed data and the buffered bytes.
+		const size_t sizeFromPrev = xxh3::k_stripeSize - m_bufferedSize;
+		memcpy(lastStripeBuffer, m_buffer + k_bufferSize - sizeFromPrev, sizeFromPrev);
+		memcpy(lastStripeBuffer + sizeFromPrev, m_buffer, m_bufferedSize);
+		lastStripe = lastStripeBuffer;
+	}
+	kernel.accumulate(acc, lastStripe, m_secret + k_secretSize - xxh3::k_stripeSize - xxh3::k_secretLastAccStart, 1);
+
+	const auto* mergeSecret = m_secret + xxh3::k_secretMergeAccsStart;
+	if constexpr (NumOfBits == 64)
+	{
+		xxh3::ToCanonical(xxh3::MergeAccs(acc, mergeSecret, m_totalSize * xxh3::k_prime64_1), result);
+	}
+	else
+	{
+		const xxh3::Uint128 hash {
+			.low = xxh3::MergeAccs(acc, mergeSecret, m_totalSize * xxh3::k_prime64_1),
+			.high = xxh3::MergeAccs(
+				acc,
+				m_secret + k_secretSize - xxh3::k_stripeSize - xxh3::k_secretMergeAccsStart,
+				~(m_totalSize * xxh3::k_prime64_2)
+			)
+		};
+		xxh3::ToCanonical(hash, result);
+	}
+	return result;
+}
+
+template class XXH3Hasher<64>;
+template class XXH3Hasher<128>;
+
 
 }  // namespace gan
 
@@ -19,16 +19,29 @@
 #include <Hook.h>
 
 #include <InstructionDecoder.h>
+#include <PE.h>
 #include <Types.h>
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <bitset>
 #include <cassert>
+#include <deque>
+#include <execution>
+#include <expected>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <ranges>
+#include <set>
 #include <shared_mutex>
 #include <span>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 
@@ -62,11 +75,19 @@ struct PrologStrategy
 		RelNearJmp32,
 
 		// "mov rax, imm64" + "jmp rax"; amd64 only
-		AbsoluteJmp64
+		// Only used for auxiliary prologs. It overwrites too many instructions to be a
+		// hook prolog on its own.
+		AbsoluteJmp64,
+
+		// "0xE9 imm32"; relative jump; amd64 only
+		// Used when the hook function is too far away and there's no space for an
+		// auxiliary prolog. The jump goes to a "relay" allocated in a trampoline slot
+		// close to the original function, which then jumps to the hook function.
+		RelNearJmp32ToRelay
 	};
 
 	Type type { };
-	uint8_t imm8 { };  // optional; only valid when type=RelShortJmpToAux
+	int8_t imm8 { };  // optional; only valid when type=RelShortJmpToAux
 };
 
 
@@ -96,13 +117,262 @@ struct PrologWithDisp
 
 struct Trampoline
 {
-	constexpr static uint32_t k_size = 0x28;
+	constexpr static uint32_t k_size = 0x30;  // Large enough for a trampoline and for any stub, the largest of which is ProbeStub
 
 	uint8_t opcode[k_size] { };
 };
 
 
 
+// Shared by all instances of RetiredList. See Hook::SetGracePeriod().
+std::atomic<uint64_t> s_gracePeriodMs { 5000 };
+
+
+// ---------------------------------------------------------------------------
+// Class RetiredList: Code released while other threads may still be running
+//                    it, e.g. a relay which a thread has just jumped to, is
+//                    held back for a grace period before it's reused or
+//                    freed, and so are tables still being looked up.
+//                    Windows boosts threads which have been ready to run
+//                    for about four seconds, so only a thread suspended on
+//                    purpose stays in such code for longer. Hook functions
+//                    still running are the caller's concern.
+// ---------------------------------------------------------------------------
+
+template <class T>
+class RetiredList
+{
+public:
+	void Add(T item)	{ m_items.emplace_back(std::move(item), ::GetTickCount64()); }
+
+	// Hands over items retired at least a grace period ago to "reclaim", oldest first
+	template <class F>
+	void Reclaim(F&& reclaim)
+	{
+		const auto now = ::GetTickCount64();
+		const auto gracePeriodMs = s_gracePeriodMs.load(std::memory_order_relaxed);
+		while (!m_items.empty() && now - m_items.front().second >= gracePeriodMs)
+		{
+			reclaim(m_items.front().first);
+			m_items.pop_front();
+		}
+	}
+
+private:
+	std::deque<std::pair<T, uint64_t>> m_items;  // Paired with the tick count when retired, oldest first
+};
+
+
+// ---------------------------------------------------------------------------
+// Class TrampolineLookupTable: Maps hooked functions to their trampolines for
+//                              hook functions calling GetTrampoline(). Lookups
+//                              are wait-free. Modifications must be serialized
+//                              by the caller.
+// ---------------------------------------------------------------------------
+
+class TrampolineLookupTable
+{
+public:
+	gan::MemAddr Find(gan::MemAddr funcAddr) const noexcept
+	{
+		const Table* table = m_current.load(std::memory_order_acquire);
+		if (!table)
+			return gan::MemAddr{ nullptr };
+
+		// The table is never full, so there's always an empty slot to end the probing.
+		for (size_t i = GetHash(funcAddr); ; ++i)
+		{
+			const Slot& slot = table->slots[i & table->mask];
+			const auto key = slot.funcAddr.load(std::memory_order_acquire);
+			if (key == funcAddr.Ptr())
+				return gan::MemAddr{ slot.trampoline.load(std::memory_order_acquire) };
+			if (!key)
+				return gan::MemAddr{ nullptr };
+		}
+	}
+
+	void Insert(gan::MemAddr funcAddr, gan::MemAddr trampolineAddr)
+	{
+		m_retired.Reclaim([](const std::unique_ptr<Table>&) { });  // Freed as they're dropped from the list
+
+		// A function hooked before still has its key, so only new ones can make the table too full.
+		Slot* slot = m_table ? &FindSlot(*m_table, funcAddr) : nullptr;
+		if (!slot || (!slot->funcAddr.load(std::memory_order_relaxed) && (m_table->numKeys + 1) * 2 > m_table->mask + 1))
+			slot = &FindSlot(Rebuild(), funcAddr);
+
+		if (!slot->funcAddr.load(std::memory_order_relaxed))
+		{
+			// The trampoline must be in place before readers can see the key.
+			slot->trampoline.store(trampolineAddr.Ptr(), std::memory_order_relaxed);
+			slot->funcAddr.store(funcAddr.Ptr(), std::memory_order_release);
+			++m_table->numKeys;
+		}
+		else
+			slot->trampoline.store(trampolineAddr.Ptr(), std::memory_order_release);
+	}
+
+	// Keys are never removed, or probing from other keys could stop early. The slot
+	// is reused if the same function gets hooked again.
+	void Remove(gan::MemAddr funcAddr) noexcept
+	{
+		m_retired.Reclaim([](const std::unique_ptr<Table>&) { });
+		if (!m_table)
+			return;
+
+		Slot& slot = FindSlot(*m_table, funcAddr);
+		if (slot.funcAddr.load(std::memory_order_relaxed))
+			slot.trampoline.store(nullptr, std::memory_order_release);
+	}
+
+private:
+	constexpr static size_t k_minCapacity = 64;
+
+	struct Slot
+	{
+		std::atomic<void*> funcAddr { nullptr };
+		std::atomic<void*> trampoline { nullptr };
+	};
+
+	struct Table
+	{
+		explicit Table(size_t capacity)
+			: slots(std::make_unique<Slot[]>(capacity))
+			, mask(capacity - 1)
+			, numKeys(0)
+		{ }
+
+		std::unique_ptr<Slot[]> slots;
+		size_t mask;
+		size_t numKeys;  // including those removed
+	};
+
+	// Fibonacci hashing. Function addresses are often aligned, so their low bits alone are poor hashes.
+	static size_t GetHash(gan::MemAddr funcAddr) noexcept
+	{
+		constexpr size_t k_multiplier = gan::Is64() ? 0x9E37'79B9'7F4A'7C15ull : 0x9E37'79B9u;
+		constexpr int k_shift = sizeof(size_t) * 4;
+		const auto hash = reinterpret_cast<size_t>(funcAddr.Ptr()) * k_multiplier;
+		return hash >> k_shift;
+	}
+
+	// Returns either the slot with "funcAddr" or the empty slot where it should go.
+	static Slot& FindSlot(Table& table, gan::MemAddr funcAddr) noexcept
+	{
+		for (size_t i = GetHash(funcAddr); ; ++i)
+		{
+			Slot& slot = table.slots[i & table.mask];
+			const auto key = slot.funcAddr.load(std::memory_order_relaxed);
+			if (!key || key == funcAddr.Ptr())
+				return slot;
+		}
+	}
+
+	// Copies live entries to a new table and publishes it. Keys of removed functions are left behind,
+	// so a table filled by them is rebuilt at the same capacity. Readers may still be walking the old
+	// table, which is freed after a grace period like retired code.
+	Table& Rebuild()
+	{
+		std::vector<std::pair<void*, void*>> entries;
+		if (m_table)
+		{
+			const Table& oldTable = *m_table;
+			for (auto i : std::views::iota(0uz, oldTable.mask + 1))
+			{
+				const Slot& slot = oldTable.slots[i];
+				if (void* trampoline = slot.trampoline.load(std::memory_order_relaxed))
+					entries.emplace_back(slot.funcAddr.load(std::memory_order_relaxed), trampoline);
+			}
+		}
+
+		const size_t capacity = std::bit_ceil(std::max(k_minCapacity, (entries.size() + 1) * 4));
+		auto newTable = std::make_unique<Table>(capacity);
+		Table& table = *newTable;
+		for (const auto& [funcAddr, trampoline] : entries)
+		{
+			Slot& slot = FindSlot(table, gan::MemAddr{ funcAddr });
+			slot.funcAddr.store(funcAddr, std::memory_order_relaxed);
+			slot.trampoline.store(trampoline, std::memory_order_relaxed);
+		}
+		table.numKeys = entries.size();
+
+		m_current.store(&table, std::memory_order_release);
+		if (m_table)
+			m_retired.Add(std::move(m_table));
+		m_table = std::move(newTable);
+		return table;
+	}
+
+	std::atomic<const Table*> m_current { nullptr };
+	std::unique_ptr<Table> m_table;  // Owns the one in m_current
+	RetiredList<std::unique_ptr<Table>> m_retired;  // Replaced tables which readers may still be walking
+};
+
+
+// ---------------------------------------------------------------------------
+// Class StripedLocks: Mutexes shared by addresses hashing to the same
+//                     stripe. A set of addresses is locked at once in the
+//                     order of stripes, so that holders of overlapping sets
+//                     can't deadlock.
+// ---------------------------------------------------------------------------
+
+class StripedLocks
+{
+public:
+	constexpr static uint32_t k_numStripeBits = 6;
+	constexpr static size_t k_numStripes = size_t{ 1 } << k_numStripeBits;
+	using StripeSet = std::bitset<k_numStripes>;
+
+	// Unlocks the stripes when destroyed
+	class Guard
+	{
+	public:
+		Guard(StripedLocks& owner, StripeSet stripes) noexcept
+			: m_owner(owner)
+			, m_stripes(stripes)
+		{ }
+
+		~Guard()
+		{
+			for (auto i : std::views::iota(0uz, k_numStripes))
+			{
+				if (m_stripes[i])
+					m_owner.m_mutexes[i].unlock();
+			}
+		}
+
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+
+	private:
+		StripedLocks& m_owner;
+		const StripeSet m_stripes;
+	};
+
+	[[nodiscard]] Guard Lock(std::span<const gan::MemAddr> addrs)
+	{
+		StripeSet stripes;
+		for (const auto addr : addrs)
+			stripes.set(GetStripe(addr));
+		for (auto i : std::views::iota(0uz, k_numStripes))
+		{
+			if (stripes[i])
+				m_mutexes[i].lock();
+		}
+		return Guard{ *this, stripes };
+	}
+
+private:
+	// Fibonacci hashing, as page-aligned addresses have many trailing zeros
+	static size_t GetStripe(gan::MemAddr addr) noexcept
+	{
+		const auto value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(addr.ConstPtr()));
+		return static_cast<size_t>((value * 0x9E37'79B9'7F4A'7C15ull) >> (64 - k_numStripeBits));
+	}
+
+	std::mutex m_mutexes[k_numStripes];
+};
+
+
 // ---------------------------------------------------------------------------
 // Class HookRegistry: bookkeeping installed hooks. See struct
 // HookRegistry::Record for what's being stored.
@@ -115,34 +385,58 @@ class HookRegistry : public gan::Singleton<HookRegistry>
 public:
 	struct Record
 	{
+		struct Layer
+		{
+			gan::MemAddr hookFunc;
+			gan::MemAddr link;  // LayerLink to the next layer, or to the trampoline from the last one
+		};
+
 		Prolog original;
 		Prolog modified;
 		gan::MemAddr trampoline;
+		gan::MemAddr relay;  // nullptr unless strategy is RelNearJmp32ToRelay or the hook is toggleable or layered
 		PrologStrategy strategy;
+		std::vector<Layer> layers;  // Only for layered hooks, from the outermost one. "relay" links to the first.
 
 		bool IsValid() const noexcept	{ return static_cast<bool>(trampoline); }
 		operator bool() const noexcept	{ return IsValid(); }
 	};
 
-	bool Register(gan::MemAddr funcAddr, const Record& record)
+	// All or nothing. Records must be valid and their modified prologs must not overlap existing ones or each
+	// other. On failure, returns the position of the first record which can't be registered.
+	std::expected<void, size_t> RegisterBatch(std::span<const std::pair<gan::MemAddr, Record>> records)
 	{
 		std::unique_lock lock(m_mutex);
 
-		if (!record  // Record must be valid.
-			|| m_records.find(funcAddr) != m_records.end())  // Address already exists.
+		for (auto i : std::views::iota(0uz, records.size()))
 		{
-			return false;
+			const auto& [funcAddr, record] = records[i];
+			if (!record || Overlaps(funcAddr, record.modified.length))
+			{
+				for (const auto& [addedAddr, addedRecord] : records.first(i))
+				{
+					m_records.erase(addedAddr);
+					m_trampolines.Remove(addedAddr);
+				}
+				return std::unexpected{ i };
+			}
+			m_records.emplace(funcAddr, record);
+			m_trampolines.Insert(funcAddr, record.trampoline);
 		}
-		m_records.emplace(funcAddr, record);
-		return true;
+		return { };
 	}
 
-	gan::ConstMemAddr GetTrampoline(gan::MemAddr funcAddr) const
+	// Serializes transactions touching any of "funcAddrs", while those on other targets go on in parallel.
+	// Must be held from before the registry is first looked up until the transaction is done.
+	[[nodiscard]] StripedLocks::Guard LockTargets(std::span<const gan::MemAddr> funcAddrs)
 	{
-		std::shared_lock lock(m_mutex);
+		return m_targetLocks.Lock(funcAddrs);
+	}
 
-		const auto record = LookUp(funcAddr);
-		return gan::ConstMemAddr{ record ? record->trampoline.Ptr() : nullptr };
+	// Called by hook functions on every call. Doesn't lock.
+	gan::ConstMemAddr GetTrampoline(gan::MemAddr funcAddr) const noexcept
+	{
+		return gan::ConstMemAddr{ m_trampolines.Find(funcAddr).Ptr() };
 	}
 
 	std::optional<Record> LookUp(const gan::MemAddr funcAddr) const
@@ -155,219 +449,555 @@ public:
 			std::nullopt;
 	}
 
-	std::optional<Record> Unregister(const gan::MemAddr funcAddr)
+	// The record of "funcAddr" must exist.
+	void SetLayers(gan::MemAddr funcAddr, std::vector<Record::Layer> layers)
 	{
 		std::unique_lock lock(m_mutex);
 
-		const auto& itr = m_records.find(funcAddr);
-		if (itr != m_records.end())
+		const auto itr = m_records.find(funcAddr);
+		assert(itr != m_records.end());
+		itr->second.layers = std::move(layers);
+	}
+
+	void UnregisterBatch(std::span<const gan::MemAddr> funcAddrs)
+	{
+		std::unique_lock lock(m_mutex);
+
+		for (const auto funcAddr : funcAddrs)
 		{
-			auto unregisteredRecord = itr->second;
-			m_records.erase(itr);
-			return unregisteredRecord;
+			m_records.erase(funcAddr);
+			m_trampolines.Remove(funcAddr);
 		}
-		return std::nullopt;
 	}
 
 private:
 	HookRegistry() = default;
 
-	std::unordered_map<gan::MemAddr, Record> m_records;
+	// Whether [addr, addr + length) shares any byte with a registered prolog. Probes make it possible
+	// for a prolog to start in the middle of another. Must be called with the lock held.
+	bool Overlaps(gan::MemAddr addr, uint8_t length) const noexcept
+	{
+		const auto next = m_records.lower_bound(addr);
+		if (next != m_records.end() && next->first < addr.Offset(std::max<uint8_t>(length, 1)))
+			return true;
+		if (next == m_records.begin())
+			return false;
+		const auto& [prevAddr, prevRecord] = *std::prev(next);
+		return prevAddr.Offset(prevRecord.modified.length) > addr;
+	}
+
+	std::map<gan::MemAddr, Record> m_records;  // Ordered for Overlaps()
+	TrampolineLookupTable m_trampolines;
+	StripedLocks m_targetLocks;
 
-	// Although Gandr doesn't support multi-threaded hook installation/uninstallation,
-	// it still needs to support situations where one thread is calling a hooked function
-	// and potentially looking up address to its trampoline while another thread making
-	// modifications to the hook registry.
+	// Guards the records themselves. Transactions on different targets may run at the same time, and
+	// registering also checks for overlaps under this lock, so that two of them can't both claim the same
+	// bytes. Hook functions look up trampolines through m_trampolines without taking this lock.
 	mutable std::shared_mutex m_mutex;
 };
 
 
 // ---------------------------------------------------------------------------
-// Class TrampolineRegistry: managing memory pages for trampoline storage
+// Class AddressRangeSet: A set of disjoint address ranges. Adjacent ranges are
+//                        merged.
 // ---------------------------------------------------------------------------
 
-class TrampolineRegistry : public gan::Singleton<TrampolineRegistry>
+class AddressRangeSet
 {
-	friend class gan::Singleton<TrampolineRegistry>;
-
 public:
-	constexpr static auto k_trampolineSize = Trampoline::k_size;
-
-	// Try allocating a trampoline within the range of 32-bit offset from "desiredAddress".
-	gan::MemAddr Register(const Trampoline& trampoline, gan::MemRange desiredAddrRange)
+	void Add(gan::MemAddr begin, gan::MemAddr end)
 	{
-		std::unique_lock lock(m_mutex);
-
-		const auto pageIndex =
-			FindRelevantPageInRange(desiredAddrRange)
-			.or_else([this, desiredAddrRange] { return std::make_optional(AddNewPage(desiredAddrRange)); })
-			.value();
-		assert(m_freeLists[pageIndex].size() > 0);
+		assert(begin < end);
 
-		// get a free slot
-		const FreeSlot slot = m_freeLists[pageIndex].back();
-		m_freeLists[pageIndex].pop_back();
+		// Ranges overlapping with the new one are merged into it along with adjacent ones.
+		Remove(begin, end);
+		if (const auto next = m_ranges.find(end); next != m_ranges.end())
+		{
+			end = next->second;
+			m_ranges.erase(next);
+		}
+		if (auto prev = m_ranges.lower_bound(begin); prev != m_ranges.begin() && (--prev)->second == begin)
+		{
+			begin = prev->first;
+			m_ranges.erase(prev);
+		}
+		m_ranges.emplace(begin, end);
+	}
 
-		auto trampolineAddr = m_pages[pageIndex].Offset(slot.pageOffset);
-		memcpy(trampolineAddr.Ptr<uint8_t>(), trampoline.opcode, k_trampolineSize);
+	void Remove(gan::MemAddr begin, gan::MemAddr end)
+	{
+		// Cut [begin, end) out of every range overlapping with it.
+		auto itr = m_ranges.upper_bound(begin);
+		if (itr != m_ranges.begin())
+			--itr;
+		while (itr != m_ranges.end() && itr->first < end)
+		{
+			const auto [rangeBegin, rangeEnd] = *itr;
+			if (rangeEnd <= begin)
+			{
+				++itr;
+				continue;
+			}
 
-		assert(m_records.find(trampolineAddr) == m_records.end());
-		m_records.try_emplace(trampolineAddr, pageIndex);
+			itr = m_ranges.erase(itr);
+			if (rangeBegin < begin)
+				m_ranges.emplace(rangeBegin, begin);
+			if (end < rangeEnd)
+				itr = m_ranges.emplace(end, rangeEnd).first;
+		}
+	}
 
-		return trampolineAddr;
+	// Returns the lowest address within "bounds" where "size" bytes are in the set, or nullptr if there's none.
+	gan::MemAddr FindFirstFit(gan::MemRange bounds, size_t size) const
+	{
+		// Start from the last range beginning at or below bounds.min, which may still extend into bounds.
+		auto itr = m_ranges.upper_bound(bounds.min);
+		if (itr != m_ranges.begin())
+			--itr;
+		for ( ; itr != m_ranges.end() && itr->first < bounds.max; ++itr)
+		{
+			const auto addr = std::max(itr->first, bounds.min);
+			const auto end = std::min(itr->second, bounds.max);
+			if (addr < end && static_cast<size_t>(end - addr) >= size)
+				return addr;
+		}
+		return gan::MemAddr{ nullptr };
 	}
 
-	void Unregister(gan::MemAddr addr)
+	// Returns the address nearest to "origin" where "size" bytes are in the set, or nullptr if there's none.
+	// The address returned is within "bounds", but the bytes following it don't have to be. "origin" must be
+	// within "bounds".
+	gan::MemAddr FindNearestFit(gan::MemAddr origin, gan::MemRange bounds, size_t size) const
 	{
-		std::unique_lock lock(m_mutex);
+		assert(bounds.min <= origin && origin < bounds.max);
 
-		const auto& itr = m_records.find(addr);
-		if (itr == m_records.end())
-			return;
+		const auto isFit = [&bounds, size](gan::MemAddr addr, gan::MemAddr rangeBegin, gan::MemAddr rangeEnd) noexcept {
+			return addr >= rangeBegin && addr >= bounds.min && addr < bounds.max
+				&& rangeEnd - addr >= static_cast<ptrdiff_t>(size);
+		};
+
+		// The first fit going up is the start of a range.
+		const auto next = m_ranges.upper_bound(origin);
+		gan::MemAddr forward{ nullptr };
+		for (auto itr = next; itr != m_ranges.end() && itr->first < bounds.max; ++itr)
+		{
+			if (isFit(itr->first, itr->first, itr->second))
+			{
+				forward = itr->first;
+				break;
+			}
+		}
+
+		// The first fit going down is as close to the end of a range as possible.
+		gan::MemAddr backward{ nullptr };
+		for (auto itr = next; itr != m_ranges.begin(); )
+		{
+			--itr;
+			if (itr->second <= bounds.min)
+				break;
+
+			const auto addr = std::min(origin, itr->second.Offset(-static_cast<intptr_t>(size)));
+			if (isFit(addr, itr->first, itr->second))
+			{
+				backward = addr;
+				break;
+			}
+		}
 
-		const auto pageIndex = itr->second;
-		const auto offset = static_cast<uint32_t>(addr - m_pages[pageIndex]);  // negative offset will be treated as a big, positve offset
-		assert(offset <= m_allocGranularity - k_trampolineSize);
-		m_freeLists[pageIndex].emplace_back(offset);
-		m_records.erase(itr);
+		if (!forward || (backward && origin - backward <= forward - origin))
+			return backward;
+		return forward;
 	}
 
+	void Clear() noexcept	{ m_ranges.clear(); }
+
 private:
-	TrampolineRegistry()
-		: m_records()
-		, m_pages()
-		, m_freeLists()
-		, m_allocGranularity(GetAllocGranularity())
-		, m_mutex()
+	std::map<gan::MemAddr, gan::MemAddr> m_ranges;  // Mapping the beginning of each range to its end
+};
+
+
+// ---------------------------------------------------------------------------
+// Class FreeRegionCache: Free regions of the address space, aligned with the
+//                        allocation granularity. It's populated with one walk
+//                        through the address space and then kept up to date
+//                        by the caller reporting what it allocates and frees.
+//                        Allocations made elsewhere in the process make it
+//                        stale, which the caller finds out when allocating
+//                        at a cached address fails, and then only the range
+//                        being allocated in is walked through again.
+// ---------------------------------------------------------------------------
+
+class FreeRegionCache
+{
+public:
+	explicit FreeRegionCache(uint32_t granularity) noexcept
+		: m_regions()
+		, m_addressSpace(GetAddressSpace())
+		, m_granularity(granularity)
+		, m_populated(false)
 	{ }
 
-	static int GetAllocGranularity() noexcept
+	// Returns a granularity-aligned address at which "size" bytes are free and within "range", or nullptr
+	// if there's none. "range" must be aligned with the granularity.
+	gan::MemAddr Find(gan::MemRange range, size_t size)
 	{
-		SYSTEM_INFO sysInfo;
-		::GetSystemInfo(&sysInfo);
-		return sysInfo.dwAllocationGranularity;
+		if (!m_populated)
+		{
+			Scan(m_addressSpace);
+			m_populated = true;
+		}
+		return m_regions.FindFirstFit(range, size);
 	}
 
-	// Assumes that "desiredAddrRange" is aligned with the result from GetAllocGranularity()
-	static gan::MemAddr FindPageForAlloc(gan::MemRange desiredAddrRange) noexcept
+	void MarkUsed(gan::MemAddr addr, size_t size)
 	{
-		if constexpr (gan::Is64())
-		{
-			const auto allocGranularity = GetAllocGranularity();
-			const auto addrToFindStart = desiredAddrRange.min;
-			const auto addrToFindEnd = desiredAddrRange.max.Offset(-allocGranularity);
-
-			// Iterate through pages until hitting one with the MEM_FREE state.
-			for (auto addr = addrToFindStart; addr < addrToFindEnd; )
-			{
-				MEMORY_BASIC_INFORMATION memInfo{ };
-				const auto result = ::VirtualQuery(addr.ConstPtr<uint8_t>(), &memInfo, sizeof(memInfo));
-				if (result == 0)
-				{
-					// VirtualQuery failed with the address passed in
-					addr = addr.Offset(allocGranularity);
-					continue;
-				}
-
-				if (memInfo.State == MEM_FREE)
-				{
-					return addr;
-				}
-				else
-				{
-					const auto offset = AlignMemAddrWithGranularity(memInfo.RegionSize, allocGranularity);
-					addr = gan::MemAddr{ memInfo.BaseAddress }.Offset(offset);
-				}
-			}
-			return gan::MemAddr{ nullptr };  // Not found
-		}
-		else
-			return gan::MemAddr{ nullptr };  // Don't care in 32 bit
+		m_regions.Remove(addr, addr.Offset(static_cast<intptr_t>(size)));
 	}
 
-	static size_t GenerateMaskFromGranularity(uint32_t granularity) noexcept
+	void MarkFree(gan::MemAddr addr, size_t size)
 	{
-		const auto tzcnt = _tzcnt_u32(granularity);
-		assert(_lzcnt_u32(granularity) + tzcnt == 31);  // "granularity" must a power of 2.
-		return std::numeric_limits<size_t>::max() << tzcnt;
+		m_regions.Add(addr, addr.Offset(static_cast<intptr_t>(size)));
 	}
 
-	static size_t AlignMemAddrWithGranularity(const size_t addr, uint32_t granularity) noexcept
+	// Walks through "range" again, leaving what's cached about the rest as it is. "range" must be aligned
+	// with the granularity.
+	void Refresh(gan::MemRange range)
 	{
-		const auto offsetMask = GenerateMaskFromGranularity(granularity);
-		return (addr & offsetMask) + (addr & ~offsetMask ? granularity : 0);
+		if (!m_populated)
+			return;  // Find() walks through everything anyway.
+
+		m_regions.Remove(range.min, range.max);
+		Scan(range);
 	}
 
-	static gan::MemRange AlignMemRangeWithGranularity(gan::MemRange memRange, uint32_t granularity) noexcept
+private:
+	static gan::MemRange GetAddressSpace() noexcept
 	{
-		const auto offsetMask = GenerateMaskFromGranularity(granularity);
-		const auto rangeMin = memRange.min;
-		const auto rangeMax = memRange.max;
-		return {
-			.min = (rangeMin & offsetMask).Offset(rangeMin & ~offsetMask ? granularity : 0),
-			.max = (rangeMax & offsetMask)  // Not to return an address higher than memRange.max
-		};
+		SYSTEM_INFO sysInfo;
+		::GetSystemInfo(&sysInfo);
+		return { gan::MemAddr{ sysInfo.lpMinimumApplicationAddress }, gan::MemAddr{ sysInfo.lpMaximumApplicationAddress } };
 	}
 
-	// Assumes that caller has already obtained a lock
-	std::optional<size_t> FindRelevantPageInRange(gan::MemRange desiredAddrRange) const noexcept
+	void Scan(gan::MemRange range)
 	{
-		for (auto i : std::views::iota(0uz, m_pages.size()))
+		const auto mask = ~(static_cast<size_t>(m_granularity) - 1);
+
+		range = { std::max(range.min, m_addressSpace.min), std::min(range.max, m_addressSpace.max) };
+		gan::MemAddr addr = range.min;
+		while (addr < range.max)
 		{
-			if (!m_freeLists[i].empty()
-				&& (!gan::Is64() || desiredAddrRange.InRange(m_pages[i])))  // This condition is short-circuited for x86
+			MEMORY_BASIC_INFORMATION memInfo{ };
+			if (::VirtualQuery(addr.ConstPtr<uint8_t>(), &memInfo, sizeof(memInfo)) == 0)
+				break;
+
+			// The region may begin below "range" and end beyond it.
+			const auto regionBegin = std::max(gan::MemAddr{ memInfo.BaseAddress }, range.min);
+			const auto regionEnd = std::min(gan::MemAddr{ memInfo.BaseAddress }.Offset(static_cast<intptr_t>(memInfo.RegionSize)), range.max);
+			if (memInfo.State == MEM_FREE)
 			{
-				return i;
+				// Only whole allocation units can be allocated.
+				const auto alignedBegin = regionBegin.Offset(static_cast<intptr_t>(m_granularity) - 1) & mask;
+				const auto alignedEnd = regionEnd & mask;
+				if (alignedBegin < alignedEnd)
+					m_regions.Add(alignedBegin, alignedEnd);
 			}
+			addr = regionEnd;
 		}
-		return std::nullopt;
 	}
 
-	// Assume: caller has already obtained a lock
-	size_t AddNewPage(gan::MemRange desiredAddrRange)
-	{
-		const gan::MemRange fixedAddrRange = AlignMemRangeWithGranularity(desiredAddrRange, m_allocGranularity);
+	AddressRangeSet m_regions;
+	gan::MemRange m_addressSpace;
+	uint32_t m_granularity;
+	bool m_populated;
+};
 
-		const auto desiredAddress{ FindPageForAlloc(fixedAddrRange) };
-		gan::MemAddr newPageAddr{ ::VirtualAlloc(
-			desiredAddress.Ptr<uint8_t>(),
-			m_allocGranularity,
-			MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE
-		) };
-		assert(newPageAddr);
 
-		m_pages.emplace_back(newPageAddr);
+// ---------------------------------------------------------------------------
+// Class TrampolineRegistry: managing memory pages for trampoline storage.
+//                           Pages are indexed by address so that one with a
+//                           free slot within a given range is found in
+//                           O(log n), and each page tracks its free slots
+//                           in a bitmap. Unregistered trampolines are only
+//                           reused after a grace period, and pages with no
+//                           trampoline left are released then.
+// ---------------------------------------------------------------------------
 
-		// Generate free list
-		const auto numTrampolinesPerPage = m_allocGranularity / k_trampolineSize;
-		m_freeLists.emplace_back(
-			std::views::iota(0u, numTrampolinesPerPage)
-			| std::views::transform([](auto idx) { return FreeSlot{ idx * k_trampolineSize }; })
-			| std::ranges::to<FreeList>()
-		);
+class TrampolineRegistry : public gan::Singleton<TrampolineRegistry>
+{
+	friend class gan::Singleton<TrampolineRegistry>;
+
+public:
+	constexpr static auto k_trampolineSize = Trampoline::k_size;
+
+	// All or nothing. Each trampoline is allocated within its corresponding range in "desiredAddrRanges",
+	// which is where the 32-bit displacements in the trampoline are addressable.
+	// On failure, returns the position of the first trampoline which can't be allocated.
+	std::expected<std::vector<gan::MemAddr>, size_t> RegisterBatch(std::span<const Trampoline> trampolines, std::span<const gan::MemRange> desiredAddrRanges)
+	{
+		assert(trampolines.size() == desiredAddrRanges.size());
+
+		std::vector<gan::MemAddr> trampolineAddrs;
+		trampolineAddrs.reserve(trampolines.size());
 
-		return m_pages.size() - 1uz;
+		std::unique_lock lock(m_mutex);
+		ReclaimWithLock();
+		for (auto i : std::views::iota(0uz, trampolines.size()))
+		{
+			const auto trampolineAddr = RegisterWithLock(trampolines[i], desiredAddrRanges[i]);
+			if (!trampolineAddr)
+			{
+				// Nobody has seen these yet, so there's no need to wait.
+				for (const auto addr : trampolineAddrs)
+					ReleaseWithLock(addr);
+				return std::unexpected{ i };
+			}
+			trampolineAddrs.emplace_back(trampolineAddr);
+		}
+		return trampolineAddrs;
 	}
 
+	// Other threads may still be running the trampolines, so they're retired rather than released.
+	void UnregisterBatch(std::span<const gan::MemAddr> addrs)
+	{
+		std::unique_lock lock(m_mutex);
+		for (const auto addr : addrs)
+			m_retired.Add(addr);
+		ReclaimWithLock();
+	}
 
-	struct FreeSlot
+private:
+	// Free slots of a page. A set bit means the slot is free.
+	class SlotBitmap
 	{
-		uint32_t pageOffset;
-	};
-	using FreeList = std::vector<FreeSlot>;
+	public:
+		explicit SlotBitmap(uint32_t numSlots)
+			: m_words((numSlots + k_bitsPerWord - 1) / k_bitsPerWord, ~uint64_t{ 0 })
+			, m_numFree(numSlots)
+			, m_numSlots(numSlots)
+		{
+			// Clear the bits past the last slot.
+			if (const auto numTailBits = numSlots % k_bitsPerWord)
+				m_words.back() = (uint64_t{ 1 } << numTailBits) - 1;
+		}
 
-	// Each page in "m_pages" is of the size of "m_allocGranularity" bytes
-	std::unordered_map<gan::MemAddr, size_t> m_records;  // Mapping address to page index
-	std::vector<gan::MemAddr> m_pages;  // Base addresses of pages
-	std::vector<FreeList> m_freeLists;  // Shared index with "m_pages"
+		// Assumes that there's at least one free slot
+		uint32_t Acquire() noexcept
+		{
+			assert(m_numFree > 0);
+			const auto itr = std::ranges::find_if(m_words, [](uint64_t word) noexcept { return word != 0; });
+			assert(itr != m_words.end());
+
+			const auto bit = static_cast<uint32_t>(std::countr_zero(*itr));
+			*itr &= *itr - 1;  // Clear the lowest set bit.
+			--m_numFree;
+			return static_cast<uint32_t>(std::distance(m_words.begin(), itr)) * k_bitsPerWord + bit;
+		}
 
-	uint32_t m_allocGranularity;
+		// Returns false if the slot wasn't in use.
+		bool Release(uint32_t slot) noexcept
+		{
+			assert(slot < m_numSlots);
+			uint64_t& word = m_words[slot / k_bitsPerWord];
+			const auto mask = uint64_t{ 1 } << (slot % k_bitsPerWord);
+			if (word & mask)
+				return false;
+			word |= mask;
+			++m_numFree;
+			return true;
+		}
 
-	mutable std::shared_mutex m_mutex;  // For the reason of using mutex, see HookRegistry::m_mutex.
-};
+		bool HasFree() const noexcept	{ return m_numFree > 0; }
+		bool IsAllFree() const noexcept	{ return m_numFree == m_numSlots; }
 
+	private:
+		constexpr static uint32_t k_bitsPerWord = 64;
 
-// ---------------------------------------------------------------------------
+		std::vector<uint64_t> m_words;
+		uint32_t m_numFree;
+		uint32_t m_numSlots;
+	};
+
+	TrampolineRegistry()
+		: m_pages()
+		, m_pagesWithFreeSlots()
+		, m_allocGranularity(GetAllocGranularity())
+		, m_freeRegions(m_allocGranularity)
+		, m_retired()
+		, m_mutex()
+	{ }
+
+	// Assumes that caller has already obtained a lock
+	void ReclaimWithLock()
+	{
+		m_retired.Reclaim([this](gan::MemAddr addr) { ReleaseWithLock(addr); });
+	}
+
+	// Assumes that caller has already obtained a lock
+	gan::MemAddr RegisterWithLock(const Trampoline& trampoline, gan::MemRange desiredAddrRange)
+	{
+		const auto pageItr =
+			FindRelevantPageInRange(desiredAddrRange)
+			.or_else([this, desiredAddrRange] { return AddNewPage(desiredAddrRange); });
+		if (!pageItr)
+			return gan::MemAddr{ nullptr };
+
+		// get a free slot
+		auto& [pageAddr, freeSlots] = **pageItr;
+		const auto slot = freeSlots.Acquire();
+		if (!freeSlots.HasFree())
+			m_pagesWithFreeSlots.erase(pageAddr);
+
+		auto trampolineAddr = pageAddr.Offset(slot * k_trampolineSize);
+		memcpy(trampolineAddr.Ptr<uint8_t>(), trampoline.opcode, k_trampolineSize);
+		return trampolineAddr;
+	}
+
+	// Assumes that caller has already obtained a lock
+	void ReleaseWithLock(gan::MemAddr addr)
+	{
+		// Find the last page starting at or below "addr".
+		auto pageItr = m_pages.upper_bound(addr);
+		if (pageItr == m_pages.begin())
+			return;
+		--pageItr;
+
+		auto& [pageAddr, freeSlots] = *pageItr;
+		const auto offset = static_cast<size_t>(addr - pageAddr);
+		if (offset >= m_allocGranularity || offset % k_trampolineSize != 0)
+			return;  // Not a trampoline
+		if (!freeSlots.Release(static_cast<uint32_t>(offset / k_trampolineSize)))
+			return;  // Not in use
+
+		if (freeSlots.IsAllFree())
+		{
+			m_pagesWithFreeSlots.erase(pageAddr);
+			::VirtualFree(pageAddr.Ptr(), 0, MEM_RELEASE);
+			if constexpr (gan::Is64())
+				m_freeRegions.MarkFree(pageAddr, m_allocGranularity);
+			m_pages.erase(pageItr);
+		}
+		else
+			m_pagesWithFreeSlots.emplace(pageAddr);
+	}
+
+	static int GetAllocGranularity() noexcept
+	{
+		SYSTEM_INFO sysInfo;
+		::GetSystemInfo(&sysInfo);
+		return sysInfo.dwAllocationGranularity;
+	}
+
+	static size_t GenerateMaskFromGranularity(uint32_t granularity) noexcept
+	{
+		const auto tzcnt = _tzcnt_u32(granularity);
+		assert(_lzcnt_u32(granularity) + tzcnt == 31);  // "granularity" must a power of 2.
+		return std::numeric_limits<size_t>::max() << tzcnt;
+	}
+
+	static gan::MemRange AlignMemRangeWithGranularity(gan::MemRange memRange, uint32_t granularity) noexcept
+	{
+		const auto offsetMask = GenerateMaskFromGranularity(granularity);
+		const auto rangeMin = memRange.min;
+		const auto rangeMax = memRange.max;
+		return {
+			.min = (rangeMin & offsetMask).Offset(rangeMin & ~offsetMask ? granularity : 0),
+			.max = (rangeMax & offsetMask)  // Not to return an address higher than memRange.max
+		};
+	}
+
+	using PageMap = std::map<gan::MemAddr, SlotBitmap>;
+
+	// Assumes that caller has already obtained a lock
+	std::optional<PageMap::iterator> FindRelevantPageInRange(gan::MemRange desiredAddrRange) noexcept
+	{
+		if (m_pagesWithFreeSlots.empty())
+			return std::nullopt;
+
+		// The lowest page with free slots at or above desiredAddrRange.min. Any page does for x86.
+		const auto itr = gan::Is64() ?
+			m_pagesWithFreeSlots.lower_bound(desiredAddrRange.min) :
+			m_pagesWithFreeSlots.begin();
+		if (itr == m_pagesWithFreeSlots.end()
+			|| (gan::Is64() && !desiredAddrRange.InRange(*itr)))  // This condition is short-circuited for x86
+		{
+			return std::nullopt;
+		}
+
+		return m_pages.find(*itr);
+	}
+
+	// Assume: caller has already obtained a lock
+	std::optional<PageMap::iterator> AddNewPage(gan::MemRange desiredAddrRange)
+	{
+		const gan::MemRange fixedAddrRange = AlignMemRangeWithGranularity(desiredAddrRange, m_allocGranularity);
+
+		const auto newPageAddr = AllocatePage(fixedAddrRange);
+		if (!newPageAddr)
+			return std::nullopt;
+
+		const auto numTrampolinesPerPage = m_allocGranularity / k_trampolineSize;
+		const auto [itr, inserted] = m_pages.try_emplace(newPageAddr, numTrampolinesPerPage);
+		assert(inserted);
+		m_pagesWithFreeSlots.emplace(newPageAddr);
+		return itr;
+	}
+
+
+	// Assumes that "desiredAddrRange" is aligned with the result from GetAllocGranularity()
+	gan::MemAddr AllocatePage(gan::MemRange desiredAddrRange)
+	{
+		const auto allocate = [this](gan::MemAddr addr) noexcept {
+			return gan::MemAddr{ ::VirtualAlloc(addr.Ptr(), m_allocGranularity, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE) };
+		};
+
+		if constexpr (gan::Is64())
+		{
+			// The range is walked through again once if the cache turns out to be stale, i.e., it's out of
+			// free space in range, which may have been released by others, or an address in it is taken.
+			for (bool refreshed = false; ; )
+			{
+				const auto desiredAddress = m_freeRegions.Find(desiredAddrRange, m_allocGranularity);
+				if (!desiredAddress)
+				{
+					if (refreshed)
+						break;
+					m_freeRegions.Refresh(desiredAddrRange);
+					refreshed = true;
+					continue;
+				}
+
+				// Either it's ours now or someone else took it before us. The cache is right about it either way.
+				m_freeRegions.MarkUsed(desiredAddress, m_allocGranularity);
+				if (const auto newPageAddr = allocate(desiredAddress))
+					return newPageAddr;
+				if (!refreshed)
+				{
+					m_freeRegions.Refresh(desiredAddrRange);
+					refreshed = true;
+				}
+			}
+
+			// Nothing free in range. A page anywhere else is of no use, as what's placed in it must be reachable
+			// by rel32 from the range, so let the caller fail instead.
+			return gan::MemAddr{ };
+		}
+		else
+			return allocate(gan::MemAddr{ nullptr });  // Don't care in 32 bit
+	}
+
+	// Each page in "m_pages" is of the size of "m_allocGranularity" bytes
+	PageMap m_pages;  // Mapping base addresses of pages to their free slots
+	std::set<gan::MemAddr> m_pagesWithFreeSlots;
+
+	uint32_t m_allocGranularity;
+	FreeRegionCache m_freeRegions;  // Only used in 64 bit
+	RetiredList<gan::MemAddr> m_retired;  // Unregistered trampolines whose slots aren't free yet
+
+	mutable std::shared_mutex m_mutex;  // For the reason of using mutex, see HookRegistry::m_mutex.
+};
+
+
+// ---------------------------------------------------------------------------
 // Class OpcodeGenerator: filling in instructions to buffer; might be used
 //                        by both hooks and trampolines.
 // ---------------------------------------------------------------------------
@@ -436,6 +1066,26 @@ public:
 		}
 	};
 
+	// "jmp qword ptr [rip+0]" followed by the target address. No side effects, and
+	// unlike AbsLongJmp64 it doesn't unbalance the return stack buffer. Used by relays.
+	class AbsIndirectJmp64 : public Base<14>
+	{
+	public:
+		template <size_t N>
+		static uint8_t Make(gan::MemAddr targetAddr, uint8_t(&out)[N]) noexcept
+		{
+			static_assert(k_64bitStaticAssert<N>);
+			static_assert(N >= k_length);
+
+			out[0] = 0xFF;  // jmp /4
+			out[1] = 0x25;  // mod=00b, reg=4, r/m=101b (RIP-relative)
+			*reinterpret_cast<int32_t*>(out + 2) = 0;  // disp32; the address follows right after
+			gan::MemAddr{ out + 6 }.Ref<gan::MemAddr>() = targetAddr;
+
+			return k_length;
+		}
+	};
+
 	// Used by 32-bit trampolines
 	class AbsLongJmp32 : public Base<6>
 	{
@@ -487,9 +1137,768 @@ public:
 			return k_length;
 		}
 	};
+
+	// Stub of a toggleable hook; jumps to the hook function if the flag is set and to the trampoline
+	// otherwise. The flag is the last byte of the stub itself as trampoline pages are always writable.
+	class DispatchStub : public Base<gan::Is64() ? 38 : 20>
+	{
+	public:
+		constexpr static uint8_t k_flagOffset = k_length - 1;
+		static_assert(k_length <= Trampoline::k_size);  // Stubs are allocated in trampoline slots
+
+		template <size_t N>
+		static uint8_t Make(gan::MemAddr stubAddr, gan::MemAddr hookFunc, gan::MemAddr trampolineAddr, bool enabled, uint8_t(&out)[N]) noexcept
+		{
+			static_assert(N >= k_length);
+
+			// cmp byte ptr [flag], 0
+			out[0] = 0x80;  // cmp /7
+			out[1] = 0x3D;  // mod=00b, reg=7, r/m=101b (RIP-relative on amd64, absolute on ia32)
+			if constexpr (gan::Is64())
+				*reinterpret_cast<int32_t*>(out + 2) = k_flagOffset - 7;  // relative to the end of this instruction
+			else
+				gan::MemAddr{ out + 2 }.Ref<gan::MemAddr>() = stubAddr.Offset(k_flagOffset);
+			out[6] = 0x00;  // imm8
+
+			// je disabled
+			out[7] = 0x74;
+			if constexpr (gan::Is64())
+			{
+				out[8] = AbsIndirectJmp64::k_length;
+
+				// jmp hookFunc; disabled: jmp trampolineAddr
+				AbsIndirectJmp64::Make(hookFunc, reinterpret_cast<uint8_t(&)[14]>(out[9]));  // ugly...
+				AbsIndirectJmp64::Make(trampolineAddr, reinterpret_cast<uint8_t(&)[14]>(out[23]));
+			}
+			else
+			{
+				out[8] = RelNearJmp32::k_length;
+
+				// jmp hookFunc; disabled: jmp trampolineAddr
+				RelNearJmp32::Make(stubAddr.Offset(9), hookFunc, reinterpret_cast<uint8_t(&)[5]>(out[9]));  // ugly...
+				RelNearJmp32::Make(stubAddr.Offset(14), trampolineAddr, reinterpret_cast<uint8_t(&)[5]>(out[14]));
+			}
+
+			out[k_flagOffset] = enabled ? 1 : 0;
+			return k_length;
+		}
+	};
+
+	// "jmp [target]" with the target stored in the link itself, so that layers of a hook can be relinked
+	// with a single atomic store. Slots are consecutive in trampoline pages, keeping the target aligned.
+	class LayerLink : public Base<gan::Is64() ? 16 : 12>
+	{
+	public:
+		constexpr static uint8_t k_targetOffset = 8;
+		static_assert(k_length <= Trampoline::k_size && Trampoline::k_size % alignof(void*) == 0);
+
+		template <size_t N>
+		static uint8_t Make(gan::MemAddr linkAddr, gan::MemAddr targetAddr, uint8_t(&out)[N]) noexcept
+		{
+			static_assert(N >= k_length);
+
+			// jmp [target]
+			out[0] = 0xFF;  // jmp /4
+			out[1] = 0x25;  // mod=00b, reg=4, r/m=101b (RIP-relative on amd64, absolute on ia32)
+			if constexpr (gan::Is64())
+				*reinterpret_cast<int32_t*>(out + 2) = k_targetOffset - 6;  // relative to the end of this instruction
+			else
+				gan::MemAddr{ out + 2 }.Ref<gan::MemAddr>() = linkAddr.Offset(k_targetOffset);
+			out[6] = 0xCC;  // padding
+			out[7] = 0xCC;
+
+			gan::MemAddr{ out + k_targetOffset }.Ref<gan::MemAddr>() = targetAddr;
+			return k_length;
+		}
+	};
+
+	// Entry of a probe: calls the shared ProbeDispatcher, which finds the callback and its user data
+	// through the return address, and then jumps to the trampoline. Calling rather than jumping keeps
+	// returns predictable.
+	class ProbeStub : public Base<gan::Is64() ? 48 : 28>
+	{
+	public:
+		constexpr static uint8_t k_returnOffset = 6;  // Right after "call [dispatcher]"
+		constexpr static uint8_t k_dispatcherOffset = gan::Is64() ? 16 : 12;
+		constexpr static uint8_t k_trampolineOffset = k_dispatcherOffset + sizeof(void*);
+		constexpr static uint8_t k_callbackOffset = k_trampolineOffset + sizeof(void*);
+		constexpr static uint8_t k_userDataOffset = k_callbackOffset + sizeof(void*);
+		static_assert(k_length <= Trampoline::k_size && k_userDataOffset + sizeof(void*) == k_length);
+
+		template <size_t N>
+		static uint8_t Make(
+			gan::MemAddr stubAddr,
+			gan::MemAddr dispatcher,
+			gan::MemAddr trampolineAddr,
+			gan::MemAddr callback,
+			void* userData,
+			uint8_t(&out)[N]
+		) noexcept
+		{
+			static_assert(N >= k_length);
+
+			// call [dispatcher]; jmp [trampoline]
+			const auto makeIndirect = [stubAddr, &out](uint8_t offset, uint8_t modrm, uint8_t dataOffset) noexcept {
+				out[offset] = 0xFF;  // call /2 or jmp /4
+				out[offset + 1] = modrm;  // mod=00b, r/m=101b (RIP-relative on amd64, absolute on ia32)
+				if constexpr (gan::Is64())
+					*reinterpret_cast<int32_t*>(out + offset + 2) = dataOffset - (offset + 6);  // relative to the end of the instruction
+				else
+					gan::MemAddr{ out + offset + 2 }.Ref<gan::MemAddr>() = stubAddr.Offset(dataOffset);
+			};
+			makeIndirect(0, 0x15, k_dispatcherOffset);
+			makeIndirect(k_returnOffset, 0x25, k_trampolineOffset);
+			std::fill(out + 12, out + k_dispatcherOffset, static_cast<uint8_t>(0xCC));  // padding
+
+			gan::MemAddr{ out + k_dispatcherOffset }.Ref<gan::MemAddr>() = dispatcher;
+			gan::MemAddr{ out + k_trampolineOffset }.Ref<gan::MemAddr>() = trampolineAddr;
+			gan::MemAddr{ out + k_callbackOffset }.Ref<gan::MemAddr>() = callback;
+			gan::MemAddr{ out + k_userDataOffset }.Ref<void*>() = userData;
+			return k_length;
+		}
+	};
+
+	// Entry of a gan::Closure: stores the address of the callable object into a TLS slot in the TEB, and
+	// then jumps to the invoker. rax isn't used for passing arguments on amd64, and neither is eax on ia32.
+	class ClosureThunk : public Base<gan::Is64() ? 31 : 16>
+	{
+	public:
+		static_assert(k_length <= Trampoline::k_size);
+
+		template <size_t N>
+		static uint8_t Make(gan::MemAddr thunkAddr, void* callable, gan::MemAddr invoker, uint32_t slotOffset, uint8_t(&out)[N]) noexcept
+		{
+			static_assert(N >= k_length);
+
+			if constexpr (gan::Is64())
+			{
+				// mov rax, imm64
+				out[0] = 0x48;  // REX.W
+				out[1] = 0xB8;  // mov
+				gan::MemAddr{ out + 2 }.Ref<void*>() = callable;
+
+				// mov qword ptr gs:[slotOffset], rax
+				out[10] = 0x65;  // gs
+				out[11] = 0x48;  // REX.W
+				out[12] = 0x89;  // mov r/m64, r64
+				out[13] = 0x04;  // mod=00b, reg=0 (rax), r/m=100b
+				out[14] = 0x25;  // ss=00b, index=100b (none), base=101b (disp32)
+				*reinterpret_cast<uint32_t*>(out + 15) = slotOffset;
+
+				// mov rax, invoker; jmp rax
+				AbsLongJmpRax::Make(invoker, reinterpret_cast<uint8_t(&)[AbsLongJmpRax::k_length]>(out[19]));  // ugly...
+			}
+			else
+			{
+				// mov dword ptr fs:[slotOffset], imm32
+				out[0] = 0x64;  // fs
+				out[1] = 0xC7;  // mov /0
+				out[2] = 0x05;  // mod=00b, reg=0, r/m=101b (disp32)
+				*reinterpret_cast<uint32_t*>(out + 3) = slotOffset;
+				gan::MemAddr{ out + 7 }.Ref<void*>() = callable;
+
+				// jmp invoker
+				RelNearJmp32::Make(thunkAddr.Offset(11), invoker, reinterpret_cast<uint8_t(&)[RelNearJmp32::k_length]>(out[11]));
+			}
+			return k_length;
+		}
+	};
 };
 
 
+// ---------------------------------------------------------------------------
+// Class CodeCaveIndex: Padding in executable memory where auxiliary prologs
+//                      can be written. Each module (or each allocation, for
+//                      code outside of images) is scanned once when the first
+//                      hook is placed in it. A claimed cave is taken out of
+//                      the index until it's released, so two hooks never
+//                      share one. The cave of an uninstalled hook keeps its
+//                      auxiliary prolog for a grace period, and is only
+//                      wiped and released after it.
+// ---------------------------------------------------------------------------
+
+class CodeCaveIndex : public gan::Singleton<CodeCaveIndex>
+{
+	friend class gan::Singleton<CodeCaveIndex>;
+
+public:
+	// Claims "size" bytes of padding nearest to "jumpEnd", the address right after a "0xEB imm8" jump.
+	std::optional<gan::MemAddr> Claim(gan::MemAddr jumpEnd, size_t size)
+	{
+		std::unique_lock lock(m_mutex);
+
+		ScanAllocationOf(jumpEnd);
+
+		const auto bounds = GetReachableRange(jumpEnd);
+		while (const auto cave = m_caves.FindNearestFit(jumpEnd, bounds, size))
+		{
+			m_caves.Remove(cave, cave.Offset(static_cast<intptr_t>(size)));
+			if (IsStillPadding(cave, size, jumpEnd))
+				return cave;
+
+			// Overwritten, or the module has been unloaded. Keep it out of the index and try the next one.
+		}
+		return std::nullopt;
+	}
+
+	// The cave must have been filled with padding again.
+	void Release(gan::MemAddr cave, size_t size)
+	{
+		std::unique_lock lock(m_mutex);
+		m_caves.Add(cave, cave.Offset(static_cast<intptr_t>(size)));
+	}
+
+	// For a cave holding an auxiliary prolog which a thread may have just jumped to. It's left as it is.
+	void Retire(gan::MemAddr cave)
+	{
+		RetiredCave retired{ .address = cave };
+		memcpy(retired.code, cave.ConstPtr<uint8_t>(), sizeof(retired.code));
+		MEMORY_BASIC_INFORMATION memInfo{ };
+		if (::VirtualQuery(cave.ConstPtr<uint8_t>(), &memInfo, sizeof(memInfo)) != 0)
+			retired.allocationBase = gan::MemAddr{ memInfo.AllocationBase };
+
+		std::unique_lock lock(m_mutex);
+		m_retired.Add(retired);
+	}
+
+	// Takes caves retired at least a grace period ago, which the caller wipes with padding and releases. Caves
+	// overwritten or unmapped since are dropped.
+	std::vector<gan::MemAddr> TakeRetired()
+	{
+		std::unique_lock lock(m_mutex);
+
+		std::vector<gan::MemAddr> caves;
+		m_retired.Reclaim([&caves](const RetiredCave& retired) {
+			if (IsStillRetired(retired))
+				caves.emplace_back(retired.address);
+		});
+		return caves;
+	}
+
+private:
+	// Shorter padding is of no use as the only thing written to caves is an AbsLongJmpRax.
+	constexpr static size_t k_minCaveSize = OpcodeGenerator::AbsLongJmpRax::k_length;
+
+	struct RetiredCave
+	{
+		gan::MemAddr address;
+		gan::MemAddr allocationBase;
+		uint8_t code[k_minCaveSize] { };  // What it held when retired
+	};
+
+	CodeCaveIndex() = default;
+
+	static gan::MemRange GetReachableRange(gan::MemAddr jumpEnd) noexcept
+	{
+		// Displacements are signed. The range is clamped to the address space.
+		constexpr uintptr_t maxBackward = 0x80;
+		constexpr uintptr_t maxForward = maxBackward - 1;
+		const auto jumpEndValue = reinterpret_cast<uintptr_t>(jumpEnd.ConstPtr());
+		return {
+			.min = gan::MemAddr{ reinterpret_cast<void*>(jumpEndValue - std::min(jumpEndValue, maxBackward)) },
+			.max = gan::MemAddr{ reinterpret_cast<void*>(jumpEndValue + std::min(UINTPTR_MAX - jumpEndValue, maxForward + 1)) }
+		};
+	}
+
+	static bool IsExecutable(const MEMORY_BASIC_INFORMATION& memInfo) noexcept
+	{
+		constexpr DWORD k_execMask = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+		return memInfo.State == MEM_COMMIT && (memInfo.Protect & k_execMask) != 0 && (memInfo.Protect & PAGE_GUARD) == 0;
+	}
+
+	// Returns the length of the padding instruction at the beginning of "code", or 0 if there isn't one.
+	static size_t MatchPadding(std::span<const uint8_t> code) noexcept
+	{
+		// Multi-byte NOPs as emitted by compilers and assemblers, which may be preceded by a CS
+		// segment override and any number of operand-size prefixes
+		constexpr static uint8_t k_nop1[] { 0x90 };
+		constexpr static uint8_t k_nop3[] { 0x0F, 0x1F, 0x00 };
+		constexpr static uint8_t k_nop4[] { 0x0F, 0x1F, 0x40, 0x00 };
+		constexpr static uint8_t k_nop5[] { 0x0F, 0x1F, 0x44, 0x00, 0x00 };
+		constexpr static uint8_t k_nop7[] { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 };
+		constexpr static uint8_t k_nop8[] { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 };
+		constexpr static std::span<const uint8_t> k_nops[] { k_nop1, k_nop3, k_nop4, k_nop5, k_nop7, k_nop8 };
+
+		if (!code.empty() && code[0] == 0xCC)
+			return 1;
+
+		size_t prefixLen = 0;
+		while (prefixLen < code.size() && code[prefixLen] == 0x66)
+			++prefixLen;
+		if (prefixLen < code.size() && code[prefixLen] == 0x2E)
+			++prefixLen;
+
+		const auto rest = code.subspan(prefixLen);
+		for (const auto nop : k_nops)
+		{
+			if (rest.size() >= nop.size() && std::ranges::equal(rest.first(nop.size()), nop))
+				return prefixLen + nop.size();
+		}
+		return 0;
+	}
+
+	static bool IsAllPadding(std::span<const uint8_t> code) noexcept
+	{
+		while (!code.empty())
+		{
+			const auto length = MatchPadding(code);
+			if (length == 0)
+				return false;
+			code = code.subspan(length);
+		}
+		return true;
+	}
+
+	// A cheap check against caves which have been overwritten or unmapped since scanned. A cave may start or
+	// end in the middle of a multi-byte NOP, so only the bytes which padding consists of are checked.
+	static bool IsStillPadding(gan::MemAddr cave, size_t size, gan::MemAddr jumpEnd) noexcept
+	{
+		MEMORY_BASIC_INFORMATION jumpInfo{ };
+		MEMORY_BASIC_INFORMATION caveBeginInfo{ };
+		MEMORY_BASIC_INFORMATION caveEndInfo{ };
+		if (::VirtualQuery(jumpEnd.ConstPtr<uint8_t>(), &jumpInfo, sizeof(jumpInfo)) == 0
+			|| ::VirtualQuery(cave.ConstPtr<uint8_t>(), &caveBeginInfo, sizeof(caveBeginInfo)) == 0
+			|| ::VirtualQuery(cave.Offset(static_cast<intptr_t>(size) - 1).ConstPtr<uint8_t>(), &caveEndInfo, sizeof(caveEndInfo)) == 0)
+		{
+			return false;
+		}
+		if (!IsExecutable(caveBeginInfo) || !IsExecutable(caveEndInfo)
+			|| caveBeginInfo.AllocationBase != jumpInfo.AllocationBase
+			|| caveEndInfo.AllocationBase != jumpInfo.AllocationBase)
+		{
+			return false;
+		}
+
+		constexpr static uint8_t k_paddingBytes[] { 0xCC, 0x90, 0x66, 0x2E, 0x0F, 0x1F, 0x00, 0x40, 0x44, 0x80, 0x84 };
+		return std::ranges::all_of(
+			std::span(cave.ConstPtr<uint8_t>(), size),
+			[](uint8_t c) noexcept { return std::ranges::find(k_paddingBytes, c) != std::end(k_paddingBytes); }
+		);
+	}
+
+	// Like IsStillPadding(), but the cave must hold what it did when retired.
+	static bool IsStillRetired(const RetiredCave& retired) noexcept
+	{
+		const auto cave = retired.address;
+		MEMORY_BASIC_INFORMATION caveBeginInfo{ };
+		MEMORY_BASIC_INFORMATION caveEndInfo{ };
+		if (!retired.allocationBase
+			|| ::VirtualQuery(cave.ConstPtr<uint8_t>(), &caveBeginInfo, sizeof(caveBeginInfo)) == 0
+			|| ::VirtualQuery(cave.Offset(static_cast<intptr_t>(sizeof(retired.code)) - 1).ConstPtr<uint8_t>(), &caveEndInfo, sizeof(caveEndInfo)) == 0)
+		{
+			return false;
+		}
+		if (!IsExecutable(caveBeginInfo) || !IsExecutable(caveEndInfo)
+			|| caveBeginInfo.AllocationBase != retired.allocationBase.ConstPtr()
+			|| caveEndInfo.AllocationBase != retired.allocationBase.ConstPtr())
+		{
+			return false;
+		}
+		return memcmp(cave.ConstPtr<uint8_t>(), retired.code, sizeof(retired.code)) == 0;
+	}
+
+	// Assumes that caller has already obtained a lock
+	void ScanAllocationOf(gan::MemAddr addr)
+	{
+		MEMORY_BASIC_INFORMATION memInfo{ };
+		if (::VirtualQuery(addr.ConstPtr<uint8_t>(), &memInfo, sizeof(memInfo)) == 0 || memInfo.State != MEM_COMMIT)
+			return;
+
+		const gan::MemAddr allocBase{ memInfo.AllocationBase };
+		if (!m_scannedAllocations.emplace(allocBase).second)
+			return;  // Already scanned
+
+		if (memInfo.Type == MEM_IMAGE)
+			ScanImage(allocBase);
+		else
+		{
+			// Dynamically generated code: every executable region of the allocation
+			for (auto regionBase = allocBase;
+				::VirtualQuery(regionBase.ConstPtr<uint8_t>(), &memInfo, sizeof(memInfo)) != 0 && memInfo.AllocationBase == allocBase.ConstPtr();
+				regionBase = regionBase.Offset(static_cast<intptr_t>(memInfo.RegionSize)))
+			{
+				if (IsExecutable(memInfo))
+					AddInt3Runs(std::span(regionBase.ConstPtr<uint8_t>(), memInfo.RegionSize));
+			}
+		}
+	}
+
+	// Assumes that caller has already obtained a lock
+	void ScanImage(gan::MemAddr imageBase)
+	{
+		const auto headers = gan::PeImageHelper::GetLoadedHeaders(imageBase);
+		if (!headers)
+			return;
+
+		std::vector<std::span<const uint8_t>> execSections;
+		for (const auto& section : headers->sectionHeaderList)
+		{
+			if ((section.Characteristics & IMAGE_SCN_MEM_EXECUTE) == 0)
+				continue;
+			execSections.emplace_back(imageBase.Offset(section.VirtualAddress).ConstPtr<uint8_t>(), section.Misc.VirtualSize);
+			AddInt3Runs(execSections.back());
+		}
+
+		// Compilers other than MSVC pad functions with NOPs. Gaps between functions can be found with
+		// unwind data, which amd64 images have for all but leaf functions.
+		const auto& ntHeaders = headers->ntHeaders;
+		if (ntHeaders.GetArch() != gan::Arch::Amd64 || ntHeaders.GetNumOfDataDirectories() <= IMAGE_DIRECTORY_ENTRY_EXCEPTION)
+			return;
+		const auto& exceptionDir = ntHeaders.GetDataDirectories()[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+		const std::span functions(
+			imageBase.Offset(exceptionDir.VirtualAddress).ConstPtr<IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY>(),
+			exceptionDir.Size / sizeof(IMAGE_AMD64_RUNTIME_FUNCTION_ENTRY)
+		);
+		for (auto i : std::views::iota(1uz, functions.size()))
+		{
+			const auto gapBegin = imageBase.Offset(functions[i - 1].EndAddress);
+			const auto gapEnd = imageBase.Offset(functions[i].BeginAddress);
+			if (gapEnd - gapBegin < static_cast<ptrdiff_t>(k_minCaveSize))
+				continue;
+
+			const std::span gap(gapBegin.ConstPtr<uint8_t>(), gapEnd.ConstPtr<uint8_t>());
+			const auto isInSection = [&gap](std::span<const uint8_t> section) noexcept {
+				return gap.data() >= section.data() && gap.data() + gap.size() <= section.data() + section.size();
+			};
+			if (std::ranges::any_of(execSections, isInSection) && IsAllPadding(gap))
+				m_caves.Add(gapBegin, gapEnd);
+		}
+	}
+
+	// Assumes that caller has already obtained a lock
+	void AddInt3Runs(std::span<const uint8_t> code)
+	{
+		const uint8_t* runBegin = nullptr;
+		const auto endRun = [this, &runBegin](const uint8_t* runEnd) {
+			// The first INT3 may be a trap after a call to a noreturn function rather than padding.
+			if (runBegin && runEnd - (runBegin + 1) >= static_cast<ptrdiff_t>(k_minCaveSize))
+				m_caves.Add(gan::ConstMemAddr{ runBegin + 1 }.ConstCast(), gan::ConstMemAddr{ runEnd }.ConstCast());
+			runBegin = nullptr;
+		};
+		const auto scanBytes = [&runBegin, &endRun](const uint8_t* begin, const uint8_t* end) {
+			for (auto p = begin; p < end; ++p)
+			{
+				if (*p != 0xCC)
+					endRun(p);
+				else if (!runBegin)
+					runBegin = p;
+			}
+		};
+
+		// Most of the 16-byte blocks are either all code or all padding.
+		const __m128i int3s = _mm_set1_epi8(static_cast<char>(0xCC));
+		auto p = code.data();
+		const auto end = code.data() + code.size();
+		for ( ; end - p >= 16; p += 16)
+		{
+			const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, int3s));
+			if (mask == 0 && !runBegin)
+				continue;
+			else if (mask == 0xFFFF && runBegin)
+				continue;
+			scanBytes(p, p + 16);
+		}
+		scanBytes(p, end);
+		endRun(end);
+	}
+
+	AddressRangeSet m_caves;  // Free caves
+	RetiredList<RetiredCave> m_retired;
+	std::set<gan::MemAddr> m_scannedAllocations;  // Base addresses of scanned modules and allocations
+
+	mutable std::mutex m_mutex;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class CodeCaveClaims: Caves claimed by a transaction, which are released on
+//                       destruction unless kept
+// ---------------------------------------------------------------------------
+
+class CodeCaveClaims
+{
+public:
+	CodeCaveClaims() = default;
+	CodeCaveClaims(const CodeCaveClaims&) = delete;
+	CodeCaveClaims& operator=(const CodeCaveClaims&) = delete;
+
+	~CodeCaveClaims()
+	{
+		for (const auto cave : m_caves)
+			CodeCaveIndex::GetInstance().Release(cave, OpcodeGenerator::AbsLongJmpRax::k_length);
+	}
+
+	void Add(gan::MemAddr cave)	{ m_caves.emplace_back(cave); }
+	void Keep() noexcept	{ m_caves.clear(); }
+
+private:
+	std::vector<gan::MemAddr> m_caves;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class ProbeDispatcher: Code shared by all probes, generated once and kept
+//                        until the process exits. Called from a ProbeStub,
+//                        it saves volatile registers into a ProbeContext
+//                        on the stack, calls the callback of the probe and
+//                        restores the registers. The x87, SSE and AVX state
+//                        is saved as a whole with XSAVE, or FXSAVE where the
+//                        OS doesn't support XSAVE.
+// ---------------------------------------------------------------------------
+
+class ProbeDispatcher : public gan::Singleton<ProbeDispatcher>
+{
+	friend class gan::Singleton<ProbeDispatcher>;
+
+public:
+	// nullptr if the code couldn't be allocated
+	gan::MemAddr GetAddress() const noexcept	{ return m_code; }
+
+private:
+	using Stub = OpcodeGenerator::ProbeStub;
+	constexpr static uint8_t k_callbackDisp = Stub::k_callbackOffset - Stub::k_returnOffset;  // relative to the return address
+	constexpr static uint8_t k_userDataDisp = Stub::k_userDataOffset - Stub::k_returnOffset;
+
+	// XSAVE leaves its header alone but for the bits of XSTATE_BV in the mask, while XRSTOR faults if any of
+	// the rest is set, so the whole header is zeroed first.
+	constexpr static uint32_t k_xsaveHeaderOffset = 512;
+	constexpr static uint32_t k_minStateSize = k_xsaveHeaderOffset + 64;  // Also for FXSAVE, which stores 512 bytes
+	constexpr static uint32_t k_xsaveMask = 0b1110'0111;  // x87, SSE, AVX and AVX-512; not MPX or AMX
+
+	// The layout of gan::ProbeContext follows the order of pushes. Placeholders are filled in by Generate().
+	constexpr static uint8_t k_code64[] {
+		0x9C,                                       // pushfq
+		0x54,                                       // push rsp
+		0x48, 0x83, 0x04, 0x24, 0x10,               // add qword ptr [rsp], 16  ; rsp before "call [dispatcher]"
+		0x50, 0x51, 0x52,                           // push rax; push rcx; push rdx
+		0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53,  // push r8; push r9; push r10; push r11
+		0x53,                                       // push rbx
+		0x48, 0x89, 0xE3,                           // mov rbx, rsp
+		0x48, 0x83, 0xE4, 0xC0,                     // and rsp, -64
+		0xB8, 0x00, 0x00, 0x00, 0x00,               // mov eax, frameSize
+		0x3D, 0x00, 0x10, 0x00, 0x00,               // cmp eax, 0x1000
+		0x72, 0x17,                                 // jb last  ; Grows the stack a page at a time, like __chkstk
+		0x48, 0x81, 0xEC, 0x00, 0x10, 0x00, 0x00,   // loop: sub rsp, 0x1000
+		0x48, 0x85, 0x24, 0x24,                     // test [rsp], rsp  ; Touches the guard page
+		0x2D, 0x00, 0x10, 0x00, 0x00,               // sub eax, 0x1000
+		0x3D, 0x00, 0x10, 0x00, 0x00,               // cmp eax, 0x1000
+		0x73, 0xE9,                                 // jae loop
+		0x48, 0x29, 0xC4,                           // last: sub rsp, rax  ; shadow space at rsp, state at rsp+0x40
+		0x48, 0x8D, 0x8C, 0x24, 0x40, 0x02, 0x00, 0x00,  // lea rcx, [rsp+0x240]  ; XSAVE header
+		0x31, 0xC0,                                 // xor eax, eax
+		0x48, 0x89, 0x01,                           // mov [rcx], rax
+		0x48, 0x89, 0x41, 0x08,                     // mov [rcx+0x08], rax
+		0x48, 0x89, 0x41, 0x10,                     // mov [rcx+0x10], rax
+		0x48, 0x89, 0x41, 0x18,                     // mov [rcx+0x18], rax
+		0x48, 0x89, 0x41, 0x20,                     // mov [rcx+0x20], rax
+		0x48, 0x89, 0x41, 0x28,                     // mov [rcx+0x28], rax
+		0x48, 0x89, 0x41, 0x30,                     // mov [rcx+0x30], rax
+		0x48, 0x89, 0x41, 0x38,                     // mov [rcx+0x38], rax
+		0xB8, 0x00, 0x00, 0x00, 0x00,               // mov eax, mask
+		0x31, 0xD2,                                 // xor edx, edx
+		0x48, 0x0F, 0xAE, 0x64, 0x24, 0x40,         // xsave64 [rsp+0x40]
+		0x48, 0x8B, 0x43, 0x50,                     // mov rax, [rbx+0x50]  ; return address into the stub
+		0x48, 0x8D, 0x4B, 0x08,                     // lea rcx, [rbx+8]  ; context
+		0x48, 0x8B, 0x50, k_userDataDisp,           // mov rdx, [rax+userData]
+		0xFF, 0x50, k_callbackDisp,                 // call [rax+callback]
+		0xB8, 0x00, 0x00, 0x00, 0x00,               // mov eax, mask
+		0x31, 0xD2,                                 // xor edx, edx
+		0x48, 0x0F, 0xAE, 0x6C, 0x24, 0x40,         // xrstor64 [rsp+0x40]
+		0x48, 0x89, 0xDC,                           // mov rsp, rbx
+		0x5B,                                       // pop rbx
+		0x41, 0x5B, 0x41, 0x5A, 0x41, 0x59, 0x41, 0x58,  // pop r11; pop r10; pop r9; pop r8
+		0x5A, 0x59, 0x58,                           // pop rdx; pop rcx; pop rax
+		0x48, 0x8D, 0x64, 0x24, 0x08,               // lea rsp, [rsp+8]  ; skip rsp
+		0x9D,                                       // popfq
+		0xC3,                                       // ret  ; to "jmp [trampoline]" in the stub
+	};
+	constexpr static uint8_t k_code32[] {
+		0x9C,                                       // pushfd
+		0x54,                                       // push esp
+		0x83, 0x04, 0x24, 0x08,                     // add dword ptr [esp], 8  ; esp before "call [dispatcher]"
+		0x50, 0x51, 0x52,                           // push eax; push ecx; push edx
+		0x53,                                       // push ebx
+		0x89, 0xE3,                                 // mov ebx, esp
+		0x83, 0xE4, 0xC0,                           // and esp, -64
+		0xB8, 0x00, 0x00, 0x00, 0x00,               // mov eax, frameSize
+		0x3D, 0x00, 0x10, 0x00, 0x00,               // cmp eax, 0x1000
+		0x72, 0x15,                                 // jb last  ; Grows the stack a page at a time, like __chkstk
+		0x81, 0xEC, 0x00, 0x10, 0x00, 0x00,         // loop: sub esp, 0x1000
+		0x85, 0x24, 0x24,                           // test [esp], esp  ; Touches the guard page
+		0x2D, 0x00, 0x10, 0x00, 0x00,               // sub eax, 0x1000
+		0x3D, 0x00, 0x10, 0x00, 0x00,               // cmp eax, 0x1000
+		0x73, 0xEB,                                 // jae loop
+		0x29, 0xC4,                                 // last: sub esp, eax  ; state at esp
+		0x8D, 0x8C, 0x24, 0x00, 0x02, 0x00, 0x00,   // lea ecx, [esp+0x200]  ; XSAVE header
+		0x31, 0xC0,                                 // xor eax, eax
+		0x89, 0x01, 0x89, 0x41, 0x04,               // mov [ecx], eax; mov [ecx+0x04], eax
+		0x89, 0x41, 0x08, 0x89, 0x41, 0x0C,         // mov [ecx+0x08], eax; mov [ecx+0x0C], eax
+		0x89, 0x41, 0x10, 0x89, 0x41, 0x14,         // mov [ecx+0x10], eax; mov [ecx+0x14], eax
+		0x89, 0x41, 0x18, 0x89, 0x41, 0x1C,         // mov [ecx+0x18], eax; mov [ecx+0x1C], eax
+		0x89, 0x41, 0x20, 0x89, 0x41, 0x24,         // mov [ecx+0x20], eax; mov [ecx+0x24], eax
+		0x89, 0x41, 0x28, 0x89, 0x41, 0x2C,         // mov [ecx+0x28], eax; mov [ecx+0x2C], eax
+		0x89, 0x41, 0x30, 0x89, 0x41, 0x34,         // mov [ecx+0x30], eax; mov [ecx+0x34], eax
+		0x89, 0x41, 0x38, 0x89, 0x41, 0x3C,         // mov [ecx+0x38], eax; mov [ecx+0x3C], eax
+		0xB8, 0x00, 0x00, 0x00, 0x00,               // mov eax, mask
+		0x31, 0xD2,                                 // xor edx, edx
+		0x0F, 0xAE, 0x24, 0x24,                     // xsave [esp]
+		0x8B, 0x43, 0x18,                           // mov eax, [ebx+0x18]  ; return address into the stub
+		0x8D, 0x4B, 0x04,                           // lea ecx, [ebx+4]  ; context
+		0xFF, 0x70, k_userDataDisp,                 // push dword ptr [eax+userData]
+		0x51,                                       // push ecx
+		0xFF, 0x50, k_callbackDisp,                 // call [eax+callback]  ; cdecl
+		0x83, 0xC4, 0x08,                           // add esp, 8
+		0xB8, 0x00, 0x00, 0x00, 0x00,               // mov eax, mask
+		0x31, 0xD2,                                 // xor edx, edx
+		0x0F, 0xAE, 0x2C, 0x24,                     // xrstor [esp]
+		0x89, 0xDC,                                 // mov esp, ebx
+		0x5B,                                       // pop ebx
+		0x5A, 0x59, 0x58,                           // pop edx; pop ecx; pop eax
+		0x8D, 0x64, 0x24, 0x04,                     // lea esp, [esp+4]  ; skip esp
+		0x9D,                                       // popfd
+		0xC3,                                       // ret  ; to "jmp [trampoline]" in the stub
+	};
+	static_assert(sizeof(gan::ProbeContext) == (gan::Is64() ? 9 : 5) * sizeof(void*));
+
+	// Where the placeholders are, and what goes there
+	struct Layout
+	{
+		size_t frameSizeOffset;
+		size_t saveMaskOffset;
+		size_t saveModRmOffset;
+		size_t restoreMaskOffset;
+		size_t restoreModRmOffset;
+		uint32_t frameSizeExtra;  // Besides the state
+	};
+	constexpr static Layout k_layout64 { 27, 106, 115, 134, 143, 0x40 };
+	constexpr static Layout k_layout32 { 16, 107, 115, 134, 142, 0 };
+	static_assert(k_code64[k_layout64.frameSizeOffset - 1] == 0xB8 && k_code64[k_layout64.saveMaskOffset - 1] == 0xB8);
+	static_assert(k_code64[k_layout64.saveModRmOffset] == 0x64 && k_code64[k_layout64.restoreMaskOffset - 1] == 0xB8);
+	static_assert(k_code64[k_layout64.restoreModRmOffset] == 0x6C);
+	static_assert(k_code32[k_layout32.frameSizeOffset - 1] == 0xB8 && k_code32[k_layout32.saveMaskOffset - 1] == 0xB8);
+	static_assert(k_code32[k_layout32.saveModRmOffset] == 0x24 && k_code32[k_layout32.restoreMaskOffset - 1] == 0xB8);
+	static_assert(k_code32[k_layout32.restoreModRmOffset] == 0x2C);
+
+	// FXSAVE and FXRSTOR differ from XSAVE and XRSTOR only in the reg field of ModR/M, i.e. /0 and /1 versus /4 and /5.
+	constexpr static uint8_t k_fxsaveModRmDiff = 4 << 3;
+
+	ProbeDispatcher()
+		: m_code(Generate())
+	{ }
+
+	// Size of the area XSAVE stores into and the components to save, or a mask of 0 if only FXSAVE is supported
+	static std::pair<uint32_t, uint32_t> GetStateSaving() noexcept
+	{
+		int cpuInfo[4] { };
+		__cpuid(cpuInfo, 1);
+		constexpr int k_osxsave = 1 << 27;
+		if ((cpuInfo[2] & k_osxsave) == 0)
+			return { k_minStateSize, 0 };
+
+		// Components are at fixed offsets in the standard format, so the area ends with the highest one saved.
+		// Sizing for everything enabled in XCR0 instead would take AMX tiles into account, which are 8 KB.
+		const auto mask = static_cast<uint32_t>(_xgetbv(0)) & k_xsaveMask;
+		uint32_t stateSize = k_minStateSize;
+		for (int component = 2; (mask >> component) != 0; ++component)  // x87 and SSE are in the legacy area
+		{
+			if ((mask & (1u << component)) == 0)
+				continue;
+			__cpuidex(cpuInfo, 0xD, component);
+			stateSize = std::max(stateSize, static_cast<uint32_t>(cpuInfo[1]) + static_cast<uint32_t>(cpuInfo[0]));  // offset + size
+		}
+		return { stateSize, mask };
+	}
+
+	static gan::MemAddr Generate() noexcept
+	{
+		const auto code = gan::Is64() ? std::span<const uint8_t>(k_code64) : std::span<const uint8_t>(k_code32);
+		const auto& layout = gan::Is64() ? k_layout64 : k_layout32;
+		void* mem = ::VirtualAlloc(nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!mem)
+			return { };
+
+		const gan::MemAddr out{ mem };
+		memcpy(mem, code.data(), code.size());
+		const auto [stateSize, mask] = GetStateSaving();
+		const uint32_t frameSize = layout.frameSizeExtra + ((stateSize + 63) & ~63u);  // Keeps the stack 64-byte aligned
+		out.Offset(layout.frameSizeOffset).Ref<uint32_t>() = frameSize;
+		out.Offset(layout.saveMaskOffset).Ref<uint32_t>() = mask;
+		out.Offset(layout.restoreMaskOffset).Ref<uint32_t>() = mask;
+		if (mask == 0)
+		{
+			out.Offset(layout.saveModRmOffset).Ref<uint8_t>() -= k_fxsaveModRmDiff;
+			out.Offset(layout.restoreModRmOffset).Ref<uint8_t>() -= k_fxsaveModRmDiff;
+		}
+
+		DWORD oldProtect;
+		if (!::VirtualProtect(mem, code.size(), PAGE_EXECUTE_READ, &oldProtect))
+		{
+			::VirtualFree(mem, 0, MEM_RELEASE);
+			return { };
+		}
+		return out;
+	}
+
+	const gan::MemAddr m_code;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class ClosureSlot: The TLS slot through which closure thunks pass callable
+//                    objects to invokers. It's accessed in the TEB directly,
+//                    both for speed and because TlsGetValue() would reset
+//                    the last error of hooked functions. Only the slots in
+//                    the TEB itself are accessible that way.
+// ---------------------------------------------------------------------------
+
+class ClosureSlot : public gan::Singleton<ClosureSlot>
+{
+	friend class gan::Singleton<ClosureSlot>;
+
+public:
+	~ClosureSlot()
+	{
+		if (m_index != TLS_OUT_OF_INDEXES)
+			::TlsFree(m_index);
+	}
+
+	// Offset of the slot in the TEB, or std::nullopt if none is available
+	std::optional<uint32_t> GetTebOffset() const noexcept
+	{
+		if (m_index == TLS_OUT_OF_INDEXES)
+			return std::nullopt;
+		return k_tlsSlotsOffset + m_index * static_cast<uint32_t>(sizeof(void*));
+	}
+
+	void* Read() const noexcept
+	{
+		const uint32_t offset = k_tlsSlotsOffset + m_index * static_cast<uint32_t>(sizeof(void*));
+#if defined(_WIN64)
+		return reinterpret_cast<void*>(__readgsqword(offset));
+#else
+		return reinterpret_cast<void*>(__readfsdword(offset));
+#endif
+	}
+
+private:
+	constexpr static uint32_t k_tlsSlotsOffset = gan::Is64() ? 0x1480 : 0xE10;  // TEB::TlsSlots
+
+	ClosureSlot()
+		: m_index(::TlsAlloc())
+	{
+		if (m_index != TLS_OUT_OF_INDEXES && m_index >= TLS_MINIMUM_AVAILABLE)
+		{
+			::TlsFree(m_index);  // In TEB::TlsExpansionSlots
+			m_index = TLS_OUT_OF_INDEXES;
+		}
+	}
+
+	DWORD m_index;
+};
+
+
+// With RelShortJmpToAux, the returned strategy owns a claimed code cave.
 PrologStrategy DetermineStrategy(gan::MemAddr origFunc, gan::MemAddr hookFunc)
 {
 	constexpr uint8_t k_lenRelShortJmpToAux = OpcodeGenerator::RelShortJmp8::k_length;
@@ -497,7 +1906,7 @@ PrologStrategy DetermineStrategy(gan::MemAddr origFunc, gan::MemAddr hookFunc)
 	constexpr uint8_t k_lenAbsoluteJmpRax = OpcodeGenerator::AbsLongJmpRax::k_length;
 
 	constexpr PrologStrategy k_RelNearJmp32 { PrologStrategy::Type::RelNearJmp32 };
-	constexpr PrologStrategy k_AbsoluteJmp64 { PrologStrategy::Type::AbsoluteJmp64 };
+	constexpr PrologStrategy k_RelNearJmp32ToRelay { PrologStrategy::Type::RelNearJmp32ToRelay };
 
 	if constexpr (gan::Is64())
 	{
@@ -508,26 +1917,19 @@ PrologStrategy DetermineStrategy(gan::MemAddr origFunc, gan::MemAddr hookFunc)
 		if (addrDiff < 0x7FFF'FFFFull - k_lenRelNearJmp32)  // disp is signed
 			return k_RelNearJmp32;  // Addressable with 32-bit displacement
 
-		for (intptr_t i = k_lenRelShortJmpToAux; i < 127 + k_lenRelShortJmpToAux - k_lenAbsoluteJmpRax; ++i)
-		{
-			auto start = origFunc.Offset(i).ConstPtr<uint8_t>();
-			auto end = origFunc.Offset(i + k_lenAbsoluteJmpRax).ConstPtr<uint8_t>();
-			if (std::all_of(start, end, [](uint8_t c) { return c == 0xCC; } ))
-			{
-				return {
-					PrologStrategy::Type::RelShortJmpToAux,
-					static_cast<uint8_t>(i - k_lenRelShortJmpToAux)
-				};
-			}
-		}
+		// The cave must be released if the strategy doesn't end up being used.
+		const auto jumpEnd = origFunc.Offset(k_lenRelShortJmpToAux);
+		if (const auto cave = CodeCaveIndex::GetInstance().Claim(jumpEnd, k_lenAbsoluteJmpRax))
+			return { PrologStrategy::Type::RelShortJmpToAux, static_cast<int8_t>(*cave - jumpEnd) };
 
-		return k_AbsoluteJmp64;  // worst case scenario
+		return k_RelNearJmp32ToRelay;  // worst case scenario
 	}
 	else
 		return k_RelNearJmp32;
 }
 
 
+// For RelNearJmp32ToRelay, "hookFunc" is the address of the relay.
 Prolog GenerateHookProlog(gan::MemAddr origFunc, gan::MemAddr hookFunc, PrologStrategy strategy) noexcept
 {
 	Prolog result;
@@ -536,34 +1938,377 @@ Prolog GenerateHookProlog(gan::MemAddr origFunc, gan::MemAddr hookFunc, PrologSt
 		if (strategy.type == PrologStrategy::Type::RelShortJmpToAux)
 			result.length = OpcodeGenerator::RelShortJmp8::Make(hookFunc, strategy.imm8, result.opcode);
 
-		else if (strategy.type == PrologStrategy::Type::RelNearJmp32)
+		else if (strategy.type == PrologStrategy::Type::RelNearJmp32
+			|| strategy.type == PrologStrategy::Type::RelNearJmp32ToRelay)
+		{
 			result.length = OpcodeGenerator::RelNearJmp32::Make(origFunc, hookFunc, result.opcode);
+		}
+
+		else if (strategy.type == PrologStrategy::Type::AbsoluteJmp64)
+			result.length = OpcodeGenerator::AbsLongJmpRax::Make(hookFunc, result.opcode);
+	}
+	else
+		result.length = OpcodeGenerator::RelNearJmp32::Make(origFunc, hookFunc, result.opcode);
+
+	assert(result.length > 0);
+	return result;
+}
+
+
+// ---------------------------------------------------------------------------
+// Class PatchTrap: Holds threads back from patches which are written behind
+//                  an INT3. Its vectored exception handler, registered once
+//                  and kept until the process exits, sends a thread running
+//                  into such an INT3 back to it, so that the thread spins
+//                  there as on "jmp $" until the patch is complete. A
+//                  debugger gets to see these breakpoints first though.
+// ---------------------------------------------------------------------------
+
+class PatchTrap : public gan::Singleton<PatchTrap>
+{
+	friend class gan::Singleton<PatchTrap>;
+
+public:
+	// False if the handler couldn't be registered
+	bool IsReady() const noexcept	{ return m_handler != nullptr; }
+
+	// Before the INT3s are written
+	void Arm(std::span<const gan::MemAddr> addrs)
+	{
+		std::unique_lock lock(m_mutex);
+		m_armed.insert(addrs.begin(), addrs.end());
+	}
+
+	// After the INT3s have been replaced and execution has been serialized
+	void Disarm(std::span<const gan::MemAddr> addrs)
+	{
+		std::unique_lock lock(m_mutex);
+		for (const auto addr : addrs)
+			m_armed.erase(m_armed.find(addr));
+	}
+
+private:
+	PatchTrap() noexcept
+		: m_armed()
+		, m_mutex()
+		, m_handler(::AddVectoredExceptionHandler(1, &Handle))
+	{ }
+
+	static LONG CALLBACK Handle(EXCEPTION_POINTERS* info) noexcept
+	{
+		if (info->ExceptionRecord->ExceptionCode != EXCEPTION_BREAKPOINT)
+			return EXCEPTION_CONTINUE_SEARCH;
+
+		// The INT3 may have been replaced since the thread ran into it, and then it's no longer armed.
+		const gan::MemAddr addr{ info->ExceptionRecord->ExceptionAddress };
+		if (!GetInstance().IsArmed(addr) && addr.Ref<volatile uint8_t>() == 0xCC)
+			return EXCEPTION_CONTINUE_SEARCH;
+
+		_mm_pause();
+#if defined(_WIN64)
+		info->ContextRecord->Rip = reinterpret_cast<DWORD64>(addr.Ptr());
+#else
+		info->ContextRecord->Eip = reinterpret_cast<DWORD>(addr.Ptr());
+#endif
+		return EXCEPTION_CONTINUE_EXECUTION;
+	}
+
+	bool IsArmed(gan::MemAddr addr) const
+	{
+		std::shared_lock lock(m_mutex);
+		return m_armed.contains(addr);
+	}
+
+	std::multiset<gan::MemAddr> m_armed;  // Batches on different pages may be written at the same time.
+	mutable std::shared_mutex m_mutex;
+	void* m_handler;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class PatchBatch: Writes a batch of patches to code memory. Every page
+//                   touched is made writable once for all patches on it, and
+//                   nothing is written unless all of the pages are writable.
+//
+// Code which other threads may be running never shows them a torn
+// instruction. A patch is written with a single locked store if it fits in
+// an aligned qword (oword on amd64). Otherwise "jmp $" is stored over its
+// first two bytes, so that threads arriving there spin in place while the
+// rest is written, and the first two bytes are replaced last. A store across
+// a cache line isn't atomic to instruction fetches, so a patch starting at
+// the last byte of one gets an INT3 caught by PatchTrap instead. Every step
+// is followed by serializing all processors, as cross-modifying code
+// requires.
+// This doesn't help a thread which was interrupted between two instructions
+// of the patched range, since it resumes in the middle of the new code.
+// ---------------------------------------------------------------------------
+
+class PatchBatch
+{
+public:
+	enum class Target : uint8_t
+	{
+		Live,		// Code which other threads may be running
+		Unreached,	// Code which can't be run until a live patch leads to it, or after one led away from it
+	};
+
+	// "tag" identifies the owner of a patch in the result of Apply()
+	void Add(gan::MemAddr address, std::span<const uint8_t> data, size_t tag, Target target = Target::Live)
+	{
+		assert(data.size() <= Prolog::k_maxSize);
+
+		Patch& patch = m_patches.emplace_back(Patch{ .address = address, .tag = tag, .target = target });
+		memcpy(patch.data, data.data(), data.size());
+		patch.length = static_cast<uint8_t>(data.size());
+	}
+
+	// Patches are written in the order they are added, except that consecutive live patches are written
+	// together to serialize only a few times for all of them. On failure, returns the tag of a patch on the
+	// page which couldn't be made writable, or of one needing PatchTrap if it isn't ready.
+	std::expected<void, size_t> Apply() const
+	{
+		const auto needsTrap = [](const Patch& patch) noexcept {
+			return patch.target == Target::Live && NeedsTrap(patch.address, patch.length);
+		};
+		if (const auto patch = std::ranges::find_if(m_patches, needsTrap); patch != m_patches.end() && !PatchTrap::GetInstance().IsReady())
+			return std::unexpected{ patch->tag };
+
+		const size_t pageSize = GetPageSize();
+		const auto pageMask = ~(pageSize - 1);
+
+		struct PageProtection
+		{
+			gan::MemAddr page;
+			DWORD oldProtect;
+			size_t tag;
+		};
+		std::vector<PageProtection> pages;
+		pages.reserve(m_patches.size());
+		for (const auto& patch : m_patches)
+		{
+			const auto firstPage = patch.address & pageMask;
+			const auto lastPage = patch.address.Offset(patch.length - 1) & pageMask;
+			for (auto page = firstPage; page <= lastPage; page = page.Offset(static_cast<intptr_t>(pageSize)))
+				pages.emplace_back(page, DWORD{ }, patch.tag);
+		}
+		std::ranges::sort(pages, std::less<gan::MemAddr>{ }, &PageProtection::page);
+		const auto [dupBegin, dupEnd] = std::ranges::unique(pages, std::equal_to<gan::MemAddr>{ }, &PageProtection::page);
+		pages.erase(dupBegin, dupEnd);
+
+		// Another batch on the same page would otherwise take PAGE_EXECUTE_READWRITE as the protection to restore.
+		std::vector<gan::MemAddr> pageAddrs;
+		pageAddrs.reserve(pages.size());
+		std::ranges::transform(pages, std::back_inserter(pageAddrs), &PageProtection::page);
+		static StripedLocks s_pageLocks;
+		const auto lock = s_pageLocks.Lock(pageAddrs);
+
+		const auto restorePages = [pageSize](std::span<const PageProtection> pagesToRestore) noexcept {
+			for (const auto& page : pagesToRestore)
+			{
+				DWORD dummy{ };
+				::VirtualProtect(page.page.Ptr(), pageSize, page.oldProtect, &dummy);
+			}
+		};
+
+		for (auto i : std::views::iota(0uz, pages.size()))
+		{
+			if (!::VirtualProtect(pages[i].page.Ptr(), pageSize, PAGE_EXECUTE_READWRITE, &pages[i].oldProtect))
+			{
+				restorePages(std::span(pages).first(i));
+				return std::unexpected{ pages[i].tag };
+			}
+		}
+
+		for (auto first = m_patches.begin(); first != m_patches.end(); )
+		{
+			if (first->target == Target::Unreached)
+			{
+				memcpy(first->address.Ptr<uint8_t>(), first->data, first->length);
+				++first;
+				continue;
+			}
+			const auto last = std::find_if(first, m_patches.end(), [](const Patch& patch) noexcept {
+				return patch.target != Target::Live;
+			});
+			WriteLive(std::span(first, last));
+			first = last;
+		}
+
+		restorePages(pages);
+		return { };
+	}
+
+private:
+	constexpr static size_t k_cacheLineSize = 64;
+
+	struct Patch
+	{
+		gan::MemAddr address;
+		size_t tag;
+		Target target;
+		uint8_t data[Prolog::k_maxSize] { };
+		uint8_t length { 0 };
+	};
+
+	static void WriteLive(std::span<const Patch> patches)
+	{
+		// Trailing bytes which are already in place needn't be written. A restored prolog usually ends with
+		// instructions the hook prolog didn't cover, so that what's left often fits in a single store.
+		std::vector<uint8_t> lengths;
+		lengths.reserve(patches.size());
+		bool anySplit = false;
+		for (const auto& patch : patches)
+		{
+			const uint8_t* dest = patch.address.Ptr<uint8_t>();
+			uint8_t length = patch.length;
+			while (length > 0 && dest[length - 1] == patch.data[length - 1])
+				--length;
+			lengths.emplace_back(length);
+			anySplit |= !CanWriteAtomically(patch.address, length);
+		}
+
+		constexpr static uint8_t k_selfJmp[] { 0xEB, 0xFE };  // jmp $
+		constexpr static uint8_t k_int3[] { 0xCC };
+		const auto getStopper = [](gan::MemAddr address, size_t length) noexcept {
+			return NeedsTrap(address, length) ? std::span<const uint8_t>(k_int3) : std::span<const uint8_t>(k_selfJmp);
+		};
+
+		std::vector<gan::MemAddr> trapped;
+		for (auto i : std::views::iota(0uz, patches.size()))
+		{
+			if (NeedsTrap(patches[i].address, lengths[i]))
+				trapped.emplace_back(patches[i].address);
+		}
+		if (!trapped.empty())
+			PatchTrap::GetInstance().Arm(trapped);
+
+		if (anySplit)
+		{
+			for (auto i : std::views::iota(0uz, patches.size()))
+			{
+				if (!CanWriteAtomically(patches[i].address, lengths[i]))
+					WriteAtomically(patches[i].address, getStopper(patches[i].address, lengths[i]));
+			}
+			SerializeExecution();
+
+			// Nobody gets past the first bytes of these patches now.
+			for (auto i : std::views::iota(0uz, patches.size()))
+			{
+				if (!CanWriteAtomically(patches[i].address, lengths[i]))
+				{
+					const size_t stopperLength = getStopper(patches[i].address, lengths[i]).size();
+					const auto tail = std::span(patches[i].data, lengths[i]).subspan(stopperLength);
+					memcpy(patches[i].address.Offset(static_cast<intptr_t>(stopperLength)).Ptr<uint8_t>(), tail.data(), tail.size());
+				}
+			}
+			SerializeExecution();
+		}
+
+		for (auto i : std::views::iota(0uz, patches.size()))
+		{
+			if (lengths[i] > 0)
+			{
+				const size_t headLength = CanWriteAtomically(patches[i].address, lengths[i]) ? lengths[i] : getStopper(patches[i].address, lengths[i]).size();
+				WriteAtomically(patches[i].address, std::span(patches[i].data, headLength));
+			}
+		}
+		SerializeExecution();
+
+		if (!trapped.empty())
+			PatchTrap::GetInstance().Disarm(trapped);
+	}
+
+	// Two bytes can be written anywhere within a cache line.
+	static bool CanWriteAtomically(gan::MemAddr address, size_t length) noexcept
+	{
+		const auto offsetInQword = static_cast<size_t>(address - (address & ~size_t{ 7 }));
+		const auto offsetInOword = static_cast<size_t>(address - (address & ~size_t{ 15 }));
+		const auto offsetInLine = static_cast<size_t>(address - (address & ~(k_cacheLineSize - 1)));
+		return length <= 1
+			|| (length == 2 && offsetInLine + length <= k_cacheLineSize)
+			|| offsetInQword + length <= 8
+			|| (gan::Is64() && offsetInOword + length <= 16);
+	}
 
-		else if (strategy.type == PrologStrategy::Type::AbsoluteJmp64)
-			result.length = OpcodeGenerator::AbsLongJmpRax::Make(hookFunc, result.opcode);
+	// Whether a patch can't even be stopped with "jmp $"
+	static bool NeedsTrap(gan::MemAddr address, size_t length) noexcept
+	{
+		return !CanWriteAtomically(address, length) && !CanWriteAtomically(address, 2);
 	}
-	else
-		result.length = OpcodeGenerator::RelNearJmp32::Make(origFunc, hookFunc, result.opcode);
 
-	assert(result.length > 0);
-	return result;
-}
+	// Replaces the bytes at "address" with a single locked instruction, leaving the bytes around them as they are
+	static void WriteAtomically(gan::MemAddr address, std::span<const uint8_t> data) noexcept
+	{
+		assert(CanWriteAtomically(address, data.size()));
 
+		const gan::MemAddr qword = address & ~size_t{ 7 };
+		const auto offsetInQword = static_cast<size_t>(address - qword);
+		if (offsetInQword + data.size() <= 8)
+		{
+			auto* dest = qword.Ptr<volatile long long>();
+			long long expected = *dest;
+			while (true)
+			{
+				long long desired = expected;
+				memcpy(reinterpret_cast<uint8_t*>(&desired) + offsetInQword, data.data(), data.size());
+				const long long prev = _InterlockedCompareExchange64(dest, desired, expected);
+				if (prev == expected)
+					return;
+				expected = prev;
+			}
+		}
 
-bool WriteMemory(gan::MemAddr address, const std::span<const uint8_t>& data) noexcept
-{
-	auto rawPtr = address.Ptr<uint8_t>();
+#if defined(_WIN64)
+		const gan::MemAddr oword = address & ~size_t{ 15 };
+		const auto offsetInOword = static_cast<size_t>(address - oword);
+		if (offsetInOword + data.size() <= 16)
+		{
+			auto* dest = oword.Ptr<volatile long long>();
+			alignas(16) long long expected[2] { dest[0], dest[1] };
+			while (true)
+			{
+				alignas(16) long long desired[2] { expected[0], expected[1] };
+				memcpy(reinterpret_cast<uint8_t*>(desired) + offsetInOword, data.data(), data.size());
+				if (_InterlockedCompareExchange128(dest, desired[1], desired[0], expected))
+					return;
+			}
+		}
+#endif  // _WIN64
 
-	DWORD oldAttr{ };
-	::VirtualProtect(rawPtr, data.size(), PAGE_EXECUTE_READWRITE, &oldAttr);
+		// Two bytes crossing a qword (oword on amd64) within a cache line
+		auto* dest = address.Ptr<volatile short>();
+		short expected = *dest;
+		while (true)
+		{
+			short desired;
+			memcpy(&desired, data.data(), sizeof(desired));
+			const short prev = _InterlockedCompareExchange16(dest, desired, expected);
+			if (prev == expected)
+				return;
+			expected = prev;
+		}
+	}
 
-	memcpy(rawPtr, data.data(), data.size());
+	// The IPIs sent by FlushProcessWriteBuffers() make every processor running a thread of this process execute
+	// a serializing instruction, so that none of them keeps running code it fetched before the writes.
+	static void SerializeExecution() noexcept
+	{
+		::FlushInstructionCache(::GetCurrentProcess(), nullptr, 0);
+		::FlushProcessWriteBuffers();
+	}
 
-	DWORD dummy{ };
-	::VirtualProtect(rawPtr, data.size(), oldAttr, &dummy);
+	static size_t GetPageSize() noexcept
+	{
+		static const size_t s_pageSize = [] {
+			SYSTEM_INFO sysInfo;
+			::GetSystemInfo(&sysInfo);
+			return static_cast<size_t>(sysInfo.dwPageSize);
+		}();
+		return s_pageSize;
+	}
 
-	return true;
-}
+	std::vector<Patch> m_patches;
+};
 
 
 // ---------------------------------------------------------------------------
@@ -582,18 +2327,20 @@ public:
 			return false;
 	}
 
-	static bool Create(gan::MemAddr origFunc, gan::MemAddr hookFunc, uint8_t offsetToAux) noexcept
+	static void Create(PatchBatch& batch, size_t tag, gan::MemAddr origFunc, gan::MemAddr hookFunc, int8_t offsetToAux)
 	{
 		constexpr PrologStrategy k_strategyAbsLongJmp { PrologStrategy::Type::AbsoluteJmp64 };
 		const auto mainHookProlog = GenerateHookProlog(origFunc, hookFunc, k_strategyAbsLongJmp);
 
-		return WriteMemory(
+		batch.Add(
 			origFunc.Offset(OpcodeGenerator::RelShortJmp8::k_length).Offset(offsetToAux),
-			std::span(mainHookProlog.opcode, mainHookProlog.length)
+			std::span(mainHookProlog.opcode, mainHookProlog.length),
+			tag,
+			PatchBatch::Target::Unreached
 		);
 	}
 
-	static bool Delete(gan::MemAddr origFunc, uint8_t offsetToAux) noexcept
+	static void Delete(PatchBatch& batch, size_t tag, gan::MemAddr auxProlog)
 	{
 		static_assert(OpcodeGenerator::AbsLongJmpRax::k_length == 12);
 		const static uint8_t k_int3Opcodes[OpcodeGenerator::AbsLongJmpRax::k_length] {
@@ -601,9 +2348,11 @@ public:
 			0xCC, 0xCC, 0xCC, 0xCC,
 			0xCC, 0xCC, 0xCC, 0xCC
 		};
-		return WriteMemory(
-			origFunc.Offset(OpcodeGenerator::RelShortJmp8::k_length).Offset(offsetToAux),
-			std::span(k_int3Opcodes)
+		batch.Add(
+			auxProlog,
+			std::span(k_int3Opcodes),
+			tag,
+			PatchBatch::Target::Unreached
 		);
 	}
 };
@@ -746,120 +2495,154 @@ Trampoline GenerateTrampoline(gan::MemAddr origFuncAddr, const Prolog& prolog) n
 }
 
 
-}  // unnamed namespace
+Trampoline GenerateRelay(gan::MemAddr hookFunc) noexcept
+{
+	Trampoline result;
+	if constexpr (gan::Is64())
+		OpcodeGenerator::AbsIndirectJmp64::Make(hookFunc, reinterpret_cast<uint8_t(&)[14]>(result.opcode));  // ugly...
+	return result;
+}
+
 
+// Links may be read and relinked while being executed.
+gan::MemAddr GetLinkTarget(gan::MemAddr link) noexcept
+{
+	auto& target = link.Offset(OpcodeGenerator::LayerLink::k_targetOffset).Ref<void*>();
+	return gan::MemAddr{ std::atomic_ref(target).load(std::memory_order_acquire) };
+}
 
 
-namespace gan
+void SetLinkTarget(gan::MemAddr link, gan::MemAddr targetAddr) noexcept
 {
+	auto& target = link.Offset(OpcodeGenerator::LayerLink::k_targetOffset).Ref<void*>();
+	std::atomic_ref(target).store(targetAddr.Ptr(), std::memory_order_release);
+}
 
 
-// ---------------------------------------------------------------------------
-// Class Hook
-// ---------------------------------------------------------------------------
+// Toggleable and layered hooks and probes always jump to a stub, which is allocated close to the target function.
+constexpr PrologStrategy k_stubStrategy {
+	gan::Is64() ? PrologStrategy::Type::RelNearJmp32ToRelay : PrologStrategy::Type::RelNearJmp32
+};
 
-Hook::OpResult Hook::Install()
+
+// Everything needed to install a hook, prepared without touching the target function
+struct InstallPlan
 {
-	if (m_hooked)
-		return OpResult::Hooked;
+	PrologStrategy strategy;
+	Prolog hookProlog;  // only its length is valid until the relay is allocated, if there's one
+	PrologWithDisp origProlog;
+	Trampoline trampoline;
+	gan::MemRange trampolineRange;  // where all displacements in the trampoline are addressable
+	std::optional<Trampoline> relay;  // for RelNearJmp32ToRelay, or the stub of a toggleable or layered hook or a probe
+	gan::MemRange relayRange;  // where the relay is reachable from the hook prolog
+	gan::Hook::Dispatch dispatch;  // unless Direct, "relay" is a placeholder until the trampoline is allocated
+};
 
-	HookRegistry& hookReg = HookRegistry::GetInstance();
-	if (hookReg.GetTrampoline(m_funcOrig))
-		return OpResult::AddressInUse;
 
-	// Determine what should be written to the target function.
-	auto strategy = DetermineStrategy(m_funcOrig, m_funcHook);
-	if (AuxiliaryPrologHelper::ShouldUseAuxProlog(strategy.type)
-		&& !AuxiliaryPrologHelper::Create(m_funcOrig, m_funcHook, strategy.imm8))
-	{
-		strategy.type = PrologStrategy::Type::AbsoluteJmp64;  // Fall back to writing the absolute jump in place.
-	}
+std::optional<InstallPlan> PlanInstall(gan::MemAddr origFunc, gan::MemAddr hookFunc, PrologStrategy strategy, gan::Hook::Dispatch dispatch)
+{
+	const bool usesStub = dispatch != gan::Hook::Dispatch::Direct;
+	const bool usesRelay = strategy.type == PrologStrategy::Type::RelNearJmp32ToRelay || usesStub;
 
-	// Generate a new prolog and backup the original one.
-	const auto hookProlog = GenerateHookProlog(m_funcOrig, m_funcHook, strategy);
-	const auto origProlog = CopyProlog(m_funcOrig, hookProlog.length);
+	// Generate a new prolog and backup the original one. With a relay, the prolog is generated
+	// again once the relay is allocated, but the length is the same.
+	const auto hookProlog = GenerateHookProlog(origFunc, usesRelay ? origFunc : hookFunc, strategy);
+	auto origProlog = CopyProlog(origFunc, hookProlog.length);
 	if (!origProlog)
-		return OpResult::PrologNotSupported;
+		return std::nullopt;
 
 	// Trampoline to get back to the original function body
-	const auto trampoline = GenerateTrampoline(m_funcOrig, origProlog->prolog);
+	const auto trampoline = GenerateTrampoline(origFunc, origProlog->prolog);
 
 	// Find the address range in which all displacements of the original prolog are addressable.
 	// Address of the original function is also taken into consideration.
-	const auto desiredTramAddrRange = GetAddressableRange(m_funcOrig, origProlog->displacements);
+	const auto trampolineRange = GetAddressableRange(origFunc, origProlog->displacements);
+
+	return InstallPlan{
+		.strategy = strategy,
+		.hookProlog = hookProlog,
+		.origProlog = std::move(*origProlog),
+		.trampoline = trampoline,
+		.trampolineRange = trampolineRange,
+		.relay = usesStub ? std::make_optional(Trampoline{ }) : usesRelay ? std::make_optional(GenerateRelay(hookFunc)) : std::nullopt,
+		.relayRange = GetAddressableRange(origFunc, { }),
+		.dispatch = dispatch
+	};
+}
 
-	// Allocate memory and fix up displacements for trampoline.
-	TrampolineRegistry& trampolineReg = TrampolineRegistry::GetInstance();
-	const auto trampolineAddr = trampolineReg.Register(trampoline, desiredTramAddrRange);
-	if (!trampolineAddr)
-		return OpResult::TrampolineAllocFailed;
-	if (origProlog->displacements.size() > 0)
-		FixupDisplacements(trampolineAddr, origProlog->displacements);
 
-	// Register hook and modify memory
-	const HookRegistry::Record newHookRecord {
-		.original = origProlog->prolog,
-		.modified = hookProlog,
-		.trampoline = trampolineAddr,
-		.strategy = strategy
-	};
-	if (hookReg.Register(m_funcOrig, newHookRecord))
-	{
-		if (WriteMemory(m_funcOrig, std::span(hookProlog.opcode, hookProlog.length)))
-		{
-			m_hooked = true;
-			return OpResult::Hooked;
-		}
-		else
-			hookReg.Unregister(m_funcOrig);
-	}
+// Where the auxiliary prolog is written if "strategy" needs one
+gan::MemAddr GetAuxPrologAddr(gan::MemAddr origFunc, PrologStrategy strategy) noexcept
+{
+	return origFunc.Offset(OpcodeGenerator::RelShortJmp8::k_length).Offset(strategy.imm8);
+}
+
 
-	trampolineReg.Unregister(trampolineAddr);
-	if (AuxiliaryPrologHelper::ShouldUseAuxProlog(strategy.type))
-		AuxiliaryPrologHelper::Delete(m_funcOrig, strategy.imm8);
-	return OpResult::AccessDenied;
+// Wipes the auxiliary prologs retired a grace period ago, so that their caves can be claimed again. If a page of
+// theirs can't be made writable, the caves are dropped instead.
+void ReclaimCodeCaves()
+{
+	CodeCaveIndex& caveIndex = CodeCaveIndex::GetInstance();
+	const auto caves = caveIndex.TakeRetired();
+	if (caves.empty())
+		return;
+
+	PatchBatch wipes;
+	for (auto i : std::views::iota(0uz, caves.size()))
+		AuxiliaryPrologHelper::Delete(wipes, i, caves[i]);
+	if (!wipes.Apply())
+		return;
+
+	for (const auto cave : caves)
+		caveIndex.Release(cave, OpcodeGenerator::AbsLongJmpRax::k_length);
 }
 
 
-Hook::OpResult Hook::Uninstall()
+}  // unnamed namespace
+
+
+
+namespace gan
 {
-	if (!m_hooked)
-		return OpResult::NotHooked;
 
-	HookRegistry& hookReg = HookRegistry::GetInstance();
-	if (const auto record = hookReg.LookUp(m_funcOrig))
-	{
-		const Prolog& expectedHookProlog = record->modified;
 
-		// Make sure the prolog altered by our hook hasn't been modified by others.
-		if (memcmp(m_funcOrig.Ptr<uint8_t>(), expectedHookProlog.opcode, expectedHookProlog.length) != 0)
-			return OpResult::PrologMismatched;
+// ---------------------------------------------------------------------------
+// Class Hook
+// ---------------------------------------------------------------------------
+
+Hook::OpResult Hook::Install()
+{
+	if (m_hooked)
+		return OpResult::Hooked;
 
-		// We don't expect user making hook modification across threads. Thus no check
-		// is made against the results from LookUp() and Unregister().
-		hookReg.Unregister(m_funcOrig);
+	HookTransaction transaction;
+	transaction.Install(*this);
+	const auto result = transaction.Commit();
+	return result ? OpResult::Hooked : result.error().result;
+}
 
-		const Prolog& origProlog = record->original;
-		if (WriteMemory(m_funcOrig, std::span(origProlog.opcode, origProlog.length)))
-		{
-			TrampolineRegistry::GetInstance().Unregister(record->trampoline);
-		}
-		else
-		{
-			// Failed to write memory somehow. Have to restore hook registry.
-			hookReg.Register(m_funcOrig, *record);
-			return OpResult::AccessDenied;
-		}
 
-		if (AuxiliaryPrologHelper::ShouldUseAuxProlog(record->strategy.type))
-			AuxiliaryPrologHelper::Delete(m_funcOrig, record->strategy.imm8);
+Hook::OpResult Hook::Uninstall()
+{
+	if (!m_hooked)
+		return OpResult::NotHooked;
 
-		m_hooked = false;
+	HookTransaction transaction;
+	transaction.Uninstall(*this);
+	const auto result = transaction.Commit();
+	if (result)
 		return OpResult::Unhooked;
-	}
 
-	m_hooked = false;
-	return OpResult::NotHooked;
+	if (result.error().result == OpResult::NotHooked)
+	{
+		// The record is gone somehow. There's nothing left to uninstall.
+		if (m_trampolineSlot)
+			*m_trampolineSlot = nullptr;
+		m_original = MemAddr{ };
+		std::atomic_ref(m_dispatchFlag).store(nullptr);
+		m_hooked = false;
+	}
+	return result.error().result;
 }
 
 
@@ -879,4 +2662,462 @@ ConstMemAddr Hook::GetTrampolineAddr(ConstMemAddr origFunc)
 }
 
 
+void Hook::SetGracePeriod(std::chrono::milliseconds gracePeriod) noexcept
+{
+	assert(gracePeriod.count() >= 0);
+	s_gracePeriodMs.store(static_cast<uint64_t>(gracePeriod.count()), std::memory_order_relaxed);
+}
+
+
+std::chrono::milliseconds Hook::GetGracePeriod() noexcept
+{
+	return std::chrono::milliseconds{ s_gracePeriodMs.load(std::memory_order_relaxed) };
+}
+
+
+
+
+// ---------------------------------------------------------------------------
+// Class Probe
+// ---------------------------------------------------------------------------
+
+std::optional<uint8_t> Probe::GetPatchLength(ConstMemAddr addr)
+{
+	const auto hookProlog = GenerateHookProlog(addr.ConstCast(), addr.ConstCast(), k_stubStrategy);
+	const auto origProlog = CopyProlog(addr, hookProlog.length);
+	return origProlog ? std::make_optional(origProlog->prolog.length) : std::nullopt;
+}
+
+
+
+
+
+// ---------------------------------------------------------------------------
+// Class Closure
+// ---------------------------------------------------------------------------
+
+MemAddr internal::_CreateClosureThunk(void* callable, MemAddr invoker)
+{
+	const auto slotOffset = ClosureSlot::GetInstance().GetTebOffset();
+	if (!slotOffset)
+		return MemAddr{ };
+
+	// Near the invoker, so that thunks stay close to the code which uses them
+	const Trampoline placeholder{ };
+	const auto range = GetAddressableRange(invoker, { });
+	const auto allocated = TrampolineRegistry::GetInstance().RegisterBatch(std::span(&placeholder, 1), std::span(&range, 1));
+	if (!allocated)
+		return MemAddr{ };
+
+	const MemAddr thunk = allocated->front();
+	OpcodeGenerator::ClosureThunk::Make(thunk, callable, invoker, *slotOffset, thunk.Ref<uint8_t[Trampoline::k_size]>());
+	return thunk;
+}
+
+
+void internal::_DestroyClosureThunk(MemAddr thunk) noexcept
+{
+	TrampolineRegistry::GetInstance().UnregisterBatch(std::span(&thunk, 1));
+}
+
+
+void* internal::_GetClosureCallable() noexcept
+{
+	return ClosureSlot::GetInstance().Read();
+}
+
+
+
+
+// ---------------------------------------------------------------------------
+// Class HookTransaction
+// ---------------------------------------------------------------------------
+
+void HookTransaction::Install(Hook& hook)
+{
+	m_operations.emplace_back(&hook, true);
+}
+
+
+void HookTransaction::Uninstall(Hook& hook)
+{
+	m_operations.emplace_back(&hook, false);
+}
+
+
+std::expected<void, HookTransaction::Failure> HookTransaction::Commit()
+{
+	const auto operations = std::exchange(m_operations, { });
+
+	struct PendingInstall
+	{
+		size_t index;
+		InstallPlan plan;
+	};
+	struct PendingUninstall
+	{
+		size_t index;
+		HookRegistry::Record record;
+	};
+	std::vector<PendingInstall> installs;
+	std::vector<PendingUninstall> uninstalls;
+
+	// Layers added to or removed from targets which stay hooked. Their prologs aren't touched.
+	struct PendingLayerChange
+	{
+		size_t index;
+		HookRegistry::Record record;
+	};
+	std::vector<PendingLayerChange> layerAdditions;
+	std::vector<PendingLayerChange> layerRemovals;
+
+	const auto fail = [](size_t index, Hook::OpResult result) noexcept {
+		return std::unexpected{ Failure{ .index = index, .result = result } };
+	};
+
+	ReclaimCodeCaves();
+
+	// Transactions on the same targets take turns from here on. Others go on in parallel.
+	HookRegistry& hookReg = HookRegistry::GetInstance();
+	std::vector<MemAddr> targetAddrs;
+	targetAddrs.reserve(operations.size());
+	std::ranges::transform(operations, std::back_inserter(targetAddrs), [](const Operation& operation) noexcept { return operation.hook->m_funcOrig; });
+	const auto targetLock = hookReg.LockTargets(targetAddrs);
+
+	// Prepare everything without touching any code, so that nothing has to be undone on failure.
+	std::unordered_set<MemAddr> targets;
+	CodeCaveClaims caveClaims;
+	struct PendingPlan
+	{
+		size_t index;
+		PrologStrategy strategy;
+		std::optional<InstallPlan> plan;
+	};
+	std::vector<PendingPlan> plans;
+	for (auto i : std::views::iota(0uz, operations.size()))
+	{
+		Hook& hook = *operations[i].hook;
+		if (hook.m_hooked == operations[i].install)
+			continue;  // Already in the requested state
+
+		if (!targets.emplace(hook.m_funcOrig).second)
+			return fail(i, Hook::OpResult::AddressInUse);  // Two operations on the same address
+
+		const bool layered = hook.m_dispatch == Hook::Dispatch::Layered;
+		if (operations[i].install)
+		{
+			if (hookReg.GetTrampoline(hook.m_funcOrig))
+			{
+				// Only layered hooks can be put on top of each other.
+				auto record = hookReg.LookUp(hook.m_funcOrig);
+				if (!layered || !record || record->layers.empty())
+					return fail(i, Hook::OpResult::AddressInUse);
+				layerAdditions.emplace_back(i, std::move(*record));
+				continue;
+			}
+
+			if (hook.m_dispatch == Hook::Dispatch::Probe && !ProbeDispatcher::GetInstance().GetAddress())
+				return fail(i, Hook::OpResult::TrampolineAllocFailed);
+
+			const auto strategy = hook.m_dispatch != Hook::Dispatch::Direct ?
+				k_stubStrategy :
+				DetermineStrategy(hook.m_funcOrig, hook.m_funcHook);
+			if (AuxiliaryPrologHelper::ShouldUseAuxProlog(strategy.type))
+				caveClaims.Add(GetAuxPrologAddr(hook.m_funcOrig, strategy));
+			plans.emplace_back(i, strategy, std::nullopt);
+		}
+		else
+		{
+			auto record = hookReg.LookUp(hook.m_funcOrig);
+			if (!record)
+				return fail(i, Hook::OpResult::NotHooked);
+
+			if (layered)
+			{
+				const auto& layers = record->layers;
+				if (std::ranges::find(layers, hook.m_original, &HookRegistry::Record::Layer::link) == layers.end())
+					return fail(i, Hook::OpResult::NotHooked);
+				if (record->layers.size() > 1)
+				{
+					layerRemovals.emplace_back(i, std::move(*record));
+					continue;
+				}
+			}
+
+			// Make sure the prolog altered by our hook hasn't been modified by others.
+			const Prolog& expectedHookProlog = record->modified;
+			if (memcmp(hook.m_funcOrig.Ptr<uint8_t>(), expectedHookProlog.opcode, expectedHookProlog.length) != 0)
+				return fail(i, Hook::OpResult::PrologMismatched);
+			uninstalls.emplace_back(i, std::move(*record));
+		}
+	}
+
+	// Decoding and relocating prologs is the bulk of the work for large batches, and independent for each
+	// target. Spread it over the thread pool unless there are too few to be worth it.
+	constexpr size_t k_minParallelPlans = 64;
+	const auto planInstall = [&operations](PendingPlan& pending) noexcept {
+		const Hook& hook = *operations[pending.index].hook;
+		pending.plan = PlanInstall(hook.m_funcOrig, hook.m_funcHook, pending.strategy, hook.m_dispatch);
+	};
+	if (plans.size() >= k_minParallelPlans)
+		std::for_each(std::execution::par, plans.begin(), plans.end(), planInstall);
+	else
+		std::ranges::for_each(plans, planInstall);
+	for (auto& [index, strategy, plan] : plans)
+	{
+		if (!plan)
+			return fail(index, Hook::OpResult::PrologNotSupported);
+		installs.emplace_back(index, std::move(*plan));
+	}
+
+	if (installs.empty() && uninstalls.empty() && layerAdditions.empty() && layerRemovals.empty())
+		return { };
+
+	// Allocate all trampolines, relays and layer links at once.
+	std::vector<Trampoline> trampolines;
+	std::vector<MemRange> trampolineRanges;
+	std::vector<size_t> trampolineOwners;  // Operation index
+	const auto addTrampoline = [&](const Trampoline& trampoline, MemRange range, size_t index) {
+		trampolines.emplace_back(trampoline);
+		trampolineRanges.emplace_back(range);
+		trampolineOwners.emplace_back(index);
+	};
+	for (const auto& [index, plan] : installs)
+	{
+		addTrampoline(plan.trampoline, plan.trampolineRange, index);
+		if (plan.relay)
+			addTrampoline(*plan.relay, plan.relayRange, index);
+		if (plan.dispatch == Hook::Dispatch::Layered)
+			addTrampoline(Trampoline{ }, plan.relayRange, index);  // Link of the first layer
+	}
+	for (const auto& [index, record] : layerAdditions)
+		addTrampoline(Trampoline{ }, GetAddressableRange(operations[index].hook->m_funcOrig, { }), index);
+	TrampolineRegistry& trampolineReg = TrampolineRegistry::GetInstance();
+	const auto allocated = trampolineReg.RegisterBatch(trampolines, trampolineRanges);
+	if (!allocated)
+		return fail(trampolineOwners[allocated.error()], Hook::OpResult::TrampolineAllocFailed);
+
+	// Fix up displacements of trampolines, write stubs and point hook prologs to relays.
+	std::vector<MemAddr> trampolineAddrs(installs.size());
+	std::vector<MemAddr> relayAddrs(installs.size());
+	std::vector<MemAddr> originalAddrs(installs.size());  // See Hook::GetOriginal()
+	auto allocatedAddr = allocated->begin();
+	for (auto i : std::views::iota(0uz, installs.size()))
+	{
+		const Hook& hook = *operations[installs[i].index].hook;
+		InstallPlan& plan = installs[i].plan;
+		trampolineAddrs[i] = *allocatedAddr++;
+		originalAddrs[i] = trampolineAddrs[i];
+		if (plan.origProlog.displacements.size() > 0)
+			FixupDisplacements(trampolineAddrs[i], plan.origProlog.displacements);
+
+		if (plan.relay)
+		{
+			relayAddrs[i] = *allocatedAddr++;
+			if (plan.dispatch == Hook::Dispatch::Toggleable)
+			{
+				OpcodeGenerator::DispatchStub::Make(
+					relayAddrs[i],
+					hook.m_funcHook,
+					trampolineAddrs[i],
+					hook.IsEnabled(),
+					relayAddrs[i].Ref<uint8_t[Trampoline::k_size]>()
+				);
+			}
+			else if (plan.dispatch == Hook::Dispatch::Layered)
+			{
+				// The relay links to the only layer, which links to the trampoline.
+				originalAddrs[i] = *allocatedAddr++;
+				OpcodeGenerator::LayerLink::Make(relayAddrs[i], hook.m_funcHook, relayAddrs[i].Ref<uint8_t[Trampoline::k_size]>());
+				OpcodeGenerator::LayerLink::Make(originalAddrs[i], trampolineAddrs[i], originalAddrs[i].Ref<uint8_t[Trampoline::k_size]>());
+			}
+			else if (plan.dispatch == Hook::Dispatch::Probe)
+			{
+				OpcodeGenerator::ProbeStub::Make(
+					relayAddrs[i],
+					ProbeDispatcher::GetInstance().GetAddress(),
+					trampolineAddrs[i],
+					hook.m_funcHook,
+					hook.m_userData,
+					relayAddrs[i].Ref<uint8_t[Trampoline::k_size]>()
+				);
+			}
+			plan.hookProlog = GenerateHookProlog(hook.m_funcOrig, relayAddrs[i], plan.strategy);
+		}
+	}
+	std::vector<MemAddr> addedLinkAddrs(allocatedAddr, allocated->end());
+	assert(addedLinkAddrs.size() == layerAdditions.size());
+
+	// Register new hooks.
+	std::vector<std::pair<MemAddr, HookRegistry::Record>> newRecords;
+	newRecords.reserve(installs.size());
+	for (auto i : std::views::iota(0uz, installs.size()))
+	{
+		const Hook& hook = *operations[installs[i].index].hook;
+		const InstallPlan& plan = installs[i].plan;
+		newRecords.emplace_back(
+			hook.m_funcOrig,
+			HookRegistry::Record{
+				.original = plan.origProlog.prolog,
+				.modified = plan.hookProlog,
+				.trampoline = trampolineAddrs[i],
+				.relay = relayAddrs[i],
+				.strategy = plan.strategy,
+				.layers = plan.dispatch == Hook::Dispatch::Layered ?
+					std::vector{ HookRegistry::Record::Layer{ hook.m_funcHook, originalAddrs[i] } } :
+					std::vector<HookRegistry::Record::Layer>{ }
+			}
+		);
+	}
+	if (const auto registered = hookReg.RegisterBatch(newRecords); !registered)
+	{
+		trampolineReg.UnregisterBatch(*allocated);
+		return fail(installs[registered.error()].index, Hook::OpResult::AddressInUse);
+	}
+	const auto unregisterNewRecords = [&hookReg, &newRecords] {
+		std::vector<MemAddr> newHookAddrs;
+		newHookAddrs.reserve(newRecords.size());
+		std::ranges::transform(newRecords, std::back_inserter(newHookAddrs), [](const auto& record) noexcept { return record.first; });
+		hookReg.UnregisterBatch(newHookAddrs);
+	};
+
+	// A prolog overlapping another target, e.g. of a probe, may have been patched or restored by a transaction
+	// on that target since it was copied. Now that the bytes are registered, nobody else can change them.
+	for (const auto& install : installs)
+	{
+		const Prolog& original = install.plan.origProlog.prolog;
+		if (memcmp(operations[install.index].hook->m_funcOrig.Ptr<uint8_t>(), original.opcode, original.length) != 0)
+		{
+			unregisterNewRecords();
+			trampolineReg.UnregisterBatch(*allocated);
+			return fail(install.index, Hook::OpResult::AddressInUse);
+		}
+	}
+
+	// Trampoline slots must be ready before hook functions can be reached.
+	const auto setTrampolineSlots = [&operations, &installs](std::span<const MemAddr> addrs) noexcept {
+		for (auto i : std::views::iota(0uz, installs.size()))
+		{
+			if (void** slot = operations[installs[i].index].hook->m_trampolineSlot)
+				*slot = addrs.empty() ? nullptr : addrs[i].Ptr();
+		}
+	};
+	setTrampolineSlots(originalAddrs);
+
+	// Modify memory. Auxiliary prologs must be in place before the short jumps to them, and those of uninstalled
+	// hooks are left for ReclaimCodeCaves(). Prologs are patched after them, all together.
+	PatchBatch patches;
+	for (const auto& install : installs)
+	{
+		const Hook& hook = *operations[install.index].hook;
+		const InstallPlan& plan = install.plan;
+		if (AuxiliaryPrologHelper::ShouldUseAuxProlog(plan.strategy.type))
+			AuxiliaryPrologHelper::Create(patches, install.index, hook.m_funcOrig, hook.m_funcHook, plan.strategy.imm8);
+	}
+	for (const auto& install : installs)
+	{
+		const InstallPlan& plan = install.plan;
+		patches.Add(operations[install.index].hook->m_funcOrig, std::span(plan.hookProlog.opcode, plan.hookProlog.length), install.index);
+	}
+	for (const auto& uninstall : uninstalls)
+	{
+		const HookRegistry::Record& record = uninstall.record;
+		patches.Add(operations[uninstall.index].hook->m_funcOrig, std::span(record.original.opcode, record.original.length), uninstall.index);
+	}
+	if (const auto applied = patches.Apply(); !applied)
+	{
+		unregisterNewRecords();
+		trampolineReg.UnregisterBatch(*allocated);
+		setTrampolineSlots({ });
+		return fail(applied.error(), Hook::OpResult::AccessDenied);
+	}
+
+	// Nothing can fail from here on. Relink layers, each with a single atomic store.
+	std::vector<MemAddr> removedTrampolineAddrs;
+	for (auto i : std::views::iota(0uz, layerAdditions.size()))
+	{
+		const Hook& hook = *operations[layerAdditions[i].index].hook;
+		auto& layers = layerAdditions[i].record.layers;
+		const MemAddr relay = layerAdditions[i].record.relay;
+
+		// The new layer goes on top and passes calls on to the previous top layer.
+		const MemAddr link = addedLinkAddrs[i];
+		OpcodeGenerator::LayerLink::Make(link, GetLinkTarget(relay), link.Ref<uint8_t[Trampoline::k_size]>());
+		if (hook.m_trampolineSlot)
+			*hook.m_trampolineSlot = link.Ptr();
+		SetLinkTarget(relay, hook.m_funcHook);
+
+		layers.emplace(layers.begin(), hook.m_funcHook, link);
+		hookReg.SetLayers(hook.m_funcOrig, std::move(layers));
+	}
+	for (auto& [index, record] : layerRemovals)
+	{
+		const Hook& hook = *operations[index].hook;
+		auto& layers = record.layers;
+
+		// Whatever comes before the layer gets its target.
+		const auto layer = std::ranges::find(layers, hook.m_original, &HookRegistry::Record::Layer::link);
+		const MemAddr prevLink = layer == layers.begin() ? record.relay : std::prev(layer)->link;
+		SetLinkTarget(prevLink, GetLinkTarget(layer->link));
+		removedTrampolineAddrs.emplace_back(layer->link);
+
+		layers.erase(layer);
+		hookReg.SetLayers(hook.m_funcOrig, std::move(layers));
+	}
+
+	// Release what uninstalled hooks were holding.
+	std::vector<MemAddr> removedHookAddrs;
+	removedHookAddrs.reserve(uninstalls.size());
+	for (const auto& uninstall : uninstalls)
+	{
+		removedHookAddrs.emplace_back(operations[uninstall.index].hook->m_funcOrig);
+		removedTrampolineAddrs.emplace_back(uninstall.record.trampoline);
+		if (uninstall.record.relay)
+			removedTrampolineAddrs.emplace_back(uninstall.record.relay);
+		for (const auto& layer : uninstall.record.layers)
+			removedTrampolineAddrs.emplace_back(layer.link);
+		if (AuxiliaryPrologHelper::ShouldUseAuxProlog(uninstall.record.strategy.type))
+		{
+			const auto auxAddr = GetAuxPrologAddr(operations[uninstall.index].hook->m_funcOrig, uninstall.record.strategy);
+			CodeCaveIndex::GetInstance().Retire(auxAddr);
+		}
+	}
+	hookReg.UnregisterBatch(removedHookAddrs);
+	trampolineReg.UnregisterBatch(removedTrampolineAddrs);
+	caveClaims.Keep();
+
+	for (auto i : std::views::iota(0uz, installs.size()))
+	{
+		Hook& hook = *operations[installs[i].index].hook;
+		if (installs[i].plan.dispatch == Hook::Dispatch::Toggleable)
+		{
+			// The stub was made with the state at that time, which SetEnabled() may have changed since.
+			std::atomic_ref(hook.m_dispatchFlag).store(relayAddrs[i].Offset(OpcodeGenerator::DispatchStub::k_flagOffset).Ptr<uint8_t>());
+			hook.SyncDispatchFlag();
+		}
+		hook.m_original = originalAddrs[i];
+		hook.m_hooked = true;
+	}
+	for (auto i : std::views::iota(0uz, layerAdditions.size()))
+	{
+		Hook& hook = *operations[layerAdditions[i].index].hook;
+		hook.m_original = addedLinkAddrs[i];
+		hook.m_hooked = true;
+	}
+	const auto resetHook = [&operations](size_t index) noexcept {
+		Hook& hook = *operations[index].hook;
+		if (hook.m_trampolineSlot)
+			*hook.m_trampolineSlot = nullptr;
+		hook.m_original = MemAddr{ };
+		std::atomic_ref(hook.m_dispatchFlag).store(nullptr);
+		hook.m_hooked = false;
+	};
+	for (const auto& uninstall : uninstalls)
+		resetHook(uninstall.index);
+	for (const auto& removal : layerRemovals)
+		resetHook(removal.index);
+	return { };
+}
+
+
 }  // namespace gan
@@ -216,7 +216,7 @@ constexpr OpcodeDefinition k_opDefTable[] {
 	{ { 0x0F, 0xBA }, RegField::R6,	MakeFlags(Operand::R_M, Operand::Imm8) },
 
 	// CALL
-	{ 0xE8,					MakeFlags(Operand::Imm32) },
+	{ 0xE8,					MakeFlags(Operand::Imm32),	MakeFlags(MiscFlags::TreatImmAsDisp) },
 	{ 0xFF, RegField::R2,	MakeFlags(Operand::R_M) },
 	// No support for opcodes "0x9A" and "0xFF /3".
 
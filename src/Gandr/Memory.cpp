@@ -23,19 +23,18 @@
 #include <windows.h>
 
 
-namespace gan
+namespace
 {
 
 
-std::expected<MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnumerator::operator()(uint32_t pid, ConstMemRange addrRange)
+template <typename Alloc>
+auto EnumerateMemoryRegions(gan::WinHandle process, gan::ConstMemRange addrRange, const Alloc& alloc)
+	-> std::expected<gan::internal::_Vector<gan::MemoryRegion, Alloc>, gan::MemoryRegionEnumerator::Error>
 {
-	WinHandle process{ ::OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pid) };
-	return (*this)(process, addrRange);
-}
+	using namespace gan;
+	using Error = MemoryRegionEnumerator::Error;
 
-std::expected<MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnumerator::operator()(WinHandle process, ConstMemRange addrRange)
-{
-	MemoryRegionList regions;
+	internal::_Vector<MemoryRegion, Alloc> regions{ alloc };
 
 	if (addrRange.min > addrRange.max)
 		return std::unexpected{ Error::InvalidAddressRange };
@@ -81,6 +80,36 @@ std::expected<MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnume
 }
 
 
+}  // unnamed namespace
+
+
+namespace gan
+{
+
+
+std::expected<MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnumerator::operator()(uint32_t pid, ConstMemRange addrRange)
+{
+	AutoWinHandle process{ ::OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pid) };
+	return (*this)(*process, addrRange);
+}
+
+std::expected<MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnumerator::operator()(WinHandle process, ConstMemRange addrRange)
+{
+	return EnumerateMemoryRegions(process, addrRange, std::allocator<void>{ });
+}
+
+std::expected<pmr::MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnumerator::operator()(uint32_t pid, std::pmr::memory_resource* resource, ConstMemRange addrRange)
+{
+	AutoWinHandle process{ ::OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pid) };
+	return (*this)(*process, resource, addrRange);
+}
+
+std::expected<pmr::MemoryRegionList, MemoryRegionEnumerator::Error> MemoryRegionEnumerator::operator()(WinHandle process, std::pmr::memory_resource* resource, ConstMemRange addrRange)
+{
+	return EnumerateMemoryRegions(process, addrRange, std::pmr::polymorphic_allocator<>{ resource });
+}
+
+
 static_assert(MemoryStateFlags{ MemoryState::Commit } == MEM_COMMIT);
 static_assert(MemoryStateFlags{ MemoryState::Free } == MEM_FREE);
 static_assert(MemoryStateFlags{ MemoryState::Reserve } == MEM_RESERVE);
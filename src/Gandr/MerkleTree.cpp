@@ -0,0 +1,166 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <MerkleTree.h>
+
+#include <algorithm>
+#include <cassert>
+#include <execution>
+
+
+namespace
+{
+
+
+// Different seeds for leaves and inner nodes, so that a leaf can't collide with an inner node by construction.
+constexpr uint64_t k_leafSeed = 0;
+constexpr uint64_t k_nodeSeed = 0x4D65'726B'6C65'0001ull;
+
+
+}  // unnamed namespace
+
+
+namespace gan
+{
+
+
+MerkleTree::MerkleTree(ConstMemRange range, size_t leafSize)
+	: m_range(range)
+	, m_leafSize(leafSize)
+	, m_levels()
+	, m_dirtyFlags()
+{
+	assert(range.max >= range.min);
+	assert(leafSize > 0);
+
+	// An empty range still has a single (empty) leaf so that there's always a root.
+	const auto rangeSize = static_cast<size_t>(range.max - range.min);
+	auto numNodes = std::max((rangeSize + leafSize - 1) / leafSize, 1uz);
+	m_levels.emplace_back(numNodes);
+	while (numNodes > 1)
+	{
+		numNodes = (numNodes + 1) / 2;
+		m_levels.emplace_back(numNodes);
+	}
+
+	m_dirtyFlags.assign(m_levels.front().size(), true);
+}
+
+
+void MerkleTree::MarkDirty(size_t leafIndex) noexcept
+{
+	assert(leafIndex < m_dirtyFlags.size());
+	if (leafIndex < m_dirtyFlags.size())
+		m_dirtyFlags[leafIndex] = true;
+}
+
+
+void MerkleTree::MarkDirty(ConstMemRange range) noexcept
+{
+	// Clip to our own range first
+	const auto rangeMin = std::max(range.min, m_range.min);
+	const auto rangeMax = std::min(range.max, m_range.max);
+	if (rangeMin >= rangeMax)
+		return;
+
+	const auto first = static_cast<size_t>(rangeMin - m_range.min) / m_leafSize;
+	const auto last = static_cast<size_t>(rangeMax - m_range.min - 1) / m_leafSize;
+	std::fill(m_dirtyFlags.begin() + first, m_dirtyFlags.begin() + last + 1, true);
+}
+
+
+void MerkleTree::MarkAllDirty() noexcept
+{
+	std::ranges::fill(m_dirtyFlags, true);
+}
+
+
+size_t MerkleTree::Update()
+{
+	std::vector<size_t> dirtyNodes;
+	for (size_t i = 0; i < m_dirtyFlags.size(); ++i)
+	{
+		if (m_dirtyFlags[i])
+		{
+			dirtyNodes.emplace_back(i);
+			m_dirtyFlags[i] = false;
+		}
+	}
+	const auto numDirtyLeaves = dirtyNodes.size();
+	if (numDirtyLeaves == 0)
+		return 0;
+
+	// Leaves are where the bulk of the work is. Spread them over the thread pool.
+	std::for_each(
+		std::execution::par,
+		dirtyNodes.begin(),
+		dirtyNodes.end(),
+		[this](size_t leafIndex) noexcept { HashLeaf(leafIndex); }
+	);
+
+	// Walk up the tree. "dirtyNodes" stays sorted, so siblings are always adjacent.
+	for (size_t level = 1; level < m_levels.size(); ++level)
+	{
+		std::ranges::transform(dirtyNodes, dirtyNodes.begin(), [](size_t index) noexcept { return index >> 1; });
+		const auto duplicates = std::ranges::unique(dirtyNodes);
+		dirtyNodes.erase(duplicates.begin(), duplicates.end());
+
+		std::for_each(
+			std::execution::par,
+			dirtyNodes.begin(),
+			dirtyNodes.end(),
+			[this, level](size_t nodeIndex) noexcept { HashNode(level, nodeIndex); }
+		);
+	}
+
+	return numDirtyLeaves;
+}
+
+
+ConstMemRange MerkleTree::GetLeafRange(size_t leafIndex) const noexcept
+{
+	assert(leafIndex < m_levels.front().size());
+	const auto leafMin = m_range.min.Offset(leafIndex * m_leafSize);
+	const auto leafMax = std::min(leafMin.Offset(m_leafSize), m_range.max);
+	return { .min = leafMin, .max = leafMax };
+}
+
+
+void MerkleTree::HashLeaf(size_t leafIndex) noexcept
+{
+	const auto leafRange = GetLeafRange(leafIndex);
+	Hasher::GetXXH3(leafRange.min, static_cast<size_t>(leafRange.max - leafRange.min), m_levels.front()[leafIndex], k_leafSeed);
+}
+
+
+void MerkleTree::HashNode(size_t level, size_t nodeIndex) noexcept
+{
+	assert(level > 0);
+
+	// A lone child at the end of a level is hashed by itself.
+	const auto& children = m_levels[level - 1];
+	const auto firstChild = nodeIndex << 1;
+	const auto numChildren = std::min(children.size() - firstChild, 2uz);
+
+	Digest childDigests[2];
+	std::copy_n(children.begin() + firstChild, numChildren, childDigests);
+	Hasher::GetXXH3(ConstMemAddr{ childDigests }, numChildren * sizeof(Digest), m_levels[level][nodeIndex], k_nodeSeed);
+}
+
+
+}  // namespace gan
@@ -42,39 +42,36 @@ HANDLE GetModuleListSnapshop(uint32_t processId) noexcept
 	return snap;
 }
 
-gan::ModuleInfo MakeModuleInfo(const MODULEENTRY32W& moduleEntry)
+template <typename Alloc>
+gan::internal::_ModuleInfo<Alloc> MakeModuleInfo(const MODULEENTRY32W& moduleEntry, const Alloc& alloc)
 {
 	return {
 		.base{ gan::ConstMemAddr{ moduleEntry.modBaseAddr } },
 		.size{ moduleEntry.modBaseSize },
-		.imageName{ moduleEntry.szModule },
-		.imagePath{ moduleEntry.szExePath }
+		.imageName{ moduleEntry.szModule, alloc },
+		.imagePath{ moduleEntry.szExePath, alloc }
 	};
 }
 
 
-
-}  // unnamed namespace
-
-
-namespace gan
+template <typename Alloc>
+auto EnumerateModules(uint32_t processId, const Alloc& alloc)
+	-> std::expected<gan::internal::_Vector<gan::internal::_ModuleInfo<Alloc>, Alloc>, gan::ModuleEnumerator::Error>
 {
+	using Error = gan::ModuleEnumerator::Error;
 
-
-std::expected<ModuleList, ModuleEnumerator::Error> ModuleEnumerator::operator()(uint32_t processId)
-{
-	AutoWinHandle hSnap{ GetModuleListSnapshop(processId) };
+	gan::AutoWinHandle hSnap{ GetModuleListSnapshop(processId) };
 	if (!hSnap)
 		return std::unexpected{ Error::SnapshotFailed };
 
-	ModuleList moduleList;
+	gan::internal::_Vector<gan::internal::_ModuleInfo<Alloc>, Alloc> moduleList{ alloc };
 	MODULEENTRY32W modEntry{ .dwSize = sizeof(modEntry) };
 
 	for (BOOL mod32Result{ ::Module32FirstW(*hSnap, &modEntry) };
 		mod32Result;
 		mod32Result = ::Module32NextW(*hSnap, &modEntry))
 	{
-		moduleList.emplace_back(MakeModuleInfo(modEntry));
+		moduleList.emplace_back(MakeModuleInfo(modEntry, alloc));
 	}
 
 	// In a success, Module32Next() would end with returning FALSE and setting error code to ERROR_NO_MORE_FILES
@@ -84,10 +81,33 @@ std::expected<ModuleList, ModuleEnumerator::Error> ModuleEnumerator::operator()(
 	return moduleList;
 }
 
+
+}  // unnamed namespace
+
+
+namespace gan
+{
+
+
+std::expected<ModuleList, ModuleEnumerator::Error> ModuleEnumerator::operator()(uint32_t processId)
+{
+	return EnumerateModules(processId, std::allocator<void>{ });
+}
+
 std::expected<ModuleList, ModuleEnumerator::Error> ModuleEnumerator::operator()(WinHandle process)
 {
 	return (*this)(::GetProcessId(process));
 }
 
+std::expected<pmr::ModuleList, ModuleEnumerator::Error> ModuleEnumerator::operator()(uint32_t processId, std::pmr::memory_resource* resource)
+{
+	return EnumerateModules(processId, std::pmr::polymorphic_allocator<>{ resource });
+}
+
+std::expected<pmr::ModuleList, ModuleEnumerator::Error> ModuleEnumerator::operator()(WinHandle process, std::pmr::memory_resource* resource)
+{
+	return (*this)(::GetProcessId(process), resource);
+}
+
 
 }  // namespace gan
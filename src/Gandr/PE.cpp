@@ -28,7 +28,8 @@ namespace
 
 
 // Fill in data in PeHeaders::sectionHeaderList
-void SetUpSectionHeaders(gan::ConstMemAddr baseAddr, gan::PeHeaders& headers)
+template <typename Alloc>
+void SetUpSectionHeaders(gan::ConstMemAddr baseAddr, gan::internal::_PeHeaders<Alloc>& headers)
 {
 	const uint16_t numSections = headers.ntHeaders.fileHeader.NumberOfSections;
 	headers.sectionHeaderList.reserve(numSections);
@@ -47,19 +48,25 @@ void SetUpSectionHeaders(gan::ConstMemAddr baseAddr, gan::PeHeaders& headers)
 
 
 // Fill in data in PeHeaders::exportData
-void SetUpExportDirectory(gan::ConstMemAddr baseAddr, gan::PeHeaders& headers)
+template <typename Alloc>
+void SetUpExportDirectory(gan::ConstMemAddr baseAddr, gan::internal::_PeHeaders<Alloc>& headers)
 {
 	if (headers.ntHeaders.GetNumOfDataDirectories() < IMAGE_DIRECTORY_ENTRY_EXPORT)
 		return;  // IMAGE_EXPORT_DIRECTORY doesn't exist in the image
 
-	const auto& addrDir = headers.ntHeaders.GetDataDirectories()[IMAGE_DIRECTORY_ENTRY_EXPORT];
+	const IMAGE_DATA_DIRECTORY& addrDir = headers.ntHeaders.GetDataDirectories()[IMAGE_DIRECTORY_ENTRY_EXPORT];
 	if (addrDir.Size == 0)
 		return;  // Empty export directory
 
 	// Initialize .directory
 	const gan::ConstMemAddr addrExportDir = baseAddr.Offset(addrDir.VirtualAddress);
-	headers.exportData = { .directory = addrExportDir.ConstRef<IMAGE_EXPORT_DIRECTORY>() };
-	const auto& exportDir = headers.exportData->directory;
+	using ExportData = gan::internal::_ImageExportData<Alloc>;
+	const auto alloc = headers.sectionHeaderList.get_allocator();
+	headers.exportData.emplace(ExportData{
+		.directory = addrExportDir.ConstRef<IMAGE_EXPORT_DIRECTORY>(),
+		.functions = typename ExportData::ExportedFunctionList{ alloc }
+	});
+	const IMAGE_EXPORT_DIRECTORY& exportDir = headers.exportData->directory;
 	assert(exportDir.NumberOfFunctions >= exportDir.NumberOfNames);
 
 	// Initialize .functions
@@ -76,9 +83,12 @@ void SetUpExportDirectory(gan::ConstMemAddr baseAddr, gan::PeHeaders& headers)
 	for (uint32_t i = 0; i < exportDir.NumberOfFunctions; ++i)
 	{
 		const auto addrFunc = addrTable[i];
+		// Names are assigned later, but they have to be created with the allocator of the list
 		exportFuncs.emplace_back(
 			addrFunc,
-			static_cast<gan::Ordinal>(exportDir.Base + i)
+			static_cast<gan::Ordinal>(exportDir.Base + i),
+			false,
+			typename ExportData::ExportedFunction::NameString{ alloc }
 		);
 
 		// In the case of forwarding, RVA points to a string inside the range of exportDataRange.
@@ -103,14 +113,49 @@ void SetUpExportDirectory(gan::ConstMemAddr baseAddr, gan::PeHeaders& headers)
 }
 
 
+template <typename Alloc>
+std::optional<gan::internal::_PeHeaders<Alloc>> LoadHeaders(gan::ConstMemAddr addr, const Alloc& alloc)
+{
+	assert(addr);
+
+	const auto& dosHeader = addr.ConstRef<IMAGE_DOS_HEADER>();
+	using Headers = gan::internal::_PeHeaders<Alloc>;
+	Headers headers{
+		.dosHeader = dosHeader,
+		.ntHeaders = addr.Offset(dosHeader.e_lfanew).ConstRef<gan::ImageNtHeaders>(),
+		.sectionHeaderList = typename Headers::SectionHeaderList{ alloc }
+	};
+
+	// Only support images for 32-bit and 64-bit x86-based architectures
+	const bool isSupported =
+		headers.dosHeader.e_magic == IMAGE_DOS_SIGNATURE
+		&& headers.ntHeaders.signature == IMAGE_NT_SIGNATURE
+		&& (headers.ntHeaders.fileHeader.Machine == IMAGE_FILE_MACHINE_I386 || headers.ntHeaders.fileHeader.Machine == IMAGE_FILE_MACHINE_AMD64)
+		&& (headers.ntHeaders.optHeader32.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC || headers.ntHeaders.optHeader64.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC);
+
+	// Traverse the image to fill in more data
+	std::optional<Headers> resultOpt;
+	if (isSupported)
+	{
+		SetUpSectionHeaders(addr, headers);
+		SetUpExportDirectory(addr, headers);
+
+		resultOpt = std::move(headers);
+	}
+
+	return resultOpt;
 }
 
 
+}  // unnamed namespace
+
+
 namespace gan
 {
 
 
-std::optional<uint32_t> PeHeaders::FindSectionByName(uint32_t startIndex, std::u8string_view name) const noexcept
+template <typename Alloc>
+std::optional<uint32_t> internal::_PeHeaders<Alloc>::FindSectionByName(uint32_t startIndex, std::u8string_view name) const noexcept
 {
 	static_assert(sizeof(IMAGE_SECTION_HEADER::Name) == IMAGE_SIZEOF_SHORT_NAME);
 
@@ -133,34 +178,19 @@ std::optional<uint32_t> PeHeaders::FindSectionByName(uint32_t startIndex, std::u
 }
 
 
-std::optional<PeHeaders> PeImageHelper::GetLoadedHeaders(ConstMemAddr addr)
-{
-	assert(addr);
-
-	const auto& dosHeader = addr.ConstRef<IMAGE_DOS_HEADER>();
-	PeHeaders headers{
-		.dosHeader = dosHeader,
-		.ntHeaders = addr.Offset(dosHeader.e_lfanew).ConstRef<ImageNtHeaders>()
-	};
+template struct internal::_PeHeaders<std::allocator<void>>;
+template struct internal::_PeHeaders<std::pmr::polymorphic_allocator<>>;
 
-	// Only support images for 32-bit and 64-bit x86-based architectures
-	const bool isSupported =
-		headers.dosHeader.e_magic == IMAGE_DOS_SIGNATURE
-		&& headers.ntHeaders.signature == IMAGE_NT_SIGNATURE
-		&& (headers.ntHeaders.fileHeader.Machine == IMAGE_FILE_MACHINE_I386 || headers.ntHeaders.fileHeader.Machine == IMAGE_FILE_MACHINE_AMD64)
-		&& (headers.ntHeaders.optHeader32.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC || headers.ntHeaders.optHeader64.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC);
 
-	// Traverse the image to fill in more data
-	std::optional<PeHeaders> resultOpt;
-	if (isSupported)
-	{
-		SetUpSectionHeaders(addr, headers);
-		SetUpExportDirectory(addr, headers);
+std::optional<PeHeaders> PeImageHelper::GetLoadedHeaders(ConstMemAddr addr)
+{
+	return LoadHeaders(addr, std::allocator<void>{ });
+}
 
-		resultOpt = std::move(headers);
-	}
 
-	return resultOpt;
+std::optional<pmr::PeHeaders> PeImageHelper::GetLoadedHeaders(ConstMemAddr addr, std::pmr::memory_resource* resource)
+{
+	return LoadHeaders(addr, std::pmr::polymorphic_allocator<>{ resource });
 }
 
 
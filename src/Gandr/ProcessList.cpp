@@ -28,7 +28,8 @@ namespace
 {
 
 
-constexpr gan::ProcessInfo MakeProcessInfo(const PROCESSENTRY32W& procEntry)
+template <typename Alloc>
+constexpr gan::internal::_ProcessInfo<Alloc> MakeProcessInfo(const PROCESSENTRY32W& procEntry, const Alloc& alloc)
 {
 	ABOVE_NORMAL_PRIORITY_CLASS;
 	return {
@@ -36,7 +37,7 @@ constexpr gan::ProcessInfo MakeProcessInfo(const PROCESSENTRY32W& procEntry)
 		.nThread{ procEntry.cntThreads },
 		.pidParent{ procEntry.th32ParentProcessID },
 		.basePriority{ static_cast<uint32_t>(procEntry.pcPriClassBase) },  // Base priority defined in [0, 31], REF: https://learn.microsoft.com/en-us/windows/win32/procthread/scheduling-priorities
-		.imageName{ procEntry.szExeFile }
+		.imageName{ procEntry.szExeFile, alloc }
 	};
 }
 
@@ -50,28 +51,25 @@ constexpr gan::ThreadInfo MakeThreadInfo(const THREADENTRY32& threadEntry)
 }
 
 
-}  // unnamed namespace
-
-
-namespace gan
+template <typename Alloc>
+auto EnumerateProcesses(const Alloc& alloc)
+	-> std::expected<gan::internal::_Vector<gan::internal::_ProcessInfo<Alloc>, Alloc>, gan::ProcessEnumerator::Error>
 {
+	using Error = gan::ProcessEnumerator::Error;
 
-
-std::expected<ProcessList, ProcessEnumerator::Error> ProcessEnumerator::operator()()
-{
 	constexpr uint32_t k_ignoredParam = 0;
-	AutoWinHandle hSnap{ ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, k_ignoredParam) };
+	gan::AutoWinHandle hSnap{ ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, k_ignoredParam) };
 	if (!hSnap)
 		return std::unexpected{ Error::SnapshotFailed };
 
-	ProcessList procList;
+	gan::internal::_Vector<gan::internal::_ProcessInfo<Alloc>, Alloc> procList{ alloc };
 	PROCESSENTRY32W procEntry{ .dwSize = sizeof(procEntry) };
 
 	for (BOOL proc32Result{ ::Process32FirstW(*hSnap, &procEntry) };
 		proc32Result;
 		proc32Result = ::Process32NextW(*hSnap, &procEntry))
 	{
-		procList.emplace_back(MakeProcessInfo(procEntry));
+		procList.emplace_back(MakeProcessInfo(procEntry, alloc));
 	}
 
 	// In a success, Process32Next() would end with returning FALSE and setting error code to ERROR_NO_MORE_FILES
@@ -81,20 +79,18 @@ std::expected<ProcessList, ProcessEnumerator::Error> ProcessEnumerator::operator
 	return procList;
 }
 
-std::expected<ThreadList, ThreadEnumerator::Error> ThreadEnumerator::operator()()
+template <typename Alloc>
+auto EnumerateThreads(uint32_t pid, const Alloc& alloc)
+	-> std::expected<gan::internal::_Vector<gan::ThreadInfo, Alloc>, gan::ThreadEnumerator::Error>
 {
-	constexpr uint32_t k_allProcesses = 0;
-	return (*this)(k_allProcesses);
-}
+	using Error = gan::ThreadEnumerator::Error;
 
-std::expected<ThreadList, ThreadEnumerator::Error> ThreadEnumerator::operator()(uint32_t pid)
-{
 	constexpr uint32_t k_ignoredParam = 0;
-	AutoWinHandle hSnap{ ::CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, k_ignoredParam) };
+	gan::AutoWinHandle hSnap{ ::CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, k_ignoredParam) };
 	if (!hSnap)
 		return std::unexpected{ Error::SnapshotFailed };
 
-	ThreadList threadList;
+	gan::internal::_Vector<gan::ThreadInfo, Alloc> threadList{ alloc };
 	THREADENTRY32 threadEntry{ .dwSize = sizeof(threadEntry) };
 
 	for (BOOL thread32Result{ ::Thread32First(*hSnap, &threadEntry) };
@@ -113,4 +109,38 @@ std::expected<ThreadList, ThreadEnumerator::Error> ThreadEnumerator::operator()(
 }
 
 
+}  // unnamed namespace
+
+
+namespace gan
+{
+
+
+std::expected<ProcessList, ProcessEnumerator::Error> ProcessEnumerator::operator()()
+{
+	return EnumerateProcesses(std::allocator<void>{ });
+}
+
+std::expected<pmr::ProcessList, ProcessEnumerator::Error> ProcessEnumerator::operator()(std::pmr::memory_resource* resource)
+{
+	return EnumerateProcesses(std::pmr::polymorphic_allocator<>{ resource });
+}
+
+std::expected<ThreadList, ThreadEnumerator::Error> ThreadEnumerator::operator()()
+{
+	constexpr uint32_t k_allProcesses = 0;
+	return (*this)(k_allProcesses);
+}
+
+std::expected<ThreadList, ThreadEnumerator::Error> ThreadEnumerator::operator()(uint32_t pid)
+{
+	return EnumerateThreads(pid, std::allocator<void>{ });
+}
+
+std::expected<pmr::ThreadList, ThreadEnumerator::Error> ThreadEnumerator::operator()(uint32_t pid, std::pmr::memory_resource* resource)
+{
+	return EnumerateThreads(pid, std::pmr::polymorphic_allocator<>{ resource });
+}
+
+
 }  // namespace gan
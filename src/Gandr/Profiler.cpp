@@ -0,0 +1,443 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Profiler.h>
+
+#include <Hook.h>
+#include <Types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <ranges>
+#include <span>
+#include <unordered_set>
+
+#include <intrin.h>
+#include <windows.h>
+
+
+namespace
+{
+
+
+constexpr size_t k_cacheLineSize = 64;
+
+
+// Counters are written only by their own threads, but can be read by others at the same time.
+void Increase(uint64_t& counter, uint64_t n) noexcept
+{
+	std::atomic_ref ref(counter);
+	ref.store(ref.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+
+uint64_t Load(const uint64_t& counter) noexcept
+{
+	return std::atomic_ref(const_cast<uint64_t&>(counter)).load(std::memory_order_relaxed);
+}
+
+
+}  // unnamed namespace
+
+
+
+namespace gan
+{
+
+
+struct alignas(k_cacheLineSize) internal::ProfilerCounter
+{
+	uint64_t calls;
+	uint64_t cycles;
+	uint64_t buckets[Profiler::k_numBuckets];
+};
+static_assert(sizeof(internal::ProfilerCounter) % k_cacheLineSize == 0);
+
+
+}  // namespace gan
+
+
+
+namespace
+{
+
+
+// ---------------------------------------------------------------------------
+// Struct ThreadContext: What a thread keeps for profiling. It's trivially
+//                       constructible and destructible, so that the thread
+//                       local variable needs neither initialization checks
+//                       nor destruction.
+// ---------------------------------------------------------------------------
+
+struct ThreadContext
+{
+	// Profiled call in progress
+	struct Frame
+	{
+		void* returnAddr;
+		gan::internal::ProfilerCounter* counter;
+		uint64_t start;
+	};
+
+	struct ProfilerCounters
+	{
+		uint64_t id;
+		gan::internal::ProfilerCounter* counters;
+	};
+
+	gan::internal::ProfilerCounter* FindCounters(uint64_t profilerId) const noexcept
+	{
+		const auto profilers = std::span(this->profilers, numProfilers);
+		const auto itr = std::ranges::find(profilers, profilerId, &ProfilerCounters::id);
+		return itr != profilers.end() ? itr->counters : nullptr;
+	}
+
+	Frame frames[gan::Profiler::k_maxDepth];
+	size_t depth;
+	ProfilerCounters profilers[gan::Profiler::k_maxPerThread];
+	size_t numProfilers;
+	uint64_t numDestroyedSeen;  // ProfilerIds::GetNumDestroyed() when the thread last looked for them
+	bool busy;  // In the profiler itself
+};
+
+
+constinit thread_local ThreadContext t_context { };
+
+
+// Called by the exit stub. The return value is where the profiled function should have returned to.
+// On ia32, st(0) may hold a return value, so nothing here may touch the x87 stack.
+void* OnExit() noexcept
+{
+	const uint64_t end = __rdtsc();
+
+	ThreadContext& context = t_context;
+	assert(context.depth > 0);
+	const auto& frame = context.frames[--context.depth];
+
+	gan::internal::ProfilerCounter& counter = *frame.counter;
+	const uint64_t cycles = end - frame.start;
+	Increase(counter.cycles, cycles);
+	Increase(counter.buckets[std::min<size_t>(std::bit_width(cycles), gan::Profiler::k_numBuckets - 1)], 1);
+	return frame.returnAddr;
+}
+
+
+// ---------------------------------------------------------------------------
+// Class ExitStub: Code which profiled functions return to, generated once and
+//                 kept until the process exits. Return values are preserved
+//                 while OnExit() is called, and then the stub returns to
+//                 the original return address.
+// ---------------------------------------------------------------------------
+
+class ExitStub : public gan::Singleton<ExitStub>
+{
+	friend class gan::Singleton<ExitStub>;
+
+public:
+	// nullptr if the code couldn't be allocated
+	gan::MemAddr GetAddress() const noexcept	{ return m_code; }
+
+private:
+	constexpr static uint8_t k_code64[] {
+		0x50,                                       // push rax  ; placeholder of the return address
+		0x50,                                       // push rax
+		0x53,                                       // push rbx
+		0x48, 0x89, 0xE3,                           // mov rbx, rsp
+		0x48, 0x83, 0xE4, 0xF0,                     // and rsp, -16
+		0x48, 0x83, 0xEC, 0x60,                     // sub rsp, 0x60  ; xmm0-xmm3 (for __vectorcall) and shadow space
+		0x66, 0x0F, 0x7F, 0x44, 0x24, 0x20,         // movdqa [rsp+0x20], xmm0
+		0x66, 0x0F, 0x7F, 0x4C, 0x24, 0x30,         // movdqa [rsp+0x30], xmm1
+		0x66, 0x0F, 0x7F, 0x54, 0x24, 0x40,         // movdqa [rsp+0x40], xmm2
+		0x66, 0x0F, 0x7F, 0x5C, 0x24, 0x50,         // movdqa [rsp+0x50], xmm3
+		0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,         // mov rax, OnExit
+		0xFF, 0xD0,                                 // call rax
+		0x48, 0x89, 0x43, 0x10,                     // mov [rbx+0x10], rax
+		0x66, 0x0F, 0x6F, 0x44, 0x24, 0x20,         // movdqa xmm0, [rsp+0x20]
+		0x66, 0x0F, 0x6F, 0x4C, 0x24, 0x30,         // movdqa xmm1, [rsp+0x30]
+		0x66, 0x0F, 0x6F, 0x54, 0x24, 0x40,         // movdqa xmm2, [rsp+0x40]
+		0x66, 0x0F, 0x6F, 0x5C, 0x24, 0x50,         // movdqa xmm3, [rsp+0x50]
+		0x48, 0x89, 0xDC,                           // mov rsp, rbx
+		0x5B,                                       // pop rbx
+		0x58,                                       // pop rax
+		0xC3,                                       // ret
+	};
+	constexpr static uint8_t k_calleeOffset64 = 40;
+	constexpr static uint8_t k_code32[] {
+		0x50,                                       // push eax  ; placeholder of the return address
+		0x50,                                       // push eax
+		0x52,                                       // push edx
+		0x53,                                       // push ebx
+		0x89, 0xE3,                                 // mov ebx, esp
+		0x83, 0xE4, 0xF0,                           // and esp, -16
+		0x83, 0xEC, 0x10,                           // sub esp, 0x10  ; xmm0 (for __vectorcall)
+		0x66, 0x0F, 0x7F, 0x04, 0x24,               // movdqa [esp], xmm0
+		0xB8, 0, 0, 0, 0,                           // mov eax, OnExit
+		0xFF, 0xD0,                                 // call eax
+		0x89, 0x43, 0x0C,                           // mov [ebx+0x0C], eax
+		0x66, 0x0F, 0x6F, 0x04, 0x24,               // movdqa xmm0, [esp]
+		0x89, 0xDC,                                 // mov esp, ebx
+		0x5B,                                       // pop ebx
+		0x5A,                                       // pop edx
+		0x58,                                       // pop eax
+		0xC3,                                       // ret
+	};
+	constexpr static uint8_t k_calleeOffset32 = 18;
+
+	ExitStub()
+		: m_code(Generate())
+	{ }
+
+	static gan::MemAddr Generate() noexcept
+	{
+		const auto code = gan::Is64() ? std::span<const uint8_t>(k_code64) : std::span<const uint8_t>(k_code32);
+		void* mem = ::VirtualAlloc(nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!mem)
+			return { };
+
+		memcpy(mem, code.data(), code.size());
+		gan::MemAddr{ mem }.Offset(gan::Is64() ? k_calleeOffset64 : k_calleeOffset32).Ref<void*>() = reinterpret_cast<void*>(OnExit);
+		DWORD oldProtect;
+		if (!::VirtualProtect(mem, code.size(), PAGE_EXECUTE_READ, &oldProtect))
+		{
+			::VirtualFree(mem, 0, MEM_RELEASE);
+			return { };
+		}
+		return gan::MemAddr{ mem };
+	}
+
+	const gan::MemAddr m_code;
+};
+
+
+// ---------------------------------------------------------------------------
+// Class ProfilerIds: IDs of profilers alive, which threads check against
+//                    theirs to find counters of destroyed profilers. IDs are
+//                    unique in the process, unlike addresses of profilers.
+// ---------------------------------------------------------------------------
+
+class ProfilerIds : public gan::Singleton<ProfilerIds>
+{
+	friend class gan::Singleton<ProfilerIds>;
+
+public:
+	uint64_t Add()
+	{
+		std::lock_guard lock(m_mutex);
+		const auto id = m_nextId++;
+		m_alive.emplace(id);
+		return id;
+	}
+
+	void Remove(uint64_t id)
+	{
+		std::lock_guard lock(m_mutex);
+		m_alive.erase(id);
+		m_numDestroyed.fetch_add(1, std::memory_order_release);
+	}
+
+	bool IsAlive(uint64_t id) const
+	{
+		std::lock_guard lock(m_mutex);
+		return m_alive.contains(id);
+	}
+
+	// Only ever grows, so that threads can tell whether it's worth looking for destroyed ones
+	uint64_t GetNumDestroyed() const noexcept	{ return m_numDestroyed.load(std::memory_order_acquire); }
+
+private:
+	ProfilerIds()
+		: m_alive()
+		, m_nextId(1)
+		, m_numDestroyed(0)
+		, m_mutex()
+	{ }
+
+	std::unordered_set<uint64_t> m_alive;
+	uint64_t m_nextId;
+	std::atomic<uint64_t> m_numDestroyed;
+	mutable std::mutex m_mutex;
+};
+
+
+}  // unnamed namespace
+
+
+
+namespace gan
+{
+
+
+// ---------------------------------------------------------------------------
+// Class Profiler
+// ---------------------------------------------------------------------------
+
+Profiler::Profiler()
+	: m_id(ProfilerIds::GetInstance().Add())
+	, m_numDropped(0)
+{ }
+
+
+Profiler::~Profiler()
+{
+	ProfilerIds::GetInstance().Remove(m_id);
+}
+
+
+bool Profiler::Add(MemAddr func)
+{
+	if (!m_probes.empty())
+		return false;
+
+	m_funcs.emplace_back(func);
+	return true;
+}
+
+
+std::expected<void, HookTransaction::Failure> Profiler::Install()
+{
+	if (!m_funcs.empty() && !ExitStub::GetInstance().GetAddress())
+		return std::unexpected{ HookTransaction::Failure{ .index = 0, .result = Hook::OpResult::TrampolineAllocFailed } };
+
+	if (m_probes.empty())
+	{
+		m_targets.reserve(m_funcs.size());
+		m_probes.reserve(m_funcs.size());
+		for (auto i : std::views::iota(0uz, m_funcs.size()))
+		{
+			m_targets.emplace_back(this, i);
+			m_probes.emplace_back(m_funcs[i], OnEntry, &m_targets[i]);
+		}
+	}
+
+	HookTransaction transaction;
+	for (auto& probe : m_probes)
+		transaction.Install(probe.GetHook());
+	return transaction.Commit();
+}
+
+
+std::expected<void, HookTransaction::Failure> Profiler::Uninstall()
+{
+	HookTransaction transaction;
+	for (auto& probe : m_probes)
+		transaction.Uninstall(probe.GetHook());
+	return transaction.Commit();
+}
+
+
+std::vector<Profiler::Histogram> Profiler::Collect() const
+{
+	std::vector<Histogram> histograms(m_funcs.size());
+	for (auto i : std::views::iota(0uz, m_funcs.size()))
+		histograms[i].func = m_funcs[i];
+
+	std::lock_guard lock(m_mutex);
+
+	for (const auto& counters : m_threadCounters)
+	{
+		for (auto i : std::views::iota(0uz, m_funcs.size()))
+		{
+			const Counter& counter = counters[i];
+			Histogram& histogram = histograms[i];
+			histogram.calls += Load(counter.calls);
+			histogram.cycles += Load(counter.cycles);
+			for (auto bucket : std::views::iota(0uz, k_numBuckets))
+				histogram.buckets[bucket] += Load(counter.buckets[bucket]);
+		}
+	}
+	return histograms;
+}
+
+
+void Profiler::OnEntry(ProbeContext& context, void* userData)
+{
+	ThreadContext& thread = t_context;
+	if (thread.busy)
+		return;
+
+	const Target& target = *static_cast<const Target*>(userData);
+	Counter* counters = thread.FindCounters(target.owner->m_id);
+	if (!counters)
+	{
+		// Anything called from here, such as the heap, may be profiled as well.
+		thread.busy = true;
+		if (thread.numProfilers == k_maxPerThread)
+		{
+			// Counters of profilers destroyed since the last time make room.
+			const auto& ids = ProfilerIds::GetInstance();
+			const auto numDestroyed = ids.GetNumDestroyed();
+			if (thread.numDestroyedSeen != numDestroyed)
+			{
+				thread.numDestroyedSeen = numDestroyed;
+				const auto destroyed = std::ranges::remove_if(
+					std::span(thread.profilers, thread.numProfilers),
+					[&ids](uint64_t id) { return !ids.IsAlive(id); },
+					&ThreadContext::ProfilerCounters::id
+				);
+				thread.numProfilers -= destroyed.size();
+			}
+		}
+		if (thread.numProfilers < k_maxPerThread)
+		{
+			counters = target.owner->AddThread();
+			thread.profilers[thread.numProfilers++] = { .id = target.owner->m_id, .counters = counters };
+		}
+		thread.busy = false;
+
+		if (!counters)
+		{
+			target.owner->m_numDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	Counter& counter = counters[target.index];
+	Increase(counter.calls, 1);
+	if (thread.depth == k_maxDepth)
+		return;
+
+	// Return to the exit stub instead, which calls OnExit().
+#if defined(_WIN64)
+	void*& returnAddr = *reinterpret_cast<void**>(context.rsp);
+#else
+	void*& returnAddr = *reinterpret_cast<void**>(context.esp);
+#endif
+	ThreadContext::Frame& frame = thread.frames[thread.depth++];
+	frame.returnAddr = returnAddr;
+	frame.counter = &counter;
+	returnAddr = ExitStub::GetInstance().GetAddress().Ptr();
+	frame.start = __rdtsc();
+}
+
+
+Profiler::Counter* Profiler::AddThread()
+{
+	auto counters = std::make_unique<Counter[]>(m_funcs.size());
+	Counter* result = counters.get();
+
+	std::lock_guard lock(m_mutex);
+
+	m_threadCounters.emplace_back(std::move(counters));
+	return result;
+}
+
+
+}  // namespace gan
@@ -0,0 +1,592 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Trace.h>
+
+#include <Types.h>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <ranges>
+#include <unordered_set>
+
+#include <intrin.h>
+#include <windows.h>
+
+
+namespace
+{
+
+
+constexpr size_t k_cacheLineSize = 64;
+constexpr size_t k_batchSize = 1 << 20;  // Written to the file once exceeded
+
+
+constexpr size_t AlignUp(size_t size) noexcept
+{
+	return (size + gan::k_traceAlignment - 1) & ~(gan::k_traceAlignment - 1);
+}
+
+
+uint64_t QueryQpc() noexcept
+{
+	LARGE_INTEGER counter;
+	::QueryPerformanceCounter(&counter);
+	return static_cast<uint64_t>(counter.QuadPart);
+}
+
+
+}  // unnamed namespace
+
+
+
+namespace gan::internal
+{
+
+
+// ---------------------------------------------------------------------------
+// Class TraceRing: A single-producer single-consumer ring buffer of records,
+//                  each of which is contiguous. A record that would wrap
+//                  around is put at the start instead, after a padding
+//                  record filling the end.
+// ---------------------------------------------------------------------------
+
+// Each position is given a cache line of its own, and the padding for that is what C4324 warns about.
+#pragma warning(push)
+#pragma warning(disable: 4324)
+class TraceRing
+{
+public:
+	TraceRing(size_t capacity, uint32_t threadId)
+		: m_buffer(std::make_unique_for_overwrite<uint8_t[]>(capacity))
+		, m_mask(capacity - 1)
+		, m_threadId(threadId)
+		, m_numDropped(0)
+		, m_head(0)
+		, m_tail(0)
+	{
+		assert(std::has_single_bit(capacity) && capacity >= k_traceAlignment);
+	}
+
+	// Producer
+	bool Push(uint32_t type, ConstMemAddr data, uint32_t size) noexcept
+	{
+		const size_t capacity = m_mask + 1;
+		const size_t stride = sizeof(TraceRecordHeader) + AlignUp(std::min<size_t>(size, capacity));
+		const uint64_t head = m_head.load(std::memory_order_relaxed);
+		const size_t offset = head & m_mask;
+		const size_t padding = capacity - offset < stride ? capacity - offset : 0;
+		if (stride + padding > capacity - (head - m_tail.load(std::memory_order_acquire)))
+		{
+			m_numDropped.store(m_numDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (padding > 0)
+			WriteHeader(offset, { .timestamp = 0, .type = TraceWriter::k_paddingType, .size = static_cast<uint32_t>(padding - sizeof(TraceRecordHeader)) });
+		const size_t recordOffset = (offset + padding) & m_mask;
+		WriteHeader(recordOffset, { .timestamp = __rdtsc(), .type = type, .size = size });
+		memcpy(m_buffer.get() + recordOffset + sizeof(TraceRecordHeader), data.ConstPtr(), size);
+
+		m_head.store(head + padding + stride, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer. Appends a block of all pending records to "out", if there are any.
+	void Drain(std::vector<uint8_t>& out)
+	{
+		uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		const uint64_t head = m_head.load(std::memory_order_acquire);
+		if (tail == head)
+			return;
+
+		const size_t blockOffset = out.size();
+		out.resize(blockOffset + sizeof(TraceBlockHeader));
+		while (tail != head)
+		{
+			const size_t offset = tail & m_mask;
+			const auto& header = ConstMemAddr{ m_buffer.get() + offset }.ConstRef<TraceRecordHeader>();
+			const size_t stride = sizeof(TraceRecordHeader) + AlignUp(header.size);
+			if (header.type != TraceWriter::k_paddingType)
+				out.insert(out.end(), m_buffer.get() + offset, m_buffer.get() + offset + stride);
+			tail += stride;
+		}
+		m_tail.store(tail, std::memory_order_release);
+
+		const TraceBlockHeader blockHeader {
+			.size = static_cast<uint32_t>(out.size() - blockOffset - sizeof(TraceBlockHeader)),
+			.threadId = m_threadId,
+			.tsc = __rdtsc(),
+			.qpc = QueryQpc(),
+			.numDropped = GetNumDropped()
+		};
+		memcpy(out.data() + blockOffset, &blockHeader, sizeof(blockHeader));
+	}
+
+	uint64_t GetNumDropped() const noexcept	{ return m_numDropped.load(std::memory_order_relaxed); }
+
+private:
+	void WriteHeader(size_t offset, const TraceRecordHeader& header) noexcept
+	{
+		memcpy(m_buffer.get() + offset, &header, sizeof(header));
+	}
+
+	const std::unique_ptr<uint8_t[]> m_buffer;
+	const size_t m_mask;
+	const uint32_t m_threadId;
+	std::atomic<uint64_t> m_numDropped;  // Written by the producer only
+
+	// Positions only ever grow. Each is written by one side and kept away from the other.
+	alignas(k_cacheLineSize) std::atomic<uint64_t> m_head;
+	alignas(k_cacheLineSize) std::atomic<uint64_t> m_tail;
+};
+#pragma warning(pop)
+
+
+}  // namespace gan::internal
+
+
+
+namespace
+{
+
+
+// Rings of the calling thread. Trivial, so that the thread local variable needs neither initialization checks
+// nor destruction.
+struct ThreadRings
+{
+	struct Entry
+	{
+		uint64_t writerId;
+		gan::internal::TraceRing* ring;
+	};
+
+	gan::internal::TraceRing* Find(uint64_t writerId) const noexcept
+	{
+		const auto entries = std::span(this->entries, numEntries);
+		const auto itr = std::ranges::find(entries, writerId, &Entry::writerId);
+		return itr != entries.end() ? itr->ring : nullptr;
+	}
+
+	Entry entries[gan::TraceWriter::k_maxPerThread];
+	size_t numEntries;
+	uint64_t numDestroyedSeen;  // TraceWriterIds::GetNumDestroyed() when the thread last looked for them
+	bool busy;  // Adding a ring, which may call functions traced by the same thread
+};
+
+
+constinit thread_local ThreadRings t_rings { };
+
+
+// ---------------------------------------------------------------------------
+// Class TraceWriterIds: IDs of writers alive, which threads check against
+//                       theirs to find rings of destroyed writers.
+// ---------------------------------------------------------------------------
+
+class TraceWriterIds : public gan::Singleton<TraceWriterIds>
+{
+	friend class gan::Singleton<TraceWriterIds>;
+
+public:
+	uint64_t Add()
+	{
+		std::lock_guard lock(m_mutex);
+		const auto id = m_nextId++;
+		m_alive.emplace(id);
+		return id;
+	}
+
+	void Remove(uint64_t id)
+	{
+		std::lock_guard lock(m_mutex);
+		m_alive.erase(id);
+		m_numDestroyed.fetch_add(1, std::memory_order_release);
+	}
+
+	bool IsAlive(uint64_t id) const
+	{
+		std::lock_guard lock(m_mutex);
+		return m_alive.contains(id);
+	}
+
+	// Only ever grows, so that threads can tell whether any writer has been destroyed since they last looked
+	uint64_t GetNumDestroyed() const noexcept	{ return m_numDestroyed.load(std::memory_order_acquire); }
+
+private:
+	TraceWriterIds()
+		: m_alive()
+		, m_nextId(1)
+		, m_numDestroyed(0)
+		, m_mutex()
+	{ }
+
+	std::unordered_set<uint64_t> m_alive;
+	uint64_t m_nextId;
+	std::atomic<uint64_t> m_numDestroyed;
+	mutable std::mutex m_mutex;
+};
+
+
+}  // unnamed namespace
+
+
+
+namespace gan
+{
+
+
+// ---------------------------------------------------------------------------
+// Class TraceWriter
+// ---------------------------------------------------------------------------
+
+TraceWriter::TraceWriter()
+	: m_id(TraceWriterIds::GetInstance().Add())
+	, m_options()
+	, m_open(false)
+	, m_numDropped(0)
+	, m_writeError(NO_ERROR)
+	, m_stopping(false)
+{ }
+
+
+TraceWriter::~TraceWriter()
+{
+	Close();
+	TraceWriterIds::GetInstance().Remove(m_id);
+}
+
+
+WinErrorCode TraceWriter::Open(std::wstring_view path, const Options& options)
+{
+	if (m_open.load(std::memory_order_relaxed))
+		return ERROR_ALREADY_INITIALIZED;
+
+	m_file = ::CreateFileW(
+		std::wstring{ path }.c_str(),
+		GENERIC_WRITE,
+		FILE_SHARE_READ,
+		nullptr,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr
+	);
+	if (!m_file)
+		return GetLastError();
+
+	LARGE_INTEGER frequency;
+	::QueryPerformanceFrequency(&frequency);
+	const TraceFileHeader header {
+		.magic = k_traceMagic,
+		.version = k_traceVersion,
+		.headerSize = sizeof(TraceFileHeader),
+		.qpcFrequency = static_cast<uint64_t>(frequency.QuadPart)
+	};
+	DWORD numWritten = 0;
+	if (!::WriteFile(*m_file, &header, sizeof(header), &numWritten, nullptr))
+	{
+		const auto error = GetLastError();
+		m_file.Invalidate();
+		return error;
+	}
+
+	m_options = options;
+	m_options.ringSize = std::bit_ceil(std::max(options.ringSize, k_traceAlignment * 2));
+	m_writeError = NO_ERROR;
+	m_stopping = false;
+	m_open.store(true, std::memory_order_release);
+	m_drainer = std::thread(&TraceWriter::DrainerMain, this);
+	return NO_ERROR;
+}
+
+
+WinErrorCode TraceWriter::Close()
+{
+	if (!m_open.exchange(false, std::memory_order_acq_rel))
+		return NO_ERROR;
+
+	{
+		std::lock_guard lock(m_stateMutex);
+		m_stopping = true;
+	}
+	m_wakeUp.notify_one();
+	m_drainer.join();  // The drainer drains once more before returning.
+
+	m_file.Invalidate();
+	return m_writeError;
+}
+
+
+void TraceWriter::Flush()
+{
+	std::lock_guard lock(m_drainMutex);
+	Drain();
+}
+
+
+bool TraceWriter::Write(uint32_t type, ConstMemAddr data, uint32_t size) noexcept
+{
+	if (type == k_paddingType || !m_open.load(std::memory_order_acquire))
+		return false;
+
+	ThreadRings& rings = t_rings;
+	internal::TraceRing* ring = rings.Find(m_id);
+	if (!ring)
+	{
+		if (rings.busy)
+			return false;
+
+		rings.busy = true;
+		if (rings.numEntries == k_maxPerThread)
+		{
+			// Rings of writers destroyed since the last time make room.
+			const auto& ids = TraceWriterIds::GetInstance();
+			const auto numDestroyed = ids.GetNumDestroyed();
+			if (rings.numDestroyedSeen != numDestroyed)
+			{
+				rings.numDestroyedSeen = numDestroyed;
+				const auto destroyed = std::ranges::remove_if(
+					std::span(rings.entries, rings.numEntries),
+					[&ids](uint64_t writerId) { return !ids.IsAlive(writerId); },
+					&ThreadRings::Entry::writerId
+				);
+				rings.numEntries -= destroyed.size();
+			}
+		}
+		if (rings.numEntries < k_maxPerThread)
+		{
+			ring = AddThread();
+			if (ring)
+				rings.entries[rings.numEntries++] = { .writerId = m_id, .ring = ring };
+		}
+		rings.busy = false;
+
+		if (!ring)
+		{
+			m_numDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+	}
+	return ring->Push(type, data, size);
+}
+
+
+uint64_t TraceWriter::GetNumDropped() const
+{
+	std::lock_guard lock(m_ringsMutex);
+
+	uint64_t numDropped = m_numDropped.load(std::memory_order_relaxed);
+	for (const auto& ring : m_rings)
+		numDropped += ring->GetNumDropped();
+	return numDropped;
+}
+
+
+internal::TraceRing* TraceWriter::AddThread() noexcept
+{
+	auto ring = std::unique_ptr<internal::TraceRing>(
+		new (std::nothrow) internal::TraceRing(m_options.ringSize, ::GetCurrentThreadId())
+	);
+	if (!ring)
+		return nullptr;
+	internal::TraceRing* result = ring.get();
+
+	std::lock_guard lock(m_ringsMutex);
+
+	m_rings.emplace_back(std::move(ring));
+	return result;
+}
+
+
+void TraceWriter::DrainerMain()
+{
+	bool stopping = false;
+	while (!stopping)
+	{
+		{
+			std::unique_lock lock(m_stateMutex);
+			m_wakeUp.wait_for(lock, m_options.drainInterval, [this]() { return m_stopping; });
+			stopping = m_stopping;
+		}
+
+		std::lock_guard lock(m_drainMutex);
+		Drain();
+	}
+}
+
+
+void TraceWriter::Drain()
+{
+	std::vector<internal::TraceRing*> rings;
+	{
+		std::lock_guard lock(m_ringsMutex);
+		rings.reserve(m_rings.size());
+		std::ranges::transform(m_rings, std::back_inserter(rings), [](const auto& ring) noexcept { return ring.get(); });
+	}
+
+	const auto writeBatch = [this]() noexcept {
+		DWORD numWritten = 0;
+		if (m_writeError == NO_ERROR
+			&& !::WriteFile(*m_file, m_batch.data(), static_cast<DWORD>(m_batch.size()), &numWritten, nullptr))
+		{
+			m_writeError = GetLastError();  // Later records are discarded so that rings keep draining.
+		}
+		m_batch.clear();
+	};
+	for (auto* ring : rings)
+	{
+		ring->Drain(m_batch);
+		if (m_batch.size() >= k_batchSize)
+			writeBatch();
+	}
+	if (!m_batch.empty())
+		writeBatch();
+}
+
+
+
+
+// ---------------------------------------------------------------------------
+// Class TraceReader
+// ---------------------------------------------------------------------------
+
+TraceReader::TraceReader() noexcept
+	: m_view()
+	, m_header(nullptr)
+{ }
+
+
+TraceReader::~TraceReader()
+{
+	Close();
+}
+
+
+WinErrorCode TraceReader::Open(std::wstring_view path)
+{
+	Close();
+
+	m_file = ::CreateFileW(
+		std::wstring{ path }.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE,  // The writer may still be appending.
+		nullptr,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		nullptr
+	);
+	if (!m_file)
+		return GetLastError();
+
+	LARGE_INTEGER fileSize;
+	if (!::GetFileSizeEx(*m_file, &fileSize))
+		return GetLastError();
+	if (static_cast<uint64_t>(fileSize.QuadPart) < sizeof(TraceFileHeader))
+		return ERROR_BAD_FORMAT;
+
+	m_mapping = ::CreateFileMappingW(*m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping)
+		return GetLastError();
+	const void* view = ::MapViewOfFile(*m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+		return GetLastError();
+	m_view = std::span(static_cast<const uint8_t*>(view), static_cast<size_t>(fileSize.QuadPart));
+
+	const auto& header = ConstMemAddr{ m_view.data() }.ConstRef<TraceFileHeader>();
+	if (header.magic != k_traceMagic
+		|| header.version != k_traceVersion
+		|| header.headerSize < sizeof(TraceFileHeader)
+		|| header.headerSize % k_traceAlignment != 0
+		|| header.headerSize > m_view.size())
+	{
+		Close();
+		return ERROR_BAD_FORMAT;
+	}
+	m_header = &header;
+	return NO_ERROR;
+}
+
+
+TraceReader::Iterator TraceReader::begin() const noexcept
+{
+	return m_header ? Iterator{ m_view.subspan(m_header->headerSize) } : Iterator{ };
+}
+
+
+void TraceReader::Close() noexcept
+{
+	if (!m_view.empty())
+		::UnmapViewOfFile(m_view.data());
+	m_view = { };
+	m_header = nullptr;
+	m_mapping.Invalidate();
+	m_file.Invalidate();
+}
+
+
+
+
+// ---------------------------------------------------------------------------
+// Class TraceReader::Iterator
+// ---------------------------------------------------------------------------
+
+TraceReader::Iterator::Iterator(std::span<const uint8_t> blocks) noexcept
+	: m_blocks(blocks)
+	, m_records(blocks.first(0))
+{
+	++*this;
+}
+
+
+TraceReader::Iterator& TraceReader::Iterator::operator++() noexcept
+{
+	while (true)
+	{
+		if (m_records.size() >= sizeof(TraceRecordHeader))
+		{
+			const auto& header = ConstMemAddr{ m_records.data() }.ConstRef<TraceRecordHeader>();
+			const size_t stride = sizeof(TraceRecordHeader) + AlignUp(header.size);
+			if (stride <= m_records.size())
+			{
+				m_record.type = header.type;
+				m_record.timestamp = header.timestamp;
+				m_record.data = m_records.subspan(sizeof(TraceRecordHeader), header.size);
+				m_records = m_records.subspan(stride);
+				return *this;
+			}
+		}
+
+		// Next block. Anything incomplete ends the iteration.
+		if (m_blocks.size() < sizeof(TraceBlockHeader))
+			break;
+		const auto& header = ConstMemAddr{ m_blocks.data() }.ConstRef<TraceBlockHeader>();
+		if (header.size % k_traceAlignment != 0 || header.size > m_blocks.size() - sizeof(TraceBlockHeader))
+			break;
+		m_record.threadId = header.threadId;
+		m_records = m_blocks.subspan(sizeof(TraceBlockHeader), header.size);
+		m_blocks = m_blocks.subspan(sizeof(TraceBlockHeader) + header.size);
+	}
+
+	m_blocks = { };
+	m_records = { };
+	return *this;
+}
+
+
+}  // namespace gan
@@ -0,0 +1,91 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+
+#include <ApiTracer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+
+#include <windows.h>
+
+
+using namespace std::literals;
+
+
+DEFINE_TESTSUITE_START(ApiTracer)
+
+	DEFINE_TEST_SHARED_START
+
+		struct Calls
+		{
+			uint32_t watchedId;
+			std::atomic<uint32_t> numCalls;
+			std::atomic<uint32_t> numWatchedCalls;
+			std::atomic<uintptr_t> watchedArg;
+		};
+
+		static void OnCall(uint32_t exportId, gan::ProbeContext& context, void* userData)
+		{
+			Calls& calls = *static_cast<Calls*>(userData);
+			++calls.numCalls;
+			if (exportId != calls.watchedId)
+				return;
+
+			++calls.numWatchedCalls;
+#if defined(_WIN64)
+			calls.watchedArg = context.rcx;
+#else
+			calls.watchedArg = *reinterpret_cast<const uint32_t*>(context.esp + 4);  // Past the return address
+#endif
+		}
+
+	DEFINE_TEST_SHARED_END
+
+	DEFINE_TEST_START(Gdi32)
+	{
+		const auto hMod = ::LoadLibraryW(L"gdi32.dll");
+		ASSERT(hMod);
+
+		Calls calls{ };
+		gan::ApiTracer tracer(OnCall, &calls);
+		const auto numExports = tracer.AddModule(gan::ConstMemAddr{ hMod });
+		ASSERT(numExports && *numExports > 0);
+
+		const auto& exports = tracer.GetExports();
+		const auto itr = std::ranges::find(exports, "GetStockObject"sv, &gan::ApiTracer::Export::name);
+		ASSERT(itr != exports.end());
+		calls.watchedId = static_cast<uint32_t>(itr - exports.begin());
+		const auto getStockObject = reinterpret_cast<decltype(&GetStockObject)>(itr->addr.Ptr());
+
+		const auto whiteBrush = getStockObject(WHITE_BRUSH);
+		ASSERT(tracer.Install());
+		EXPECT(!tracer.AddModule(gan::ConstMemAddr{ hMod }));  // Too late
+		EXPECT(getStockObject(WHITE_BRUSH) == whiteBrush);
+		ASSERT(tracer.Uninstall());
+		getStockObject(BLACK_BRUSH);  // Not traced
+
+		EXPECT(calls.numWatchedCalls == 1);
+		EXPECT(calls.watchedArg == WHITE_BRUSH);
+		EXPECT(calls.numCalls >= calls.numWatchedCalls);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
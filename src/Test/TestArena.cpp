@@ -0,0 +1,82 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+
+#include <Arena.h>
+
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+
+DEFINE_TESTSUITE_START(MonotonicArena)
+
+	DEFINE_TEST_START(AllocateWithinBuffer)
+	{
+		gan::MonotonicArena arena{ 0x1000 };
+		ASSERT(arena.GetCapacity() >= 0x1000);
+
+		void* block1 = arena.allocate(24, 8);
+		void* block2 = arena.allocate(64, 64);
+		ASSERT(block1);
+		ASSERT(block2);
+		EXPECT(reinterpret_cast<uintptr_t>(block2) % 64 == 0);
+		EXPECT(static_cast<uint8_t*>(block2) >= static_cast<uint8_t*>(block1) + 24);
+		EXPECT(arena.GetUsedSize() >= 24 + 64);
+		EXPECT(arena.GetOverflowSize() == 0);
+
+		// Deallocation doesn't give memory back until Reset()
+		const auto usedSize = arena.GetUsedSize();
+		arena.deallocate(block2, 64, 64);
+		EXPECT(arena.GetUsedSize() == usedSize);
+
+		arena.Reset();
+		EXPECT(arena.GetUsedSize() == 0);
+		EXPECT(arena.allocate(24, 8) == block1);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(OverflowGrowsBufferOnReset)
+	{
+		gan::MonotonicArena arena{ 0x100 };
+		const auto initCapacity = arena.GetCapacity();
+
+		const auto runCycle = [&arena] {
+			std::pmr::vector<std::pmr::wstring> strings{ &arena };
+			for (int i = 0; i < 100; ++i)
+				strings.emplace_back(L"A string long enough to defeat small string optimization");
+			return strings.size();
+		};
+
+		EXPECT(runCycle() == 100);
+		const auto cycleSize = arena.GetUsedSize();
+		EXPECT(arena.GetOverflowSize() > 0);
+
+		arena.Reset();
+		EXPECT(arena.GetCapacity() > initCapacity);
+		EXPECT(arena.GetCapacity() >= cycleSize);
+
+		// The same amount of work now fits in the buffer
+		EXPECT(runCycle() == 100);
+		EXPECT(arena.GetOverflowSize() == 0);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
@@ -19,8 +19,17 @@
 #include "Test.h"
 
 #include <Buffer.h>
+#include <BufferPool.h>
+#include <Handle.h>
 
+#include <atomic>
+#include <cstring>
 #include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
 
 
 DEFINE_TESTSUITE_START(Buffer)
@@ -119,4 +128,312 @@ DEFINE_TESTSUITE_START(Buffer)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(VirtualMemoryGrowInPlace)
+	{
+		constexpr size_t k_size = 100 << 20;  // 100 MB
+		const auto buffer = gan::Buffer::Allocate(k_size);
+		ASSERT(buffer);
+		EXPECT(buffer->IsVirtualMemory());
+		EXPECT(buffer->GetCapacity() == k_size);
+
+		auto* data = buffer->GetData();
+		data[k_size - 1] = 0x5A;
+
+		// Within the reservation, only more pages get committed
+		if constexpr (gan::Is64())
+		{
+			ASSERT(buffer->Resize(k_size * 3));
+			EXPECT(buffer->GetData() == data);
+		}
+		else
+			ASSERT(buffer->Resize(k_size + (1 << 20)));
+		EXPECT(buffer->GetData()[k_size - 1] == 0x5A);
+		buffer->GetData()[buffer->GetSize() - 1] = 0xA5;
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(VirtualMemoryOptions)
+	{
+		const auto buffer = gan::Buffer::Allocate(1000, gan::BufferOptions{ gan::BufferOption::VirtualMemory, gan::BufferOption::Prefault });
+		ASSERT(buffer);
+		EXPECT(buffer->IsVirtualMemory());
+		EXPECT(buffer->GetCapacity() >= 1000);
+		EXPECT(buffer->GetData()[999] == 0);
+
+		// Falls back to normal pages if large pages aren't available
+		const auto largePageBuffer = gan::Buffer::Allocate(1 << 20, gan::BufferOptions{ gan::BufferOption::LargePages });
+		ASSERT(largePageBuffer);
+		EXPECT(largePageBuffer->IsVirtualMemory());
+		EXPECT(largePageBuffer->GetCapacity() >= 1 << 20);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(PooledToVirtualMemory)
+	{
+		const auto buffer = gan::Buffer::Allocate(1 << 20);
+		ASSERT(buffer);
+		EXPECT(!buffer->IsVirtualMemory());
+		buffer->GetData()[12345] = 0x5A;
+
+		ASSERT(buffer->Resize(gan::Buffer::k_virtualMemoryThreshold));
+		EXPECT(buffer->IsVirtualMemory());
+		EXPECT(buffer->GetData()[12345] == 0x5A);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+DEFINE_TESTSUITE_START(BufferPool)
+
+	DEFINE_TEST_START(BurstWithoutHeapAllocation)
+	{
+		constexpr size_t k_size = 32'767 * sizeof(wchar_t);  // Same as DebugSession's command line buffer
+		auto& pool = gan::BufferPool::GetInstance();
+
+		// Warm up the pool
+		ASSERT(gan::Buffer::Allocate(k_size));
+
+		const auto statsBefore = pool.GetStats();
+		for (int i = 0; i < 1000; ++i)
+		{
+			const auto buffer = gan::Buffer::Allocate(k_size);
+			ASSERT(buffer);
+		}
+		const auto statsAfter = pool.GetStats();
+		EXPECT(statsAfter.numHeapAllocs == statsBefore.numHeapAllocs);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(NonPooledSize)
+	{
+		auto& pool = gan::BufferPool::GetInstance();
+		EXPECT(!gan::BufferPool::IsPooledSize(100));
+		EXPECT(!gan::BufferPool::IsPooledSize(gan::BufferPool::k_maxBlockSize * 2));
+		EXPECT(gan::BufferPool::IsPooledSize(gan::BufferPool::k_minBlockSize));
+
+		const auto statsBefore = pool.GetStats();
+		auto* block = pool.Acquire(100);
+		ASSERT(block);
+		pool.Release(block, 100);
+		const auto statsAfter = pool.GetStats();
+		EXPECT(statsAfter.numHeapAllocs == statsBefore.numHeapAllocs + 1);
+		EXPECT(statsAfter.numHeapFrees == statsBefore.numHeapFrees + 1);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(MultiThreaded)
+	{
+		constexpr int k_numThreads = 8;
+		std::atomic<int> numFailures = 0;
+
+		std::vector<std::thread> threads;
+		for (int i = 0; i < k_numThreads; ++i)
+		{
+			threads.emplace_back([&numFailures, i] {
+				for (size_t j = 0; j < 10'000; ++j)
+				{
+					const auto size = (j * 37 + i) % 5000;
+					const auto buffer = gan::Buffer::Allocate(size);
+					if (!buffer)
+					{
+						++numFailures;
+						continue;
+					}
+
+					// Blocks must never be handed out twice
+					memset(buffer->GetData(), i, buffer->GetSize());
+					if (!buffer->Resize(size * 2))
+						++numFailures;
+					for (size_t k = 0; k < size; ++k)
+					{
+						if (buffer->GetData()[k] != static_cast<uint8_t>(i))
+						{
+							++numFailures;
+							break;
+						}
+					}
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+
+		EXPECT(numFailures == 0);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+DEFINE_TESTSUITE_START(InlineBuffer)
+
+	DEFINE_TEST_START(SmallStaysInline)
+	{
+		gan::InlineBuffer<32> buffer;
+		EXPECT(buffer.IsInline());
+		EXPECT(buffer.GetSize() == 0);
+		EXPECT(buffer.GetCapacity() == 32);
+
+		ASSERT(buffer.Resize(32));
+		EXPECT(buffer.IsInline());
+		EXPECT(buffer.GetSize() == 32);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(GrowToPool)
+	{
+		gan::InlineBuffer<32> buffer;
+		ASSERT(buffer.Resize(24));
+		for (uint8_t i = 0; i < 24; ++i)
+			buffer[i] = i;
+
+		ASSERT(buffer.Resize(100));
+		EXPECT(!buffer.IsInline());
+		EXPECT(buffer.GetCapacity() == 128);
+		EXPECT(buffer[23] == 23);
+
+		// Growth is geometric, so small steps don't reallocate each time
+		size_t numReallocs = 0;
+		for (size_t size = 100; size < (1 << 20); size += 1000)
+		{
+			const auto* oldData = buffer.GetData();
+			ASSERT(buffer.Resize(size));
+			if (buffer.GetData() != oldData)
+				++numReallocs;
+		}
+		EXPECT(numReallocs <= 14);
+		EXPECT(buffer[23] == 23);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Move)
+	{
+		gan::InlineBuffer<32> inlineBuffer;
+		ASSERT(inlineBuffer.Resize(16));
+		inlineBuffer[15] = 0x5A;
+
+		auto movedInline = std::move(inlineBuffer);
+		EXPECT(movedInline.IsInline());
+		EXPECT(movedInline.GetSize() == 16);
+		EXPECT(movedInline[15] == 0x5A);
+		EXPECT(inlineBuffer.GetSize() == 0);
+
+		gan::InlineBuffer<32> pooledBuffer;
+		ASSERT(pooledBuffer.Resize(1000));
+		pooledBuffer[999] = 0xA5;
+		const auto* pooledData = pooledBuffer.GetData();
+
+		// Out-of-line storage is taken over rather than copied
+		movedInline = std::move(pooledBuffer);
+		EXPECT(movedInline.GetData() == pooledData);
+		EXPECT(movedInline.GetSize() == 1000);
+		EXPECT(movedInline[999] == 0xA5);
+		EXPECT(pooledBuffer.IsInline());
+		EXPECT(pooledBuffer.GetSize() == 0);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+DEFINE_TESTSUITE_START(BufferChain)
+
+	DEFINE_TEST_SHARED_START
+
+		std::vector<uint8_t> m_data;
+
+		DEFINE_TEST_SETUP
+		{
+			// Several chunks of the default size plus a partial one
+			m_data.resize(0x4'1234);
+			for (size_t i = 0; i < m_data.size(); ++i)
+				m_data[i] = static_cast<uint8_t>(i * 31 + (i >> 12));
+			return true;
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(AppendAcrossChunks)
+	{
+		gan::BufferChain chain;
+		ASSERT(chain.Append(gan::ConstMemAddr{ m_data.data() }, 100));
+		ASSERT(chain.Append(gan::ConstMemAddr{ m_data.data() + 100 }, m_data.size() - 100));
+		EXPECT(chain.GetSize() == m_data.size());
+		EXPECT(chain.GetSegments().size() > 1);
+
+		// Earlier segments stay where they are as the chain grows
+		const auto* firstSegmentData = chain.GetSegments().front().data();
+		ASSERT(chain.Append(gan::ConstMemAddr{ m_data.data() }, m_data.size()));
+		EXPECT(chain.GetSegments().front().data() == firstSegmentData);
+
+		size_t offset = 0;
+		for (const auto& segment : chain.GetSegments())
+		{
+			for (size_t i = 0; i < segment.size(); ++i, ++offset)
+				ASSERT(segment[i] == m_data[offset % m_data.size()]);
+		}
+		EXPECT(offset == 2 * m_data.size());
+
+		// A range spanning the boundary of both appended copies
+		constexpr size_t k_copyOffset = 0x3'0000;
+		const size_t sizeBeforeBoundary = m_data.size() - k_copyOffset;
+		std::vector<uint8_t> copied(0x2'0000);
+		ASSERT(chain.CopyTo(gan::MemAddr{ copied.data() }, k_copyOffset, copied.size()));
+		EXPECT(memcmp(copied.data(), m_data.data() + k_copyOffset, sizeBeforeBoundary) == 0);
+		EXPECT(memcmp(copied.data() + sizeBeforeBoundary, m_data.data(), copied.size() - sizeBeforeBoundary) == 0);
+		EXPECT(!chain.CopyTo(gan::MemAddr{ copied.data() }, chain.GetSize() - 1, 2));
+
+		auto movedChain = std::move(chain);
+		EXPECT(movedChain.GetSize() == 2 * m_data.size());
+		EXPECT(chain.IsEmpty());
+		EXPECT(chain.GetSegments().empty());
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(AppendFromProcess)
+	{
+		gan::BufferChain chain(0x1000);
+		ASSERT(chain.AppendFromProcess(GetCurrentProcess(), gan::ConstMemAddr{ m_data.data() }, m_data.size()) == NO_ERROR);
+		ASSERT(chain.GetSize() == m_data.size());
+
+		std::vector<uint8_t> copied(m_data.size());
+		ASSERT(chain.CopyTo(gan::MemAddr{ copied.data() }, 0, copied.size()));
+		EXPECT(copied == m_data);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(FileRoundTrip)
+	{
+		wchar_t dir[MAX_PATH];
+		wchar_t path[MAX_PATH];
+		ASSERT(GetTempPathW(MAX_PATH, dir) && GetTempFileNameW(dir, L"gan", 0, path));
+
+		gan::BufferChain chain;
+		ASSERT(chain.Append(gan::ConstMemAddr{ m_data.data() }, m_data.size()));
+		{
+			gan::AutoWinHandle hFile{ CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr) };
+			ASSERT(hFile);
+			EXPECT(chain.WriteToFile(*hFile) == NO_ERROR);
+		}
+
+		gan::BufferChain readChain;
+		{
+			gan::AutoWinHandle hFile{ CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+			ASSERT(hFile);
+			EXPECT(readChain.AppendFromFile(*hFile, std::numeric_limits<size_t>::max()) == NO_ERROR);  // Until end of file
+		}
+		DeleteFileW(path);
+
+		ASSERT(readChain.GetSize() == m_data.size());
+		std::vector<uint8_t> copied(m_data.size());
+		ASSERT(readChain.CopyTo(gan::MemAddr{ copied.data() }, 0, copied.size()));
+		EXPECT(copied == m_data);
+	}
+	DEFINE_TEST_END
+
 DEFINE_TESTSUITE_END
@@ -20,19 +20,43 @@
 
 #include <Hash.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <windows.h>
 
 
 DEFINE_TESTSUITE_START(Hash)
 
-	DEFINE_TEST_START(SHA256)
-	{
+	DEFINE_TEST_SHARED_START
+
 		constexpr static const char k_text[] =
 			"Du gamla, Du fria, Du fjällhöga nord.\n"
 			"Du tysta, Du glädjerika sköna!\n"
 			"Jag hälsar Dig, vänaste land uppå jord,\n"
 			"Din sol, Din himmel, Dina ängder gröna.";
 
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(SHA1)
+	{
+		constexpr static const uint8_t k_digest[] {
+			0x10,0x8d,0x60,0x43,0x6f,0xf6,0xee,0xeb,0x6d,0xf1,0x1c,0xb9,0xbb,0x8f,0x91,0x76,
+			0x0c,0x43,0x80,0xca
+		};
+
+		gan::Hash<160> hash;
+		memset(hash.data, 0, sizeof(hash.data));
+
+		ASSERT(gan::Hasher::GetSHA(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, hash) == NO_ERROR);
+		ASSERT(memcmp(hash.data, k_digest, sizeof(hash.data)) == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(SHA256)
+	{
 		constexpr static const uint8_t k_digest[] {
 			0x2b,0x52,0x04,0xcf,0x34,0xe9,0x25,0x8b,0x93,0xc6,0x1a,0x96,0x70,0x01,0xf7,0xc9,
 			0xf9,0x31,0x6c,0x09,0x78,0xe1,0xb0,0xde,0x41,0x3a,0x2c,0x50,0x8a,0xf1,0x69,0x84
@@ -46,4 +70,267 @@ DEFINE_TESTSUITE_START(Hash)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(SHA512)
+	{
+		constexpr static const uint8_t k_digest[] {
+			0x36,0x73,0xd2,0x2f,0x75,0xd6,0x9e,0x2d,0x2d,0x1c,0x09,0x29,0xd2,0x7d,0x74,0xa2,
+			0xf5,0x2a,0x17,0xe2,0x04,0xd5,0xbe,0x4a,0x1d,0x1f,0x96,0x4a,0xc9,0xd9,0x88,0xcd,
+			0x34,0x4a,0x56,0xcc,0x79,0xe9,0x6a,0x3c,0x00,0xdb,0xbe,0xee,0x3a,0xd9,0xb2,0x98,
+			0xb4,0x1c,0x02,0x20,0xa3,0x92,0x73,0x17,0x4a,0x33,0x66,0xe8,0x3e,0x57,0x4d,0x80
+		};
+
+		gan::Hash<512> hash;
+		memset(hash.data, 0, sizeof(hash.data));
+
+		ASSERT(gan::Hasher::GetSHA(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, hash) == NO_ERROR);
+		ASSERT(memcmp(hash.data, k_digest, sizeof(hash.data)) == 0);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+DEFINE_TESTSUITE_START(Hash_CRC32C)
+
+	DEFINE_TEST_START(KnownVectors)
+	{
+		constexpr static const char k_check[] = "123456789";
+		EXPECT(gan::Hasher::GetCRC32C(gan::ConstMemAddr{ k_check }, sizeof(k_check) - 1) == 0xE306'9283);
+
+		// Test vectors from RFC 3720 B.4
+		uint8_t data[32];
+		memset(data, 0, sizeof(data));
+		EXPECT(gan::Hasher::GetCRC32C(gan::ConstMemAddr{ data }, sizeof(data)) == 0x8A91'36AA);
+		memset(data, 0xFF, sizeof(data));
+		EXPECT(gan::Hasher::GetCRC32C(gan::ConstMemAddr{ data }, sizeof(data)) == 0x62A8'AB43);
+		for (uint8_t i = 0; i < sizeof(data); ++i)
+			data[i] = i;
+		EXPECT(gan::Hasher::GetCRC32C(gan::ConstMemAddr{ data }, sizeof(data)) == 0x46DD'794E);
+
+		EXPECT(gan::Hasher::GetCRC32C(gan::ConstMemAddr{ data }, 0) == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Incremental)
+	{
+		// Long enough to go through the interleaved code paths, with an unaligned start
+		std::vector<uint8_t> data(100'001);
+		for (size_t i = 0; i < data.size(); ++i)
+			data[i] = static_cast<uint8_t>(i * 13 + (i >> 8));
+		const auto* input = data.data() + 1;
+		const size_t size = data.size() - 1;
+
+		const uint32_t expected = gan::Hasher::GetCRC32C(gan::ConstMemAddr{ input }, size);
+		for (const size_t chunkSize : { 1uz, 7uz, 768uz, 24'577uz })
+		{
+			uint32_t crc = 0;
+			for (size_t offset = 0; offset < size; offset += chunkSize)
+				crc = gan::Hasher::GetCRC32C(gan::ConstMemAddr{ input + offset }, std::min(chunkSize, size - offset), crc);
+			EXPECT(crc == expected);
+		}
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+DEFINE_TESTSUITE_START(Hash_XXH3)
+
+	DEFINE_TEST_SHARED_START
+
+		constexpr static const char k_text[] = "The quick brown fox jumps over the lazy dog";
+		constexpr static uint64_t k_seed = 0x1234;
+
+		// Long enough to go through multiple blocks of stripes
+		static std::vector<uint8_t> MakeLongInput()
+		{
+			std::vector<uint8_t> data(100'000);
+			for (size_t i = 0; i < data.size(); ++i)
+				data[i] = static_cast<uint8_t>(i * 7 + (i >> 10));
+			return data;
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(Short64)
+	{
+		constexpr static const uint8_t k_digest[] { 0xce,0x7d,0x19,0xa5,0x41,0x8f,0xb3,0x65 };
+		constexpr static const uint8_t k_digestSeeded[] { 0x21,0xab,0x17,0xef,0xbd,0xb2,0x69,0xcd };
+
+		gan::Hash<64> hash;
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, hash);
+		EXPECT(memcmp(hash.data, k_digest, sizeof(hash.data)) == 0);
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, hash, k_seed);
+		EXPECT(memcmp(hash.data, k_digestSeeded, sizeof(hash.data)) == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Short128)
+	{
+		constexpr static const uint8_t k_digest[] {
+			0xdd,0xd6,0x50,0x20,0x5c,0xa3,0xe7,0xfa,0x24,0xa1,0xcc,0x2e,0x3a,0x8a,0x76,0x51
+		};
+		constexpr static const uint8_t k_digestSeeded[] {
+			0xad,0x1a,0xc8,0x1b,0x69,0x39,0xc5,0x12,0xec,0x81,0xc0,0xc8,0x04,0xe3,0x93,0x85
+		};
+
+		gan::Hash<128> hash;
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, hash);
+		EXPECT(memcmp(hash.data, k_digest, sizeof(hash.data)) == 0);
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, hash, k_seed);
+		EXPECT(memcmp(hash.data, k_digestSeeded, sizeof(hash.data)) == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Long)
+	{
+		constexpr static const uint8_t k_digest64[] { 0xa2,0x4a,0x0d,0xf3,0x2a,0xe9,0x2c,0x1c };
+		constexpr static const uint8_t k_digest128Seeded[] {
+			0xdb,0xdd,0xc3,0x26,0xc9,0xa0,0x39,0x49,0x9e,0xf5,0x3d,0xa7,0x29,0xf9,0xa3,0x9c
+		};
+
+		const auto data = MakeLongInput();
+
+		gan::Hash<64> hash64;
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ data.data() }, data.size(), hash64);
+		EXPECT(memcmp(hash64.data, k_digest64, sizeof(hash64.data)) == 0);
+
+		gan::Hash<128> hash128;
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ data.data() }, data.size(), hash128, k_seed);
+		EXPECT(memcmp(hash128.data, k_digest128Seeded, sizeof(hash128.data)) == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Streaming)
+	{
+		const auto data = MakeLongInput();
+
+		// Feed chunks of odd sizes so that updates cross buffer, stripe and block boundaries.
+		for (const size_t chunkSize : { 1uz, 63uz, 64uz, 255uz, 257uz, 4099uz })
+		{
+			gan::XXH3Hasher<64> hasher64;
+			gan::XXH3Hasher<128> hasher128{ k_seed };
+			for (size_t offset = 0; offset < data.size(); offset += chunkSize)
+			{
+				const auto size = std::min(chunkSize, data.size() - offset);
+				hasher64.Update(gan::ConstMemAddr{ data.data() + offset }, size);
+				hasher128.Update(gan::ConstMemAddr{ data.data() + offset }, size);
+			}
+
+			gan::Hash<64> expected64;
+			gan::Hash<128> expected128;
+			gan::Hasher::GetXXH3(gan::ConstMemAddr{ data.data() }, data.size(), expected64);
+			gan::Hasher::GetXXH3(gan::ConstMemAddr{ data.data() }, data.size(), expected128, k_seed);
+			EXPECT(hasher64.Finish() == expected64);
+			EXPECT(hasher128.Finish() == expected128);
+		}
+
+		// Short inputs are buffered until Finish()
+		gan::XXH3Hasher<64> hasher;
+		hasher.Update(gan::ConstMemAddr{ k_text }, 10);
+		hasher.Update(gan::ConstMemAddr{ k_text + 10 }, sizeof(k_text) - 11);
+		gan::Hash<64> expected;
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ k_text }, sizeof(k_text) - 1, expected);
+		EXPECT(hasher.Finish() == expected);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+DEFINE_TESTSUITE_START(Hash_File)
+
+	DEFINE_TEST_SHARED_START
+
+		std::wstring m_path;
+		std::vector<uint8_t> m_data;
+
+		DEFINE_TEST_SETUP
+		{
+			wchar_t dir[MAX_PATH];
+			wchar_t path[MAX_PATH];
+			if (!GetTempPathW(MAX_PATH, dir) || !GetTempFileNameW(dir, L"gan", 0, path))
+				return false;
+			m_path = path;
+
+			// Not a multiple of the internal chunk size, so that the last read is a partial one
+			m_data.resize(0x34'5678);
+			for (size_t i = 0; i < m_data.size(); ++i)
+				m_data[i] = static_cast<uint8_t>(i * 31 + (i >> 12));
+
+			HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (hFile == INVALID_HANDLE_VALUE)
+				return false;
+			DWORD numWritten = 0;
+			const bool written = WriteFile(hFile, m_data.data(), static_cast<DWORD>(m_data.size()), &numWritten, nullptr)
+				&& numWritten == m_data.size();
+			CloseHandle(hFile);
+			return written;
+		}
+
+		DEFINE_TEST_TEARDOWN
+		{
+			DeleteFileW(m_path.c_str());
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(XXH3)
+	{
+		gan::Hash<64> hash64;
+		gan::Hash<64> expected64;
+		ASSERT(gan::Hasher::HashFile(m_path, hash64) == NO_ERROR);
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ m_data.data() }, m_data.size(), expected64);
+		EXPECT(hash64 == expected64);
+
+		gan::Hash<128> hash128;
+		gan::Hash<128> expected128;
+		ASSERT(gan::Hasher::HashFile(m_path, hash128) == NO_ERROR);
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ m_data.data() }, m_data.size(), expected128);
+		EXPECT(hash128 == expected128);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(SHA)
+	{
+		gan::Hash<256> hash;
+		gan::Hash<256> expected;
+		ASSERT(gan::Hasher::HashFile(m_path, hash) == NO_ERROR);
+		ASSERT(gan::Hasher::GetSHA(gan::ConstMemAddr{ m_data.data() }, m_data.size(), expected) == NO_ERROR);
+		EXPECT(hash == expected);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(StreamingSHA)
+	{
+		gan::Hash<512> expected;
+		ASSERT(gan::Hasher::GetSHA(gan::ConstMemAddr{ m_data.data() }, m_data.size(), expected) == NO_ERROR);
+
+		// Finish() resets the hasher, so the same instance can be used twice
+		gan::ShaHasher<512> hasher;
+		for (int round = 0; round < 2; ++round)
+		{
+			constexpr size_t k_chunkSize = 0x1'0001;
+			for (size_t offset = 0; offset < m_data.size(); offset += k_chunkSize)
+				ASSERT(hasher.Update(gan::ConstMemAddr{ m_data.data() + offset }, std::min(k_chunkSize, m_data.size() - offset)) == NO_ERROR);
+
+			gan::Hash<512> hash;
+			ASSERT(hasher.Finish(hash) == NO_ERROR);
+			EXPECT(hash == expected);
+		}
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(NonExistentFile)
+	{
+		gan::Hash<64> hash;
+		EXPECT(gan::Hasher::HashFile(m_path + L".nonexistent", hash) == ERROR_FILE_NOT_FOUND);
+	}
+	DEFINE_TEST_END
+
 DEFINE_TESTSUITE_END
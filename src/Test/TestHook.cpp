@@ -21,8 +21,18 @@
 #include <Hook.h>
 #include <PE.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <set>
+#include <span>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include <intrin.h>
 #include <windows.h>
 #include <commctrl.h>
 #include <processthreadsapi.h>
@@ -47,6 +57,23 @@ DEFINE_TESTSUITE_START(Hook_General)
 		__declspec(noinline) static size_t Add(size_t n1, size_t n2) { return Zero() ? 0 : n1 + n2; }
 		__declspec(noinline) static size_t Mul(size_t n1, size_t n2) { return Zero() ? 0 : n1 * n2; }
 
+		__declspec(noinline) static size_t AddAndTriple(size_t n1, size_t n2)
+		{
+			return gan::StaticHook<&Add>::GetTrampoline()(n1, n2) * 3;
+		}
+
+		// Layers on top of Add()
+		inline static const gan::Hook* s_incLayer = nullptr;
+		inline static const gan::Hook* s_doubleLayer = nullptr;
+		__declspec(noinline) static size_t AddAndIncrement(size_t n1, size_t n2)
+		{
+			return s_incLayer->GetOriginal<decltype(&Add)>()(n1, n2) + 1;
+		}
+		__declspec(noinline) static size_t AddAndDouble(size_t n1, size_t n2)
+		{
+			return s_doubleLayer->GetOriginal<decltype(&Add)>()(n1, n2) * 2;
+		}
+
 		struct Dummy
 		{
 			__declspec(noinline) size_t Add(size_t n2) const { return Zero() ? 0 : n + n2; }
@@ -124,9 +151,1054 @@ DEFINE_TESTSUITE_START(Hook_General)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(StaticHook_Trampoline)
+	{
+		gan::StaticHook<&Add> hook{ AddAndTriple };
+
+		EXPECT(!gan::StaticHook<&Add>::GetTrampoline());
+		ASSERT(hook.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(gan::StaticHook<&Add>::GetTrampoline());
+		EXPECT(Add(123, 321) == 1332);
+		ASSERT(hook.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(!gan::StaticHook<&Add>::GetTrampoline());
+		EXPECT(Add(123, 321) == 444);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Toggleable)
+	{
+		gan::Hook hook { Add, Mul, gan::Hook::Dispatch::Toggleable };
+
+		hook.SetEnabled(false);
+		ASSERT(hook.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(Add(123, 321) == 444);
+		hook.SetEnabled(true);
+		EXPECT(Add(123, 321) == 39483);
+		EXPECT(gan::Hook::GetTrampoline(Add)(123, 321) == 444);
+		hook.SetEnabled(false);
+		EXPECT(Add(123, 321) == 444);
+		ASSERT(hook.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(!hook.IsEnabled());
+		EXPECT(Add(123, 321) == 444);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Layered)
+	{
+		gan::Hook incLayer { Add, AddAndIncrement, gan::Hook::Dispatch::Layered };
+		gan::Hook doubleLayer { Add, AddAndDouble, gan::Hook::Dispatch::Layered };
+		s_incLayer = &incLayer;
+		s_doubleLayer = &doubleLayer;
+
+		ASSERT(incLayer.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(Add(123, 321) == 445);
+
+		// Layers after the first one don't touch the prolog.
+		uint8_t prolog[8];
+		memcpy(prolog, reinterpret_cast<const void*>(Add), sizeof(prolog));
+		ASSERT(doubleLayer.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(memcmp(prolog, reinterpret_cast<const void*>(Add), sizeof(prolog)) == 0);
+		EXPECT(Add(123, 321) == 890);
+		EXPECT(gan::Hook::GetTrampoline(Add)(123, 321) == 444);
+
+		gan::Hook directHook { Add, Mul };
+		EXPECT(directHook.Install() == gan::Hook::OpResult::AddressInUse);
+
+		ASSERT(incLayer.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(memcmp(prolog, reinterpret_cast<const void*>(Add), sizeof(prolog)) == 0);
+		EXPECT(Add(123, 321) == 888);
+		ASSERT(doubleLayer.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(Add(123, 321) == 444);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+DEFINE_TESTSUITE_START(Hook_Transaction)
+
+	DEFINE_TEST_SHARED_START
+
+		static size_t Zero() { return reinterpret_cast<size_t>(GetModuleHandleA("ThisModuleMustNotExistOrWeAreScrewed")); }
+
+		__declspec(noinline) static size_t Add(size_t n1, size_t n2) { return Zero() ? 0 : n1 + n2; }
+		__declspec(noinline) static size_t Sub(size_t n1, size_t n2) { return Zero() ? 0 : n1 - n2; }
+		__declspec(noinline) static size_t Mul(size_t n1, size_t n2) { return Zero() ? 0 : n1 * n2; }
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(InstallAndUninstall)
+	{
+		gan::Hook hookAdd { Add, Mul };
+		gan::Hook hookSub { Sub, Mul };
+
+		gan::HookTransaction installation;
+		installation.Install(hookAdd);
+		installation.Install(hookSub);
+		ASSERT(installation.GetSize() == 2);
+		ASSERT(installation.Commit());
+		EXPECT(installation.GetSize() == 0);
+		EXPECT(Add(123, 321) == 39483);
+		EXPECT(Sub(123, 321) == 39483);
+
+		gan::HookTransaction uninstallation;
+		uninstallation.Uninstall(hookAdd);
+		uninstallation.Uninstall(hookSub);
+		ASSERT(uninstallation.Commit());
+		EXPECT(Add(123, 321) == 444);
+		EXPECT(Sub(321, 123) == 198);
+		EXPECT(hookAdd.Uninstall() == gan::Hook::OpResult::NotHooked);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(RollbackOnFailure)
+	{
+		gan::Hook hookAdd { Add, Mul };
+		gan::Hook hookSub { Sub, Mul };
+		gan::Hook hookSubAgain { Sub, Add };
+		ASSERT(hookSub.Install() == gan::Hook::OpResult::Hooked);
+
+		gan::HookTransaction transaction;
+		transaction.Install(hookAdd);
+		transaction.Install(hookSubAgain);  // Sub() is already hooked.
+		const auto result = transaction.Commit();
+		ASSERT(!result);
+		EXPECT(result.error().index == 1);
+		EXPECT(result.error().result == gan::Hook::OpResult::AddressInUse);
+		EXPECT(Add(123, 321) == 444);  // Must not be hooked.
+		EXPECT(hookAdd.Install() == gan::Hook::OpResult::Hooked);  // Nothing is left behind.
+
+		EXPECT(hookAdd.Uninstall() == gan::Hook::OpResult::Unhooked);
+		ASSERT(hookSub.Uninstall() == gan::Hook::OpResult::Unhooked);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+DEFINE_TESTSUITE_START(Hook_Probe)
+
+	DEFINE_TEST_SHARED_START
+
+		// Returns n1 + n2 + 3 in a few instructions, so that a probe can be put at a known instruction
+		// boundary. The probe goes right before n2 is added, when the accumulator holds n1.
+#ifdef _WIN64
+		constexpr static uint8_t k_sumCode[] {
+			0x48, 0x89, 0xC8,        // mov rax, rcx
+			0x48, 0x01, 0xD0,        // add rax, rdx
+			0x48, 0x83, 0xC0, 0x01,  // add rax, 1
+			0x48, 0x83, 0xC0, 0x02,  // add rax, 2
+			0xC3,                    // ret
+		};
+		constexpr static size_t k_probeOffset = 3;
+#else
+		constexpr static uint8_t k_sumCode[] {
+			0x8B, 0x44, 0x24, 0x04,  // mov eax, [esp+4]
+			0x03, 0x44, 0x24, 0x08,  // add eax, [esp+8]
+			0x83, 0xC0, 0x01,        // add eax, 1
+			0x83, 0xC0, 0x02,        // add eax, 2
+			0xC3,                    // ret
+		};
+		constexpr static size_t k_probeOffset = 4;
+#endif  // _WIN64
+
+		// Stores 1.0 and a YMM register, both loaded before the probe, into a buffer of 36 bytes. Registers
+		// are named as on ia32; the encoding is the same with the 64-bit ones on amd64.
+		constexpr static uint8_t k_vectorCode[] {
+#ifndef _WIN64
+			0x8B, 0x4C, 0x24, 0x04,        // mov ecx, [esp+4]
+#endif  // _WIN64
+			0xC5, 0xFE, 0x6F, 0x01,        // vmovdqu ymm0, [ecx]
+			0xD9, 0xE8,                    // fld1
+			0x0F, 0x1F, 0x44, 0x00, 0x00,  // nop dword ptr [eax+eax]  ; probe
+			0xD9, 0x59, 0x20,              // fstp dword ptr [ecx+32]
+			0xC5, 0xFE, 0x7F, 0x01,        // vmovdqu [ecx], ymm0
+			0xC5, 0xF8, 0x77,              // vzeroupper
+			0xC3,                          // ret
+		};
+		constexpr static size_t k_vectorProbeOffset = gan::Is64() ? 6 : 10;
+		constexpr static uint8_t k_clobberCode[] {
+			0xC5, 0xFD, 0x74, 0xC0,        // vpcmpeqb ymm0, ymm0, ymm0
+			0xDB, 0xE3,                    // fninit
+			0xC3,                          // ret
+		};
+		constexpr static size_t k_vectorCodeOffset = 0x40;
+		constexpr static size_t k_clobberCodeOffset = 0x80;
+
+		static void OnProbe(gan::ProbeContext& context, void* userData)
+		{
+			++*static_cast<size_t*>(userData);
+#ifdef _WIN64
+			context.rax += 1000;
+#else
+			context.eax += 1000;
+#endif  // _WIN64
+		}
+
+		// Leaves all vector registers and the x87 stack in a different state than before the probe
+		static void OnProbeClobber(gan::ProbeContext&, void* userData)
+		{
+			gan::ToAnyFn<void(*)()>(userData)();
+		}
+
+		static bool IsAvxSupported()
+		{
+			int cpuInfo[4] { };
+			__cpuid(cpuInfo, 1);
+			constexpr int k_osxsave = 1 << 27;
+			constexpr int k_avx = 1 << 28;
+			return (cpuInfo[2] & (k_osxsave | k_avx)) == (k_osxsave | k_avx) && (_xgetbv(0) & 0b110) == 0b110;
+		}
+
+		gan::MemAddr m_code;
+
+		DEFINE_TEST_SETUP
+		{
+			m_code = gan::MemAddr{ VirtualAlloc(nullptr, 0x1000, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE) };
+			if (!m_code)
+				return false;
+			memcpy(m_code.Ptr(), k_sumCode, sizeof(k_sumCode));
+			memcpy(m_code.Offset(k_vectorCodeOffset).Ptr(), k_vectorCode, sizeof(k_vectorCode));
+			memcpy(m_code.Offset(k_clobberCodeOffset).Ptr(), k_clobberCode, sizeof(k_clobberCode));
+			return true;
+		}
+
+		DEFINE_TEST_TEARDOWN
+		{
+			VirtualFree(m_code.Ptr(), 0, MEM_RELEASE);
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(InstallAndUninstall)
+	{
+		const auto sum = gan::ToAnyFn<size_t(*)(size_t, size_t)>(m_code.Ptr());
+
+		size_t hits = 0;
+		gan::Probe probe { m_code.Offset(k_probeOffset), OnProbe, &hits };
+		EXPECT(sum(123, 321) == 447);
+		ASSERT(probe.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(sum(123, 321) == 1447);
+		EXPECT(sum(1, 2) == 1006);
+		EXPECT(hits == 2);
+		ASSERT(probe.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(sum(123, 321) == 447);
+		EXPECT(hits == 2);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(Overlapping)
+	{
+		size_t hits = 0;
+		gan::Probe probe { m_code.Offset(k_probeOffset), OnProbe, &hits };
+		ASSERT(probe.Install() == gan::Hook::OpResult::Hooked);
+
+		// Patching the entry takes more bytes than there are before the probe.
+		gan::Probe entryProbe { m_code, OnProbe, &hits };
+		EXPECT(entryProbe.Install() == gan::Hook::OpResult::AddressInUse);
+		gan::Probe sameProbe { m_code.Offset(k_probeOffset), OnProbe, &hits };
+		EXPECT(sameProbe.Install() == gan::Hook::OpResult::AddressInUse);
+
+		ASSERT(probe.Uninstall() == gan::Hook::OpResult::Unhooked);
+		ASSERT(entryProbe.Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(entryProbe.Uninstall() == gan::Hook::OpResult::Unhooked);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(VectorState)
+	{
+		if (!IsAvxSupported())
+			return;
+
+		const auto store = gan::ToAnyFn<void(*)(uint8_t*)>(m_code.Offset(k_vectorCodeOffset).Ptr());
+		gan::Probe probe { m_code.Offset(k_vectorCodeOffset + k_vectorProbeOffset), OnProbeClobber, m_code.Offset(k_clobberCodeOffset).Ptr() };
+		ASSERT(probe.Install() == gan::Hook::OpResult::Hooked);
+
+		// Both halves of the YMM register must survive, as well as the x87 stack.
+		uint8_t buffer[36];
+		for (size_t i = 0; i < 32; ++i)
+			buffer[i] = static_cast<uint8_t>(i);
+		store(buffer);
+		for (size_t i = 0; i < 32; ++i)
+			EXPECT(buffer[i] == i);
+		float one;
+		memcpy(&one, buffer + 32, sizeof(one));
+		EXPECT(one == 1.0f);
+
+		ASSERT(probe.Uninstall() == gan::Hook::OpResult::Unhooked);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+DEFINE_TESTSUITE_START(Hook_TrampolineSlots)
+
+	DEFINE_TEST_SHARED_START
+
+		// Returns n1 + n2 + 3. Many copies are hooked at once.
+#ifdef _WIN64
+		constexpr static uint8_t k_sumCode[] {
+			0x48, 0x89, 0xC8,        // mov rax, rcx
+			0x48, 0x01, 0xD0,        // add rax, rdx
+			0x48, 0x83, 0xC0, 0x01,  // add rax, 1
+			0x48, 0x83, 0xC0, 0x02,  // add rax, 2
+			0xC3,                    // ret
+		};
+#else
+		constexpr static uint8_t k_sumCode[] {
+			0x8B, 0x44, 0x24, 0x04,  // mov eax, [esp+4]
+			0x03, 0x44, 0x24, 0x08,  // add eax, [esp+8]
+			0x83, 0xC0, 0x01,        // add eax, 1
+			0x83, 0xC0, 0x02,        // add eax, 2
+			0xC3,                    // ret
+		};
+#endif  // _WIN64
+		constexpr static size_t k_funcStride = 16;
+		constexpr static size_t k_numFuncs = 4096;
+
+		using Func = size_t (*)(size_t, size_t);
+
+		static size_t Mul(size_t n1, size_t n2) { return n1 * n2; }
+
+		Func GetFunc(size_t index) const
+		{
+			return gan::ToAnyFn<Func>(m_code.Offset(index * k_funcStride).Ptr());
+		}
+
+		gan::MemAddr m_code;
+
+		DEFINE_TEST_SETUP
+		{
+			constexpr size_t k_codeSize = k_numFuncs * k_funcStride;
+			m_code = gan::MemAddr{ VirtualAlloc(nullptr, k_codeSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE) };
+			if (!m_code)
+				return false;
+			memset(m_code.Ptr(), 0xCC, k_codeSize);
+			for (size_t i = 0; i < k_numFuncs; ++i)
+				memcpy(m_code.Offset(i * k_funcStride).Ptr(), k_sumCode, sizeof(k_sumCode));
+			return true;
+		}
+
+		DEFINE_TEST_TEARDOWN
+		{
+			VirtualFree(m_code.Ptr(), 0, MEM_RELEASE);
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(AllocationAndRelease)
+	{
+		SYSTEM_INFO sysInfo;
+		GetSystemInfo(&sysInfo);
+		const auto pageMask = ~(static_cast<size_t>(sysInfo.dwAllocationGranularity) - 1);
+		const auto isCommitted = [](gan::MemAddr page) {
+			MEMORY_BASIC_INFORMATION memInfo{ };
+			return VirtualQuery(page.ConstPtr(), &memInfo, sizeof(memInfo)) != 0 && memInfo.State == MEM_COMMIT;
+		};
+
+		// The keeper stays installed throughout, and so does the page of its trampoline.
+		gan::Hook keeper(GetFunc(0), Mul);
+		ASSERT(keeper.Install() == gan::Hook::OpResult::Hooked);
+
+		std::vector<gan::Hook> hooks;
+		hooks.reserve(k_numFuncs - 2);
+		for (size_t i = 2; i < k_numFuncs; ++i)
+			hooks.emplace_back(GetFunc(i), Mul);
+		const auto installAll = [&hooks]() {
+			gan::HookTransaction transaction;
+			for (auto& hook : hooks)
+				transaction.Install(hook);
+			std::set<gan::MemAddr> trampolines;
+			if (transaction.Commit())
+			{
+				for (const auto& hook : hooks)
+					trampolines.emplace(gan::FromAnyFn(hook.GetOriginal<Func>()));
+			}
+			return trampolines;
+		};
+		const auto uninstallAll = [&hooks]() {
+			gan::HookTransaction transaction;
+			for (auto& hook : hooks)
+				transaction.Uninstall(hook);
+			return transaction.Commit().has_value();
+		};
+
+		// Thousands of trampolines take more than one page.
+		const auto firstTrampolines = installAll();
+		ASSERT(firstTrampolines.size() == hooks.size());
+		std::set<gan::MemAddr> pages;
+		for (const auto trampoline : firstTrampolines)
+			pages.emplace(trampoline & pageMask);
+		EXPECT(pages.size() > 1);
+		ASSERT(uninstallAll());
+
+		// Unregistered trampolines are neither reused nor freed during the grace period.
+		const auto secondTrampolines = installAll();
+		ASSERT(secondTrampolines.size() == hooks.size());
+		EXPECT(std::ranges::none_of(secondTrampolines, [&firstTrampolines](gan::MemAddr trampoline) {
+			return firstTrampolines.contains(trampoline);
+		}));
+		for (const auto trampoline : secondTrampolines)
+			pages.emplace(trampoline & pageMask);
+		ASSERT(uninstallAll());
+		EXPECT(std::ranges::all_of(pages, isCommitted));
+
+		// Once it has passed, retired trampolines are reclaimed before new ones are allocated, and pages with no
+		// trampoline left are freed. Only the one of the keeper is left, where the latecomer goes.
+		const auto gracePeriod = gan::Hook::GetGracePeriod();
+		gan::Hook::SetGracePeriod(std::chrono::milliseconds::zero());
+		gan::Hook latecomer(GetFunc(1), Mul);
+		const auto result = latecomer.Install();
+		gan::Hook::SetGracePeriod(gracePeriod);
+		ASSERT(result == gan::Hook::OpResult::Hooked);
+		EXPECT(std::ranges::count_if(pages, isCommitted) <= 1);
+		EXPECT(pages.contains(gan::MemAddr{ gan::FromAnyFn(latecomer.GetOriginal<Func>()) } & pageMask));
+
+		// Slots freed in the page left come first.
+		const auto thirdTrampolines = installAll();
+		ASSERT(thirdTrampolines.size() == hooks.size());
+		EXPECT(std::ranges::any_of(thirdTrampolines, [&firstTrampolines](gan::MemAddr trampoline) {
+			return firstTrampolines.contains(trampoline);
+		}));
+		EXPECT(GetFunc(2)(3, 4) == 12);
+		EXPECT(uninstallAll());
+		EXPECT(latecomer.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(keeper.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(GetFunc(0)(3, 4) == 10);
+		EXPECT(GetFunc(1)(3, 4) == 10);
+		EXPECT(GetFunc(2)(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+DEFINE_TESTSUITE_START(Hook_Closure)
+
+	DEFINE_TEST_SHARED_START
+
+		static size_t Zero() { return reinterpret_cast<size_t>(GetModuleHandleA("ThisModuleMustNotExistOrWeAreScrewed")); }
+
+		__declspec(noinline) static size_t Add(size_t n1, size_t n2) { return Zero() ? 0 : n1 + n2; }
+		__declspec(noinline) static size_t Mul(size_t n1, size_t n2) { return Zero() ? 0 : n1 * n2; }
+		__declspec(noinline) static size_t AddTwice(size_t n1, size_t n2) { return Add(Add(n1, n2), n2); }
+
+		using Func = decltype(&Add);
+
+		// Hooks a function with a state of its own
+		struct Offset
+		{
+			Offset(Func func, size_t offset)
+				: offset(offset)
+				, numCalls(0)
+				, closure([this](size_t n1, size_t n2) {
+					++numCalls;
+					return hook->GetOriginal<Func>()(n1, n2) + this->offset;
+				})
+			{
+				if (closure.Get())
+					hook.emplace(func, closure.Get());
+			}
+
+			size_t offset;
+			size_t numCalls;
+			gan::Closure<Func> closure;
+			std::optional<gan::Hook> hook;
+		};
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(StatePerInstance)
+	{
+		Offset addOffset(Add, 1000);
+		Offset mulOffset(Mul, 2000);
+		ASSERT(addOffset.hook && mulOffset.hook);
+		ASSERT(addOffset.hook->Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(mulOffset.hook->Install() == gan::Hook::OpResult::Hooked);
+
+		EXPECT(Add(1, 2) == 1003);
+		EXPECT(Mul(3, 4) == 2012);
+		EXPECT(Add(5, 6) == 1011);
+		EXPECT(addOffset.numCalls == 2);
+		EXPECT(mulOffset.numCalls == 1);
+
+		ASSERT(addOffset.hook->Uninstall() == gan::Hook::OpResult::Unhooked);
+		ASSERT(mulOffset.hook->Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(Add(1, 2) == 3);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(NestedCalls)
+	{
+		// The outer closure calls the inner one before its own state is used again.
+		Offset twiceOffset(AddTwice, 1000);
+		Offset addOffset(Add, 1);
+		ASSERT(twiceOffset.hook && addOffset.hook);
+		ASSERT(twiceOffset.hook->Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(addOffset.hook->Install() == gan::Hook::OpResult::Hooked);
+
+		EXPECT(AddTwice(1, 2) == 1007);
+		EXPECT(twiceOffset.numCalls == 1);
+		EXPECT(addOffset.numCalls == 2);
+
+		ASSERT(addOffset.hook->Uninstall() == gan::Hook::OpResult::Unhooked);
+		ASSERT(twiceOffset.hook->Uninstall() == gan::Hook::OpResult::Unhooked);
+	}
+	DEFINE_TEST_END
+
 DEFINE_TESTSUITE_END
 
 
+
+DEFINE_TESTSUITE_START(Hook_Concurrency)
+
+	DEFINE_TEST_SHARED_START
+
+		// Returns n1 + n2 + 3, like in Hook_Probe. Many copies are hooked at once.
+#ifdef _WIN64
+		constexpr static uint8_t k_sumCode[] {
+			0x48, 0x89, 0xC8,        // mov rax, rcx
+			0x48, 0x01, 0xD0,        // add rax, rdx
+			0x48, 0x83, 0xC0, 0x01,  // add rax, 1
+			0x48, 0x83, 0xC0, 0x02,  // add rax, 2
+			0xC3,                    // ret
+		};
+#else
+		constexpr static uint8_t k_sumCode[] {
+			0x8B, 0x44, 0x24, 0x04,  // mov eax, [esp+4]
+			0x03, 0x44, 0x24, 0x08,  // add eax, [esp+8]
+			0x83, 0xC0, 0x01,        // add eax, 1
+			0x83, 0xC0, 0x02,        // add eax, 2
+			0xC3,                    // ret
+		};
+#endif  // _WIN64
+		constexpr static size_t k_funcStride = 16;
+		constexpr static size_t k_numFuncs = 4096;
+		constexpr static size_t k_numThreads = 8;
+
+		using Func = size_t (*)(size_t, size_t);
+
+		static size_t Mul(size_t n1, size_t n2) { return n1 * n2; }
+
+		Func GetFunc(size_t index) const
+		{
+			return gan::ToAnyFn<Func>(m_code.Offset(index * k_funcStride).Ptr());
+		}
+
+		gan::MemAddr m_code;
+
+		DEFINE_TEST_SETUP
+		{
+			constexpr size_t k_codeSize = k_numFuncs * k_funcStride;
+			m_code = gan::MemAddr{ VirtualAlloc(nullptr, k_codeSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE) };
+			if (!m_code)
+				return false;
+			memset(m_code.Ptr(), 0xCC, k_codeSize);
+			for (size_t i = 0; i < k_numFuncs; ++i)
+				memcpy(m_code.Offset(i * k_funcStride).Ptr(), k_sumCode, sizeof(k_sumCode));
+			return true;
+		}
+
+		DEFINE_TEST_TEARDOWN
+		{
+			VirtualFree(m_code.Ptr(), 0, MEM_RELEASE);
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(DifferentTargets)
+	{
+		constexpr size_t k_numRounds = 4;
+
+		// Functions of each thread are interleaved with those of the others, so that all threads keep
+		// patching the same pages.
+		std::atomic<size_t> numFailures = 0;
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < k_numThreads; ++t)
+		{
+			threads.emplace_back([this, t, &numFailures]() {
+				std::vector<gan::Hook> hooks;
+				hooks.reserve(k_numFuncs / k_numThreads);
+				for (size_t i = t; i < k_numFuncs; i += k_numThreads)
+					hooks.emplace_back(GetFunc(i), Mul);
+
+				for (size_t round = 0; round < k_numRounds; ++round)
+				{
+					for (auto& hook : hooks)
+						numFailures += hook.Install() != gan::Hook::OpResult::Hooked;
+					for (size_t i = t; i < k_numFuncs; i += k_numThreads)
+						numFailures += GetFunc(i)(3, 4) != 12;
+					for (auto& hook : hooks)
+						numFailures += hook.Uninstall() != gan::Hook::OpResult::Unhooked;
+					for (size_t i = t; i < k_numFuncs; i += k_numThreads)
+						numFailures += GetFunc(i)(3, 4) != 10;
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		EXPECT(numFailures == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(SameTargets)
+	{
+		constexpr size_t k_numTargets = 4;
+		constexpr size_t k_numRounds = 200;
+
+		// Every thread puts a layer on each target, so that layers come and go on all of them at the same time.
+		std::atomic<size_t> numFailures = 0;
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < k_numThreads; ++t)
+		{
+			threads.emplace_back([this, &numFailures]() {
+				for (size_t round = 0; round < k_numRounds; ++round)
+				{
+					std::vector<gan::Hook> layers;
+					layers.reserve(k_numTargets);
+					for (size_t i = 0; i < k_numTargets; ++i)
+						layers.emplace_back(GetFunc(i), Mul, gan::Hook::Dispatch::Layered);
+
+					for (auto& layer : layers)
+						numFailures += layer.Install() != gan::Hook::OpResult::Hooked;
+					for (size_t i = 0; i < k_numTargets; ++i)
+						numFailures += GetFunc(i)(3, 4) != 12;
+					for (auto& layer : layers)
+						numFailures += layer.Uninstall() != gan::Hook::OpResult::Unhooked;
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		EXPECT(numFailures == 0);
+
+		for (size_t i = 0; i < k_numTargets; ++i)
+		{
+			EXPECT(memcmp(gan::FromAnyFn(GetFunc(i)), k_sumCode, sizeof(k_sumCode)) == 0);
+			EXPECT(GetFunc(i)(3, 4) == 10);
+		}
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(ToggleWhileInstalling)
+	{
+		constexpr size_t k_numRounds = 1000;
+
+		// The hook is disabled while it's being installed, which must stick whenever it happens.
+		size_t numFailures = 0;
+		for (size_t round = 0; round < k_numRounds; ++round)
+		{
+			gan::Hook hook(GetFunc(0), Mul, gan::Hook::Dispatch::Toggleable);
+			std::thread toggler([&hook]() { hook.SetEnabled(false); });
+			numFailures += hook.Install() != gan::Hook::OpResult::Hooked;
+			toggler.join();
+			numFailures += GetFunc(0)(3, 4) != 10;
+			numFailures += hook.Uninstall() != gan::Hook::OpResult::Unhooked;
+		}
+		EXPECT(numFailures == 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(LookupsWhileRebuilding)
+	{
+		// Distinct functions hooked and unhooked one after another keep the lookup table being rebuilt,
+		// while readers must keep finding the trampoline of the one which stays hooked.
+		gan::Hook keeper(GetFunc(0), Mul);
+		ASSERT(keeper.Install() == gan::Hook::OpResult::Hooked);
+		const auto trampoline = gan::Hook::GetTrampoline(GetFunc(0));
+		ASSERT(trampoline);
+		EXPECT(trampoline(3, 4) == 10);
+
+		std::atomic<bool> stop = false;
+		std::atomic<size_t> numWrongResults = 0;
+		std::vector<std::thread> readers;
+		for (size_t t = 0; t < k_numThreads; ++t)
+		{
+			readers.emplace_back([this, trampoline, &stop, &numWrongResults]() {
+				while (!stop.load(std::memory_order_relaxed))
+					numWrongResults += gan::Hook::GetTrampoline(GetFunc(0)) != trampoline;
+			});
+		}
+
+		size_t numFailures = 0;
+		for (size_t i = 1; i < k_numFuncs; ++i)
+		{
+			gan::Hook hook(GetFunc(i), Mul);
+			numFailures += hook.Install() != gan::Hook::OpResult::Hooked;
+			numFailures += hook.Uninstall() != gan::Hook::OpResult::Unhooked;
+		}
+		stop = true;
+		for (auto& reader : readers)
+			reader.join();
+		EXPECT(numFailures == 0);
+		EXPECT(numWrongResults == 0);
+
+		ASSERT(keeper.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(GetFunc(0)(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(CallsWhilePatching)
+	{
+		constexpr size_t k_numTargets = 17;
+		constexpr size_t k_targetStride = 48;
+		constexpr size_t k_cacheLineSize = 64;
+		constexpr size_t k_codeSize = k_numTargets * k_targetStride + k_cacheLineSize;
+		constexpr size_t k_numRounds = 500;
+		static_assert((k_numTargets - 1) * k_targetStride % k_cacheLineSize == 0);
+
+		// Copies which can be hot-patched, as their first instruction covers any hook prolog. They start at
+		// every offset within an oword, so that prologs are written both with single stores and "jmp $" first,
+		// and the last one at the last byte of a cache line, where not even "jmp $" can be written with one
+		// store. The padding isn't int3, or short jumps to auxiliary prologs would be used instead.
+		constexpr static uint8_t k_longNop[] { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 };
+		const gan::MemAddr code{ VirtualAlloc(nullptr, k_codeSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE) };
+		ASSERT(code);
+		memset(code.Ptr(), 0xC3, k_codeSize);  // ret
+		std::vector<Func> targets;
+		for (size_t i = 0; i < k_numTargets; ++i)
+		{
+			const size_t offset = i * k_targetStride + (i + 1 < k_numTargets ? i : k_cacheLineSize - 1);
+			const gan::MemAddr target = code.Offset(offset);
+			memcpy(target.Ptr(), k_longNop, sizeof(k_longNop));
+			memcpy(target.Offset(sizeof(k_longNop)).Ptr(), k_sumCode, sizeof(k_sumCode));
+			targets.emplace_back(gan::ToAnyFn<Func>(target.Ptr()));
+		}
+
+		// Callers must only ever see the hooked or the original function.
+		std::atomic<bool> stop = false;
+		std::atomic<size_t> numWrongResults = 0;
+		std::vector<std::thread> callers;
+		for (size_t t = 0; t < k_numThreads; ++t)
+		{
+			callers.emplace_back([&targets, &stop, &numWrongResults]() {
+				while (!stop.load(std::memory_order_relaxed))
+				{
+					for (const Func target : targets)
+					{
+						const size_t result = target(3, 4);
+						numWrongResults += result != 10 && result != 12;
+					}
+				}
+			});
+		}
+
+		std::vector<gan::Hook> hooks;
+		hooks.reserve(k_numTargets);
+		for (const Func target : targets)
+			hooks.emplace_back(target, Mul);
+
+		size_t numFailures = 0;
+		for (size_t round = 0; round < k_numRounds; ++round)
+		{
+			gan::HookTransaction installation;
+			for (auto& hook : hooks)
+				installation.Install(hook);
+			numFailures += !installation.Commit();
+
+			gan::HookTransaction uninstallation;
+			for (auto& hook : hooks)
+				uninstallation.Uninstall(hook);
+			numFailures += !uninstallation.Commit();
+		}
+		stop = true;
+		for (auto& caller : callers)
+			caller.join();
+		EXPECT(numFailures == 0);
+		EXPECT(numWrongResults == 0);
+
+		VirtualFree(code.Ptr(), 0, MEM_RELEASE);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+
+
+
+#ifdef _WIN64
+extern "C" size_t Test_Hook_NopGapSum(size_t n1, size_t n2);
+
+DEFINE_TESTSUITE_START(Hook_Placement)
+
+	DEFINE_TEST_SHARED_START
+
+		constexpr static uint8_t k_sumCode[] {
+			0x48, 0x89, 0xC8,        // mov rax, rcx
+			0x48, 0x01, 0xD0,        // add rax, rdx
+			0x48, 0x83, 0xC0, 0x01,  // add rax, 1
+			0x48, 0x83, 0xC0, 0x02,  // add rax, 2
+			0xC3,                    // ret
+		};
+		constexpr static uint8_t k_mulCode[] {
+			0x48, 0x89, 0xC8,        // mov rax, rcx
+			0x48, 0x0F, 0xAF, 0xC2,  // imul rax, rdx
+			0xC3,                    // ret
+		};
+		constexpr static intptr_t k_1GB = 0x4000'0000;
+		constexpr static intptr_t k_2GB = 2 * k_1GB;
+		constexpr static size_t k_holeSize = 16 * k_1GB;
+
+		using Func = size_t (*)(size_t, size_t);
+
+		// Code is placed at chosen addresses in a hole of the address space, away from everything else.
+		gan::MemAddr m_hole;
+		size_t m_granularity = 0;
+		std::vector<gan::MemAddr> m_allocations;
+
+		bool Reserve(gan::MemAddr begin, gan::MemAddr end)
+		{
+			if (!VirtualAlloc(begin.Ptr(), static_cast<size_t>(end - begin), MEM_RESERVE, PAGE_NOACCESS))
+				return false;
+			m_allocations.emplace_back(begin);
+			return true;
+		}
+
+		Func PlaceCode(gan::MemAddr addr, std::span<const uint8_t> code)
+		{
+			if (!VirtualAlloc(addr.Ptr(), m_granularity, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE))
+				return nullptr;
+			m_allocations.emplace_back(addr);
+			memcpy(addr.Ptr(), code.data(), code.size());
+			return gan::ToAnyFn<Func>(addr.Ptr());
+		}
+
+		// Where "0xEB imm8" at "jump" goes
+		static gan::MemAddr GetShortJumpDest(gan::MemAddr jump)
+		{
+			return jump.Offset(2 + jump.Offset(1).ConstRef<int8_t>());
+		}
+
+		// Whether "aux" is an auxiliary prolog, i.e., "mov rax, hookFunc; jmp rax"
+		static bool IsAuxPrologTo(gan::MemAddr aux, Func hookFunc)
+		{
+			return aux.ConstRef<uint16_t>() == 0xB848
+				&& aux.Offset(2).ConstRef<const void*>() == gan::FromAnyFn(hookFunc)
+				&& aux.Offset(10).ConstRef<uint16_t>() == 0xE0FF;
+		}
+
+		// With incremental linking, the address of a function is that of a jump to it.
+		static gan::MemAddr SkipIncrementalLinkingThunk(gan::MemAddr func)
+		{
+			if (func.ConstRef<uint8_t>() != 0xE9)
+				return func;
+			return func.Offset(5 + func.Offset(1).ConstRef<int32_t>());
+		}
+
+		DEFINE_TEST_SETUP
+		{
+			SYSTEM_INFO sysInfo;
+			GetSystemInfo(&sysInfo);
+			m_granularity = sysInfo.dwAllocationGranularity;
+
+			// Find a hole by reserving it and releasing it right away.
+			void* hole = VirtualAlloc(nullptr, k_holeSize, MEM_RESERVE, PAGE_NOACCESS);
+			if (!hole)
+				return false;
+			VirtualFree(hole, 0, MEM_RELEASE);
+			m_hole = gan::MemAddr{ hole };
+			return true;
+		}
+
+		DEFINE_TEST_TEARDOWN
+		{
+			for (const auto allocation : m_allocations)
+				VirtualFree(allocation.Ptr(), 0, MEM_RELEASE);
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(HookFunctionOutOfReach)
+	{
+		// The hook function is too far away for a 32-bit displacement, so the target jumps to a relay near it.
+		const auto targetAddr = m_hole.Offset(4 * k_1GB);
+		const auto target = PlaceCode(targetAddr, k_sumCode);
+		const auto hookFunc = PlaceCode(m_hole.Offset(12 * k_1GB), k_mulCode);
+		ASSERT(target && hookFunc);
+
+		gan::Hook hook(target, hookFunc);
+		ASSERT(hook.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(targetAddr.Ref<uint8_t>() == 0xE9);  // jmp rel32
+		EXPECT(target(3, 4) == 12);
+		EXPECT(hook.GetOriginal<Func>()(3, 4) == 10);
+
+		EXPECT(hook.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(memcmp(targetAddr.ConstPtr(), k_sumCode, sizeof(k_sumCode)) == 0);
+		EXPECT(target(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(TrampolineNearTargetAfterRegionsTaken)
+	{
+		const auto hookFunc = PlaceCode(m_hole.Offset(14 * k_1GB), k_mulCode);
+		ASSERT(hookFunc);
+
+		// Hooking something else first makes sure free regions have been cached, including the hole.
+		const auto otherTarget = PlaceCode(m_hole.Offset(2 * k_1GB), k_sumCode);
+		ASSERT(otherTarget);
+		gan::Hook otherHook(otherTarget, hookFunc);
+		ASSERT(otherHook.Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(otherHook.Uninstall() == gan::Hook::OpResult::Unhooked);
+
+		// Then everything within reach of the target is taken but for one allocation unit, unbeknownst to the cache.
+		const auto targetAddr = m_hole.Offset(8 * k_1GB);
+		const auto freeAddr = targetAddr.Offset(k_1GB);
+		const auto target = PlaceCode(targetAddr, k_sumCode);
+		ASSERT(target);
+		ASSERT(Reserve(targetAddr.Offset(-k_2GB), targetAddr));
+		ASSERT(Reserve(targetAddr.Offset(static_cast<intptr_t>(m_granularity)), freeAddr));
+		ASSERT(Reserve(freeAddr.Offset(static_cast<intptr_t>(m_granularity)), targetAddr.Offset(k_2GB + static_cast<intptr_t>(m_granularity))));
+
+		gan::Hook hook(target, hookFunc);
+		ASSERT(hook.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT((gan::MemAddr{ gan::FromAnyFn(hook.GetOriginal<Func>()) } & ~(m_granularity - 1)) == freeAddr);
+		EXPECT(target(3, 4) == 12);
+		EXPECT(hook.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(target(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(WholeRangeTaken)
+	{
+		// Everything within reach of the target is taken, and it has no cave, so there's nowhere to put a relay.
+		const auto targetAddr = m_hole.Offset(8 * k_1GB);
+		const auto target = PlaceCode(targetAddr, k_sumCode);
+		const auto hookFunc = PlaceCode(m_hole.Offset(14 * k_1GB), k_mulCode);
+		ASSERT(target && hookFunc);
+		ASSERT(Reserve(targetAddr.Offset(-k_2GB), targetAddr));
+		ASSERT(Reserve(targetAddr.Offset(static_cast<intptr_t>(m_granularity)), targetAddr.Offset(k_2GB + static_cast<intptr_t>(m_granularity))));
+
+		gan::Hook hook(target, hookFunc);
+		EXPECT(hook.Install() == gan::Hook::OpResult::TrampolineAllocFailed);
+		EXPECT(memcmp(targetAddr.ConstPtr(), k_sumCode, sizeof(k_sumCode)) == 0);
+		EXPECT(target(3, 4) == 10);
+		EXPECT(hook.Uninstall() == gan::Hook::OpResult::NotHooked);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(CaveInInt3Run)
+	{
+		std::vector<uint8_t> code(0x1000, 0xC3);
+		std::ranges::copy(k_sumCode, code.begin() + 0x40);
+		std::fill(code.begin() + 0x4F, code.begin() + 0x5B, 0xCC);  // Too short once the first INT3, which may be a trap, is left out
+		std::fill(code.begin() + 0x65, code.begin() + 0xA3, 0xCC);  // Across 16-byte blocks
+		const auto pageAddr = m_hole.Offset(1 * k_1GB);
+		const auto targetAddr = pageAddr.Offset(0x40);
+		const auto hookFunc = PlaceCode(m_hole.Offset(13 * k_1GB), k_mulCode);
+		ASSERT(PlaceCode(pageAddr, code) && hookFunc);
+		const auto target = gan::ToAnyFn<Func>(targetAddr.Ptr());
+
+		// The target jumps to an auxiliary prolog in the nearest run of INT3s, which jumps to the hook function.
+		gan::Hook hook(target, hookFunc);
+		ASSERT(hook.Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(targetAddr.Ref<uint8_t>() == 0xEB);  // jmp rel8
+		const auto aux = GetShortJumpDest(targetAddr);
+		EXPECT(aux == pageAddr.Offset(0x66));
+		EXPECT(IsAuxPrologTo(aux, hookFunc));
+		EXPECT(target(3, 4) == 12);
+		EXPECT(hook.GetOriginal<Func>()(3, 4) == 10);
+
+		// The auxiliary prolog is left for threads which may have just jumped to it.
+		EXPECT(hook.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(memcmp(targetAddr.ConstPtr(), k_sumCode, sizeof(k_sumCode)) == 0);
+		EXPECT(IsAuxPrologTo(aux, hookFunc));
+		EXPECT(target(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(CaveInNopGap)
+	{
+		// Test_Hook_NopGapSum() is followed by NOPs, which are found between functions with unwind data.
+		const auto targetAddr = SkipIncrementalLinkingThunk(gan::MemAddr{ gan::FromAnyFn(&Test_Hook_NopGapSum) });
+		const auto target = gan::ToAnyFn<Func>(targetAddr.Ptr());
+		const auto hookFunc = PlaceCode(m_hole.Offset(targetAddr < m_hole ? 14 * k_1GB : 2 * k_1GB), k_mulCode);
+		ASSERT(hookFunc);
+		uint8_t original[15];
+		memcpy(original, targetAddr.ConstPtr(), sizeof(original));
+
+		gan::Hook hook(target, hookFunc);
+		ASSERT(hook.Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(targetAddr.Ref<uint8_t>() == 0xEB);  // jmp rel8
+		const auto aux = GetShortJumpDest(targetAddr);
+		EXPECT(aux == targetAddr.Offset(sizeof(original)));
+		EXPECT(IsAuxPrologTo(aux, hookFunc));
+		EXPECT(target(3, 4) == 12);
+		EXPECT(hook.GetOriginal<Func>()(3, 4) == 10);
+
+		EXPECT(hook.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(memcmp(targetAddr.ConstPtr(), original, sizeof(original)) == 0);
+		EXPECT(target(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(CaveClaimedOnce)
+	{
+		// One cave within reach of two targets
+		std::vector<uint8_t> code(0x1000, 0xC3);
+		std::ranges::copy(k_sumCode, code.begin() + 0x40);
+		std::fill(code.begin() + 0x4F, code.begin() + 0x60, 0xCC);
+		std::ranges::copy(k_sumCode, code.begin() + 0x60);
+		const auto pageAddr = m_hole.Offset(3 * k_1GB);
+		const auto caveBegin = pageAddr.Offset(0x50);
+		const auto caveEnd = pageAddr.Offset(0x60);
+		const auto target1Addr = pageAddr.Offset(0x40);
+		const auto target2Addr = pageAddr.Offset(0x60);
+		const auto hookFunc = PlaceCode(m_hole.Offset(11 * k_1GB), k_mulCode);
+		ASSERT(PlaceCode(pageAddr, code) && hookFunc);
+		const auto target1 = gan::ToAnyFn<Func>(target1Addr.Ptr());
+		const auto target2 = gan::ToAnyFn<Func>(target2Addr.Ptr());
+
+		// Whichever is hooked later has to go through a relay.
+		gan::Hook hook1(target1, hookFunc);
+		gan::Hook hook2(target2, hookFunc);
+		ASSERT(hook1.Install() == gan::Hook::OpResult::Hooked);
+		ASSERT(hook2.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(target1Addr.Ref<uint8_t>() == 0xEB);  // jmp rel8
+		EXPECT(GetShortJumpDest(target1Addr) == caveBegin);
+		EXPECT(target2Addr.Ref<uint8_t>() == 0xE9);  // jmp rel32
+		EXPECT(target1(3, 4) == 12);
+		EXPECT(target2(3, 4) == 12);
+
+		// The cave isn't released along with the hook which has claimed it, but only a grace period later.
+		EXPECT(hook1.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(hook2.Uninstall() == gan::Hook::OpResult::Unhooked);
+		EXPECT(IsAuxPrologTo(caveBegin, hookFunc));
+		ASSERT(hook2.Install() == gan::Hook::OpResult::Hooked);
+		EXPECT(target2Addr.Ref<uint8_t>() == 0xE9);  // jmp rel32
+		EXPECT(hook2.Uninstall() == gan::Hook::OpResult::Unhooked);
+
+		const auto gracePeriod = gan::Hook::GetGracePeriod();
+		gan::Hook::SetGracePeriod(std::chrono::milliseconds::zero());
+		const auto result = hook2.Install();
+		gan::Hook::SetGracePeriod(gracePeriod);
+		ASSERT(result == gan::Hook::OpResult::Hooked);
+		ASSERT(target2Addr.Ref<uint8_t>() == 0xEB);  // jmp rel8
+		const auto aux = GetShortJumpDest(target2Addr);
+		EXPECT(aux >= caveBegin && aux.Offset(12) <= caveEnd);
+		EXPECT(IsAuxPrologTo(aux, hookFunc));
+		EXPECT(target2(3, 4) == 12);
+
+		// Everything but the auxiliary prolog just left is as it was, including the one wiped.
+		EXPECT(hook2.Uninstall() == gan::Hook::OpResult::Unhooked);
+		const auto auxOffset = static_cast<size_t>(aux - pageAddr);
+		EXPECT(memcmp(pageAddr.ConstPtr(), code.data(), auxOffset) == 0);
+		EXPECT(memcmp(aux.Offset(12).ConstPtr(), code.data() + auxOffset + 12, code.size() - auxOffset - 12) == 0);
+		EXPECT(target1(3, 4) == 10);
+		EXPECT(target2(3, 4) == 10);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
+#endif  // _WIN64
+
+
+
 DEFINE_TESTSUITE_START(Hook_Kernel32)
 
 	DEFINE_TEST_SHARED_START
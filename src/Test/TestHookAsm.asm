@@ -0,0 +1,57 @@
+;
+;  Gandr - another minimalism library for hacking x86-based Windows
+;  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+;
+;  This program is free software: you can redistribute it and/or modify
+;  it under the terms of the GNU General Public License as published by
+;  the Free Software Foundation, either version 3 of the License, or
+;  (at your option) any later version.
+;
+;  This program is distributed in the hope that it will be useful,
+;  but WITHOUT ANY WARRANTY; without even the implied warranty of
+;  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;  GNU General Public License for more details.
+;
+;  You should have received a copy of the GNU General Public License
+;  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+;
+
+IFDEF _WIN64
+
+	_TEXT SEGMENT
+
+	; Functions have unwind data with FRAME, so the linker emits RUNTIME_FUNCTION
+	; entries for them, and the NOPs between Test_Hook_NopGapSum and
+	; Test_Hook_NopGapNext are a gap which isn't covered by any entry.
+	Test_Hook_NopGapPrev PROC FRAME
+	.endprolog
+		xor 	eax, eax
+		ret
+	Test_Hook_NopGapPrev ENDP
+
+	; 15 bytes, so the gap starts at offset 15
+	Test_Hook_NopGapSum PROC FRAME
+	.endprolog
+		mov 	rax, rcx
+		add 	rax, rdx
+		add 	rax, 1
+		add 	rax, 2
+		ret
+	Test_Hook_NopGapSum ENDP
+
+	; Two 8-byte NOPs as padding, as emitted by compilers other than MSVC
+	db		0Fh, 1Fh, 84h, 00h, 00h, 00h, 00h, 00h
+	db		0Fh, 1Fh, 84h, 00h, 00h, 00h, 00h, 00h
+
+	Test_Hook_NopGapNext PROC FRAME
+	.endprolog
+		xor 	eax, eax
+		ret
+	Test_Hook_NopGapNext ENDP
+
+	_TEXT ENDS
+
+ENDIF
+
+
+END
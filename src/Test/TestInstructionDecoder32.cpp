@@ -281,6 +281,22 @@ DEFINE_TESTSUITE_START(InstructionDecoder_IA32)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(CallNearRel)
+	{
+		// call  [eip + 44332211h]
+		const static uint8_t k_inCallNearRel[] { 0xE8, 0x11, 0x22, 0x33, 0x44 };
+
+		gan::InstructionDecoder decoder(gan::Arch::IA32, gan::ConstMemAddr{ k_inCallNearRel });
+		const auto lengthDetails = decoder.GetNextLength();
+		ASSERT(lengthDetails);
+		EXPECT(lengthDetails->dispNeedsFixup);
+		EXPECT(lengthDetails->lengthOp == 1);
+		EXPECT(lengthDetails->lengthDisp == 4);
+		EXPECT(lengthDetails->lengthImm == 0);
+		EXPECT(lengthDetails->GetLength() == 5);
+	}
+	DEFINE_TEST_END
+
 	// Single-byte instruction
 	DEFINE_TEST_START(PushEax)
 	{
@@ -18,6 +18,7 @@
 
 #include "Test.h"
 
+#include <Arena.h>
 #include <Memory.h>
 #include <Types.h>
 
@@ -72,6 +73,22 @@ DEFINE_TESTSUITE_START(Memory)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(EnumMemoryWithArena)
+	{
+		gan::MonotonicArena arena;
+
+		auto memoryRegionList = gan::MemoryRegionEnumerator{}(GetCurrentProcessId(), &arena);
+		ASSERT(memoryRegionList);
+		EXPECT(!memoryRegionList->empty());
+		EXPECT(memoryRegionList->get_allocator().resource() == &arena);
+
+		const gan::ConstMemAddr addrStack{ &memoryRegionList };
+		EXPECT(std::ranges::any_of(*memoryRegionList, [addrStack](const auto& region) {
+			return region.base <= addrStack && addrStack < region.base.Offset(region.size);
+		}));
+	}
+	DEFINE_TEST_END
+
 	DEFINE_TEST_START(EnumMemoryInvalidProcess)
 	{
 		auto memoryRegionList1 = gan::MemoryRegionEnumerator{}(nullptr);
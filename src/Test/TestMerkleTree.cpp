@@ -0,0 +1,123 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+
+#include <MerkleTree.h>
+
+#include <vector>
+
+
+DEFINE_TESTSUITE_START(MerkleTree)
+
+	DEFINE_TEST_SHARED_START
+
+		constexpr static size_t k_leafSize = gan::MerkleTree::k_defaultLeafSize;
+		constexpr static size_t k_dataSize = k_leafSize * 37 + 123;  // Odd number of leaves; the last one is partial
+
+		std::vector<uint8_t> data;
+
+		DEFINE_TEST_SETUP
+		{
+			data.resize(k_dataSize);
+			for (size_t i = 0; i < data.size(); ++i)
+				data[i] = static_cast<uint8_t>(i * 13 + (i >> 12));
+			return true;
+		}
+
+		gan::ConstMemRange GetDataRange() const
+		{
+			return { .min = gan::ConstMemAddr{ data.data() }, .max = gan::ConstMemAddr{ data.data() + data.size() } };
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(Build)
+	{
+		gan::MerkleTree tree{ GetDataRange() };
+		EXPECT(tree.GetLeaves().size() == 38);
+		EXPECT(tree.Update() == 38);
+		EXPECT(tree.Update() == 0);  // Nothing is dirty anymore
+
+		// Leaves are plain hashes of the underlying memory
+		gan::Hash<128> lastLeafHash;
+		gan::Hasher::GetXXH3(gan::ConstMemAddr{ data.data() + k_leafSize * 37 }, 123, lastLeafHash);
+		EXPECT(tree.GetLeaves().back() == lastLeafHash);
+
+		// Same content, same root
+		gan::MerkleTree tree2{ GetDataRange() };
+		tree2.Update();
+		EXPECT(tree.GetRoot() == tree2.GetRoot());
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(DirtyRehash)
+	{
+		gan::MerkleTree tree{ GetDataRange() };
+		tree.Update();
+		const auto origRoot = tree.GetRoot();
+		const auto origLeaf5 = tree.GetLeaves()[5];
+		const auto origLeaf6 = tree.GetLeaves()[6];
+
+		// Modify a byte in leaf 5
+		auto& byte = data[k_leafSize * 5 + 17];
+		byte ^= 0xFF;
+		const gan::ConstMemAddr byteAddr{ &byte };
+		tree.MarkDirty({ .min = byteAddr, .max = byteAddr.Offset(1) });
+		EXPECT(tree.Update() == 1);
+		EXPECT(tree.GetLeaves()[5] != origLeaf5);
+		EXPECT(tree.GetLeaves()[6] == origLeaf6);
+		EXPECT(tree.GetRoot() != origRoot);
+
+		// Revert the change
+		byte ^= 0xFF;
+		tree.MarkDirty(5);
+		EXPECT(tree.Update() == 1);
+		EXPECT(tree.GetLeaves()[5] == origLeaf5);
+		EXPECT(tree.GetRoot() == origRoot);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(MarkDirtyRange)
+	{
+		gan::MerkleTree tree{ GetDataRange() };
+		tree.Update();
+
+		// Spans the end of leaf 2 to the beginning of leaf 4, and a range partially outside
+		const gan::ConstMemAddr base{ data.data() };
+		tree.MarkDirty({ .min = base.Offset(k_leafSize * 3 - 1), .max = base.Offset(k_leafSize * 4 + 1) });
+		EXPECT(tree.Update() == 3);
+		tree.MarkDirty({ .min = base.Offset(k_dataSize - 1), .max = base.Offset(k_dataSize + k_leafSize * 10) });
+		EXPECT(tree.Update() == 1);
+
+		tree.MarkAllDirty();
+		EXPECT(tree.Update() == tree.GetLeaves().size());
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(EmptyRange)
+	{
+		const gan::ConstMemAddr base{ data.data() };
+		gan::MerkleTree tree{ { .min = base, .max = base } };
+		EXPECT(tree.GetLeaves().size() == 1);
+		EXPECT(tree.Update() == 1);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
@@ -18,6 +18,7 @@
 
 #include "Test.h"
 
+#include <Arena.h>
 #include <ModuleList.h>
 
 #include <algorithm>
@@ -28,9 +29,9 @@
 
 namespace
 {
-	bool SearchModInList(const gan::ModuleList& modList, const wchar_t* modName)
+	bool SearchModInList(const auto& modList, const wchar_t* modName)
 	{
-		const auto funcMatchMod = [modName](const gan::ModuleInfo& modInfo) {
+		const auto funcMatchMod = [modName](const auto& modInfo) {
 			return StrStrIW(modInfo.imageName.c_str(), modName) != nullptr;
 		};
 		return std::ranges::find_if(modList, funcMatchMod) != modList.end();
@@ -50,6 +51,20 @@ DEFINE_TESTSUITE_START(ModuleList)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(CheckModulesWithArena)
+	{
+		gan::MonotonicArena arena;
+
+		auto moduleList = gan::ModuleEnumerator{}(GetCurrentProcessId(), &arena);
+		ASSERT(moduleList);
+		EXPECT(moduleList->get_allocator().resource() == &arena);
+		EXPECT(moduleList->front().imagePath.get_allocator().resource() == &arena);
+
+		EXPECT(SearchModInList(moduleList.value(), L"Test.exe"));
+		EXPECT(SearchModInList(moduleList.value(), L"kernel32.dll"));
+	}
+	DEFINE_TEST_END
+
 
 
 DEFINE_TESTSUITE_END
@@ -18,6 +18,7 @@
 
 #include "Test.h"
 
+#include <Arena.h>
 #include <PE.h>
 
 #include <optional>
@@ -48,7 +49,7 @@ std::pair<HMODULE, void*> GetModuleInfo(const wchar_t* modName)
 }
 
 
-gan::Rva SearchFunctionRvaByName(const gan::ImageExportData::ExportedFunctionList& exportData, std::string_view name)
+gan::Rva SearchFunctionRvaByName(const auto& exportData, std::string_view name)
 {
 	const auto itr = std::ranges::find_if(
 		exportData,
@@ -122,4 +123,31 @@ DEFINE_TESTSUITE_START(PE)
 	}
 	DEFINE_TEST_END
 
+	DEFINE_TEST_START(Export_Kernel32_WithArena)
+	{
+		auto [hMod, baseAddr] = GetModuleInfo(L"kernel32");
+		ASSERT(hMod);
+		ASSERT(baseAddr);
+
+		gan::MonotonicArena arena;
+		const gan::ConstMemAddr modBaseAddr{ baseAddr };
+		auto peHeaders = gan::PeImageHelper::GetLoadedHeaders(modBaseAddr, &arena);
+		ASSERT(peHeaders);
+		ASSERT(peHeaders->exportData);
+		EXPECT(peHeaders->sectionHeaderList.get_allocator().resource() == &arena);
+		EXPECT(peHeaders->exportData->functions.get_allocator().resource() == &arena);
+		EXPECT(peHeaders->FindSectionByName(0, u8".text"));
+
+		constexpr static auto k_funcName = "GetCurrentThreadId"sv;
+		const auto addrLoadedFunction = ::GetProcAddress(hMod, k_funcName.data());
+		ASSERT(addrLoadedFunction);
+		EXPECT(
+			addrLoadedFunction ==
+				modBaseAddr
+				.Offset(SearchFunctionRvaByName(peHeaders->exportData->functions, k_funcName))
+				.ConstPtr<void>()
+		);
+	}
+	DEFINE_TEST_END
+
 DEFINE_TESTSUITE_END
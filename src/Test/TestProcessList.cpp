@@ -18,6 +18,7 @@
 
 #include "Test.h"
 
+#include <Arena.h>
 #include <ProcessList.h>
 
 #include <algorithm>
@@ -71,4 +72,28 @@ DEFINE_TESTSUITE_START(ProcessList)
 	}
 	DEFINE_TEST_END
 
+
+	DEFINE_TEST_START(FindSelfWithArena)
+	{
+		const auto procId = GetCurrentProcessId();
+		const auto threadId = GetCurrentThreadId();
+
+		gan::MonotonicArena arena;
+		for (int cycle = 0; cycle < 2; ++cycle)
+		{
+			{
+				auto procList = gan::ProcessEnumerator{}(&arena);
+				ASSERT(procList);
+				EXPECT(procList->get_allocator().resource() == &arena);
+				EXPECT(std::ranges::any_of(*procList, [procId](const auto& procInfo) { return procInfo.pid == procId; }));
+
+				auto threadList = gan::ThreadEnumerator{}(procId, &arena);
+				ASSERT(threadList);
+				EXPECT(std::ranges::any_of(*threadList, [threadId](const auto& threadInfo) { return threadInfo.tid == threadId; }));
+			}
+			arena.Reset();
+		}
+	}
+	DEFINE_TEST_END
+
 DEFINE_TESTSUITE_END
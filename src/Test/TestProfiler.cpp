@@ -0,0 +1,175 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+
+#include <Profiler.h>
+
+#include <array>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <windows.h>
+
+
+DEFINE_TESTSUITE_START(Profiler)
+
+	DEFINE_TEST_SHARED_START
+
+		// Zero() must enforce runtime evaluation to prevent compiler from treating Add() as constexpr.
+		static size_t Zero() { return reinterpret_cast<size_t>(GetModuleHandleA("ThisModuleMustNotExistOrWeAreScrewed")); }
+
+		__declspec(noinline) static size_t Add(size_t n1, size_t n2) { return Zero() ? 0 : n1 + n2; }
+		__declspec(noinline) static size_t Mul(size_t n1, size_t n2) { return Zero() ? 0 : n1 * n2; }
+		__declspec(noinline) static size_t AddTwice(size_t n1, size_t n2) { return Add(Add(n1, n2), n2); }
+
+		// Distinct functions, one for each of more profilers than a thread has counters of
+		template <size_t N>
+		__declspec(noinline) static size_t AddN(size_t n1, size_t n2) { return Zero() ? 0 : n1 + n2 + N; }
+
+		template <size_t... N>
+		constexpr static auto MakeAddNs(std::index_sequence<N...>) { return std::array{ &AddN<N>... }; }
+
+		static uint64_t SumBuckets(const gan::Profiler::Histogram& histogram)
+		{
+			return std::accumulate(std::begin(histogram.buckets), std::end(histogram.buckets), 0ull);
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(CallCounts)
+	{
+		gan::Profiler profiler;
+		ASSERT(profiler.Add(Add));
+		ASSERT(profiler.Add(Mul));
+		ASSERT(profiler.Install());
+		EXPECT(!profiler.Add(AddTwice));  // Too late
+
+		size_t sum = 0;
+		for (size_t i = 0; i < 100; ++i)
+			sum += Add(i, 1) + Mul(i, 2);
+		EXPECT(sum == 14950);
+		ASSERT(profiler.Uninstall());
+		EXPECT(Add(123, 321) == 444);  // Not counted
+
+		const auto histograms = profiler.Collect();
+		ASSERT(histograms.size() == 2);
+		EXPECT(histograms[0].func == gan::MemAddr{ gan::FromAnyFn(Add) });
+		EXPECT(histograms[0].calls == 100);
+		EXPECT(histograms[1].calls == 100);
+		EXPECT(SumBuckets(histograms[0]) == 100);
+		EXPECT(histograms[0].cycles > 0);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(NestedCalls)
+	{
+		gan::Profiler profiler;
+		ASSERT(profiler.Add(AddTwice));
+		ASSERT(profiler.Add(Add));
+		ASSERT(profiler.Install());
+		EXPECT(AddTwice(1, 2) == 5);
+		ASSERT(profiler.Uninstall());
+
+		// Latency is inclusive.
+		const auto histograms = profiler.Collect();
+		EXPECT(histograms[0].calls == 1);
+		EXPECT(histograms[1].calls == 2);
+		EXPECT(histograms[0].cycles >= histograms[1].cycles);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(MultipleThreads)
+	{
+		constexpr size_t k_numThreads = 4;
+		constexpr size_t k_numCalls = 10000;
+
+		gan::Profiler profiler;
+		ASSERT(profiler.Add(Add));
+		ASSERT(profiler.Install());
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < k_numThreads; ++i)
+		{
+			threads.emplace_back([]() {
+				for (size_t j = 0; j < k_numCalls; ++j)
+					Add(j, 1);
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		ASSERT(profiler.Uninstall());
+
+		const auto histograms = profiler.Collect();
+		EXPECT(histograms[0].calls == k_numThreads * k_numCalls);
+		EXPECT(SumBuckets(histograms[0]) == k_numThreads * k_numCalls);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(ManyProfilersOverTime)
+	{
+		// Counters of destroyed profilers make room for those of new ones.
+		for (size_t i = 0; i < 2 * gan::Profiler::k_maxPerThread; ++i)
+		{
+			gan::Profiler profiler;
+			ASSERT(profiler.Add(Add));
+			ASSERT(profiler.Install());
+			EXPECT(Add(1, 2) == 3);
+			ASSERT(profiler.Uninstall());
+			EXPECT(profiler.Collect()[0].calls == 1);
+			EXPECT(profiler.GetNumDropped() == 0);
+		}
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(TooManyProfilersAtOnce)
+	{
+		const auto funcs = MakeAddNs(std::make_index_sequence<gan::Profiler::k_maxPerThread + 1>{ });
+		std::vector<std::unique_ptr<gan::Profiler>> profilers;
+		for (const auto func : funcs)
+		{
+			auto& profiler = profilers.emplace_back(std::make_unique<gan::Profiler>());
+			ASSERT(profiler->Add(func));
+			ASSERT(profiler->Install());
+		}
+
+		// The last one doesn't get counters in this thread, but it's known how many calls it has missed.
+		for (size_t i = 0; i < funcs.size(); ++i)
+			EXPECT(funcs[i](1, 2) == 3 + i);
+		for (size_t i = 0; i + 1 < funcs.size(); ++i)
+			EXPECT(profilers[i]->Collect()[0].calls == 1);
+		EXPECT(profilers.back()->Collect()[0].calls == 0);
+		EXPECT(profilers.back()->GetNumDropped() == 1);
+
+		// Until another one is destroyed
+		ASSERT(profilers.front()->Uninstall());
+		profilers.front().reset();
+		EXPECT(funcs.back()(1, 2) == 3 + gan::Profiler::k_maxPerThread);
+		EXPECT(profilers.back()->Collect()[0].calls == 1);
+		EXPECT(profilers.back()->GetNumDropped() == 1);
+
+		for (size_t i = 1; i < profilers.size(); ++i)
+			EXPECT(profilers[i]->Uninstall());
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END
@@ -0,0 +1,206 @@
+/*
+ *  Gandr - another minimalism library for hacking x86-based Windows
+ *  Copyright (C) 2020-2026 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Test.h"
+
+#include <Trace.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+
+
+DEFINE_TESTSUITE_START(Trace)
+
+	DEFINE_TEST_SHARED_START
+
+		struct Event
+		{
+			uint32_t thread;
+			uint32_t sequence;
+		};
+
+		constexpr static uint32_t k_eventType = 1;
+		constexpr static uint32_t k_textType = 2;
+
+		std::wstring m_path;
+
+		DEFINE_TEST_SETUP
+		{
+			wchar_t dir[MAX_PATH];
+			wchar_t path[MAX_PATH];
+			if (!GetTempPathW(MAX_PATH, dir) || !GetTempFileNameW(dir, L"gan", 0, path))
+				return false;
+			m_path = path;
+			return true;
+		}
+
+		DEFINE_TEST_TEARDOWN
+		{
+			DeleteFileW(m_path.c_str());
+		}
+
+	DEFINE_TEST_SHARED_END
+
+
+	DEFINE_TEST_START(WriteAndRead)
+	{
+		constexpr std::string_view k_text = "variable-sized record";
+
+		gan::TraceWriter writer;
+		EXPECT(!writer.Write(k_eventType, Event{ }));  // Not open yet
+		ASSERT(writer.Open(m_path) == NO_ERROR);
+		ASSERT(writer.Write(k_eventType, Event{ .thread = 0, .sequence = 1 }));
+		ASSERT(writer.Write(k_textType, gan::ConstMemAddr{ k_text.data() }, static_cast<uint32_t>(k_text.size())));
+		ASSERT(writer.Write(k_eventType, Event{ .thread = 0, .sequence = 2 }));
+		ASSERT(writer.Close() == NO_ERROR);
+
+		gan::TraceReader reader;
+		ASSERT(reader.Open(m_path) == NO_ERROR);
+		EXPECT(reader.GetQpcFrequency() > 0);
+
+		std::vector<gan::TraceReader::Record> records;
+		for (const auto& record : reader)
+			records.push_back(record);
+		ASSERT(records.size() == 3);
+		EXPECT(records[0].threadId == GetCurrentThreadId());
+		EXPECT(records[0].type == k_eventType);
+		EXPECT(records[0].data.size() == sizeof(Event));
+		EXPECT(reinterpret_cast<const Event*>(records[0].data.data())->sequence == 1);
+		EXPECT(records[1].type == k_textType);
+		EXPECT(std::string_view(reinterpret_cast<const char*>(records[1].data.data()), records[1].data.size()) == k_text);
+		EXPECT(records[2].timestamp >= records[0].timestamp);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(MultipleThreads)
+	{
+		constexpr uint32_t k_numThreads = 4;
+		constexpr uint32_t k_numEvents = 100000;
+
+		gan::TraceWriter writer;
+		ASSERT(writer.Open(m_path, { .ringSize = 1 << 12, .drainInterval = std::chrono::milliseconds(1) }) == NO_ERROR);
+
+		std::vector<std::thread> threads;
+		for (uint32_t i = 0; i < k_numThreads; ++i)
+		{
+			threads.emplace_back([&writer, i]() {
+				for (uint32_t j = 0; j < k_numEvents; ++j)
+					writer.Write(k_eventType, Event{ .thread = i, .sequence = j });
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		const uint64_t numDropped = writer.GetNumDropped();
+		ASSERT(writer.Close() == NO_ERROR);
+
+		// Records of each thread must be in order, with drops as the only gaps.
+		gan::TraceReader reader;
+		ASSERT(reader.Open(m_path) == NO_ERROR);
+		std::vector<int64_t> lastSequences(k_numThreads, -1);
+		uint64_t numRecords = 0;
+		bool ordered = true;
+		for (const auto& record : reader)
+		{
+			const auto& event = *reinterpret_cast<const Event*>(record.data.data());
+			ordered = ordered && event.thread < k_numThreads && event.sequence > lastSequences[event.thread];
+			if (!ordered)
+				break;
+			lastSequences[event.thread] = event.sequence;
+			++numRecords;
+		}
+		EXPECT(ordered);
+		EXPECT(numRecords + numDropped == k_numThreads * k_numEvents);
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(ManyWritersOverTime)
+	{
+		// Rings of destroyed writers make room for later ones on the same thread.
+		for (size_t i = 0; i < gan::TraceWriter::k_maxPerThread * 3; ++i)
+		{
+			gan::TraceWriter writer;
+			ASSERT(writer.Open(m_path) == NO_ERROR);
+			EXPECT(writer.Write(k_eventType, Event{ .thread = 0, .sequence = static_cast<uint32_t>(i) }));
+			EXPECT(writer.GetNumDropped() == 0);
+			ASSERT(writer.Close() == NO_ERROR);
+		}
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(TooManyWritersAtOnce)
+	{
+		constexpr size_t k_numWriters = gan::TraceWriter::k_maxPerThread + 1;
+
+		std::vector<std::wstring> paths;
+		std::vector<std::unique_ptr<gan::TraceWriter>> writers;
+		for (size_t i = 0; i < k_numWriters; ++i)
+		{
+			paths.emplace_back(m_path + std::to_wstring(i));
+			writers.emplace_back(std::make_unique<gan::TraceWriter>());
+			ASSERT(writers.back()->Open(paths.back()) == NO_ERROR);
+		}
+
+		// The last writer finds no room on this thread, and says so.
+		for (size_t i = 0; i < k_numWriters - 1; ++i)
+			EXPECT(writers[i]->Write(k_eventType, Event{ .thread = 0, .sequence = 0 }));
+		EXPECT(!writers.back()->Write(k_eventType, Event{ .thread = 0, .sequence = 0 }));
+		EXPECT(writers.back()->GetNumDropped() == 1);
+
+		// Until another one goes away.
+		writers.front().reset();
+		EXPECT(writers.back()->Write(k_eventType, Event{ .thread = 0, .sequence = 1 }));
+		EXPECT(writers.back()->GetNumDropped() == 1);
+
+		writers.clear();
+		for (const auto& path : paths)
+			DeleteFileW(path.c_str());
+	}
+	DEFINE_TEST_END
+
+	DEFINE_TEST_START(TruncatedFile)
+	{
+		gan::TraceWriter writer;
+		ASSERT(writer.Open(m_path) == NO_ERROR);
+		for (uint32_t i = 0; i < 10; ++i)
+			ASSERT(writer.Write(k_eventType, Event{ .thread = 0, .sequence = i }));
+		writer.Flush();
+		ASSERT(writer.Write(k_eventType, Event{ .thread = 0, .sequence = 10 }));
+		ASSERT(writer.Close() == NO_ERROR);
+
+		// Cut the second block in half.
+		HANDLE hFile = CreateFileW(m_path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		ASSERT(hFile != INVALID_HANDLE_VALUE);
+		LARGE_INTEGER size;
+		GetFileSizeEx(hFile, &size);
+		size.QuadPart -= 8;
+		const bool truncated = SetFilePointerEx(hFile, size, nullptr, FILE_BEGIN) && SetEndOfFile(hFile);
+		CloseHandle(hFile);
+		ASSERT(truncated);
+
+		gan::TraceReader reader;
+		ASSERT(reader.Open(m_path) == NO_ERROR);
+		EXPECT(std::ranges::distance(reader.begin(), reader.end()) == 10);
+	}
+	DEFINE_TEST_END
+
+DEFINE_TESTSUITE_END